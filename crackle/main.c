@@ -11,44 +11,480 @@
     GNU General Public License for more details.
 */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "CrackleCommandLine.h"
 #include "NibbleDiskImage.h"
 #include "BlockDiskImage.h"
+#include "Assembler.h"
+#include "FileOpen.h"
+#include "util.h"
 
 
-static DiskImage* allocateDiskImageObject(CrackleCommandLine* pCommandLine);
+typedef struct SnapSources
+{
+    AssemblerInitParams initParams;
+    Assembler*          pAssemblers[CRACKLE_COMMAND_LINE_MAX_SNAP_SOURCES];
+    unsigned int        assemblerCount;
+} SnapSources;
+
+typedef struct ImageBuild
+{
+    const CrackleImageSpec* pSpec;
+    DiskImage*              pDiskImage;
+    pthread_t               thread;
+    int                     isThreadRunning;
+    int                     hasFailed;
+} ImageBuild;
+
+
+static void assembleSnapSources(SnapSources* pSources, CrackleCommandLine* pCommandLine);
+static void createImageBuilds(ImageBuild*           pBuilds, 
+                              CrackleCommandLine*   pCommandLine, 
+                              SnapSources*          pSources, 
+                              DiskImageObjectCache* pCache);
+static void reportSetupFailure(CrackleCommandLine* pCommandLine);
+static int runImageBuilds(ImageBuild* pBuilds, unsigned int buildCount);
+static void reportBuildFailure(const char* pOutputImageFilename);
+static int verifyImage(ImageBuild* pExpectedBuild, CrackleCommandLine* pCommandLine);
+static int diffImages(ImageBuild* pScriptBuild, CrackleCommandLine* pCommandLine);
+static void freeImageBuilds(ImageBuild* pBuilds, unsigned int buildCount);
+static void freeSnapSources(SnapSources* pSources);
 int main(int argc, const char** argv)
 {
-    int                returnValue = 0;
-    DiskImage*         pDiskImage = NULL;
-    CrackleCommandLine commandLine;
+    int                   returnValue = 0;
+    DiskImageObjectCache* pCache = NULL;
+    CrackleCommandLine    commandLine;
+    SnapSources           snapSources;
+    ImageBuild            builds[CRACKLE_COMMAND_LINE_MAX_IMAGES];
 
     memset(&commandLine, 0, sizeof(commandLine));
+    memset(&snapSources, 0, sizeof(snapSources));
+    memset(builds, 0, sizeof(builds));
     __try
     {
         commandLine = CrackleCommandLine_Init(argc-1, argv+1);
-        pDiskImage = allocateDiskImageObject(&commandLine);
-        DiskImage_ProcessScriptFile(pDiskImage, commandLine.pScriptFilename);
-        DiskImage_WriteImage(pDiskImage, commandLine.pOutputImageFilename);
+        pCache = DiskImageObjectCache_Create();
+        assembleSnapSources(&snapSources, &commandLine);
+        createImageBuilds(builds, &commandLine, &snapSources, pCache);
     }
     __catch
     {
-        printf("%s image build failed.\n", commandLine.pOutputImageFilename ? commandLine.pOutputImageFilename : "");
+        reportSetupFailure(&commandLine);
         returnValue = 1;
     }
     
-    DiskImage_Free(pDiskImage);
+    if (returnValue == 0 && commandLine.pVerifyImageFilename)
+        returnValue = verifyImage(&builds[0], &commandLine);
+    else if (returnValue == 0 && commandLine.pDiffImageFilenames[0])
+        returnValue = diffImages(&builds[0], &commandLine);
+    else if (returnValue == 0)
+        returnValue = runImageBuilds(builds, commandLine.imageCount);
+    
+    freeImageBuilds(builds, commandLine.imageCount);
+    DiskImageObjectCache_Free(pCache);
+    freeSnapSources(&snapSources);
+    FileOpen_FreeDirectoryCache();
     
     return returnValue;
 }
 
-static DiskImage* allocateDiskImageObject(CrackleCommandLine* pCommandLine)
+static Assembler* assembleSnapSource(SnapSources* pSources, const char* pSourceFilename);
+static void assembleSnapSources(SnapSources* pSources, CrackleCommandLine* pCommandLine)
 {
-    if (pCommandLine->imageFormat == FORMAT_NIB_5_25)
-        return (DiskImage*) NibbleDiskImage_Create();
-    else if (pCommandLine->imageFormat == FORMAT_HDV_3_5)
+    unsigned int i;
+    
+    pSources->initParams.pPutDirectories = pCommandLine->pPutDirectories;
+    pSources->initParams.keepObjectsInMemory = 1;
+    for (i = 0 ; i < pCommandLine->snapSourceCount ; i++)
+        assembleSnapSource(pSources, pCommandLine->pSnapSourceFilenames[i]);
+}
+
+static Assembler* assembleSnapSource(SnapSources* pSources, const char* pSourceFilename)
+{
+    Assembler* pAssembler = NULL;
+    
+    __try
+    {
+        pAssembler = Assembler_CreateFromFile(pSourceFilename, &pSources->initParams);
+    }
+    __catch
+    {
+        printf("Failed to open %s\n", pSourceFilename);
+        __rethrow;
+    }
+    pSources->pAssemblers[pSources->assemblerCount++] = pAssembler;
+    
+    Assembler_Run(pAssembler);
+    if (Assembler_GetErrorCount(pAssembler))
+    {
+        printf("Encountered errors while assembling %s\n", pSourceFilename);
+        __throw(invalidArgumentException);
+    }
+    
+    return pAssembler;
+}
+
+static DiskImage* allocateDiskImageObject(const CrackleImageSpec* pSpec, CrackleCommandLine* pCommandLine);
+static void addAssemblerObjectsToDiskImage(Assembler* pAssembler, DiskImage* pDiskImage);
+static void createImageBuilds(ImageBuild*           pBuilds, 
+                              CrackleCommandLine*   pCommandLine, 
+                              SnapSources*          pSources, 
+                              DiskImageObjectCache* pCache)
+{
+    unsigned int i;
+    unsigned int j;
+    
+    for (i = 0 ; i < pCommandLine->imageCount ; i++)
+    {
+        ImageBuild* pBuild = &pBuilds[i];
+        
+        pBuild->pSpec = &pCommandLine->images[i];
+        pBuild->pDiskImage = allocateDiskImageObject(pBuild->pSpec, pCommandLine);
+        DiskImage_SetObjectCache(pBuild->pDiskImage, pCache);
+        if (pCommandLine->usePlans && pBuild->pSpec->pOutputImageFilename)
+            DiskImage_EnablePlan(pBuild->pDiskImage, pBuild->pSpec->pOutputImageFilename);
+        if (pBuild->pSpec->pOutputImageFilename)
+            DiskImage_EnableResolvedScript(pBuild->pDiskImage, pBuild->pSpec->pOutputImageFilename);
+        if (pCommandLine->writeEquates && pBuild->pSpec->pOutputImageFilename)
+            DiskImage_EnableEquates(pBuild->pDiskImage, pBuild->pSpec->pOutputImageFilename);
+        for (j = 0 ; j < pSources->assemblerCount ; j++)
+            addAssemblerObjectsToDiskImage(pSources->pAssemblers[j], pBuild->pDiskImage);
+    }
+}
+
+static DiskImage* allocateNibbleDiskImageObject(CrackleCommandLine* pCommandLine);
+static DiskImage* allocateDiskImageObject(const CrackleImageSpec* pSpec, CrackleCommandLine* pCommandLine)
+{
+    if (pSpec->imageFormat == FORMAT_NIB_5_25)
+        return allocateNibbleDiskImageObject(pCommandLine);
+    else if (pSpec->imageFormat == FORMAT_HDV_3_5)
         return (DiskImage*) BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    else if (pSpec->imageFormat == FORMAT_HDV_32M)
+        return (DiskImage*) BlockDiskImage_CreateSparse(BLOCK_DISK_IMAGE_32M_BLOCK_COUNT, NULL);
+    else
+        __throw(invalidArgumentException);
+}
+
+static DiskImage* allocateNibbleDiskImageObject(CrackleCommandLine* pCommandLine)
+{
+    NibbleDiskImage* pNibbleDiskImage = NibbleDiskImage_Create();
+    
+    NibbleDiskImage_SetEncodeThreadCount(pNibbleDiskImage, pCommandLine->threadCount);
+    return (DiskImage*)pNibbleDiskImage;
+}
+
+static void addAssemblerObjectsToDiskImage(Assembler* pAssembler, DiskImage* pDiskImage)
+{
+    BinaryBufferOutput output;
+    
+    Assembler_ObjectFileEnumStart(pAssembler);
+    while (Assembler_ObjectFileEnumNext(pAssembler, &output))
+    {
+        DiskImageInsert defaultInsert;
+        
+        /* Compressed objects are placed on the disk as is, to be decompressed by the 6502 code which loads them. */
+        if (output.isCompressed)
+        {
+            output.pContent = output.pCompressedContent;
+            output.contentLength = output.compressedLength;
+        }
+        memset(&defaultInsert, 0, sizeof(defaultInsert));
+        if (output.isRW18)
+        {
+            defaultInsert.type = DISK_IMAGE_INSERTION_RW18;
+            defaultInsert.length = output.contentLength;
+            defaultInsert.side = output.side;
+            defaultInsert.track = output.track;
+            defaultInsert.intraTrackOffset = output.offset;
+        }
+        DiskImage_AddInMemoryObject(pDiskImage, output.pFilename, output.pContent, output.contentLength, &defaultInsert);
+    }
+}
+
+static void freeSnapSources(SnapSources* pSources)
+{
+    unsigned int i;
+    
+    for (i = 0 ; i < pSources->assemblerCount ; i++)
+        Assembler_Free(pSources->pAssemblers[i]);
+}
+
+static void reportSetupFailure(CrackleCommandLine* pCommandLine)
+{
+    unsigned int i;
+    
+    if (pCommandLine->imageCount == 0)
+        reportBuildFailure(NULL);
+    for (i = 0 ; i < pCommandLine->imageCount ; i++)
+        reportBuildFailure(pCommandLine->images[i].pOutputImageFilename);
+}
+
+static void reportBuildFailure(const char* pOutputImageFilename)
+{
+    printf("%s image build failed.\n", pOutputImageFilename ? pOutputImageFilename : "");
+}
+
+static void* buildImageThread(void* pvBuild);
+static void buildImage(ImageBuild* pBuild);
+static int runImageBuilds(ImageBuild* pBuilds, unsigned int buildCount)
+{
+    int          returnValue = 0;
+    unsigned int i;
+    
+    /* The first image is built on this thread while the others, if any, are built on their own threads.  An image
+       whose thread can't be started is just built here afterwards. */
+    for (i = 1 ; i < buildCount ; i++)
+        pBuilds[i].isThreadRunning = 0 == pthread_create(&pBuilds[i].thread, NULL, buildImageThread, &pBuilds[i]);
+    if (buildCount > 0)
+        buildImage(&pBuilds[0]);
+    for (i = 1 ; i < buildCount ; i++)
+    {
+        if (pBuilds[i].isThreadRunning)
+            pthread_join(pBuilds[i].thread, NULL);
+        else
+            buildImage(&pBuilds[i]);
+    }
+    
+    for (i = 0 ; i < buildCount ; i++)
+    {
+        if (pBuilds[i].hasFailed)
+        {
+            reportBuildFailure(pBuilds[i].pSpec->pOutputImageFilename);
+            returnValue = 1;
+        }
+    }
+    return returnValue;
+}
+
+static void* buildImageThread(void* pvBuild)
+{
+    buildImage((ImageBuild*)pvBuild);
+    return NULL;
+}
+
+static void buildImage(ImageBuild* pBuild)
+{
+    const CrackleImageSpec* pSpec = pBuild->pSpec;
+    
+    __try
+    {
+        if (pSpec->updateImage)
+        {
+            DiskImage_UpdateImage(pBuild->pDiskImage, pSpec->pScriptFilename, pSpec->pOutputImageFilename);
+        }
+        else
+        {
+            DiskImage_ProcessScriptFile(pBuild->pDiskImage, pSpec->pScriptFilename);
+            DiskImage_WriteImage(pBuild->pDiskImage, pSpec->pOutputImageFilename);
+        }
+    }
+    __catch
+    {
+        pBuild->hasFailed = 1;
+        clearExceptionCode();
+    }
+}
+
+static void decodeImageFile(const char* pImageFilename, unsigned int threadCount, NibbleTrackStatus* pTracks);
+static void buildExpectedTracks(ImageBuild* pExpectedBuild, NibbleTrackStatus* pTracks);
+static unsigned int reportTrackStatus(const NibbleTrackStatus* pTracks);
+static int verifyImage(ImageBuild* pExpectedBuild, CrackleCommandLine* pCommandLine)
+{
+    int                returnValue = 0;
+    NibbleTrackStatus* pTracks = NULL;
+    NibbleTrackStatus* pExpectedTracks = NULL;
+    
+    __try
+    {
+        pTracks = allocateAndZero(DISK_IMAGE_TRACKS_PER_SIDE * sizeof(*pTracks));
+        decodeImageFile(pCommandLine->pVerifyImageFilename, pCommandLine->threadCount, pTracks);
+        if (pExpectedBuild->pSpec->pScriptFilename)
+        {
+            pExpectedTracks = allocateAndZero(DISK_IMAGE_TRACKS_PER_SIDE * sizeof(*pExpectedTracks));
+            buildExpectedTracks(pExpectedBuild, pExpectedTracks);
+            NibbleDiskImage_CompareTracks(pTracks, pExpectedTracks);
+        }
+        if (reportTrackStatus(pTracks))
+            returnValue = 1;
+    }
+    __catch
+    {
+        printf("%s image verification failed.\n", pCommandLine->pVerifyImageFilename);
+        returnValue = 1;
+    }
+    
+    free(pExpectedTracks);
+    free(pTracks);
+    
+    return returnValue;
+}
+
+static void decodeImageFile(const char* pImageFilename, unsigned int threadCount, NibbleTrackStatus* pTracks)
+{
+    NibbleDiskImage* pImage = NULL;
+    
+    __try
+    {
+        pImage = NibbleDiskImage_Create();
+        NibbleDiskImage_SetEncodeThreadCount(pImage, threadCount);
+        NibbleDiskImage_ReadImage(pImage, pImageFilename);
+        NibbleDiskImage_VerifyTracks(pImage, pTracks);
+    }
+    __catch
+    {
+        DiskImage_Free((DiskImage*)pImage);
+        __rethrow;
+    }
+    DiskImage_Free((DiskImage*)pImage);
+}
+
+static void buildExpectedTracks(ImageBuild* pExpectedBuild, NibbleTrackStatus* pTracks)
+{
+    DiskImage_ProcessScriptFile(pExpectedBuild->pDiskImage, pExpectedBuild->pSpec->pScriptFilename);
+    NibbleDiskImage_VerifyTracks((NibbleDiskImage*)pExpectedBuild->pDiskImage, pTracks);
+}
+
+static void printTrackFormat(const NibbleTrackStatus* pTrack);
+static unsigned int reportTrackStatus(const NibbleTrackStatus* pTracks)
+{
+    unsigned int problemCount = 0;
+    unsigned int track;
+    
+    for (track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+    {
+        const NibbleTrackStatus* pTrack = &pTracks[track];
+        
+        printf("Track %2u: ", track);
+        printTrackFormat(pTrack);
+        if (pTrack->isMismatched)
+            printf(" - doesn't match script");
+        printf("\n");
+        
+        if (pTrack->format == NIBBLE_TRACK_BAD || pTrack->isMismatched)
+            problemCount++;
+    }
+    printf("%u of %u tracks have problems.\n", problemCount, DISK_IMAGE_TRACKS_PER_SIDE);
+    
+    return problemCount;
+}
+
+static void printTrackFormat(const NibbleTrackStatus* pTrack)
+{
+    switch (pTrack->format)
+    {
+    case NIBBLE_TRACK_BLANK:
+        printf("blank");
+        break;
+    case NIBBLE_TRACK_RW18:
+        printf("RW18 side $%02x", pTrack->side);
+        break;
+    case NIBBLE_TRACK_RWTS16:
+        printf("RWTS16 sectors $%04x", pTrack->validSectors);
+        break;
+    default:
+        printf("BAD (RWTS16 sectors $%04x good, $%04x bad)", pTrack->validSectors, pTrack->badSectors);
+        break;
+    }
+}
+
+static unsigned int reportTrackDiffs(ImageBuild*              pScriptBuild, 
+                                     const NibbleTrackStatus* pTracks1, 
+                                     const NibbleTrackStatus* pTracks2, 
+                                     const NibbleTrackDiff*   pDiffs);
+static int diffImages(ImageBuild* pScriptBuild, CrackleCommandLine* pCommandLine)
+{
+    int                returnValue = 0;
+    NibbleDiskImage*   pScriptImage = (NibbleDiskImage*)pScriptBuild->pDiskImage;
+    NibbleTrackStatus* pTracks = NULL;
+    NibbleTrackDiff    diffs[DISK_IMAGE_TRACKS_PER_SIDE];
+    
+    __try
+    {
+        pTracks = allocateAndZero(2 * DISK_IMAGE_TRACKS_PER_SIDE * sizeof(*pTracks));
+        decodeImageFile(pCommandLine->pDiffImageFilenames[0], pCommandLine->threadCount, pTracks);
+        decodeImageFile(pCommandLine->pDiffImageFilenames[1], 
+                        pCommandLine->threadCount, 
+                        pTracks + DISK_IMAGE_TRACKS_PER_SIDE);
+        NibbleDiskImage_DiffTracks(pScriptImage, pTracks, pTracks + DISK_IMAGE_TRACKS_PER_SIDE, diffs);
+        if (pScriptBuild->pSpec->pScriptFilename)
+        {
+            NibbleDiskImage_RecordWriters(pScriptImage);
+            NibbleDiskImage_ProcessScriptFile(pScriptImage, pScriptBuild->pSpec->pScriptFilename);
+        }
+        if (reportTrackDiffs(pScriptBuild, pTracks, pTracks + DISK_IMAGE_TRACKS_PER_SIDE, diffs))
+            returnValue = 1;
+    }
+    __catch
+    {
+        printf("%s and %s image diff failed.\n", pCommandLine->pDiffImageFilenames[0], pCommandLine->pDiffImageFilenames[1]);
+        returnValue = 1;
+    }
+    
+    free(pTracks);
+    
+    return returnValue;
+}
+
+static void reportRegionWriter(ImageBuild* pScriptBuild, unsigned int track, unsigned int region);
+static unsigned int reportTrackDiffs(ImageBuild*              pScriptBuild, 
+                                     const NibbleTrackStatus* pTracks1, 
+                                     const NibbleTrackStatus* pTracks2, 
+                                     const NibbleTrackDiff*   pDiffs)
+{
+    unsigned int differentCount = 0;
+    unsigned int track;
+    unsigned int region;
+    
+    for (track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+    {
+        const char* pRegionName = pTracks1[track].format == NIBBLE_TRACK_RW18 ? "page" : "sector";
+        
+        if (pDiffs[track].isFormatDifferent)
+        {
+            printf("Track %2u: ", track);
+            printTrackFormat(&pTracks1[track]);
+            printf(" vs ");
+            printTrackFormat(&pTracks2[track]);
+            printf("\n");
+        }
+        for (region = 0 ; region < DISK_IMAGE_RW18_PAGES_PER_TRACK ; region++)
+        {
+            if (!(pDiffs[track].differentRegions & (1 << region)))
+                continue;
+            printf("Track %2u %s %2u differs", track, pRegionName, region);
+            reportRegionWriter(pScriptBuild, track, region);
+            printf("\n");
+        }
+        if (pDiffs[track].isFormatDifferent || pDiffs[track].differentRegions)
+            differentCount++;
+    }
+    printf("%u of %u tracks differ.\n", differentCount, DISK_IMAGE_TRACKS_PER_SIDE);
+    
+    return differentCount;
+}
+
+static void reportRegionWriter(ImageBuild* pScriptBuild, unsigned int track, unsigned int region)
+{
+    const NibbleRegionWriter* pWriter;
+    
+    if (!pScriptBuild->pSpec->pScriptFilename)
+        return;
+    pWriter = NibbleDiskImage_GetRegionWriter((NibbleDiskImage*)pScriptBuild->pDiskImage, track, region);
+    if (!pWriter)
+        printf(" - not written by %s", pScriptBuild->pSpec->pScriptFilename);
+    else if (pWriter->pObjectFilename)
+        printf(" - last written by %s:%u (%s)", 
+               pScriptBuild->pSpec->pScriptFilename, pWriter->lineNumber, pWriter->pObjectFilename);
     else
-        return NULL;
+        printf(" - last written by %s:%u", pScriptBuild->pSpec->pScriptFilename, pWriter->lineNumber);
+}
+
+static void freeImageBuilds(ImageBuild* pBuilds, unsigned int buildCount)
+{
+    unsigned int i;
+    
+    for (i = 0 ; i < buildCount ; i++)
+        DiskImage_Free(pBuilds[i].pDiskImage);
 }
@@ -14,6 +14,9 @@
 #define _ASSEMBLER_H_
 
 #include "try_catch.h"
+#include "Vfs.h"
+#include "BinaryBuffer.h"
+#include "InstructionSetSupported.h"
 
 
 typedef struct AssemblerInitParams
@@ -21,6 +24,8 @@ typedef struct AssemblerInitParams
     const char* pListFilename;
     const char* pPutDirectories;
     const char* pOutputDirectory;
+    Vfs*        pVfs;
+    int         keepObjectsInMemory;
 } AssemblerInitParams;
 
 typedef struct Assembler Assembler;
@@ -34,5 +39,17 @@ __throws Assembler* Assembler_CreateFromFile(const char* pSourceFilename, const
          unsigned int Assembler_GetErrorCount(Assembler* pThis);
          unsigned int Assembler_GetWarningCount(Assembler* pThis);
 
+         void       Assembler_ObjectFileEnumStart(Assembler* pThis);
+         int        Assembler_ObjectFileEnumNext(Assembler* pThis, BinaryBufferOutput* pOutput);
+
+/* Returns the first of the assembled lines.  The rest are linked through their pNext fields. */
+         struct LineInfo* Assembler_GetFirstLine(Assembler* pThis);
+
+/* Returns the value of a defined global label along with the instruction set in effect where it was defined.  Throws
+   invalidArgumentException if there is no such label. */
+__throws unsigned short Assembler_GetLabelValue(Assembler*               pThis, 
+                                                const char*              pLabelName, 
+                                                InstructionSetSupported* pInstructionSet);
+
 
 #endif /* _ASSEMBLER_H_ */
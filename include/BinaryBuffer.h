@@ -15,10 +15,14 @@
 
 #include "try_catch.h"
 #include "SizedString.h"
+#include "Vfs.h"
 
 
 #define BINARY_BUFFER_SAV_SIGNATURE     "SAV\x1a"
 #define BINARY_BUFFER_RW18SAV_SIGNATURE "USR\x1a"
+/* Signatures used in place of the above when the content following the header has been compressed with LzPack. */
+#define BINARY_BUFFER_LZSAV_SIGNATURE     "SVZ\x1a"
+#define BINARY_BUFFER_LZRW18SAV_SIGNATURE "USZ\x1a"
 
 
 typedef struct SavFileHeader
@@ -38,6 +42,22 @@ typedef struct RW18SavFileHeader
 } RW18SavFileHeader;
 
 
+typedef struct BinaryBufferOutput
+{
+    const char*          pFilename;
+    const unsigned char* pContent;
+    size_t               contentLength;
+    int                  isRW18;
+    int                  isCompressed;
+    const unsigned char* pCompressedContent;
+    size_t               compressedLength;
+    unsigned short       baseAddress;
+    unsigned short       side;
+    unsigned short       track;
+    unsigned short       offset;
+} BinaryBufferOutput;
+
+
 typedef struct BinaryBuffer BinaryBuffer;
 
 
@@ -50,6 +70,7 @@ __throws unsigned char* BinaryBuffer_Realloc(BinaryBuffer* pThis, unsigned char*
          
          void           BinaryBuffer_SetOrigin(BinaryBuffer* pThis, unsigned short origin);
          unsigned short BinaryBuffer_GetOrigin(BinaryBuffer* pThis);
+         void           BinaryBuffer_SetCompression(BinaryBuffer* pThis, int compressOutput);
 __throws void           BinaryBuffer_QueueWriteToFile(BinaryBuffer* pThis, 
                                                       const char*   pDirectoryName, 
                                                       SizedString*  pFilename,
@@ -61,6 +82,8 @@ __throws void           BinaryBuffer_QueueRW18WriteToFile(BinaryBuffer*  pThis,
                                                           unsigned short side,
                                                           unsigned short track,
                                                           unsigned short offset);
-__throws void           BinaryBuffer_ProcessWriteFileQueue(BinaryBuffer* pThis);
+__throws void           BinaryBuffer_ProcessWriteFileQueue(BinaryBuffer* pThis, Vfs* pVfs);
+         void           BinaryBuffer_WriteFileQueueEnumStart(BinaryBuffer* pThis);
+         int            BinaryBuffer_WriteFileQueueEnumNext(BinaryBuffer* pThis, BinaryBufferOutput* pOutput);
 
 #endif /* _BINARY_BUFFER_H_ */
@@ -19,12 +19,19 @@
 
 #define BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT    1600
 #define BLOCK_DISK_IMAGE_3_5_DISK_SIZE      (DISK_IMAGE_BLOCK_SIZE * BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT)
+#define BLOCK_DISK_IMAGE_32M_BLOCK_COUNT    65535
+#define BLOCK_DISK_IMAGE_32M_DISK_SIZE      (DISK_IMAGE_BLOCK_SIZE * BLOCK_DISK_IMAGE_32M_BLOCK_COUNT)
 
 
 typedef struct BlockDiskImage BlockDiskImage;
 
 
 __throws BlockDiskImage* BlockDiskImage_Create(unsigned int blockCount);
+__throws BlockDiskImage* BlockDiskImage_CreateWithVfs(unsigned int blockCount, Vfs* pVfs);
+/* Sparse images only allocate the blocks which are written to and skip over the untouched ones when writing the image
+   file, so large hard disk volumes only cost as much memory and I/O as the data placed in them.  There is no
+   contiguous image buffer so BlockDiskImage_GetImagePointer() returns NULL for them. */
+__throws BlockDiskImage* BlockDiskImage_CreateSparse(unsigned int blockCount, Vfs* pVfs);
 
 __throws void            BlockDiskImage_ProcessScriptFile(BlockDiskImage* pThis, const char* pScriptFilename);
 __throws void            BlockDiskImage_ProcessScript(BlockDiskImage* pThis, char* pScriptText);
@@ -20,15 +20,36 @@ typedef enum CrackleImageFormat
 {
     FORMAT_UNKNOWN = 0,
     FORMAT_NIB_5_25,
-    FORMAT_HDV_3_5
+    FORMAT_HDV_3_5,
+    FORMAT_HDV_32M
 } CrackleImageFormat;
 
 
-typedef struct CrackleCommandLine
+#define CRACKLE_COMMAND_LINE_MAX_SNAP_SOURCES 32
+#define CRACKLE_COMMAND_LINE_MAX_THREADS      64
+#define CRACKLE_COMMAND_LINE_MAX_IMAGES       8
+
+
+typedef struct CrackleImageSpec
 {
     const char*        pScriptFilename;
     const char*        pOutputImageFilename;
+    int                updateImage;
     CrackleImageFormat imageFormat;
+} CrackleImageSpec;
+
+typedef struct CrackleCommandLine
+{
+    CrackleImageSpec   images[CRACKLE_COMMAND_LINE_MAX_IMAGES];
+    unsigned int       imageCount;
+    const char*        pPutDirectories;
+    const char*        pVerifyImageFilename;
+    const char*        pDiffImageFilenames[2];
+    const char*        pSnapSourceFilenames[CRACKLE_COMMAND_LINE_MAX_SNAP_SOURCES];
+    unsigned int       snapSourceCount;
+    unsigned int       threadCount;
+    int                usePlans;
+    int                writeEquates;
 } CrackleCommandLine;
 
 
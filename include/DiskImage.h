@@ -14,6 +14,7 @@
 #define _DISK_IMAGE_H_
 
 #include "try_catch.h"
+#include "Vfs.h"
 
 
 #define DISK_IMAGE_BYTES_PER_SECTOR       256
@@ -27,9 +28,14 @@
 #define DISK_IMAGE_RW18_SIDE_2            0x79
 #define DISK_IMAGE_RW18_PAGES_PER_TRACK   18
 #define DISK_IMAGE_RW18_BYTES_PER_TRACK   (DISK_IMAGE_RW18_PAGES_PER_TRACK * DISK_IMAGE_PAGE_SIZE)
+#define DISK_IMAGE_MANIFEST_SUFFIX        ".manifest"
+#define DISK_IMAGE_PLAN_SUFFIX            ".plan"
+#define DISK_IMAGE_RESOLVED_SCRIPT_SUFFIX ".resolved"
+#define DISK_IMAGE_EQUATES_SUFFIX         ".equ.S"
 
 
 typedef struct DiskImage DiskImage;
+typedef struct DiskImageObjectCache DiskImageObjectCache;
 
 
 typedef enum DiskImageInsertionType
@@ -71,12 +77,46 @@ typedef struct DiskImageInsert
 __throws void      DiskImage_ProcessScriptFile(DiskImage* pThis, const char*  pScriptFilename);
 __throws void      DiskImage_ProcessScript(DiskImage* pThis, char* pScriptText);
 
+__throws void      DiskImage_AddInMemoryObject(DiskImage*             pThis, 
+                                               const char*            pFilename, 
+                                               const unsigned char*   pData, 
+                                               unsigned int           length,
+                                               const DiskImageInsert* pDefaultInsert);
 __throws void      DiskImage_ReadObjectFile(DiskImage* pThis, const char* pFilename);
 __throws void      DiskImage_UpdateImageTableFile(DiskImage* pThis, unsigned short newImageTableAddress);
 __throws void      DiskImage_InsertObjectFile(DiskImage* pThis, DiskImageInsert* pInsert);
 
 __throws void      DiskImage_WriteImage(DiskImage* pThis, const char* pImageFilename);
-
+/* Replaces the contents of the image with an image file of the same size.  Not supported for sparse images. */
+__throws void      DiskImage_ReadImage(DiskImage* pThis, const char* pImageFilename);
+/* Brings an image previously built by this routine up to date with the script, only rewriting the parts of the image
+   affected by script lines which have changed since.  Falls back to a full build if the image or its manifest
+   (pImageFilename with DISK_IMAGE_MANIFEST_SUFFIX appended) are missing or don't match. */
+__throws void      DiskImage_UpdateImage(DiskImage* pThis, const char* pScriptFilename, const char* pImageFilename);
+/* Makes DiskImage_ProcessScriptFile() keep a compiled plan of the script in pImageFilename with DISK_IMAGE_PLAN_SUFFIX
+   appended.  Later runs replay the plan instead of parsing the script again until the script, or an object file which
+   one of its '*' fields or image table updates depends upon, changes. */
+__throws void      DiskImage_EnablePlan(DiskImage* pThis, const char* pImageFilename);
+/* Makes script processing write a copy of the script, with the track and offset of each RW18 line which used '?' for
+   them filled in, to pImageFilename with DISK_IMAGE_RESOLVED_SCRIPT_SUFFIX appended.  It is only written when the
+   script has such lines, had no errors, and the placement differs from what the file already holds. */
+__throws void      DiskImage_EnableResolvedScript(DiskImage* pThis, const char* pImageFilename);
+/* Makes script processing, or the replay of its plan, write LABEL_SIDE, LABEL_TRACK, LABEL_OFFSET, and LABEL_LENGTH
+   assembler equates for the object placed by each RW18 line to pImageFilename with DISK_IMAGE_EQUATES_SUFFIX appended.
+   LABEL is the object's filename without its directory or extension.  As with the resolved script, the file is only
+   written after a build without errors and only when its contents change. */
+__throws void      DiskImage_EnableEquates(DiskImage* pThis, const char* pImageFilename);
+
+/* Object files read from the Vfs are cached so that later script lines which reference the same file don't read it
+   again.  Several images, even ones being built concurrently on different threads, can share a cache so that object
+   files used by more than one of them are only read once.  Each image holds a reference to its cache so
+   DiskImageObjectCache_Free() only drops the caller's reference.  The cache keeps one entry per file.  The entry for
+   a file which has changed since it was read is discarded once no image which used it is still alive. */
+__throws DiskImageObjectCache* DiskImageObjectCache_Create(void);
+         void                  DiskImageObjectCache_Free(DiskImageObjectCache* pThis);
+         void                  DiskImage_SetObjectCache(DiskImage* pThis, DiskImageObjectCache* pCache);
+
+/* Sparse images have no contiguous copy of the image so NULL is returned for them. */
          unsigned char* DiskImage_GetImagePointer(DiskImage* pThis);
          size_t         DiskImage_GetImageSize(DiskImage* pThis);
 
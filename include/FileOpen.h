@@ -17,5 +17,8 @@
 #include "try_catch.h"
 
 __throws FILE* FileOpen(const char* pFilename, const char* pMode);
+/* Copies the name of the file which FileOpen() would open for pFilename into pBuffer.  Returns 0 if it won't fit. */
+          int   FileOpen_ResolvePath(const char* pFilename, char* pBuffer, size_t bufferSize);
+          void  FileOpen_FreeDirectoryCache(void);
 
 #endif /* _FILE_OPEN_H_ */
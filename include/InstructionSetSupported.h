@@ -0,0 +1,24 @@
+/*  Copyright (C) 2012  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#ifndef _INSTRUCTION_SET_SUPPORTED_H_
+#define _INSTRUCTION_SET_SUPPORTED_H_
+
+typedef enum InstructionSetSupported
+{
+    INSTRUCTION_SET_6502 = 0,
+    INSTRUCTION_SET_65C02,
+    INSTRUCTION_SET_65816,
+    INSTRUCTION_SET_INVALID
+} InstructionSetSupported;
+
+#endif /* _INSTRUCTION_SET_SUPPORTED_H_ */
@@ -15,6 +15,7 @@
 
 #include "Symbol.h"
 #include "TextSource.h"
+#include "InstructionSetSupported.h"
 
 /* Bits used in LineInfo::flags */
 /* NOTE: First 2 flags match the conditional flags in Assembler_Priv.h */
@@ -23,16 +24,27 @@
 #define LINEINFO_FLAG_WAS_EQU                       4
 #define LINEINFO_FLAG_FORWARD_REFERENCE             8
 #define LINEINFO_FLAG_DISALLOW_FORWARD              16
+#define LINEINFO_FLAG_INSTRUCTION                   32
+#define LINEINFO_FLAG_CYCLES                        64
+#define LINEINFO_FLAG_TIMING_CRITICAL               128
+#define LINEINFO_FLAG_RELAXATION_HINT               256
+#define LINEINFO_FLAG_ALLOW_LONG_BRANCH             512
+#define LINEINFO_FLAG_LONG_BRANCH                   1024
+#define LINEINFO_FLAG_OPTIMIZE                      2048
 
-typedef struct Symbol Symbol;
-
-typedef enum InstructionSetSupported
+/* Peephole rewrites which have been applied to a line within an OPT region. */
+typedef enum PeepholeRewrite
 {
-    INSTRUCTION_SET_6502 = 0,
-    INSTRUCTION_SET_65C02,
-    INSTRUCTION_SET_65816,
-    INSTRUCTION_SET_INVALID
-} InstructionSetSupported;
+    PEEPHOLE_NONE = 0,
+    PEEPHOLE_JSR_TO_JMP,
+    PEEPHOLE_DROP_RTS,
+    PEEPHOLE_DROP_LOAD,
+    PEEPHOLE_DROP_CLC,
+    PEEPHOLE_ADC_TO_INC,
+    PEEPHOLE_CHAINED_BRANCH
+} PeepholeRewrite;
+
+typedef struct Symbol Symbol;
 
 
 struct LineInfo
@@ -44,6 +56,7 @@ struct LineInfo
     unsigned char*          pMachineCode;
     size_t                  machineCodeSize;
     InstructionSetSupported instructionSet;
+    PeepholeRewrite         peepholeRewrite;
     int                     indentation;
     unsigned int            lineNumber;
     unsigned int            flags;
@@ -51,4 +64,11 @@ struct LineInfo
     unsigned short          equValue;
 };
 
+
+/* A labelled line starts a new block of code or data (EQU lines define constants so they don't count). */
+static inline int LineInfo_IsLabelled(struct LineInfo* pLineInfo)
+{
+    return pLineInfo->pSymbol && !(pLineInfo->flags & LINEINFO_FLAG_WAS_EQU);
+}
+
 #endif /* _LINE_INFO_H_ */
@@ -25,5 +25,7 @@ __throws ListFile* ListFile_Create(FILE* pOutputFile);
          void      ListFile_Free(ListFile* pThis);
          
          void      ListFile_OutputLine(ListFile* pThis, LineInfo* pLineInfo);
+         /* Same as ListFile_OutputLine() but with pAnnotation appended to the line's text. */
+         void      ListFile_OutputAnnotatedLine(ListFile* pThis, LineInfo* pLineInfo, const char* pAnnotation);
 
 #endif /* _LIST_FILE_H_ */
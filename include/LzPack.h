@@ -0,0 +1,45 @@
+/*  Copyright (C) 2012  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Byte aligned LZ compression which is simple enough to be quickly decompressed on the 6502.
+
+   The compressed stream is a series of tokens, each followed by its data:
+     $00     - End of stream.
+     $01-$7F - Literal run.  The token is the number of literal bytes which follow it.
+     $80-$FF - Match.  (token & $7F) + LZPACK_MINIMUM_MATCH bytes are copied from earlier in the output.  The token is
+               followed by a 2 byte little endian distance back from the current output location to the start of the
+               match.  The match can overlap the bytes being output.
+*/
+#ifndef _LZ_PACK_H_
+#define _LZ_PACK_H_
+
+#include <stddef.h>
+#include "try_catch.h"
+
+
+#define LZPACK_END_TOKEN        0x00
+#define LZPACK_MATCH_TOKEN      0x80
+#define LZPACK_MAXIMUM_LITERALS 0x7F
+#define LZPACK_MINIMUM_MATCH    4
+#define LZPACK_MAXIMUM_MATCH    (0x7F + LZPACK_MINIMUM_MATCH)
+#define LZPACK_MAXIMUM_DISTANCE 0xFFFF
+
+
+/* Largest compressed stream which LzPack_Compress() can generate for srcLength bytes of input. */
+         size_t LzPack_MaximumCompressedSize(size_t srcLength);
+/* pDest must be able to hold LzPack_MaximumCompressedSize(srcLength) bytes.  Returns the compressed length. */
+         size_t LzPack_Compress(unsigned char* pDest, const unsigned char* pSrc, size_t srcLength);
+/* Returns the decompressed length.  Throws bufferOverrunException if the stream is truncated or would overflow pDest
+   and invalidArgumentException if a match reaches back before the start of the output. */
+__throws size_t LzPack_Decompress(unsigned char* pDest, size_t destSize, const unsigned char* pSrc, size_t srcLength);
+
+#endif /* _LZ_PACK_H_ */
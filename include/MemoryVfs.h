@@ -0,0 +1,36 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Vfs implementation which keeps all of its files in memory.  Files opened for read are served from the contents
+   added with MemoryVfs_AddFile() and files opened for write are captured so that they can be retrieved later with
+   MemoryVfs_GetFileData().  The returned FILE* streams are built with funopen() on OS X and the GNU fopencookie()
+   elsewhere so that all file data is allocated through the same malloc()/realloc() as the rest of the code. */
+#ifndef _MEMORY_VFS_H_
+#define _MEMORY_VFS_H_
+
+#include <stddef.h>
+#include "try_catch.h"
+#include "Vfs.h"
+
+
+typedef struct MemoryVfs MemoryVfs;
+
+
+__throws MemoryVfs*           MemoryVfs_Create(void);
+         void                 MemoryVfs_Free(MemoryVfs* pThis);
+         Vfs*                 MemoryVfs_GetVfs(MemoryVfs* pThis);
+         
+__throws void                 MemoryVfs_AddFile(MemoryVfs* pThis, const char* pFilename, 
+                                                const void* pData, size_t dataSize);
+         const unsigned char* MemoryVfs_GetFileData(MemoryVfs* pThis, const char* pFilename, size_t* pDataSize);
+
+#endif /* _MEMORY_VFS_H_ */
@@ -28,7 +28,46 @@
 typedef struct NibbleDiskImage NibbleDiskImage;
 
 
+typedef enum NibbleTrackFormat
+{
+    NIBBLE_TRACK_BLANK,
+    NIBBLE_TRACK_RW18,
+    NIBBLE_TRACK_RWTS16,
+    NIBBLE_TRACK_BAD
+} NibbleTrackFormat;
+
+/* Result of decoding one track of a nibble image.  RWTS16 sectors are written individually so a RWTS16 track can
+   contain a mix of sectors which decoded correctly, sectors which didn't and sectors which were never written. */
+typedef struct NibbleTrackStatus
+{
+    NibbleTrackFormat format;
+    unsigned int      side;
+    unsigned short    validSectors;
+    unsigned short    badSectors;
+    int               isMismatched;
+    unsigned char     data[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+} NibbleTrackStatus;
+
+/* Regions are the DISK_IMAGE_PAGE_SIZE byte pages of a RW18 track or the sectors of any other track.  A track whose
+   format or RW18 side differs isn't broken down into regions. */
+typedef struct NibbleTrackDiff
+{
+    unsigned int differentRegions;
+    int          isFormatDifferent;
+} NibbleTrackDiff;
+
+/* The script line and object responsible for the last write to a region of the image. */
+typedef struct NibbleRegionWriter
+{
+    unsigned int lineNumber;
+    const char*  pObjectFilename;
+} NibbleRegionWriter;
+
+
 __throws NibbleDiskImage* NibbleDiskImage_Create(void);
+__throws NibbleDiskImage* NibbleDiskImage_CreateWithVfs(Vfs* pVfs);
+/* Number of threads used to nibblize the tracks when the image is flushed and to decode them when it is verified. */
+         void             NibbleDiskImage_SetEncodeThreadCount(NibbleDiskImage* pThis, unsigned int threadCount);
 
 __throws void             NibbleDiskImage_ProcessScriptFile(NibbleDiskImage* pThis, const char* pScriptFilename);
 __throws void             NibbleDiskImage_ProcessScript(NibbleDiskImage* pThis, char* pScriptText);
@@ -49,4 +88,26 @@ __throws void             NibbleDiskImage_ReadRW18Track(NibbleDiskImage* pThis,
                                                         unsigned char* pTrackData,
                                                         size_t trackDataSize);
 
+/* Replaces the contents of the image with a .nib file previously written by NibbleDiskImage_WriteImage(). */
+__throws void             NibbleDiskImage_ReadImage(NibbleDiskImage* pThis, const char* pImageFilename);
+/* Decodes every track of the image into pTracks[DISK_IMAGE_TRACKS_PER_SIDE]. */
+__throws void             NibbleDiskImage_VerifyTracks(NibbleDiskImage* pThis, NibbleTrackStatus* pTracks);
+/* Sets isMismatched for each track whose format or decoded data differs from pExpectedTracks and returns the number
+   of such tracks. */
+         unsigned int     NibbleDiskImage_CompareTracks(NibbleTrackStatus*       pTracks, 
+                                                        const NibbleTrackStatus* pExpectedTracks);
+/* Fills in pDiffs[DISK_IMAGE_TRACKS_PER_SIDE] with the regions of each track which differ between the two sets of
+   decoded tracks and returns the number of tracks with differences.  The tracks are compared on pThis's threads. */
+         unsigned int     NibbleDiskImage_DiffTracks(NibbleDiskImage*         pThis,
+                                                     const NibbleTrackStatus* pTracks1, 
+                                                     const NibbleTrackStatus* pTracks2, 
+                                                     NibbleTrackDiff*         pDiffs);
+
+/* Once called, the image remembers which script line and object last wrote each region of every track. */
+__throws void             NibbleDiskImage_RecordWriters(NibbleDiskImage* pThis);
+/* Returns NULL if writers aren't being recorded or nothing has written to the region since. */
+         const NibbleRegionWriter* NibbleDiskImage_GetRegionWriter(NibbleDiskImage* pThis, 
+                                                                   unsigned int     track, 
+                                                                   unsigned int     region);
+
 #endif /* _NIBBLE_DISK_IMAGE_H_ */
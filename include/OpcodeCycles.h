@@ -0,0 +1,38 @@
+/*  Copyright (C) 2012  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Clock cycle counts for the 6502 and 65C02 instructions emitted by snap. */
+#ifndef _OPCODE_CYCLES_H_
+#define _OPCODE_CYCLES_H_
+
+#include <stddef.h>
+#include "LineInfo.h"
+
+
+typedef struct OpcodeCycles
+{
+    /* Both are 0 when the machine code isn't a known instruction. */
+    unsigned int minCycles;
+    unsigned int maxCycles;
+    /* Set for conditional branches where minCycles is the not taken and maxCycles the taken count. */
+    int          isBranch;
+} OpcodeCycles;
+
+
+/* Counts the cycles taken by the instruction in pMachineCode when it is located at address.  The extra cycle taken
+   by indexed reads which cross a page is included in maxCycles unless the base address makes that impossible. */
+OpcodeCycles OpcodeCycles_Get(InstructionSetSupported instructionSet, 
+                              unsigned short          address, 
+                              const unsigned char*    pMachineCode, 
+                              size_t                  machineCodeSize);
+
+#endif /* _OPCODE_CYCLES_H_ */
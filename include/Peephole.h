@@ -0,0 +1,29 @@
+/*  Copyright (C) 2012  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Peephole optimizations of the instructions assembled within OPT regions. */
+#ifndef _PEEPHOLE_H_
+#define _PEEPHOLE_H_
+
+#include <stddef.h>
+#include "LineInfo.h"
+
+
+/* Flags the lines which can be shortened by reassembling them in a rewritten form and returns how many lines were
+   newly flagged.  Lines flagged by an earlier call are left as is. */
+size_t Peephole_FindRewrites(LineInfo* pFirstLine);
+
+/* Retargets branches which land on a JMP, BRA or an identical branch so that they go straight to the final
+   destination when it is within range.  The code is patched in place since this doesn't change its size. */
+void   Peephole_ChainBranches(LineInfo* pFirstLine);
+
+#endif /* _PEEPHOLE_H_ */
@@ -0,0 +1,42 @@
+/*  Copyright (C) 2012  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Attributes the cycles executed by the simulator to the assembled lines which generated the code. */
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <stdio.h>
+#include "try_catch.h"
+#include "LineInfo.h"
+#include "Simulator.h"
+
+
+typedef struct Profiler Profiler;
+
+
+__throws Profiler*     Profiler_Create(LineInfo* pFirstLine);
+         void          Profiler_Free(Profiler* pThis);
+
+         void          Profiler_AttachToSimulator(Profiler* pThis, Simulator* pSimulator);
+         void          Profiler_RecordInstruction(Profiler* pThis, unsigned short address, unsigned int cycles);
+
+         unsigned long Profiler_GetTotalCycles(Profiler* pThis);
+         /* Cycles spent executing code which wasn't generated by an assembled instruction line. */
+         unsigned long Profiler_GetUnattributedCycles(Profiler* pThis);
+
+/* Outputs the list file with the cycles, percentage of total cycles and instruction count appended to each line
+   which was executed. */
+__throws void          Profiler_OutputAnnotatedListing(Profiler* pThis, FILE* pFile);
+/* Outputs the topCount global labels and lines which took the most cycles. */
+__throws void          Profiler_OutputReport(Profiler* pThis, FILE* pFile, size_t topCount);
+
+#endif /* _PROFILER_H_ */
@@ -0,0 +1,82 @@
+/*  Copyright (C) 2012  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Cycle counting 6502/65C02 simulator used to run assembled code without a real machine. */
+#ifndef _SIMULATOR_H_
+#define _SIMULATOR_H_
+
+#include <stddef.h>
+#include "try_catch.h"
+#include "LineInfo.h"
+#include "Vfs.h"
+
+
+/* Simulator_Run() pushes the return address for this sentinel so that the RTS at the end of the called routine stops
+   the simulation. */
+#define SIMULATOR_SENTINEL_ADDRESS  0xFFFF
+
+/* Bits in SimulatorRegisters::p */
+#define SIMULATOR_FLAG_C    0x01
+#define SIMULATOR_FLAG_Z    0x02
+#define SIMULATOR_FLAG_I    0x04
+#define SIMULATOR_FLAG_D    0x08
+#define SIMULATOR_FLAG_B    0x10
+#define SIMULATOR_FLAG_U    0x20
+#define SIMULATOR_FLAG_V    0x40
+#define SIMULATOR_FLAG_N    0x80
+
+typedef enum SimulatorStopReason
+{
+    SIMULATOR_STOP_RETURN = 0,
+    SIMULATOR_STOP_BRK,
+    SIMULATOR_STOP_CYCLE_BUDGET,
+    SIMULATOR_STOP_INVALID_OPCODE
+} SimulatorStopReason;
+
+typedef struct SimulatorRegisters
+{
+    unsigned short pc;
+    unsigned char  a;
+    unsigned char  x;
+    unsigned char  y;
+    unsigned char  s;
+    unsigned char  p;
+} SimulatorRegisters;
+
+/* Called after each instruction is executed with its address and the cycles that it took. */
+typedef void (*SimulatorInstructionHook)(void* pContext, unsigned short address, unsigned int cycles);
+
+typedef struct Simulator Simulator;
+
+
+__throws Simulator*          Simulator_Create(InstructionSetSupported instructionSet);
+         void                Simulator_Free(Simulator* pThis);
+
+__throws void                Simulator_LoadImage(Simulator*           pThis, 
+                                                 unsigned short       address, 
+                                                 const unsigned char* pImage, 
+                                                 size_t               imageSize);
+__throws void                Simulator_LoadSavFile(Simulator* pThis, Vfs* pVfs, const char* pFilename);
+
+/* Calls the routine at entryPoint as if by JSR and executes until it returns, a BRK or an opcode which isn't valid for
+   the instruction set is reached, or at least cycleBudget cycles have been executed.  The registers are left as the
+   routine left them with pc pointing at the instruction which wasn't executed. */
+         SimulatorStopReason Simulator_Run(Simulator* pThis, unsigned short entryPoint, unsigned long cycleBudget);
+
+         void                Simulator_SetInstructionHook(Simulator* pThis, SimulatorInstructionHook hook, void* pContext);
+
+         SimulatorRegisters* Simulator_GetRegisters(Simulator* pThis);
+         unsigned char*      Simulator_GetMemory(Simulator* pThis);
+         unsigned long       Simulator_GetCycleCount(Simulator* pThis);
+         unsigned long       Simulator_GetInstructionCount(Simulator* pThis);
+
+#endif /* _SIMULATOR_H_ */
@@ -20,6 +20,8 @@
 typedef struct SnapCommandLine
 {
     const char*         pSourceFilename;
+    const char*         pRunLabel;
+    const char*         pProfileFilename;
     AssemblerInitParams assemblerInitParams;
 } SnapCommandLine;
 
@@ -15,6 +15,7 @@
 
 #include "try_catch.h"
 #include "SizedString.h"
+#include "Vfs.h"
 
 typedef struct TextFile TextFile;
 
@@ -23,6 +24,12 @@ __throws TextFile*    TextFile_CreateFromString(const char* pText);
 __throws TextFile*    TextFile_CreateFromFile(const SizedString* pDirectoryName, 
                                               const SizedString* pFilename, 
                                               const char*        pFilenameSuffix);
+__throws TextFile*    TextFile_CreateFromVfsFile(Vfs*               pVfs,
+                                                 const SizedString* pDirectoryName, 
+                                                 const SizedString* pFilename, 
+                                                 const char*        pFilenameSuffix);
+/* Reads the whole of an already opened pFile and closes it, even on failure. */
+__throws TextFile*    TextFile_CreateFromOpenFile(FILE* pFile, const char* pFilename);
 __throws TextFile*    TextFile_CreateFromTextFile(const TextFile* pTextFile);
          void         TextFile_Free(TextFile* pThis);
          void         TextFile_Reset(TextFile* pThis);
@@ -34,4 +41,9 @@ __throws TextFile*    TextFile_CreateFromTextFile(const TextFile* pTextFile);
          unsigned int TextFile_GetLineNumber(TextFile* pThis);
          const char*  TextFile_GetFilename(TextFile* pThis);
 
+/* Returns the malloc()ed pDirectoryName/pFilename+pFilenameSuffix name that TextFile_CreateFromFile() opens. */
+__throws char*        TextFile_AllocateMergedFilename(const SizedString* pDirectoryName, 
+                                                      const SizedString* pFilename, 
+                                                      const char*        pFilenameSuffix);
+
 #endif /* _TEXT_FILE_H_ */
@@ -0,0 +1,47 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Virtual file system interface used by the snap and crackle libraries to open their input and output files. */
+#ifndef _VFS_H_
+#define _VFS_H_
+
+#include <stdio.h>
+#include <time.h>
+
+
+typedef struct Vfs Vfs;
+
+/* Identifies one version of a file's contents.  If two stamps for the same file match, its contents have not
+   changed. */
+typedef struct VfsFileStamp
+{
+    time_t modificationTime;
+    long   modificationNsec;
+    long   size;
+} VfsFileStamp;
+
+struct Vfs
+{
+    /* Returns a stdio stream for the file or NULL on failure, just like fopen(). */
+    FILE* (*open)(Vfs* pThis, const char* pFilename, const char* pMode);
+    /* Optional.  Fills in *pStamp and returns non-zero if the file exists. */
+    int   (*getFileStamp)(Vfs* pThis, const char* pFilename, VfsFileStamp* pStamp);
+};
+
+
+/* A NULL pThis opens the file from the OS file system. */
+FILE* Vfs_Open(Vfs* pThis, const char* pFilename, const char* pMode);
+
+/* Returns 0 if the file doesn't exist or the Vfs can't stamp files.  Callers must not cache the file then. */
+int   Vfs_GetFileStamp(Vfs* pThis, const char* pFilename, VfsFileStamp* pStamp);
+
+#endif /* _VFS_H_ */
@@ -38,6 +38,8 @@
 #define invalidArgumentCountException       19
 #define encounteredCommentException         20
 #define badTrackException                   21
+#define overlappingInsertException          22
+#define diskFullException                   23
 
 
 #ifndef __debugbreak
@@ -52,8 +54,9 @@ typedef struct ExceptionHandler
 } ExceptionHandler;
 
 
-extern ExceptionHandler* g_pExceptionHandlers;
-extern int               g_exceptionCode;
+/* Each thread has its own exception state so that code using these macros can run on several threads at once. */
+extern __thread ExceptionHandler* g_pExceptionHandlers;
+extern __thread int               g_exceptionCode;
 
 
 /* On Linux, it is possible that __try and __catch are already defined. */
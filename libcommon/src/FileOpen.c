@@ -10,13 +10,24 @@
     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
     GNU General Public License for more details.
 */
+#include <ctype.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include "FileOpen.h"
 #include "FileOpenTest.h"
 #include "string.h"
 #include "strings.h"
 #include "util.h"
 
+#ifdef __APPLE__
+#define MODIFICATION_NSEC(STAT) ((STAT).st_mtimespec.tv_nsec)
+#else
+#define MODIFICATION_NSEC(STAT) ((STAT).st_mtim.tv_nsec)
+#endif
+
+#define DIRECTORY_INDEX_BUCKETS 127
+
 typedef struct
 {
     char*  pFilename;
@@ -38,27 +49,73 @@ typedef struct
     size_t      filenameLength;
 } FilenameInfo;
 
+typedef struct DirectoryEntry
+{
+    struct DirectoryEntry* pNext;
+    char                   name[];
+} DirectoryEntry;
 
-static void initFilenameParts(FilenameParts* pParts, const char* pFilename);
-static FilenameInfo determineFilenameInfo(const char* pFilename);
-static FilenamePointers findLastSlashAndEndOfFilename(const char* pFilename);
-static void throwIfLengthTooLong(int length, int limit);
-static const char* findFilenameCaseInsensitive(FilenameParts* pThis);
+typedef struct DirectoryIndex
+{
+    struct DirectoryIndex* pNext;
+    char*                  pDirectoryName;
+    time_t                 modificationTime;
+    long                   modificationNsec;
+    DirectoryEntry*        buckets[DIRECTORY_INDEX_BUCKETS];
+} DirectoryIndex;
+
+
+/* Case-folded name index for each directory searched so far.  Each index is rebuilt when the modification time of
+   its directory changes.  crackle opens files from several image build threads at once so the indices are only
+   touched with g_directoryIndicesMutex held. */
+static DirectoryIndex*  g_pDirectoryIndices;
+static pthread_mutex_t  g_directoryIndicesMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static int resolveFilename(FilenameParts* pParts, const char* pFilename);
+static int isWriteMode(const char* pMode);
+static void invalidateDirectoryIndex(FilenameParts* pThis);
 __throws FILE* FileOpen(const char* pFilename, const char* pMode)
 {
     FilenameParts filenameParts;
+    FILE*         pFile;
+    
+    if (!resolveFilename(&filenameParts, pFilename))
+        return NULL;
+    
+    pFile = fopen(filenameParts.fullFilename, pMode);
+    if (pFile && isWriteMode(pMode))
+    {
+        pthread_mutex_lock(&g_directoryIndicesMutex);
+        invalidateDirectoryIndex(&filenameParts);
+        pthread_mutex_unlock(&g_directoryIndicesMutex);
+    }
+    return pFile;
+}
+
+static void initFilenameParts(FilenameParts* pParts, const char* pFilename);
+static const char* findFilenameCaseInsensitive(FilenameParts* pThis);
+static int resolveFilename(FilenameParts* pParts, const char* pFilename)
+{
     __try
     {
-        initFilenameParts(&filenameParts, pFilename);
+        initFilenameParts(pParts, pFilename);
     }
     __catch
     {
         clearExceptionCode();
-        return NULL;
+        return FALSE;
     }
-    return fopen(findFilenameCaseInsensitive(&filenameParts), pMode);
+    pthread_mutex_lock(&g_directoryIndicesMutex);
+    findFilenameCaseInsensitive(pParts);
+    pthread_mutex_unlock(&g_directoryIndicesMutex);
+    
+    return TRUE;
 }
 
+static FilenameInfo determineFilenameInfo(const char* pFilename);
+static FilenamePointers findLastSlashAndEndOfFilename(const char* pFilename);
+static void throwIfLengthTooLong(int length, int limit);
 static void initFilenameParts(FilenameParts* pParts, const char* pFilename)
 {
     FilenameInfo filenameInfo = determineFilenameInfo(pFilename);
@@ -118,7 +175,170 @@ static void throwIfLengthTooLong(int length, int limit)
         __throw(outOfMemoryException);
 }
 
+static DirectoryIndex* findOrBuildDirectoryIndex(const char* pDirectoryName);
+static const DirectoryEntry* findDirectoryEntry(const DirectoryIndex* pIndex, const char* pFilename);
+static void scanDirectoryForFilename(FilenameParts* pThis);
 static const char* findFilenameCaseInsensitive(FilenameParts* pThis)
+{
+    DirectoryIndex*       pIndex;
+    const DirectoryEntry* pEntry;
+    
+    pThis->pFilename[-1] = '\0';
+    pIndex = findOrBuildDirectoryIndex(pThis->fullFilename);
+    pThis->pFilename[-1] = PATH_SEPARATOR;
+    if (!pIndex)
+    {
+        scanDirectoryForFilename(pThis);
+        return pThis->fullFilename;
+    }
+    
+    pEntry = findDirectoryEntry(pIndex, pThis->pFilename);
+    if (pEntry)
+        memcpy(pThis->pFilename, pEntry->name, pThis->filenameLength + 1);
+    
+    return pThis->fullFilename;
+}
+
+static DirectoryIndex* findDirectoryIndex(const char* pDirectoryName);
+static DirectoryIndex* allocateDirectoryIndex(const char* pDirectoryName);
+static void freeDirectoryEntries(DirectoryIndex* pIndex);
+static int populateDirectoryIndex(DirectoryIndex* pIndex);
+static DirectoryIndex* findOrBuildDirectoryIndex(const char* pDirectoryName)
+{
+    struct stat     directoryStat;
+    DirectoryIndex* pIndex;
+    
+    if (0 != stat(pDirectoryName, &directoryStat))
+        return NULL;
+    
+    pIndex = findDirectoryIndex(pDirectoryName);
+    if (pIndex && pIndex->modificationTime == directoryStat.st_mtime && 
+                  pIndex->modificationNsec == (long)MODIFICATION_NSEC(directoryStat))
+    {
+        return pIndex;
+    }
+    if (!pIndex)
+        pIndex = allocateDirectoryIndex(pDirectoryName);
+    if (!pIndex)
+        return NULL;
+    
+    freeDirectoryEntries(pIndex);
+    if (!populateDirectoryIndex(pIndex))
+    {
+        freeDirectoryEntries(pIndex);
+        return NULL;
+    }
+    pIndex->modificationTime = directoryStat.st_mtime;
+    pIndex->modificationNsec = (long)MODIFICATION_NSEC(directoryStat);
+    
+    return pIndex;
+}
+
+static DirectoryIndex* findDirectoryIndex(const char* pDirectoryName)
+{
+    DirectoryIndex* pIndex;
+    
+    for (pIndex = g_pDirectoryIndices ; pIndex ; pIndex = pIndex->pNext)
+    {
+        if (0 == strcmp(pIndex->pDirectoryName, pDirectoryName))
+            return pIndex;
+    }
+    return NULL;
+}
+
+static DirectoryIndex* allocateDirectoryIndex(const char* pDirectoryName)
+{
+    DirectoryIndex* pIndex = NULL;
+    
+    __try
+    {
+        pIndex = allocateAndZero(sizeof(*pIndex));
+        pIndex->pDirectoryName = copyOfString(pDirectoryName);
+    }
+    __catch
+    {
+        free(pIndex);
+        clearExceptionCode();
+        return NULL;
+    }
+    pIndex->pNext = g_pDirectoryIndices;
+    g_pDirectoryIndices = pIndex;
+    
+    return pIndex;
+}
+
+static void freeDirectoryEntries(DirectoryIndex* pIndex)
+{
+    size_t i;
+    
+    for (i = 0 ; i < ARRAYSIZE(pIndex->buckets) ; i++)
+    {
+        DirectoryEntry* pEntry = pIndex->buckets[i];
+        
+        while (pEntry)
+        {
+            DirectoryEntry* pNext = pEntry->pNext;
+            free(pEntry);
+            pEntry = pNext;
+        }
+        pIndex->buckets[i] = NULL;
+    }
+    pIndex->modificationTime = 0;
+    pIndex->modificationNsec = -1;
+}
+
+static size_t hashFilename(const char* pFilename);
+static int populateDirectoryIndex(DirectoryIndex* pIndex)
+{
+    struct dirent* pNextEntry;
+    DIR*           pDir;
+    
+    pDir = opendir(pIndex->pDirectoryName);
+    if (!pDir)
+        return FALSE;
+
+    while (NULL != (pNextEntry = readdir(pDir)))
+    {
+        size_t          nameLength = strlen(pNextEntry->d_name);
+        size_t          bucket = hashFilename(pNextEntry->d_name);
+        DirectoryEntry* pEntry = malloc(sizeof(*pEntry) + nameLength + 1);
+        
+        if (!pEntry)
+        {
+            closedir(pDir);
+            return FALSE;
+        }
+        memcpy(pEntry->name, pNextEntry->d_name, nameLength + 1);
+        pEntry->pNext = pIndex->buckets[bucket];
+        pIndex->buckets[bucket] = pEntry;
+    }
+    closedir(pDir);
+    
+    return TRUE;
+}
+
+static size_t hashFilename(const char* pFilename)
+{
+    size_t hash = 0;
+    
+    while (*pFilename)
+        hash = hash * 31 + (size_t)tolower((unsigned char)*pFilename++);
+    return hash % DIRECTORY_INDEX_BUCKETS;
+}
+
+static const DirectoryEntry* findDirectoryEntry(const DirectoryIndex* pIndex, const char* pFilename)
+{
+    const DirectoryEntry* pEntry;
+    
+    for (pEntry = pIndex->buckets[hashFilename(pFilename)] ; pEntry ; pEntry = pEntry->pNext)
+    {
+        if (0 == strcasecmp(pEntry->name, pFilename))
+            return pEntry;
+    }
+    return NULL;
+}
+
+static void scanDirectoryForFilename(FilenameParts* pThis)
 {
     struct dirent* pNextEntry;
     DIR*           pDir;
@@ -127,7 +347,7 @@ static const char* findFilenameCaseInsensitive(FilenameParts* pThis)
     pDir = opendir(pThis->fullFilename);
     pThis->pFilename[-1] = PATH_SEPARATOR;
     if (!pDir)
-        return pThis->fullFilename;
+        return;
 
     while (NULL != (pNextEntry = readdir(pDir)))
     {
@@ -138,6 +358,57 @@ static const char* findFilenameCaseInsensitive(FilenameParts* pThis)
         }
     }
     closedir(pDir);
+}
+
+static int isWriteMode(const char* pMode)
+{
+    return NULL != strpbrk(pMode, "wa+");
+}
+
+static void invalidateDirectoryIndex(FilenameParts* pThis)
+{
+    DirectoryIndex* pIndex;
     
-    return pThis->fullFilename;
+    /* The file may have just been created so force the next lookup to rescan the directory rather than depend on
+       the resolution of the directory's modification time. */
+    pThis->pFilename[-1] = '\0';
+    pIndex = findDirectoryIndex(pThis->fullFilename);
+    pThis->pFilename[-1] = PATH_SEPARATOR;
+    if (pIndex)
+        freeDirectoryEntries(pIndex);
+}
+
+
+int FileOpen_ResolvePath(const char* pFilename, char* pBuffer, size_t bufferSize)
+{
+    FilenameParts filenameParts;
+    size_t        length;
+    
+    if (!resolveFilename(&filenameParts, pFilename))
+        return FALSE;
+    length = strlen(filenameParts.fullFilename);
+    if (length >= bufferSize)
+        return FALSE;
+    memcpy(pBuffer, filenameParts.fullFilename, length + 1);
+    
+    return TRUE;
+}
+
+
+void FileOpen_FreeDirectoryCache(void)
+{
+    DirectoryIndex* pIndex;
+    
+    pthread_mutex_lock(&g_directoryIndicesMutex);
+    pIndex = g_pDirectoryIndices;
+    while (pIndex)
+    {
+        DirectoryIndex* pNext = pIndex->pNext;
+        freeDirectoryEntries(pIndex);
+        free(pIndex->pDirectoryName);
+        free(pIndex);
+        pIndex = pNext;
+    }
+    g_pDirectoryIndices = NULL;
+    pthread_mutex_unlock(&g_directoryIndicesMutex);
 }
@@ -0,0 +1,391 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include "MemoryVfs.h"
+#include "MemoryVfsTest.h"
+#include "util.h"
+
+
+typedef struct MemoryFile
+{
+    struct MemoryFile* pNext;
+    char*              pFilename;
+    char*              pData;
+    size_t             dataSize;
+    size_t             allocatedSize;
+    unsigned int       generation;
+} MemoryFile;
+
+typedef struct MemoryStream
+{
+    MemoryFile* pFile;
+    size_t      position;
+} MemoryStream;
+
+struct MemoryVfs
+{
+    Vfs          vfs;
+    MemoryFile*  pFiles;
+    unsigned int lastGeneration;
+};
+
+
+static FILE* openFile(Vfs* pVfs, const char* pFilename, const char* pMode);
+static int getFileStamp(Vfs* pVfs, const char* pFilename, VfsFileStamp* pStamp);
+__throws MemoryVfs* MemoryVfs_Create(void)
+{
+    MemoryVfs* pThis = allocateAndZero(sizeof(*pThis));
+    pThis->vfs.open = openFile;
+    pThis->vfs.getFileStamp = getFileStamp;
+    return pThis;
+}
+
+static FILE* openFileForRead(MemoryVfs* pThis, const char* pFilename, const char* pMode);
+static FILE* openFileForWrite(MemoryVfs* pThis, const char* pFilename, const char* pMode);
+static FILE* openFile(Vfs* pVfs, const char* pFilename, const char* pMode)
+{
+    MemoryVfs* pThis = (MemoryVfs*)pVfs;
+    
+    if (pMode[0] == 'r')
+        return openFileForRead(pThis, pFilename, pMode);
+    if (pMode[0] == 'w')
+        return openFileForWrite(pThis, pFilename, pMode);
+    return NULL;
+}
+
+static MemoryFile* findFile(MemoryVfs* pThis, const char* pFilename);
+static int isUpdateMode(const char* pMode);
+static FILE* openStream(MemoryFile* pFile, const char* pMode);
+static FILE* openFileForRead(MemoryVfs* pThis, const char* pFilename, const char* pMode)
+{
+    MemoryFile* pFile = findFile(pThis, pFilename);
+    
+    if (!pFile)
+        return NULL;
+    /* "r+" keeps the existing contents but they may now change so the file is given a new stamp. */
+    if (isUpdateMode(pMode))
+        pFile->generation = ++pThis->lastGeneration;
+    return openStream(pFile, pMode);
+}
+
+static const char* skipCurrentDirectoryPrefix(const char* pFilename);
+static MemoryFile* findFile(MemoryVfs* pThis, const char* pFilename)
+{
+    MemoryFile* pFile;
+    
+    pFilename = skipCurrentDirectoryPrefix(pFilename);
+    for (pFile = pThis->pFiles ; pFile ; pFile = pFile->pNext)
+    {
+        if (0 == strcmp(pFile->pFilename, pFilename))
+            return pFile;
+    }
+    return NULL;
+}
+
+static const char* skipCurrentDirectoryPrefix(const char* pFilename)
+{
+    while (pFilename[0] == '.' && pFilename[1] == PATH_SEPARATOR)
+        pFilename += 2;
+    return pFilename;
+}
+
+static int isUpdateMode(const char* pMode)
+{
+    return strchr(pMode, '+') != NULL;
+}
+
+static MemoryFile* findOrAddFile(MemoryVfs* pThis, const char* pFilename);
+static void freeFileData(MemoryFile* pFile);
+static FILE* openFileForWrite(MemoryVfs* pThis, const char* pFilename, const char* pMode)
+{
+    MemoryFile* pFile = NULL;
+    
+    __try
+    {
+        pFile = findOrAddFile(pThis, pFilename);
+    }
+    __catch
+    {
+        __nothrow_and_return(NULL);
+    }
+    
+    freeFileData(pFile);
+    pFile->generation = ++pThis->lastGeneration;
+    
+    return openStream(pFile, pMode);
+}
+
+static MemoryFile* findOrAddFile(MemoryVfs* pThis, const char* pFilename)
+{
+    MemoryFile* pFile = findFile(pThis, pFilename);
+    
+    if (pFile)
+        return pFile;
+    
+    pFile = allocateAndZero(sizeof(*pFile));
+    __try
+    {
+        pFile->pFilename = copyOfString(skipCurrentDirectoryPrefix(pFilename));
+    }
+    __catch
+    {
+        free(pFile);
+        __rethrow;
+    }
+    pFile->pNext = pThis->pFiles;
+    pThis->pFiles = pFile;
+    
+    return pFile;
+}
+
+static void freeFileData(MemoryFile* pFile)
+{
+    free(pFile->pData);
+    pFile->pData = NULL;
+    pFile->dataSize = 0;
+    pFile->allocatedSize = 0;
+}
+
+static ssize_t readStream(void* pCookie, char* pBuffer, size_t size);
+static ssize_t writeStream(void* pCookie, const char* pBuffer, size_t size);
+static int     seekStream(MemoryStream* pStream, long long* pOffset, int whence);
+static int     closeStream(void* pCookie);
+#ifdef __APPLE__
+static int     appleReadStream(void* pCookie, char* pBuffer, int size);
+static int     appleWriteStream(void* pCookie, const char* pBuffer, int size);
+static fpos_t  appleSeekStream(void* pCookie, fpos_t offset, int whence);
+#else
+static int     gnuSeekStream(void* pCookie, off64_t* pOffset, int whence);
+#endif
+static FILE* openStream(MemoryFile* pFile, const char* pMode)
+{
+    MemoryStream* pStream = malloc(sizeof(*pStream));
+    int           canRead = pMode[0] == 'r' || isUpdateMode(pMode);
+    int           canWrite = pMode[0] == 'w' || isUpdateMode(pMode);
+    FILE*         pFileStream;
+    
+    if (!pStream)
+        return NULL;
+    pStream->pFile = pFile;
+    pStream->position = 0;
+#ifdef __APPLE__
+    pFileStream = funopen(pStream, 
+                          canRead ? appleReadStream : NULL, 
+                          canWrite ? appleWriteStream : NULL, 
+                          appleSeekStream, 
+                          closeStream);
+#else
+    {
+        cookie_io_functions_t functions;
+        
+        memset(&functions, 0, sizeof(functions));
+        functions.read = canRead ? readStream : NULL;
+        functions.write = canWrite ? writeStream : NULL;
+        functions.seek = gnuSeekStream;
+        functions.close = closeStream;
+        pFileStream = fopencookie(pStream, pMode, functions);
+    }
+#endif
+    if (!pFileStream)
+        free(pStream);
+    
+    return pFileStream;
+}
+
+static ssize_t readStream(void* pCookie, char* pBuffer, size_t size)
+{
+    MemoryStream* pStream = (MemoryStream*)pCookie;
+    MemoryFile*   pFile = pStream->pFile;
+    size_t        bytesLeft = pStream->position < pFile->dataSize ? pFile->dataSize - pStream->position : 0;
+    
+    if (size > bytesLeft)
+        size = bytesLeft;
+    memcpy(pBuffer, pFile->pData + pStream->position, size);
+    pStream->position += size;
+    
+    return (ssize_t)size;
+}
+
+static int growFileData(MemoryFile* pFile, size_t size);
+static ssize_t writeStream(void* pCookie, const char* pBuffer, size_t size)
+{
+    MemoryStream* pStream = (MemoryStream*)pCookie;
+    MemoryFile*   pFile = pStream->pFile;
+    size_t        endPosition = pStream->position + size;
+    
+    if (!growFileData(pFile, endPosition))
+        return -1;
+    /* Seeking past the end and then writing leaves a zero filled gap like it would in a real file. */
+    if (pStream->position > pFile->dataSize)
+        memset(pFile->pData + pFile->dataSize, 0, pStream->position - pFile->dataSize);
+    memcpy(pFile->pData + pStream->position, pBuffer, size);
+    pStream->position = endPosition;
+    if (endPosition > pFile->dataSize)
+        pFile->dataSize = endPosition;
+    
+    return (ssize_t)size;
+}
+
+static int growFileData(MemoryFile* pFile, size_t size)
+{
+    size_t newSize;
+    char*  pRealloc;
+    
+    if (size <= pFile->allocatedSize)
+        return TRUE;
+    newSize = pFile->allocatedSize ? 2 * pFile->allocatedSize : 64;
+    while (newSize < size)
+        newSize *= 2;
+    pRealloc = realloc(pFile->pData, newSize);
+    if (!pRealloc)
+        return FALSE;
+    pFile->pData = pRealloc;
+    pFile->allocatedSize = newSize;
+    
+    return TRUE;
+}
+
+static int seekStream(MemoryStream* pStream, long long* pOffset, int whence)
+{
+    long long newPosition;
+    
+    if (whence == SEEK_SET)
+        newPosition = *pOffset;
+    else if (whence == SEEK_CUR)
+        newPosition = (long long)pStream->position + *pOffset;
+    else if (whence == SEEK_END)
+        newPosition = (long long)pStream->pFile->dataSize + *pOffset;
+    else
+        return -1;
+    if (newPosition < 0)
+        return -1;
+    
+    pStream->position = (size_t)newPosition;
+    *pOffset = newPosition;
+    return 0;
+}
+
+static int closeStream(void* pCookie)
+{
+    free(pCookie);
+    return 0;
+}
+
+#ifdef __APPLE__
+static int appleReadStream(void* pCookie, char* pBuffer, int size)
+{
+    return (int)readStream(pCookie, pBuffer, (size_t)size);
+}
+
+static int appleWriteStream(void* pCookie, const char* pBuffer, int size)
+{
+    return (int)writeStream(pCookie, pBuffer, (size_t)size);
+}
+
+static fpos_t appleSeekStream(void* pCookie, fpos_t offset, int whence)
+{
+    long long newOffset = (long long)offset;
+    
+    if (seekStream((MemoryStream*)pCookie, &newOffset, whence))
+        return -1;
+    return (fpos_t)newOffset;
+}
+#else
+static int gnuSeekStream(void* pCookie, off64_t* pOffset, int whence)
+{
+    long long newOffset = (long long)*pOffset;
+    
+    if (seekStream((MemoryStream*)pCookie, &newOffset, whence))
+        return -1;
+    *pOffset = (off64_t)newOffset;
+    return 0;
+}
+#endif
+
+
+/* Memory files have no timestamps so the generation number, which is bumped every time a file's contents are
+   replaced, is used in its place. */
+static int getFileStamp(Vfs* pVfs, const char* pFilename, VfsFileStamp* pStamp)
+{
+    MemoryFile* pFile = findFile((MemoryVfs*)pVfs, pFilename);
+    
+    if (!pFile)
+        return 0;
+    pStamp->modificationTime = (time_t)pFile->generation;
+    pStamp->size = (long)pFile->dataSize;
+    return 1;
+}
+
+
+void MemoryVfs_Free(MemoryVfs* pThis)
+{
+    MemoryFile* pFile;
+    
+    if (!pThis)
+        return;
+    
+    pFile = pThis->pFiles;
+    while (pFile)
+    {
+        MemoryFile* pNext = pFile->pNext;
+        freeFileData(pFile);
+        free(pFile->pFilename);
+        free(pFile);
+        pFile = pNext;
+    }
+    free(pThis);
+}
+
+
+Vfs* MemoryVfs_GetVfs(MemoryVfs* pThis)
+{
+    return &pThis->vfs;
+}
+
+
+__throws void MemoryVfs_AddFile(MemoryVfs* pThis, const char* pFilename, const void* pData, size_t dataSize)
+{
+    MemoryFile* pFile;
+    char*       pCopy;
+    
+    pCopy = allocateAndZero(dataSize ? dataSize : 1);
+    memcpy(pCopy, pData, dataSize);
+    __try
+    {
+        pFile = findOrAddFile(pThis, pFilename);
+    }
+    __catch
+    {
+        free(pCopy);
+        __rethrow;
+    }
+    
+    freeFileData(pFile);
+    pFile->pData = pCopy;
+    pFile->dataSize = dataSize;
+    pFile->generation = ++pThis->lastGeneration;
+}
+
+
+const unsigned char* MemoryVfs_GetFileData(MemoryVfs* pThis, const char* pFilename, size_t* pDataSize)
+{
+    static const unsigned char emptyFile[1];
+    MemoryFile*                pFile = findFile(pThis, pFilename);
+    
+    if (!pFile)
+        return NULL;
+    *pDataSize = pFile->dataSize;
+    return pFile->pData ? (const unsigned char*)pFile->pData : emptyFile;
+}
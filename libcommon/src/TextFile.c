@@ -31,9 +31,6 @@ struct TextFile
 
 
 __throws static void initObject(TextFile* pThis, const char* pText);
-__throws static char* allocateStringAndCopyMergedFilename(const SizedString* pDirectory, 
-                                                          const SizedString* pFilename, 
-                                                          const char*        pFilenameSuffix);
 __throws TextFile* TextFile_CreateFromString(const char* pText)
 {
     static const char        defaultFilename[] = "filename";
@@ -45,7 +42,7 @@ __throws TextFile* TextFile_CreateFromString(const char* pText)
         pThis = allocateAndZero(sizeof(*pThis));
         initObject(pThis, pText);
         pThis->pEnd = (char*)~0UL;
-        pThis->pFilename = allocateStringAndCopyMergedFilename(NULL, &filenameString, NULL);
+        pThis->pFilename = TextFile_AllocateMergedFilename(NULL, &filenameString, NULL);
     }
     __catch
     {
@@ -63,9 +60,9 @@ __throws static void initObject(TextFile* pThis, const char* pText)
     pThis->pCurr = pText;
 }
 
-__throws static char* allocateStringAndCopyMergedFilename(const SizedString* pDirectory, 
-                                                          const SizedString* pFilename, 
-                                                          const char*        pFilenameSuffix)
+__throws char* TextFile_AllocateMergedFilename(const SizedString* pDirectory, 
+                                               const SizedString* pFilename, 
+                                               const char*        pFilenameSuffix)
 {
     static const char pathSeparator = PATH_SEPARATOR;
     size_t filenameLength = SizedString_strlen(pFilename);
@@ -88,28 +85,30 @@ __throws static char* allocateStringAndCopyMergedFilename(const SizedString* pDi
 }
 
 
-static FILE* openFile(const char* pFilename);
-static long getTextLength(FILE* pFile);
-static char* allocateTextBuffer(long textLength);
-static void readFileContentIntoTextBuffer(char* pTextBuffer, long fileSize, FILE* pFile);
 __throws TextFile* TextFile_CreateFromFile(const SizedString* pDirectory, 
                                            const SizedString* pFilename, 
                                            const char*        pFilenameSuffix)
+{
+    return TextFile_CreateFromVfsFile(NULL, pDirectory, pFilename, pFilenameSuffix);
+}
+
+
+static FILE* openFile(Vfs* pVfs, const char* pFilename);
+static void readTextFromFile(TextFile* pThis, FILE* pFile);
+__throws TextFile* TextFile_CreateFromVfsFile(Vfs*               pVfs,
+                                              const SizedString* pDirectory, 
+                                              const SizedString* pFilename, 
+                                              const char*        pFilenameSuffix)
 {
     FILE*     pFile = NULL;
-    long      textLength = -1;
     TextFile* pThis = NULL;
     
     __try
     {
         pThis = allocateAndZero(sizeof(*pThis));
-        pThis->pFilename = allocateStringAndCopyMergedFilename(pDirectory, pFilename, pFilenameSuffix);
-        pFile = openFile(pThis->pFilename);
-        textLength = getTextLength(pFile);
-        pThis->pFileBuffer = allocateTextBuffer(textLength);
-        pThis->pEnd = pThis->pFileBuffer + textLength;
-        readFileContentIntoTextBuffer(pThis->pFileBuffer, textLength, pFile);
-        initObject(pThis, pThis->pFileBuffer);
+        pThis->pFilename = TextFile_AllocateMergedFilename(pDirectory, pFilename, pFilenameSuffix);
+        pFile = openFile(pVfs, pThis->pFilename);
+        readTextFromFile(pThis, pFile);
     }
     __catch
     {
@@ -123,16 +122,29 @@ __throws TextFile* TextFile_CreateFromFile(const SizedString* pDirectory,
     return pThis;
 }
 
-static FILE* openFile(const char* pFilename)
+static FILE* openFile(Vfs* pVfs, const char* pFilename)
 {
     FILE* pFile = NULL;
     
-    pFile = fopen(pFilename, "rb");
+    pFile = Vfs_Open(pVfs, pFilename, "rb");
     if (!pFile)
         __throw(fileOpenException);
     return pFile;
 }
 
+static long getTextLength(FILE* pFile);
+static char* allocateTextBuffer(long textLength);
+static void readFileContentIntoTextBuffer(char* pTextBuffer, long fileSize, FILE* pFile);
+static void readTextFromFile(TextFile* pThis, FILE* pFile)
+{
+    long textLength = getTextLength(pFile);
+    
+    pThis->pFileBuffer = allocateTextBuffer(textLength);
+    pThis->pEnd = pThis->pFileBuffer + textLength;
+    readFileContentIntoTextBuffer(pThis->pFileBuffer, textLength, pFile);
+    initObject(pThis, pThis->pFileBuffer);
+}
+
 static long getTextLength(FILE* pFile)
 {
     long fileSize;
@@ -174,6 +186,28 @@ static void readFileContentIntoTextBuffer(char* pTextBuffer, long fileSize, FILE
 }
 
 
+__throws TextFile* TextFile_CreateFromOpenFile(FILE* pFile, const char* pFilename)
+{
+    TextFile* pThis = NULL;
+    
+    __try
+    {
+        pThis = allocateAndZero(sizeof(*pThis));
+        pThis->pFilename = copyOfString(pFilename);
+        readTextFromFile(pThis, pFile);
+    }
+    __catch
+    {
+        TextFile_Free(pThis);
+        fclose(pFile);
+        __rethrow;
+    }
+    
+    fclose(pFile);
+    return pThis;
+}
+
+
 __throws TextFile* TextFile_CreateFromTextFile(const TextFile* pTextFile)
 {
     TextFile* pThis = allocateAndZero(sizeof(*pThis));
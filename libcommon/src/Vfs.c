@@ -0,0 +1,61 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include <sys/stat.h>
+#include "FileOpen.h"
+#include "Vfs.h"
+#include "VfsTest.h"
+#include "util.h"
+
+#ifdef __APPLE__
+#define MODIFICATION_NSEC(STAT) ((STAT).st_mtimespec.tv_nsec)
+#else
+#define MODIFICATION_NSEC(STAT) ((STAT).st_mtim.tv_nsec)
+#endif
+
+
+FILE* Vfs_Open(Vfs* pThis, const char* pFilename, const char* pMode)
+{
+    if (!pThis)
+        return fopen(pFilename, pMode);
+    return pThis->open(pThis, pFilename, pMode);
+}
+
+
+static const char* resolvePathLikeFopen(const char* pFilename, char* pBuffer, size_t bufferSize);
+int Vfs_GetFileStamp(Vfs* pThis, const char* pFilename, VfsFileStamp* pStamp)
+{
+    struct stat fileStat;
+    char        resolvedFilename[PATH_LENGTH];
+    
+    memset(pStamp, 0, sizeof(*pStamp));
+    if (pThis)
+        return pThis->getFileStamp ? pThis->getFileStamp(pThis, pFilename, pStamp) : 0;
+    
+    pFilename = resolvePathLikeFopen(pFilename, resolvedFilename, sizeof(resolvedFilename));
+    if (0 != stat(pFilename, &fileStat) || !S_ISREG(fileStat.st_mode))
+        return 0;
+    pStamp->modificationTime = fileStat.st_mtime;
+    pStamp->modificationNsec = (long)MODIFICATION_NSEC(fileStat);
+    pStamp->size = (long)fileStat.st_size;
+    return 1;
+}
+
+static const char* resolvePathLikeFopen(const char* pFilename, char* pBuffer, size_t bufferSize)
+{
+    /* On case sensitive file systems fopen() is hooked to FileOpen() which ignores the case of filenames so the
+       stamp must come from the same file that it would open. */
+    if (hook_fopen == FileOpen && FileOpen_ResolvePath(pFilename, pBuffer, bufferSize))
+        return pBuffer;
+    return pFilename;
+}
@@ -10,6 +10,7 @@
     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
     GNU General Public License for more details.
 */
+#include <pthread.h>
 #include <string.h>
 
 // Include headers from C modules under test.
@@ -24,9 +25,29 @@ extern "C"
 #include "CppUTest/TestHarness.h"
 
 #define TEST_FILENAME "FileOpenTest.tst"
+#define WRITE_FILENAME "FileOpenTestWrite.tst"
+#define THREAD_ITERATIONS 200
 
 const char  g_testContent[] = "Test Content\n";
 
+static void* openFileRepeatedlyThread(void* pvMode)
+{
+    const char* pMode = (const char*)pvMode;
+    const char* pFilename = pMode[0] == 'r' ? "FILEOPENTEST.TST" : WRITE_FILENAME;
+    size_t      failures = 0;
+    
+    /* Writes invalidate the index of the directory which the other thread keeps rebuilding to find its file. */
+    for (int i = 0 ; i < THREAD_ITERATIONS ; i++)
+    {
+        FILE* pFile = FileOpen(pFilename, pMode);
+        if (pFile)
+            fclose(pFile);
+        else
+            failures++;
+    }
+    return (void*)failures;
+}
+
 TEST_GROUP(FileOpen)
 {
     FILE*       m_pFile;
@@ -42,11 +63,13 @@ TEST_GROUP(FileOpen)
     void teardown()
     {
         MallocFailureInject_Restore();
+        FileOpen_FreeDirectoryCache();
         if (m_pFile)
             fclose(m_pFile);
         if (m_pFilename)
             remove(m_pFilename);
         remove(TEST_FILENAME);
+        remove(WRITE_FILENAME);
         free((void*)m_pFilename);
         LONGS_EQUAL(noException, getExceptionCode());
     }
@@ -77,6 +100,12 @@ TEST_GROUP(FileOpen)
         LONGS_EQUAL(sizeof(buffer), bytesRead);
         STRCMP_EQUAL(g_testContent, buffer);
     }
+    
+    void closeFile()
+    {
+        fclose(m_pFile);
+        m_pFile = NULL;
+    }
 };
 
 
@@ -127,6 +156,80 @@ TEST(FileOpen, OpenExistingFileForReadInSubdirectoryWithDifferentCase)
     validateTestFileContents();
 }
 
+TEST(FileOpen, OpenExistingFileForReadWithDifferentCaseTwiceToUseCachedDirectoryIndex)
+{
+    createTestFile();
+    m_pFile = FileOpen("FILEOPENTEST.TST", "rb");
+    validateTestFileContents();
+    closeFile();
+    m_pFile = FileOpen("FileOpenTest.TST", "rb");
+    validateTestFileContents();
+}
+
+TEST(FileOpen, OpenFileWithDifferentCaseWhichWasCreatedAfterDirectoryWasIndexed)
+{
+    m_pFile = FileOpen("FILEOPENTEST.TST", "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+    createTestFile();
+    m_pFile = FileOpen("FILEOPENTEST.TST", "rb");
+    validateTestFileContents();
+}
+
+TEST(FileOpen, OpenFileWithDifferentCaseWhichWasCreatedWithFileOpenAfterDirectoryWasIndexed)
+{
+    m_pFile = FileOpen("FILEOPENTEST.TST", "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+    m_pFile = FileOpen(TEST_FILENAME, "wb");
+    fwrite(g_testContent, 1, sizeof(g_testContent), m_pFile);
+    closeFile();
+    m_pFile = FileOpen("FILEOPENTEST.TST", "rb");
+    validateTestFileContents();
+}
+
+TEST(FileOpen, OpenExistingFileForReadWithDifferentCaseInTwoDirectories)
+{
+    createTestFile("objs" SLASH_STR TEST_FILENAME );
+    m_pFile = FileOpen("objs" SLASH_STR "fileopentest.tst", "rb");
+    validateTestFileContents();
+    closeFile();
+    m_pFile = FileOpen("FILEOPENTEST.TST", "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+    m_pFile = FileOpen("objs" SLASH_STR "FILEOPENTEST.TST", "rb");
+    validateTestFileContents();
+}
+
+TEST(FileOpen, OpenFilesFromTwoThreadsWhichShareDirectoryIndex)
+{
+    pthread_t readThread;
+    pthread_t writeThread;
+    void*     pReadFailures = (void*)1;
+    void*     pWriteFailures = (void*)1;
+    
+    createTestFile();
+    LONGS_EQUAL(0, pthread_create(&readThread, NULL, openFileRepeatedlyThread, (void*)"rb"));
+    LONGS_EQUAL(0, pthread_create(&writeThread, NULL, openFileRepeatedlyThread, (void*)"wb"));
+    pthread_join(readThread, &pReadFailures);
+    pthread_join(writeThread, &pWriteFailures);
+    
+    POINTERS_EQUAL(NULL, pReadFailures);
+    POINTERS_EQUAL(NULL, pWriteFailures);
+}
+
+TEST(FileOpen, FailAllocationsWhileIndexingDirectoryShouldFallbackToScanningDirectory)
+{
+    static const int allocationsToFail = 3;
+    createTestFile();
+    for (int i = 1 ; i <= allocationsToFail ; i++)
+    {
+        MallocFailureInject_FailAllocation(i);
+        m_pFile = FileOpen("FILEOPENTEST.TST", "rb");
+        MallocFailureInject_Restore();
+        validateTestFileContents();
+        closeFile();
+        FileOpen_FreeDirectoryCache();
+    }
+}
+
 TEST(FileOpen, AttemptToOpenForReadInInvalidDirectory)
 {
     createTestFile();
@@ -157,4 +260,41 @@ TEST(FileOpen, AttemptToOpenAFilenameThatIsTooLong)
     
     m_pFile = FileOpen(filename, "rb");
     POINTERS_EQUAL(NULL, m_pFile);
+}
+
+TEST(FileOpen, ResolvePathOfExistingFileWithDifferentCase)
+{
+    char resolvedFilename[PATH_LENGTH];
+    
+    createTestFile();
+    CHECK_TRUE(FileOpen_ResolvePath("FILEOPENTEST.TST", resolvedFilename, sizeof(resolvedFilename)));
+    STRCMP_EQUAL("." SLASH_STR TEST_FILENAME, resolvedFilename);
+}
+
+TEST(FileOpen, ResolvePathOfNonExistingFileShouldLeaveNameUnchanged)
+{
+    char resolvedFilename[PATH_LENGTH];
+    
+    CHECK_TRUE(FileOpen_ResolvePath("objs" SLASH_STR "FILEOPENTEST.TST", resolvedFilename, sizeof(resolvedFilename)));
+    STRCMP_EQUAL("objs" SLASH_STR "FILEOPENTEST.TST", resolvedFilename);
+}
+
+TEST(FileOpen, AttemptToResolvePathIntoBufferThatIsTooSmall)
+{
+    char resolvedFilename[sizeof("." SLASH_STR TEST_FILENAME) - 1];
+    
+    createTestFile();
+    CHECK_FALSE(FileOpen_ResolvePath(TEST_FILENAME, resolvedFilename, sizeof(resolvedFilename)));
+}
+
+TEST(FileOpen, AttemptToResolvePathOfFilenameThatIsTooLong)
+{
+    char filename[1+1+257+1];
+    char resolvedFilename[PATH_LENGTH];
+    
+    memset(filename, 'a', sizeof(filename));
+    filename[1] = PATH_SEPARATOR;
+    filename[259] = '\0';
+    
+    CHECK_FALSE(FileOpen_ResolvePath(filename, resolvedFilename, sizeof(resolvedFilename)));
 }
\ No newline at end of file
@@ -0,0 +1,374 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "MemoryVfs.h"
+    #include "MallocFailureInject.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+
+static const char g_testContent[] = "Test Content\n";
+
+TEST_GROUP(MemoryVfs)
+{
+    MemoryVfs* m_pMemoryVfs;
+    FILE*      m_pFile;
+    char       m_buffer[64];
+    
+    void setup()
+    {
+        clearExceptionCode();
+        m_pMemoryVfs = NULL;
+        m_pFile = NULL;
+        memset(m_buffer, 0, sizeof(m_buffer));
+    }
+
+    void teardown()
+    {
+        MallocFailureInject_Restore();
+        if (m_pFile)
+            fclose(m_pFile);
+        MemoryVfs_Free(m_pMemoryVfs);
+        LONGS_EQUAL(noException, getExceptionCode());
+    }
+    
+    void create()
+    {
+        m_pMemoryVfs = MemoryVfs_Create();
+        CHECK(m_pMemoryVfs != NULL);
+    }
+    
+    void openFile(const char* pFilename, const char* pMode)
+    {
+        m_pFile = Vfs_Open(MemoryVfs_GetVfs(m_pMemoryVfs), pFilename, pMode);
+    }
+    
+    void closeFile()
+    {
+        fclose(m_pFile);
+        m_pFile = NULL;
+    }
+    
+    void validateFileContentIs(const char* pFilename, const char* pExpected)
+    {
+        size_t               dataSize = ~0U;
+        const unsigned char* pData = MemoryVfs_GetFileData(m_pMemoryVfs, pFilename, &dataSize);
+        
+        CHECK(pData != NULL);
+        LONGS_EQUAL(strlen(pExpected), dataSize);
+        CHECK(0 == memcmp(pExpected, pData, dataSize));
+    }
+};
+
+
+TEST(MemoryVfs, FailAllocationInCreate)
+{
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( m_pMemoryVfs = MemoryVfs_Create() );
+    POINTERS_EQUAL(NULL, m_pMemoryVfs);
+    LONGS_EQUAL(outOfMemoryException, getExceptionCode());
+    clearExceptionCode();
+}
+
+TEST(MemoryVfs, AttemptToOpenNonExistingFileForRead)
+{
+    create();
+    openFile("foo.bar", "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+}
+
+TEST(MemoryVfs, AttemptToGetDataForNonExistingFile)
+{
+    size_t dataSize = 0;
+    create();
+    POINTERS_EQUAL(NULL, MemoryVfs_GetFileData(m_pMemoryVfs, "foo.bar", &dataSize));
+}
+
+TEST(MemoryVfs, AttemptToOpenWithUnsupportedMode)
+{
+    create();
+    MemoryVfs_AddFile(m_pMemoryVfs, "foo.bar", g_testContent, strlen(g_testContent));
+    openFile("foo.bar", "ab");
+    POINTERS_EQUAL(NULL, m_pFile);
+}
+
+TEST(MemoryVfs, AddFileAndReadItBack)
+{
+    create();
+    MemoryVfs_AddFile(m_pMemoryVfs, "foo.bar", g_testContent, strlen(g_testContent));
+    openFile("foo.bar", "rb");
+    CHECK(m_pFile != NULL);
+    LONGS_EQUAL(strlen(g_testContent), fread(m_buffer, 1, sizeof(m_buffer), m_pFile));
+    STRCMP_EQUAL(g_testContent, m_buffer);
+}
+
+TEST(MemoryVfs, AddFileAndSeekToEndToDetermineSize)
+{
+    create();
+    MemoryVfs_AddFile(m_pMemoryVfs, "foo.bar", g_testContent, strlen(g_testContent));
+    openFile("foo.bar", "rb");
+    LONGS_EQUAL(0, fseek(m_pFile, 0, SEEK_END));
+    LONGS_EQUAL(strlen(g_testContent), ftell(m_pFile));
+}
+
+TEST(MemoryVfs, FailAllocationInOpenForRead)
+{
+    create();
+    MemoryVfs_AddFile(m_pMemoryVfs, "foo.bar", g_testContent, strlen(g_testContent));
+    MallocFailureInject_FailAllocation(1);
+    openFile("foo.bar", "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+}
+
+TEST(MemoryVfs, AddEmptyFileAndReadItBack)
+{
+    create();
+    MemoryVfs_AddFile(m_pMemoryVfs, "foo.bar", "", 0);
+    openFile("foo.bar", "rb");
+    CHECK(m_pFile != NULL);
+    LONGS_EQUAL(0, fread(m_buffer, 1, sizeof(m_buffer), m_pFile));
+}
+
+TEST(MemoryVfs, AddFileWithCurrentDirectoryPrefixAndOpenWithout)
+{
+    create();
+    MemoryVfs_AddFile(m_pMemoryVfs, "." SLASH_STR "foo.bar", g_testContent, strlen(g_testContent));
+    openFile("foo.bar", "rb");
+    CHECK(m_pFile != NULL);
+    validateFileContentIs("." SLASH_STR "." SLASH_STR "foo.bar", g_testContent);
+}
+
+TEST(MemoryVfs, AddFileTwiceShouldReplaceContent)
+{
+    create();
+    MemoryVfs_AddFile(m_pMemoryVfs, "foo.bar", "Old", 3);
+    MemoryVfs_AddFile(m_pMemoryVfs, "foo.bar", g_testContent, strlen(g_testContent));
+    validateFileContentIs("foo.bar", g_testContent);
+}
+
+TEST(MemoryVfs, FailAllocationsInAddFile)
+{
+    create();
+    for (int i = 1 ; i <= 3 ; i++)
+    {
+        MallocFailureInject_FailAllocation(i);
+        __try_and_catch( MemoryVfs_AddFile(m_pMemoryVfs, "foo.bar", g_testContent, strlen(g_testContent)) );
+        LONGS_EQUAL(outOfMemoryException, getExceptionCode());
+        clearExceptionCode();
+        openFile("foo.bar", "rb");
+        POINTERS_EQUAL(NULL, m_pFile);
+    }
+    MallocFailureInject_Restore();
+    MemoryVfs_AddFile(m_pMemoryVfs, "foo.bar", g_testContent, strlen(g_testContent));
+    validateFileContentIs("foo.bar", g_testContent);
+}
+
+TEST(MemoryVfs, WriteFileAndGetItsData)
+{
+    create();
+    openFile("foo.bar", "wb");
+    CHECK(m_pFile != NULL);
+    fwrite(g_testContent, 1, strlen(g_testContent), m_pFile);
+    closeFile();
+    validateFileContentIs("foo.bar", g_testContent);
+}
+
+TEST(MemoryVfs, WriteEmptyFileAndGetItsData)
+{
+    create();
+    openFile("foo.bar", "wb");
+    closeFile();
+    validateFileContentIs("foo.bar", "");
+}
+
+TEST(MemoryVfs, WriteFileAndReadItBack)
+{
+    create();
+    openFile("foo.bar", "wb");
+    fwrite(g_testContent, 1, strlen(g_testContent), m_pFile);
+    closeFile();
+    openFile("." SLASH_STR "foo.bar", "rb");
+    CHECK(m_pFile != NULL);
+    LONGS_EQUAL(strlen(g_testContent), fread(m_buffer, 1, sizeof(m_buffer), m_pFile));
+    STRCMP_EQUAL(g_testContent, m_buffer);
+}
+
+TEST(MemoryVfs, WriteOverAddedFile)
+{
+    create();
+    MemoryVfs_AddFile(m_pMemoryVfs, "foo.bar", "Old", 3);
+    openFile("foo.bar", "wb");
+    fwrite(g_testContent, 1, strlen(g_testContent), m_pFile);
+    closeFile();
+    validateFileContentIs("foo.bar", g_testContent);
+}
+
+TEST(MemoryVfs, WriteFileTwice)
+{
+    create();
+    openFile("foo.bar", "wb");
+    fwrite("Old", 1, 3, m_pFile);
+    closeFile();
+    openFile("foo.bar", "wb");
+    fwrite(g_testContent, 1, strlen(g_testContent), m_pFile);
+    closeFile();
+    validateFileContentIs("foo.bar", g_testContent);
+}
+
+TEST(MemoryVfs, SeekBackAndOverwriteWrittenFile)
+{
+    create();
+    openFile("foo.bar", "wb");
+    fwrite(g_testContent, 1, strlen(g_testContent), m_pFile);
+    fseek(m_pFile, 0, SEEK_SET);
+    fwrite("B", 1, 1, m_pFile);
+    closeFile();
+    validateFileContentIs("foo.bar", "Best Content\n");
+}
+
+TEST(MemoryVfs, SeekPastEndAndWriteShouldZeroFillGap)
+{
+    create();
+    openFile("foo.bar", "wb");
+    fseek(m_pFile, 2, SEEK_SET);
+    fwrite("A", 1, 1, m_pFile);
+    closeFile();
+    
+    size_t               dataSize = 0;
+    const unsigned char* pData = MemoryVfs_GetFileData(m_pMemoryVfs, "foo.bar", &dataSize);
+    LONGS_EQUAL(3, dataSize);
+    CHECK(0 == memcmp("\0\0A", pData, 3));
+}
+
+TEST(MemoryVfs, AttemptToOpenNonExistingFileForUpdate)
+{
+    create();
+    openFile("foo.bar", "r+b");
+    POINTERS_EQUAL(NULL, m_pFile);
+}
+
+TEST(MemoryVfs, OpenAddedFileForUpdateAndOverwriteWithoutTruncating)
+{
+    create();
+    MemoryVfs_AddFile(m_pMemoryVfs, "foo.bar", g_testContent, strlen(g_testContent));
+    openFile("foo.bar", "r+b");
+    CHECK(m_pFile != NULL);
+    LONGS_EQUAL(0, fseek(m_pFile, 5, SEEK_SET));
+    LONGS_EQUAL(1, fwrite("M", 1, 1, m_pFile));
+    closeFile();
+    validateFileContentIs("foo.bar", "Test Montent\n");
+}
+
+TEST(MemoryVfs, ReadBackWhatWasWrittenInReadUpdateMode)
+{
+    create();
+    MemoryVfs_AddFile(m_pMemoryVfs, "foo.bar", g_testContent, strlen(g_testContent));
+    openFile("foo.bar", "r+b");
+    LONGS_EQUAL(1, fwrite("B", 1, 1, m_pFile));
+    LONGS_EQUAL(0, fseek(m_pFile, 0, SEEK_SET));
+    LONGS_EQUAL(strlen(g_testContent), fread(m_buffer, 1, sizeof(m_buffer), m_pFile));
+    STRCMP_EQUAL("Best Content\n", m_buffer);
+}
+
+TEST(MemoryVfs, OpenAddedFileInWriteUpdateModeShouldTruncateAndAllowReadBack)
+{
+    create();
+    MemoryVfs_AddFile(m_pMemoryVfs, "foo.bar", "Old Content", 11);
+    openFile("foo.bar", "w+b");
+    CHECK(m_pFile != NULL);
+    LONGS_EQUAL(3, fwrite("New", 1, 3, m_pFile));
+    LONGS_EQUAL(0, fseek(m_pFile, 0, SEEK_SET));
+    LONGS_EQUAL(3, fread(m_buffer, 1, sizeof(m_buffer), m_pFile));
+    STRCMP_EQUAL("New", m_buffer);
+    closeFile();
+    validateFileContentIs("foo.bar", "New");
+}
+
+TEST(MemoryVfs, FailAllocationWhenFlushingWrittenData)
+{
+    create();
+    openFile("foo.bar", "wb");
+    fwrite(g_testContent, 1, strlen(g_testContent), m_pFile);
+    MallocFailureInject_FailAllocation(1);
+    LONGS_EQUAL(EOF, fflush(m_pFile));
+}
+
+TEST(MemoryVfs, FailAllocationsInOpenForWrite)
+{
+    create();
+    for (int i = 1 ; i <= 3 ; i++)
+    {
+        MallocFailureInject_FailAllocation(i);
+        openFile("foo.bar", "wb");
+        POINTERS_EQUAL(NULL, m_pFile);
+    }
+}
+
+TEST(MemoryVfs, GetFileStampOfNonExistingFile)
+{
+    VfsFileStamp stamp;
+    
+    create();
+    CHECK_FALSE(Vfs_GetFileStamp(MemoryVfs_GetVfs(m_pMemoryVfs), "foo.bar", &stamp));
+}
+
+TEST(MemoryVfs, FileStampChangesWhenContentIsReplaced)
+{
+    VfsFileStamp stamp1;
+    VfsFileStamp stamp2;
+    VfsFileStamp stamp3;
+    
+    create();
+    MemoryVfs_AddFile(m_pMemoryVfs, "foo.bar", "Old", 3);
+    CHECK_TRUE(Vfs_GetFileStamp(MemoryVfs_GetVfs(m_pMemoryVfs), "foo.bar", &stamp1));
+    CHECK_TRUE(Vfs_GetFileStamp(MemoryVfs_GetVfs(m_pMemoryVfs), "." SLASH_STR "foo.bar", &stamp2));
+    CHECK(0 == memcmp(&stamp1, &stamp2, sizeof(stamp1)));
+    LONGS_EQUAL(3, stamp1.size);
+    
+    MemoryVfs_AddFile(m_pMemoryVfs, "foo.bar", "New", 3);
+    CHECK_TRUE(Vfs_GetFileStamp(MemoryVfs_GetVfs(m_pMemoryVfs), "foo.bar", &stamp2));
+    CHECK(stamp1.modificationTime != stamp2.modificationTime);
+
+    openFile("foo.bar", "wb");
+    closeFile();
+    CHECK_TRUE(Vfs_GetFileStamp(MemoryVfs_GetVfs(m_pMemoryVfs), "foo.bar", &stamp3));
+    CHECK(stamp2.modificationTime != stamp3.modificationTime);
+    LONGS_EQUAL(0, stamp3.size);
+}
+
+TEST(MemoryVfs, FileStampChangesWhenOpenedForUpdate)
+{
+    VfsFileStamp stamp1;
+    VfsFileStamp stamp2;
+    
+    create();
+    MemoryVfs_AddFile(m_pMemoryVfs, "foo.bar", "Old", 3);
+    CHECK_TRUE(Vfs_GetFileStamp(MemoryVfs_GetVfs(m_pMemoryVfs), "foo.bar", &stamp1));
+    openFile("foo.bar", "rb");
+    closeFile();
+    CHECK_TRUE(Vfs_GetFileStamp(MemoryVfs_GetVfs(m_pMemoryVfs), "foo.bar", &stamp2));
+    CHECK(0 == memcmp(&stamp1, &stamp2, sizeof(stamp1)));
+    
+    openFile("foo.bar", "r+b");
+    closeFile();
+    CHECK_TRUE(Vfs_GetFileStamp(MemoryVfs_GetVfs(m_pMemoryVfs), "foo.bar", &stamp2));
+    CHECK(stamp1.modificationTime != stamp2.modificationTime);
+    LONGS_EQUAL(3, stamp2.size);
+}
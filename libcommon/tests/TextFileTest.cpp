@@ -15,6 +15,7 @@
 extern "C"
 {
     #include "TextFile.h"
+    #include "MemoryVfs.h"
     #include "MallocFailureInject.h"
     #include "FileFailureInject.h"
     #include "util.h"
@@ -212,6 +213,30 @@ TEST(TextFile, CreateFromFileWithSuffixAndDirectorySlash)
     validateEndOfFileForNextLine();
 }
 
+TEST(TextFile, CreateFromVfsFileWithSuffixAndDirectory)
+{
+    MemoryVfs* pMemoryVfs = MemoryVfs_Create();
+    MemoryVfs_AddFile(pMemoryVfs, "dir" SLASH_STR "InMemory.S", " \n\r \n", 5);
+    SizedString testDirectory = SizedString_InitFromString("dir");
+    m_pTextFile = TextFile_CreateFromVfsFile(MemoryVfs_GetVfs(pMemoryVfs), &testDirectory, toSizedString("InMemory"), ".S");
+    MemoryVfs_Free(pMemoryVfs);
+    STRCMP_EQUAL("dir" SLASH_STR "InMemory.S", TextFile_GetFilename(m_pTextFile));
+    fetchAndValidateLineWithSingleSpace();
+    fetchAndValidateLineWithSingleSpace();
+    validateEndOfFileForNextLine();
+}
+
+TEST(TextFile, FailToCreateFromVfsFileWhichDoesNotExist)
+{
+    MemoryVfs* pMemoryVfs = MemoryVfs_Create();
+    createTestFile(" \n\r \n");
+    __try_and_catch( m_pTextFile = TextFile_CreateFromVfsFile(MemoryVfs_GetVfs(pMemoryVfs), NULL, 
+                                                              toSizedString(tempFilename), NULL) );
+    MemoryVfs_Free(pMemoryVfs);
+    POINTERS_EQUAL(NULL, m_pTextFile);
+    validateExceptionThrown(fileOpenException);
+}
+
 TEST(TextFile, FailAllCreateFromFileAllocations)
 {
     static const int allocationsToFail = 3;
@@ -291,6 +316,52 @@ TEST(TextFile, FailFRead)
     validateExceptionThrown(fileException);
 }
 
+TEST(TextFile, CreateFromOpenFile)
+{
+    createTestFile(" \n\r \n");
+    FILE* pFile = fopen(tempFilename, "rb");
+    CHECK(pFile != NULL);
+    m_pTextFile = TextFile_CreateFromOpenFile(pFile, tempFilename);
+    STRCMP_EQUAL(tempFilename, TextFile_GetFilename(m_pTextFile));
+    fetchAndValidateLineWithSingleSpace();
+    fetchAndValidateLineWithSingleSpace();
+    validateEndOfFileForNextLine();
+}
+
+TEST(TextFile, FailAllCreateFromOpenFileAllocations)
+{
+    static const int allocationsToFail = 3;
+    createTestFile("\n\r");
+
+    for (int i = 1 ; i <= allocationsToFail ; i++)
+    {
+        MallocFailureInject_FailAllocation(i);
+        __try_and_catch( m_pTextFile = TextFile_CreateFromOpenFile(fopen(tempFilename, "rb"), tempFilename) );
+        validateExceptionThrown(outOfMemoryException);
+    }
+
+    MallocFailureInject_FailAllocation(allocationsToFail + 1);
+    m_pTextFile = TextFile_CreateFromOpenFile(fopen(tempFilename, "rb"), tempFilename);
+    CHECK_TRUE(m_pTextFile != NULL);
+}
+
+TEST(TextFile, FailFReadFromOpenFile)
+{
+    createTestFile("\n\r");
+    freadFail(0);
+    __try_and_catch( m_pTextFile = TextFile_CreateFromOpenFile(fopen(tempFilename, "rb"), tempFilename) );
+    freadRestore();
+    validateExceptionThrown(fileException);
+}
+
+TEST(TextFile, AllocateMergedFilenameWithDirectoryAndSuffix)
+{
+    SizedString testDirectory = SizedString_InitFromString("dir");
+    char*       pFilename = TextFile_AllocateMergedFilename(&testDirectory, toSizedString("Name"), ".S");
+    STRCMP_EQUAL("dir" SLASH_STR "Name.S", pFilename);
+    free(pFilename);
+}
+
 TEST(TextFile, FailAllCreateFromTextFileAllocations)
 {
     static const int allocationsToFail = 1;
@@ -0,0 +1,149 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "Vfs.h"
+    #include "FileFailureInject.h"
+    #include "FileOpen.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+
+static const char* g_testFilename = "VfsTest.tst";
+
+static FILE*       g_pOpenResult;
+static const char* g_pOpenFilename;
+static const char* g_pOpenMode;
+
+static FILE* stubOpen(Vfs* pThis, const char* pFilename, const char* pMode)
+{
+    g_pOpenFilename = pFilename;
+    g_pOpenMode = pMode;
+    return g_pOpenResult;
+}
+
+static int stubGetFileStamp(Vfs* pThis, const char* pFilename, VfsFileStamp* pStamp)
+{
+    g_pOpenFilename = pFilename;
+    pStamp->size = 42;
+    return 1;
+}
+
+
+TEST_GROUP(Vfs)
+{
+    FILE* m_pFile;
+    
+    void setup()
+    {
+        m_pFile = NULL;
+        g_pOpenResult = NULL;
+        g_pOpenFilename = NULL;
+        g_pOpenMode = NULL;
+    }
+
+    void teardown()
+    {
+        fopenRestore();
+        FileOpen_FreeDirectoryCache();
+        if (m_pFile)
+            fclose(m_pFile);
+        remove(g_testFilename);
+    }
+};
+
+
+TEST(Vfs, NullVfsShouldOpenFileFromOperatingSystem)
+{
+    m_pFile = Vfs_Open(NULL, g_testFilename, "wb");
+    CHECK(m_pFile != NULL);
+    fclose(m_pFile);
+    m_pFile = Vfs_Open(NULL, g_testFilename, "rb");
+    CHECK(m_pFile != NULL);
+}
+
+TEST(Vfs, NullVfsShouldGoThroughFopenHook)
+{
+    fopenFail(NULL);
+    m_pFile = Vfs_Open(NULL, g_testFilename, "wb");
+    POINTERS_EQUAL(NULL, m_pFile);
+}
+
+TEST(Vfs, ShouldDispatchToOpenRoutineOfVfs)
+{
+    Vfs vfs = { stubOpen };
+    
+    g_pOpenResult = stdout;
+    POINTERS_EQUAL(stdout, Vfs_Open(&vfs, "foo.bar", "rb"));
+    STRCMP_EQUAL("foo.bar", g_pOpenFilename);
+    STRCMP_EQUAL("rb", g_pOpenMode);
+}
+
+TEST(Vfs, NullVfsShouldStampFileFromOperatingSystem)
+{
+    VfsFileStamp stamp;
+    
+    CHECK_FALSE(Vfs_GetFileStamp(NULL, g_testFilename, &stamp));
+    m_pFile = Vfs_Open(NULL, g_testFilename, "wb");
+    fwrite("1234", 1, 4, m_pFile);
+    fclose(m_pFile);
+    m_pFile = NULL;
+    CHECK_TRUE(Vfs_GetFileStamp(NULL, g_testFilename, &stamp));
+    LONGS_EQUAL(4, stamp.size);
+    CHECK(stamp.modificationTime != 0);
+}
+
+TEST(Vfs, NullVfsShouldStampFileWithDifferentCaseWhenFopenIgnoresCase)
+{
+    VfsFileStamp stamp;
+    
+    m_pFile = Vfs_Open(NULL, g_testFilename, "wb");
+    fwrite("1234", 1, 4, m_pFile);
+    fclose(m_pFile);
+    m_pFile = NULL;
+    hook_fopen = FileOpen;
+    CHECK_TRUE(Vfs_GetFileStamp(NULL, "VFSTEST.TST", &stamp));
+    LONGS_EQUAL(4, stamp.size);
+    CHECK(stamp.modificationTime != 0);
+}
+
+TEST(Vfs, NullVfsShouldNotStampDirectories)
+{
+    VfsFileStamp stamp;
+    
+    CHECK_FALSE(Vfs_GetFileStamp(NULL, ".", &stamp));
+}
+
+TEST(Vfs, VfsWithoutStampRoutineCantStampFiles)
+{
+    Vfs          vfs = { stubOpen, NULL };
+    VfsFileStamp stamp;
+    
+    CHECK_FALSE(Vfs_GetFileStamp(&vfs, "foo.bar", &stamp));
+}
+
+TEST(Vfs, ShouldDispatchToGetFileStampRoutineOfVfs)
+{
+    Vfs          vfs = { stubOpen, stubGetFileStamp };
+    VfsFileStamp stamp;
+    
+    CHECK_TRUE(Vfs_GetFileStamp(&vfs, "foo.bar", &stamp));
+    STRCMP_EQUAL("foo.bar", g_pOpenFilename);
+    LONGS_EQUAL(42, stamp.size);
+}
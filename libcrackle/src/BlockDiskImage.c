@@ -28,21 +28,52 @@ struct BlockDiskImage
 
 static void freeObject(void* pThis);
 static void insertData(void* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
+static void flushImage(void* pThis);
+static int  getInsertRegions(void* pThis, const DiskImageInsert* pInsert, unsigned int* pFirst, unsigned int* pLast);
+static void validateInsert(void* pThis, const DiskImageInsert* pInsert);
 struct DiskImageVTable BlockDiskImageVTable = 
 { 
     freeObject,
-    insertData 
+    insertData,
+    flushImage,
+    getInsertRegions,
+    validateInsert
 };
 
 
 __throws BlockDiskImage* BlockDiskImage_Create(unsigned int blockCount)
+{
+    return BlockDiskImage_CreateWithVfs(blockCount, NULL);
+}
+
+__throws BlockDiskImage* BlockDiskImage_CreateWithVfs(unsigned int blockCount, Vfs* pVfs)
 {
     BlockDiskImage* pThis = NULL;
     
     __try
     {
         pThis = allocateAndZero(sizeof(*pThis));
-        DiskImage_Init(&pThis->super, &BlockDiskImageVTable, blockCount * DISK_IMAGE_BLOCK_SIZE);
+        DiskImage_Init(&pThis->super, &BlockDiskImageVTable, blockCount * DISK_IMAGE_BLOCK_SIZE, 
+                       DISK_IMAGE_BLOCK_SIZE, pVfs);
+    }
+    __catch
+    {
+        DiskImage_Free(&pThis->super);
+        __rethrow;
+    }
+        
+    return pThis;
+}
+
+__throws BlockDiskImage* BlockDiskImage_CreateSparse(unsigned int blockCount, Vfs* pVfs)
+{
+    BlockDiskImage* pThis = NULL;
+    
+    __try
+    {
+        pThis = allocateAndZero(sizeof(*pThis));
+        DiskImage_InitSparse(&pThis->super, &BlockDiskImageVTable, blockCount * DISK_IMAGE_BLOCK_SIZE, 
+                             DISK_IMAGE_BLOCK_SIZE, pVfs);
     }
     __catch
     {
@@ -59,6 +90,12 @@ static void freeObject(void* pThis)
 }
 
 
+static void flushImage(void* pThis)
+{
+    /* Block data is copied directly into the image so there is nothing to flush. */
+}
+
+
 __throws void BlockDiskImage_ProcessScriptFile(BlockDiskImage* pThis, const char* pScriptFilename)
 {
     DiskImage_ProcessScriptFile(&pThis->super, pScriptFilename);
@@ -95,29 +132,34 @@ static void insertData(void* pThis, const unsigned char* pData, DiskImageInsert*
 }
 
 
-static void insertRW18Data(BlockDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
+static DiskImageInsert validateAndConvertToBlockInsert(BlockDiskImage* pThis, const DiskImageInsert* pInsert);
 static void validateRW18InsertionProperties(DiskImageInsert* pInsert);
 static DiskImageInsert convertRW18SideTrackSectorToBlockAndOffset(DiskImageInsert* pInsert);
 static unsigned int startBlockForSide(unsigned short side);
-static void insertBlockData(BlockDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
 static void validateOffsetTypeIsBlock(DiskImageInsert* pInsert);
 static void validateImageOffsets(BlockDiskImage* pThis, DiskImageInsert* pInsert);
 static unsigned int calculateSourceOffset(DiskImageInsert* pInsert);
+static void copyToBlocks(BlockDiskImage* pThis, unsigned int imageOffset, const unsigned char* pData, unsigned int length);
 __throws void BlockDiskImage_InsertData(BlockDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
 {
-    if (pInsert->type == DISK_IMAGE_INSERTION_RW18)
-        insertRW18Data(pThis, pData, pInsert);
-    else
-        insertBlockData(pThis, pData, pInsert);
+    DiskImageInsert insert = validateAndConvertToBlockInsert(pThis, pInsert);
+    
+    copyToBlocks(pThis, calculateSourceOffset(&insert), pData + insert.sourceOffset, insert.length);
 }
 
-static void insertRW18Data(BlockDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
+static DiskImageInsert validateAndConvertToBlockInsert(BlockDiskImage* pThis, const DiskImageInsert* pInsert)
 {
     DiskImageInsert insert = *pInsert;
     
-    validateRW18InsertionProperties(pInsert);
-    insert = convertRW18SideTrackSectorToBlockAndOffset(pInsert);
-    insertBlockData(pThis, pData, &insert);
+    if (insert.type == DISK_IMAGE_INSERTION_RW18)
+    {
+        validateRW18InsertionProperties(&insert);
+        insert = convertRW18SideTrackSectorToBlockAndOffset(&insert);
+    }
+    validateOffsetTypeIsBlock(&insert);
+    validateImageOffsets(pThis, &insert);
+    
+    return insert;
 }
 
 static void validateRW18InsertionProperties(DiskImageInsert* pInsert)
@@ -158,16 +200,6 @@ static unsigned int startBlockForSide(unsigned short side)
     }
 }
 
-static void insertBlockData(BlockDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
-{
-    unsigned char* pImage = DiskImage_GetImagePointer(&pThis->super);
-    validateOffsetTypeIsBlock(pInsert);
-    validateImageOffsets(pThis, pInsert);
-    memcpy(pImage + calculateSourceOffset(pInsert), 
-           pData + pInsert->sourceOffset, 
-           pInsert->length);
-}
-
 static void validateOffsetTypeIsBlock(DiskImageInsert* pInsert)
 {
     if (pInsert->type != DISK_IMAGE_INSERTION_BLOCK)
@@ -191,6 +223,62 @@ static unsigned int calculateSourceOffset(DiskImageInsert* pInsert)
     return pInsert->block * DISK_IMAGE_BLOCK_SIZE + pInsert->intraBlockOffset;
 }
 
+static void copyToBlocks(BlockDiskImage* pThis, unsigned int imageOffset, const unsigned char* pData, unsigned int length)
+{
+    /* Copied a block at a time since the blocks of sparse images aren't contiguous. */
+    while (length > 0)
+    {
+        unsigned int   intraBlockOffset = imageOffset % DISK_IMAGE_BLOCK_SIZE;
+        unsigned int   bytesToCopy = DISK_IMAGE_BLOCK_SIZE - intraBlockOffset;
+        unsigned char* pBlock = DiskImage_GetRegionPointer(&pThis->super, imageOffset / DISK_IMAGE_BLOCK_SIZE);
+        
+        if (bytesToCopy > length)
+            bytesToCopy = length;
+        memcpy(pBlock + intraBlockOffset, pData, bytesToCopy);
+        imageOffset += bytesToCopy;
+        pData += bytesToCopy;
+        length -= bytesToCopy;
+    }
+}
+
+
+static void validateInsert(void* pThis, const DiskImageInsert* pInsert)
+{
+    validateAndConvertToBlockInsert((BlockDiskImage*)pThis, pInsert);
+}
+
+
+static int getInsertRegions(void* pvThis, const DiskImageInsert* pInsert, unsigned int* pFirst, unsigned int* pLast)
+{
+    BlockDiskImage* pThis = (BlockDiskImage*)pvThis;
+    DiskImageInsert insert = *pInsert;
+    unsigned int    blockCount = DiskImage_GetImageSize(&pThis->super) / DISK_IMAGE_BLOCK_SIZE;
+    unsigned int    startOffset;
+    
+    if (insert.type == DISK_IMAGE_INSERTION_RW18)
+    {
+        __try
+        {
+            insert = convertRW18SideTrackSectorToBlockAndOffset(&insert);
+        }
+        __catch
+        {
+            __nothrow_and_return(0);
+        }
+    }
+    if (insert.type != DISK_IMAGE_INSERTION_BLOCK || insert.length == 0)
+        return 0;
+    
+    startOffset = calculateSourceOffset(&insert);
+    *pFirst = startOffset / DISK_IMAGE_BLOCK_SIZE;
+    *pLast = (startOffset + insert.length - 1) / DISK_IMAGE_BLOCK_SIZE;
+    if (*pFirst >= blockCount)
+        return 0;
+    if (*pLast >= blockCount)
+        *pLast = blockCount - 1;
+    return 1;
+}
+
 
 __throws void BlockDiskImage_WriteImage(BlockDiskImage* pThis, const char* pImageFilename)
 {
@@ -12,9 +12,11 @@
 */
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "CrackleCommandLine.h"
 #include "CrackleCommandLineTest.h"
 #include "version.h"
+#include "util.h"
 
 static void displayCopyrightNotice(void)
 {
@@ -25,11 +27,64 @@ static void displayCopyrightNotice(void)
 
 static void displayUsage(void)
 {
-    printf("Usage: crackle --format image_format scriptFilename outputImageFilename\n\n"
+    printf("Usage: crackle --format image_format [--snap sourceFilename]...\n"
+           "               [--putdirs includeDir1;includeDir2...] [--threads count]\n"
+           "               [--plan] [--equates]\n"
+           "               scriptFilename outputImageFilename\n"
+           "   or: crackle --format image_format [options] --update imageFilename\n"
+           "               scriptFilename\n"
+           "   or: crackle [options] --format image_format scriptFilename\n"
+           "               outputImageFilename [--format image_format\n"
+           "               scriptFilename outputImageFilename]...\n"
+           "   or: crackle [options] --verify imageFilename [scriptFilename]\n"
+           "   or: crackle [options] --diff imageFilename1 imageFilename2\n"
+           "               [scriptFilename]\n\n"
            "Where: --format image_format indicates the type outputImage is to be\n"
            "         created.  image_format can be one of:\n"
            "           nib_5.25 - creates a .nib nibble image for a 5 1/4\" disk.\n"
            "           hdv_3.5 - creates a .HDV block image for a 3 1/2\" disk.\n"
+           "           hdv_32m - creates a 32MB .HDV block image for a ProDOS hard\n"
+           "             disk volume.  Only the blocks written by the script take\n"
+           "             memory and the untouched ones are left as holes in the\n"
+           "             sparse output file.  --update always rebuilds these.\n"
+           "         Up to 8 images can be built at once by following each\n"
+           "         scriptFilename/outputImageFilename pair with another --format.\n"
+           "         The images are built concurrently and any object file used by\n"
+           "         more than one of them is only read once.\n"
+           "       --snap sourceFilename assembles the specified source file before\n"
+           "         the script is processed.  Any SAV/USR output it produces is\n"
+           "         kept in memory and used by script lines which reference that\n"
+           "         output filename instead of reading it back from disk.  This\n"
+           "         flag can be specified multiple times.\n"
+           "       --putdirs sets the directories (semi-colon separated) in which\n"
+           "         files will be searched when --snap sources use PUT directive.\n"
+           "       --threads count sets the number of threads used to nibblize the\n"
+           "         tracks of a nib_5.25 image when it is written.  Defaults to 1.\n"
+           "       --plan keeps a compiled copy of each script next to its output\n"
+           "         image in outputImageFilename.plan.  Later runs replay it\n"
+           "         instead of parsing the script again until the script, or an\n"
+           "         object file which one of its '*' fields or image table\n"
+           "         updates came from, changes.\n"
+           "       --equates writes the side, track, offset, and length of every\n"
+           "         object placed by a RW18 script line as assembler equates to\n"
+           "         outputImageFilename.equ.S so that snap sources can PUT them.\n"
+           "         It is only rewritten when the placement changes.\n"
+           "       --update imageFilename brings an image built by an earlier --update\n"
+           "         run up to date with the script.  Only the lines which changed\n"
+           "         since then are re-applied and only the tracks/blocks which\n"
+           "         differ are rewritten.  The inputs used for each line are kept\n"
+           "         in imageFilename.manifest.  If that file or the image are\n"
+           "         missing or out of sync then the whole image is rebuilt.\n"
+           "       --verify imageFilename decodes every track of an existing\n"
+           "         nib_5.25 image and reports the RW18/RWTS16 status of each.\n"
+           "         When a scriptFilename is also given, the decoded data is\n"
+           "         compared against the image that the script would build.\n"
+           "         --threads sets the number of threads used to decode.\n"
+           "       --diff imageFilename1 imageFilename2 decodes both nib_5.25\n"
+           "         images and reports the RW18 pages and RWTS16 sectors which\n"
+           "         differ.  When a scriptFilename is also given, each difference\n"
+           "         is attributed to the script line and object which last wrote\n"
+           "         to it.  --threads sets the number of threads used to compare.\n"
            "       scriptFilename is the name of the input script to be used\n"
            "         for placing data in the image file.  Each line should meet\n"
            "         one of these formats:\n"
@@ -44,7 +99,16 @@ static void displayUsage(void)
 static int parseArgument(CrackleCommandLine* pThis, int argc, const char** ppArgs);
 static int hasDoubleDashPrefix(const char* pArgument);
 static int parseFlagArgument(CrackleCommandLine* pThis, int argc, const char** ppArgs);
+static CrackleImageSpec* currentImage(CrackleCommandLine* pThis);
 static void parseFormat(CrackleCommandLine* pThis, int argc, const char* pFormat);
+static CrackleImageSpec* startNextImageIfCurrentIsComplete(CrackleCommandLine* pThis);
+static int isImageComplete(const CrackleImageSpec* pImage);
+static void parseSnapSource(CrackleCommandLine* pThis, int argc, const char* pSourceFilename);
+static void parseThreadCount(CrackleCommandLine* pThis, int argc, const char* pThreadCount);
+static void parseUpdateImage(CrackleCommandLine* pThis, int argc, const char* pImageFilename);
+static void parseDiffImages(CrackleCommandLine* pThis, int argc, const char** ppImageFilenames);
+static void validateVerifyArguments(CrackleCommandLine* pThis);
+static void parseStringParameter(const char** ppDestField, int argc, const char* pSourceArgument);
 static int parseFilenameArgument(CrackleCommandLine* pThis, int argc, const char* pArgument);
 static void throwIfRequiredArgumentNotSpecified(CrackleCommandLine* pThis);
 
@@ -53,6 +117,8 @@ __throws CrackleCommandLine CrackleCommandLine_Init(int argc, const char** argv)
 {
     CrackleCommandLine commandLine;
     memset(&commandLine, 0, sizeof(commandLine));
+    commandLine.imageCount = 1;
+    commandLine.threadCount = 1;
     
     __try
     {
@@ -95,34 +161,148 @@ static int parseFlagArgument(CrackleCommandLine* pThis, int argc, const char** p
         parseFormat(pThis, argc - 1, ppArgs[1]);
         return 2;
     }
+    else if (0 == strcasecmp(*ppArgs, "--snap"))
+    {
+        parseSnapSource(pThis, argc - 1, ppArgs[1]);
+        return 2;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--threads"))
+    {
+        parseThreadCount(pThis, argc - 1, ppArgs[1]);
+        return 2;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--plan"))
+    {
+        pThis->usePlans = 1;
+        return 1;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--equates"))
+    {
+        pThis->writeEquates = 1;
+        return 1;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--update"))
+    {
+        parseUpdateImage(pThis, argc - 1, ppArgs[1]);
+        return 2;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--verify"))
+    {
+        parseStringParameter(&pThis->pVerifyImageFilename, argc - 1, ppArgs[1]);
+        return 2;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--diff"))
+    {
+        parseDiffImages(pThis, argc - 1, &ppArgs[1]);
+        return 3;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--putdirs"))
+    {
+        parseStringParameter(&pThis->pPutDirectories, argc - 1, ppArgs[1]);
+        return 2;
+    }
     else
     {
         __throw(invalidArgumentException);
     }
 }
 
+static CrackleImageSpec* currentImage(CrackleCommandLine* pThis)
+{
+    return &pThis->images[pThis->imageCount - 1];
+}
+
 static void parseFormat(CrackleCommandLine* pThis, int argc, const char* pFormat)
 {
+    CrackleImageSpec* pImage;
+    
     if (argc < 1)
         __throw(invalidArgumentException);
+    pImage = startNextImageIfCurrentIsComplete(pThis);
     if (0 == strcasecmp(pFormat, "nib_5.25"))
-        pThis->imageFormat = FORMAT_NIB_5_25;
+        pImage->imageFormat = FORMAT_NIB_5_25;
     else if (0 == strcasecmp(pFormat, "hdv_3.5"))
-        pThis->imageFormat = FORMAT_HDV_3_5;
+        pImage->imageFormat = FORMAT_HDV_3_5;
+    else if (0 == strcasecmp(pFormat, "hdv_32m"))
+        pImage->imageFormat = FORMAT_HDV_32M;
     else
         __throw(invalidArgumentException);
 }
 
+static CrackleImageSpec* startNextImageIfCurrentIsComplete(CrackleCommandLine* pThis)
+{
+    if (!isImageComplete(currentImage(pThis)))
+        return currentImage(pThis);
+    if (pThis->imageCount >= ARRAYSIZE(pThis->images))
+        __throw(invalidArgumentException);
+    pThis->imageCount++;
+    return currentImage(pThis);
+}
+
+static int isImageComplete(const CrackleImageSpec* pImage)
+{
+    return pImage->pScriptFilename && pImage->pOutputImageFilename && pImage->imageFormat != FORMAT_UNKNOWN;
+}
+
+static void parseSnapSource(CrackleCommandLine* pThis, int argc, const char* pSourceFilename)
+{
+    if (pThis->snapSourceCount >= ARRAYSIZE(pThis->pSnapSourceFilenames))
+        __throw(invalidArgumentException);
+    parseStringParameter(&pThis->pSnapSourceFilenames[pThis->snapSourceCount], argc, pSourceFilename);
+    pThis->snapSourceCount++;
+}
+
+static void parseThreadCount(CrackleCommandLine* pThis, int argc, const char* pThreadCount)
+{
+    char*         pEnd = NULL;
+    unsigned long threadCount;
+    
+    if (argc < 1)
+        __throw(invalidArgumentException);
+    threadCount = strtoul(pThreadCount, &pEnd, 10);
+    if (*pThreadCount == '\0' || *pEnd != '\0' || threadCount < 1 || threadCount > CRACKLE_COMMAND_LINE_MAX_THREADS)
+        __throw(invalidArgumentException);
+    pThis->threadCount = (unsigned int)threadCount;
+}
+
+static void parseUpdateImage(CrackleCommandLine* pThis, int argc, const char* pImageFilename)
+{
+    CrackleImageSpec* pImage = currentImage(pThis);
+    
+    if (pImage->pOutputImageFilename)
+        __throw(invalidArgumentException);
+    parseStringParameter(&pImage->pOutputImageFilename, argc, pImageFilename);
+    pImage->updateImage = 1;
+}
+
+static void parseDiffImages(CrackleCommandLine* pThis, int argc, const char** ppImageFilenames)
+{
+    if (argc < 2)
+        __throw(invalidArgumentException);
+    pThis->pDiffImageFilenames[0] = ppImageFilenames[0];
+    pThis->pDiffImageFilenames[1] = ppImageFilenames[1];
+}
+
+static void parseStringParameter(const char** ppDestField, int argc, const char* pSourceArgument)
+{
+    if (argc < 1)
+        __throw(invalidArgumentException);
+
+    *ppDestField = pSourceArgument;
+}
+
 static int parseFilenameArgument(CrackleCommandLine* pThis, int argc, const char* pArgument)
 {
-    if (!pThis->pScriptFilename)
+    CrackleImageSpec* pImage = currentImage(pThis);
+    
+    if (!pImage->pScriptFilename)
     {
-        pThis->pScriptFilename = pArgument;
+        pImage->pScriptFilename = pArgument;
         return 1;
     }
-    else if (!pThis->pOutputImageFilename)
+    else if (!pImage->pOutputImageFilename)
     {
-        pThis->pOutputImageFilename = pArgument;
+        pImage->pOutputImageFilename = pArgument;
         return 1;
     }
     else
@@ -133,6 +313,30 @@ static int parseFilenameArgument(CrackleCommandLine* pThis, int argc, const char
 
 static void throwIfRequiredArgumentNotSpecified(CrackleCommandLine* pThis)
 {
-    if (!pThis->pScriptFilename || !pThis->pOutputImageFilename || pThis->imageFormat == FORMAT_UNKNOWN)
+    unsigned int i;
+    
+    if (pThis->pVerifyImageFilename || pThis->pDiffImageFilenames[0])
+    {
+        validateVerifyArguments(pThis);
+        return;
+    }
+    for (i = 0 ; i < pThis->imageCount ; i++)
+    {
+        if (!isImageComplete(&pThis->images[i]))
+            __throw(invalidArgumentException);
+    }
+}
+
+static void validateVerifyArguments(CrackleCommandLine* pThis)
+{
+    CrackleImageSpec* pImage = &pThis->images[0];
+    
+    /* Only nibble images can be verified or diffed and the only filename argument is the optional script. */
+    if (pThis->pVerifyImageFilename && pThis->pDiffImageFilenames[0])
+        __throw(invalidArgumentException);
+    if (pThis->imageCount > 1 || pImage->pOutputImageFilename)
+        __throw(invalidArgumentException);
+    if (pImage->imageFormat != FORMAT_UNKNOWN && pImage->imageFormat != FORMAT_NIB_5_25)
         __throw(invalidArgumentException);
+    pImage->imageFormat = FORMAT_NIB_5_25;
 }
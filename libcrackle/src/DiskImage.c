@@ -11,6 +11,7 @@
     GNU General Public License for more details.
 */
 #include <assert.h>
+#include <ctype.h>
 #include <string.h>
 #include "DiskImagePriv.h"
 #include "DiskImageTest.h"
@@ -20,23 +21,59 @@
 
 #define IMAGE_TABLE_DEFAULT_ADDRESS 0x6000
 
+static void initCommonFields(DiskImage*       pThis, 
+                             DiskImageVTable* pVTable, 
+                             unsigned int     imageSize, 
+                             unsigned int     regionSize, 
+                             Vfs*             pVfs);
 static void DiskImageScriptEngine_Init(DiskImageScriptEngine* pThis);
-__throws void DiskImage_Init(DiskImage* pThis, DiskImageVTable* pVTable, unsigned int imageSize)
+__throws void DiskImage_Init(DiskImage*       pThis, 
+                             DiskImageVTable* pVTable, 
+                             unsigned int     imageSize, 
+                             unsigned int     regionSize, 
+                             Vfs*             pVfs)
 {
-    memset(pThis, 0, sizeof(*pThis));
-    pThis->pVTable = pVTable;
+    initCommonFields(pThis, pVTable, imageSize, regionSize, pVfs);
     ByteBuffer_Allocate(&pThis->image, imageSize);
     DiskImageScriptEngine_Init(&pThis->script);
 }
 
+static void initCommonFields(DiskImage*       pThis, 
+                             DiskImageVTable* pVTable, 
+                             unsigned int     imageSize, 
+                             unsigned int     regionSize, 
+                             Vfs*             pVfs)
+{
+    memset(pThis, 0, sizeof(*pThis));
+    pThis->pVTable = pVTable;
+    pThis->pVfs = pVfs;
+    pThis->imageSize = imageSize;
+    pThis->regionSize = regionSize;
+    pThis->pObjectCache = DiskImageObjectCache_Create();
+}
+
 static void DiskImageScriptEngine_Init(DiskImageScriptEngine* pThis)
 {
     pThis->pParser = ParseCSV_Create();
 }
 
 
+__throws void DiskImage_InitSparse(DiskImage*       pThis, 
+                                   DiskImageVTable* pVTable, 
+                                   unsigned int     imageSize, 
+                                   unsigned int     regionSize, 
+                                   Vfs*             pVfs)
+{
+    initCommonFields(pThis, pVTable, imageSize, regionSize, pVfs);
+    pThis->ppSparseRegions = allocateAndZero((imageSize / regionSize) * sizeof(*pThis->ppSparseRegions));
+    DiskImageScriptEngine_Init(&pThis->script);
+}
+
 static void DiskImageScriptEngine_Free(DiskImageScriptEngine* pThis);
 static void closeTextFile(DiskImageScriptEngine* pThis);
+static void freeInMemoryObjects(DiskImage* pThis);
+static void releaseHeldObjects(DiskImage* pThis);
+static void freeSparseRegions(DiskImage* pThis);
 void DiskImage_Free(DiskImage* pThis)
 {
     if (!pThis)
@@ -44,18 +81,64 @@ void DiskImage_Free(DiskImage* pThis)
     
     if (pThis->pVTable)
         pThis->pVTable->freeObject(pThis);
-    ByteBuffer_Free(&pThis->object);
+    freeInMemoryObjects(pThis);
+    releaseHeldObjects(pThis);
+    DiskImageObjectCache_Free(pThis->pObjectCache);
+    ByteBuffer_Free(&pThis->objectCopy);
     ByteBuffer_Free(&pThis->image);
+    freeSparseRegions(pThis);
     DiskImageScriptEngine_Free(&pThis->script);
+    free(pThis->pPlanFilename);
+    free(pThis->pResolvedScriptFilename);
+    free(pThis->pEquatesFilename);
     free(pThis);
 }
 
+static void freeInMemoryObjects(DiskImage* pThis)
+{
+    DiskImageObject* pObject = pThis->pInMemoryObjects;
+    
+    while (pObject)
+    {
+        DiskImageObject* pNext = pObject->pNext;
+        free(pObject);
+        pObject = pNext;
+    }
+}
+
+static void freeSparseRegions(DiskImage* pThis)
+{
+    unsigned int regionCount = pThis->imageSize / pThis->regionSize;
+    unsigned int i;
+    
+    if (!pThis->ppSparseRegions)
+        return;
+    for (i = 0 ; i < regionCount ; i++)
+        free(pThis->ppSparseRegions[i]);
+    free(pThis->ppSparseRegions);
+}
+
+static void freeEquateLabels(DiskImageScriptEngine* pThis);
 static void DiskImageScriptEngine_Free(DiskImageScriptEngine* pThis)
 {
     ParseCSV_Free(pThis->pParser);
+    DiskImagePacker_Free(&pThis->packer);
+    free(pThis->resolvedScript.pText);
+    free(pThis->equates.pText);
+    freeEquateLabels(pThis);
+    free(pThis->ppEquateLabels);
     closeTextFile(pThis);
 }
 
+static void freeEquateLabels(DiskImageScriptEngine* pThis)
+{
+    unsigned int i;
+    
+    for (i = 0 ; i < pThis->equateLabelCount ; i++)
+        free(pThis->ppEquateLabels[i]);
+    pThis->equateLabelCount = 0;
+}
+
 static void closeTextFile(DiskImageScriptEngine* pThis)
 {
     TextFile_Free(pThis->pTextFile);
@@ -63,18 +146,40 @@ static void closeTextFile(DiskImageScriptEngine* pThis)
 }
 
 
-#define LOG_ERROR(pTHIS, FORMAT, ...) fprintf(stderr, \
-                                       "%s:%d: error: " FORMAT LINE_ENDING, \
-                                       pTHIS->pScriptFilename, \
-                                       pTHIS->lineNumber, \
-                                       __VA_ARGS__)
+#define LOG_ERROR(pTHIS, FORMAT, ...) do \
+                                      { \
+                                          pTHIS->errorCount++; \
+                                          fprintf(stderr, \
+                                                  "%s:%d: error: " FORMAT LINE_ENDING, \
+                                                  pTHIS->pScriptFilename, \
+                                                  pTHIS->lineNumber, \
+                                                  __VA_ARGS__); \
+                                      } while (0)
 
 static void DiskImageScriptEngine_ProcessScriptFile(DiskImageScriptEngine* pThis, 
                                                     DiskImage*              pDiskImage, 
                                                     const char*             pScriptFilename);
 static void processScriptFromTextFile(DiskImageScriptEngine* pThis);
+static void startScriptOutputs(DiskImageScriptEngine* pThis);
+static void clearText(DiskImageText* pThis);
 static int isLineAComment(const SizedString* pLine);
+static int isLineBlank(const SizedString* pLine);
+static void reserveFixedPlacements(DiskImageScriptEngine* pThis);
+static int scriptHasPackedLines(DiskImageScriptEngine* pThis);
+static int isPackedLine(size_t fieldCount, const SizedString* pFields);
+static void reserveFixedPlacement(DiskImageScriptEngine* pThis, const SizedString* pScriptLine);
+static int isFixedPlacementLine(size_t fieldCount, const SizedString* pFields);
 static void processNextScriptLine(DiskImageScriptEngine* pThis, const SizedString* pScriptLine);
+static void updateResolvedScript(DiskImageScriptEngine* pThis, const SizedString* pScriptLine);
+static void appendPackedLineToResolvedScript(DiskImageScriptEngine* pThis, const SizedString* pScriptLine);
+static void appendText(DiskImageText* pThis, const char* pText, size_t length);
+static void writeScriptOutputs(DiskImageScriptEngine* pThis);
+static void writeScriptOutput(DiskImageScriptEngine* pThis, 
+                              const char*            pDescription, 
+                              const char*            pFilename, 
+                              const DiskImageText*   pText);
+static void writeFileIfChanged(Vfs* pVfs, const char* pFilename, const char* pData, size_t length);
+static int isFileContentEqual(Vfs* pVfs, const char* pFilename, const char* pData, size_t length);
 static void processBlockScriptLine(DiskImageScriptEngine* pThis, size_t fieldCount, const SizedString* pFields);
 static void readObjectFile(DiskImage* pDiskImage, const SizedString* pFilenameString);
 static unsigned int parseLengthField(DiskImageScriptEngine* pThis, const SizedString* pLengthField);
@@ -85,19 +190,35 @@ static void parseBlockRelatedFieldsAndSetInsertFields(DiskImageScriptEngine* pTh
                                                       size_t fieldCount, 
                                                       const SizedString* pFields);
 static int isAsterisk(const SizedString* pString);
+static int isQuestionMark(const SizedString* pString);
 static void setBlockInsertFieldsBasedOnLastInsertion(DiskImageScriptEngine* pThis);
 static void setBlockInsertFieldsBaseOnScriptFields(DiskImageScriptEngine* pThis, 
                                                    size_t fieldCount, 
                                                    const SizedString* pFields);
 static void rememberLastInsertionInformation(DiskImageScriptEngine* pThis);
 static void processRWTS16ScriptLine(DiskImageScriptEngine* pThis, size_t fieldCount, const SizedString* pFields);
+static void setRWTS16InsertFields(DiskImageScriptEngine* pThis, const SizedString* pFields);
 static void processRW18ScriptLine(DiskImageScriptEngine* pThis, size_t fieldCount, const SizedString* pFields);
+static void setRW18InsertFields(DiskImageScriptEngine* pThis, size_t fieldCount, const SizedString* pFields, int isPacked);
+static void packInsert(DiskImageScriptEngine* pThis);
+static void addEquates(DiskImageScriptEngine* pThis, const SizedString* pObjectFilename, const DiskImageInsert* pInsert);
+static void appendEquatesHeader(DiskImageScriptEngine* pThis);
+static const char* createUniqueEquateLabel(DiskImageScriptEngine* pThis, const SizedString* pObjectFilename);
+static int isEquateLabelUsed(DiskImageScriptEngine* pThis, const char* pLabel);
+static void rememberEquateLabel(DiskImageScriptEngine* pThis, char* pLabel);
+static void appendEquate(DiskImageScriptEngine* pThis, const char* pLabel, const char* pField, const char* pValue);
 static void processImageTableUpdates(DiskImageScriptEngine* pThis, unsigned short newImageTableAddress);
 static unsigned short getImageTableObjectSize(DiskImage* pDiskImage, unsigned short startImageTableAddress);
 static void reportScriptLineException(DiskImageScriptEngine* pThis);
+static void processScriptFileWithPlan(DiskImage* pThis, const char* pScriptFilename, const VfsFileStamp* pStamp);
 __throws void DiskImage_ProcessScriptFile(DiskImage* pThis, const char* pScriptFilename)
 {
-    DiskImageScriptEngine_ProcessScriptFile(&pThis->script, pThis, pScriptFilename);
+    VfsFileStamp scriptStamp;
+    
+    if (pThis->pPlanFilename && Vfs_GetFileStamp(pThis->pVfs, pScriptFilename, &scriptStamp))
+        processScriptFileWithPlan(pThis, pScriptFilename, &scriptStamp);
+    else
+        DiskImageScriptEngine_ProcessScriptFile(&pThis->script, pThis, pScriptFilename);
 }
 
 static void DiskImageScriptEngine_ProcessScriptFile(DiskImageScriptEngine* pThis, 
@@ -109,7 +230,7 @@ static void DiskImageScriptEngine_ProcessScriptFile(DiskImageScriptEngine* pThis
         SizedString scriptFilename = SizedString_InitFromString(pScriptFilename);
         pThis->pScriptFilename = pScriptFilename;
         pThis->pDiskImage = pDiskImage;
-        pThis->pTextFile = TextFile_CreateFromFile(NULL, &scriptFilename, NULL);
+        pThis->pTextFile = TextFile_CreateFromVfsFile(pDiskImage->pVfs, NULL, &scriptFilename, NULL);
     }
     __catch
     {
@@ -122,15 +243,40 @@ static void DiskImageScriptEngine_ProcessScriptFile(DiskImageScriptEngine* pThis
 
 static void processScriptFromTextFile(DiskImageScriptEngine* pThis)
 {
+    unsigned int priorErrorCount = pThis->errorCount;
+    
+    startScriptOutputs(pThis);
+    reserveFixedPlacements(pThis);
     pThis->lineNumber = 1;
     while (!TextFile_IsEndOfFile(pThis->pTextFile))
     {
         SizedString nextLine = TextFile_GetNextLine(pThis->pTextFile);
+        pThis->isLinePacked = FALSE;
         if (!isLineAComment(&nextLine))
             processNextScriptLine(pThis, &nextLine);
+        updateResolvedScript(pThis, &nextLine);
         pThis->lineNumber++;
     }
     closeTextFile(pThis);
+    if (pThis->errorCount == priorErrorCount)
+        writeScriptOutputs(pThis);
+}
+
+static void startScriptOutputs(DiskImageScriptEngine* pThis)
+{
+    DiskImagePacker_Free(&pThis->packer);
+    pThis->packedLineCount = 0;
+    pThis->hasPackedLines = FALSE;
+    clearText(&pThis->resolvedScript);
+    clearText(&pThis->equates);
+    freeEquateLabels(pThis);
+}
+
+static void clearText(DiskImageText* pThis)
+{
+    pThis->length = 0;
+    if (pThis->pText)
+        pThis->pText[0] = '\0';
 }
 
 static int isLineAComment(const SizedString* pLine)
@@ -138,6 +284,93 @@ static int isLineAComment(const SizedString* pLine)
     return pLine->pString[0] == '#';
 }
 
+static int isLineBlank(const SizedString* pLine)
+{
+    const char* pCurr = pLine->pString;
+    const char* pEnd = pCurr + pLine->stringLength;
+    
+    while (pCurr < pEnd && isspace((unsigned char)*pCurr))
+        pCurr++;
+    return pCurr == pEnd;
+}
+
+static void reserveFixedPlacements(DiskImageScriptEngine* pThis)
+{
+    /* Every fixed RW18 and RWTS16 placement is reserved before any '?' line is packed so that a '?' line can't be
+       given space which a later line of the script writes to. */
+    pThis->hasPackedLines = scriptHasPackedLines(pThis);
+    if (!pThis->hasPackedLines)
+        return;
+    while (!TextFile_IsEndOfFile(pThis->pTextFile))
+    {
+        SizedString nextLine = TextFile_GetNextLine(pThis->pTextFile);
+        if (!isLineAComment(&nextLine))
+            reserveFixedPlacement(pThis, &nextLine);
+    }
+    TextFile_Reset(pThis->pTextFile);
+}
+
+static int scriptHasPackedLines(DiskImageScriptEngine* pThis)
+{
+    int hasPackedLines = FALSE;
+    
+    while (!hasPackedLines && !TextFile_IsEndOfFile(pThis->pTextFile))
+    {
+        SizedString nextLine = TextFile_GetNextLine(pThis->pTextFile);
+        if (isLineAComment(&nextLine))
+            continue;
+        ParseCSV_Parse(pThis->pParser, &nextLine);
+        hasPackedLines = isPackedLine(ParseCSV_FieldCount(pThis->pParser), ParseCSV_FieldPointers(pThis->pParser));
+    }
+    TextFile_Reset(pThis->pTextFile);
+    
+    return hasPackedLines;
+}
+
+static int isPackedLine(size_t fieldCount, const SizedString* pFields)
+{
+    return fieldCount >= 7 && 
+           0 == SizedString_strcasecmp(&pFields[0], "rw18") && 
+           (isQuestionMark(&pFields[5]) || isQuestionMark(&pFields[6]));
+}
+
+static void reserveFixedPlacement(DiskImageScriptEngine* pThis, const SizedString* pScriptLine)
+{
+    size_t             fieldCount;
+    const SizedString* pFields;
+    
+    ParseCSV_Parse(pThis->pParser, pScriptLine);
+    fieldCount = ParseCSV_FieldCount(pThis->pParser);
+    pFields = ParseCSV_FieldPointers(pThis->pParser);
+    if (!isFixedPlacementLine(fieldCount, pFields))
+        return;
+    
+    __try
+    {
+        if (0 == SizedString_strcasecmp(&pFields[0], "rw18"))
+            setRW18InsertFields(pThis, fieldCount, pFields, FALSE);
+        else
+            setRWTS16InsertFields(pThis, pFields);
+        DiskImagePacker_Reserve(&pThis->packer, &pThis->insert);
+    }
+    __catch
+    {
+        /* Any problem with the line is reported when it is processed. */
+        __nothrow;
+    }
+}
+
+static int isFixedPlacementLine(size_t fieldCount, const SizedString* pFields)
+{
+    if (fieldCount < 1)
+        return FALSE;
+    if (0 == SizedString_strcasecmp(&pFields[0], "rwts16"))
+        return fieldCount == 6;
+    return 0 == SizedString_strcasecmp(&pFields[0], "rw18") &&
+           fieldCount >= 7 && fieldCount <= 8 &&
+           !isQuestionMark(&pFields[5]) && !isQuestionMark(&pFields[6]);
+}
+
 static void processNextScriptLine(DiskImageScriptEngine* pThis, const SizedString* pScriptLine)
 {
     size_t             fieldCount;
@@ -152,6 +385,8 @@ static void processNextScriptLine(DiskImageScriptEngine* pThis, const SizedStrin
         return;
     }
     
+    pThis->imageTableAddress = DISK_IMAGE_PLAN_NO_IMAGE_TABLE;
+    pThis->isResolvedFromObject = FALSE;
     __try
     {
         if (0 == SizedString_strcasecmp(&pFields[0], "block"))
@@ -171,6 +406,128 @@ static void processNextScriptLine(DiskImageScriptEngine* pThis, const SizedStrin
     }
 }
 
+static void updateResolvedScript(DiskImageScriptEngine* pThis, const SizedString* pScriptLine)
+{
+    /* Only '?' lines which directly follow each other, ignoring comments and blank lines, are loaded together. */
+    if (!pThis->isLinePacked && !isLineAComment(pScriptLine) && !isLineBlank(pScriptLine))
+        DiskImagePacker_EndGroup(&pThis->packer);
+    /* The resolved script is only written for scripts with '?' lines so there is no need to copy any others. */
+    if (!pThis->hasPackedLines || !pThis->pDiskImage->pResolvedScriptFilename)
+        return;
+    
+    if (pThis->isLinePacked)
+        appendPackedLineToResolvedScript(pThis, pScriptLine);
+    else
+        appendText(&pThis->resolvedScript, pScriptLine->pString, pScriptLine->stringLength);
+    appendText(&pThis->resolvedScript, LINE_ENDING, sizeof(LINE_ENDING) - 1);
+}
+
+static void appendPackedLineToResolvedScript(DiskImageScriptEngine* pThis, const SizedString* pScriptLine)
+{
+    const SizedString* pFields = ParseCSV_FieldPointers(pThis->pParser);
+    const char*        pTrackEnd = pFields[5].pString + pFields[5].stringLength;
+    const char*        pOffsetEnd = pFields[6].pString + pFields[6].stringLength;
+    DiskImageText*     pText = &pThis->resolvedScript;
+    char               buffer[16];
+    
+    /* The fields point into the line so everything around the two '?' fields is copied as it was written. */
+    appendText(pText, pScriptLine->pString, pFields[5].pString - pScriptLine->pString);
+    appendText(pText, buffer, sprintf(buffer, "%u", pThis->insert.track));
+    appendText(pText, pTrackEnd, pFields[6].pString - pTrackEnd);
+    appendText(pText, buffer, sprintf(buffer, "0x%x", pThis->insert.intraTrackOffset));
+    appendText(pText, pOffsetEnd, pScriptLine->pString + pScriptLine->stringLength - pOffsetEnd);
+}
+
+static void appendText(DiskImageText* pThis, const char* pText, size_t length)
+{
+    size_t newLength = pThis->length + length;
+    
+    if (newLength + 1 > pThis->allocatedLength)
+    {
+        size_t newAllocation = pThis->allocatedLength ? 2 * pThis->allocatedLength : 4096;
+        char*  pRealloc;
+        
+        while (newAllocation < newLength + 1)
+            newAllocation *= 2;
+        pRealloc = realloc(pThis->pText, newAllocation);
+        if (!pRealloc)
+            __throw(outOfMemoryException);
+        pThis->pText = pRealloc;
+        pThis->allocatedLength = newAllocation;
+    }
+    memcpy(pThis->pText + pThis->length, pText, length);
+    pThis->pText[newLength] = '\0';
+    pThis->length = newLength;
+}
+
+static void writeScriptOutputs(DiskImageScriptEngine* pThis)
+{
+    DiskImage* pDiskImage = pThis->pDiskImage;
+    
+    if (pThis->packedLineCount > 0)
+        writeScriptOutput(pThis, "resolved script", pDiskImage->pResolvedScriptFilename, &pThis->resolvedScript);
+    if (pThis->equates.length > 0)
+        writeScriptOutput(pThis, "equates", pDiskImage->pEquatesFilename, &pThis->equates);
+}
+
+static void writeScriptOutput(DiskImageScriptEngine* pThis, 
+                              const char*            pDescription, 
+                              const char*            pFilename, 
+                              const DiskImageText*   pText)
+{
+    if (!pFilename)
+        return;
+    __try
+    {
+        writeFileIfChanged(pThis->pDiskImage->pVfs, pFilename, pText->pText, pText->length);
+    }
+    __catch
+    {
+        LOG_ERROR(pThis, "Failed to write %s to %s.", pDescription, pFilename);
+        __rethrow;
+    }
+}
+
+static void writeFileIfChanged(Vfs* pVfs, const char* pFilename, const char* pData, size_t length)
+{
+    FILE* pFile;
+    
+    /* Leaving an unchanged file alone keeps its timestamp so that anything built from it isn't rebuilt. */
+    if (isFileContentEqual(pVfs, pFilename, pData, length))
+        return;
+    
+    pFile = Vfs_Open(pVfs, pFilename, "wb");
+    if (!pFile)
+        __throw(fileOpenException);
+    if (length != fwrite(pData, 1, length, pFile))
+    {
+        fclose(pFile);
+        __throw(fileException);
+    }
+    if (0 != fclose(pFile))
+        __throw(fileException);
+}
+
+static int isFileContentEqual(Vfs* pVfs, const char* pFilename, const char* pData, size_t length)
+{
+    FILE*  pFile = Vfs_Open(pVfs, pFilename, "rb");
+    char   buffer[4096];
+    size_t offset = 0;
+    size_t bytesRead;
+    int    isEqual = TRUE;
+    
+    if (!pFile)
+        return FALSE;
+    while (isEqual && 0 != (bytesRead = fread(buffer, 1, sizeof(buffer), pFile)))
+    {
+        isEqual = offset + bytesRead <= length && 0 == memcmp(buffer, pData + offset, bytesRead);
+        offset += bytesRead;
+    }
+    fclose(pFile);
+    
+    return isEqual && offset == length;
+}
+
 static void processBlockScriptLine(DiskImageScriptEngine* pThis, size_t fieldCount, const SizedString* pFields)
 {
     if (fieldCount < 5 || fieldCount > 6)
@@ -217,9 +574,11 @@ static unsigned int parseFieldWhichSupportsAsteriskForDefaulValue(DiskImageScrip
                                                                   unsigned int           defaultValue)
 {
     if (isAsterisk(pField))
+    {
+        pThis->isResolvedFromObject = TRUE;
         return defaultValue;
-    else
-        return SizedString_strtoul(pField, NULL, 0);
+    }
+    return SizedString_strtoul(pField, NULL, 0);
 }
 
 static int isAsterisk(const SizedString* pString)
@@ -227,6 +586,11 @@ static int isAsterisk(const SizedString* pString)
     return 0 == SizedString_strcmp(pString, "*");
 }
 
+static int isQuestionMark(const SizedString* pString)
+{
+    return 0 == SizedString_strcmp(pString, "?");
+}
+
 static void parseBlockRelatedFieldsAndSetInsertFields(DiskImageScriptEngine* pThis, 
                                                       size_t fieldCount, 
                                                       const SizedString* pFields)
@@ -234,7 +598,11 @@ static void parseBlockRelatedFieldsAndSetInsertFields(DiskImageScriptEngine* pTh
     const SizedString* pBlockField = &pFields[4];
 
     if (isAsterisk(pBlockField))
+    {
+        /* The length of the last insertion may itself have come from its object file. */
+        pThis->isResolvedFromObject = TRUE;
         setBlockInsertFieldsBasedOnLastInsertion(pThis);
+    }
     else
         setBlockInsertFieldsBaseOnScriptFields(pThis, fieldCount, pFields);
 }
@@ -273,17 +641,24 @@ static void processRWTS16ScriptLine(DiskImageScriptEngine* pThis, size_t fieldCo
         __throw(invalidArgumentException);
     }
     
+    setRWTS16InsertFields(pThis, pFields);
+    DiskImage_InsertObjectFile(pThis->pDiskImage, &pThis->insert);
+}
+
+static void setRWTS16InsertFields(DiskImageScriptEngine* pThis, const SizedString* pFields)
+{
     readObjectFile(pThis->pDiskImage, &pFields[1]);
     pThis->insert.sourceOffset = SizedString_strtoul(&pFields[2], NULL, 0);
     pThis->insert.length = parseLengthField(pThis, &pFields[3]);
     pThis->insert.type = DISK_IMAGE_INSERTION_RWTS16;
     pThis->insert.track = SizedString_strtoul(&pFields[4], NULL, 0);
     pThis->insert.sector = SizedString_strtoul(&pFields[5], NULL, 0);
-    DiskImage_InsertObjectFile(pThis->pDiskImage, &pThis->insert);
 }
 
 static void processRW18ScriptLine(DiskImageScriptEngine* pThis, size_t fieldCount, const SizedString* pFields)
 {
+    int isPacked;
+    
     if (fieldCount < 7 || fieldCount > 8)
     {
         LOG_ERROR(pThis, 
@@ -292,27 +667,174 @@ static void processRW18ScriptLine(DiskImageScriptEngine* pThis, size_t fieldCoun
                   "Line");
         __throw(invalidArgumentException);
     }
+    isPacked = isQuestionMark(&pFields[5]);
+    if (isPacked != isQuestionMark(&pFields[6]))
+    {
+        LOG_ERROR(pThis, "%s must use '?' for both the track and offset fields or for neither.", "Line");
+        __throw(invalidArgumentException);
+    }
     
+    setRW18InsertFields(pThis, fieldCount, pFields, isPacked);
+    if (isPacked)
+        packInsert(pThis);
+    DiskImage_InsertObjectFile(pThis->pDiskImage, &pThis->insert);
+    addEquates(pThis, &pFields[1], &pThis->insert);
+}
+
+static void setRW18InsertFields(DiskImageScriptEngine* pThis, size_t fieldCount, const SizedString* pFields, int isPacked)
+{
     readObjectFile(pThis->pDiskImage, &pFields[1]);
     pThis->insert.type = DISK_IMAGE_INSERTION_RW18;
     pThis->insert.sourceOffset = SizedString_strtoul(&pFields[2], NULL, 0);
     pThis->insert.length = parseLengthField(pThis, &pFields[3]);
     pThis->insert.side = parseFieldWhichSupportsAsteriskForDefaulValue(pThis, &pFields[4], 
                                                                        pThis->pDiskImage->insert.side);
-    pThis->insert.track = parseFieldWhichSupportsAsteriskForDefaulValue(pThis, &pFields[5], 
-                                                                        pThis->pDiskImage->insert.track);
-    pThis->insert.intraTrackOffset = parseFieldWhichSupportsAsteriskForDefaulValue(pThis, &pFields[6], 
-                                                                                   pThis->pDiskImage->insert.intraTrackOffset);
+    if (!isPacked)
+    {
+        pThis->insert.track = parseFieldWhichSupportsAsteriskForDefaulValue(pThis, &pFields[5], 
+                                                                            pThis->pDiskImage->insert.track);
+        pThis->insert.intraTrackOffset = parseFieldWhichSupportsAsteriskForDefaulValue(pThis, &pFields[6], 
+                                                                                       pThis->pDiskImage->insert.intraTrackOffset);
+    }
     if (fieldCount > 7)
         processImageTableUpdates(pThis, SizedString_strtoul(&pFields[7], NULL, 0));
+}
 
-    DiskImage_InsertObjectFile(pThis->pDiskImage, &pThis->insert);
+static void packInsert(DiskImageScriptEngine* pThis)
+{
+    DiskImagePacker_Pack(&pThis->packer, &pThis->insert);
+    /* Where an insert is packed depends on the lengths of the objects packed before it so a plan has to be
+       recompiled whenever they change. */
+    pThis->isResolvedFromObject = TRUE;
+    pThis->isLinePacked = TRUE;
+    pThis->packedLineCount++;
+}
+
+static void addEquates(DiskImageScriptEngine* pThis, const SizedString* pObjectFilename, const DiskImageInsert* pInsert)
+{
+    const char* pLabel;
+    char        value[16];
+    
+    if (!pThis->pDiskImage->pEquatesFilename || pInsert->type != DISK_IMAGE_INSERTION_RW18)
+        return;
+    
+    if (pThis->equates.length == 0)
+        appendEquatesHeader(pThis);
+    pLabel = createUniqueEquateLabel(pThis, pObjectFilename);
+    sprintf(value, "$%02X", pInsert->side);
+    appendEquate(pThis, pLabel, "SIDE", value);
+    sprintf(value, "%u", pInsert->track);
+    appendEquate(pThis, pLabel, "TRACK", value);
+    sprintf(value, "$%04X", pInsert->intraTrackOffset);
+    appendEquate(pThis, pLabel, "OFFSET", value);
+    sprintf(value, "$%04X", pInsert->length);
+    appendEquate(pThis, pLabel, "LENGTH", value);
+}
+
+static void appendEquatesHeader(DiskImageScriptEngine* pThis)
+{
+    static const char generatedBy[] = "* Generated by crackle from ";
+    static const char doNotEdit[] = ".  Do not edit." LINE_ENDING;
+    
+    appendText(&pThis->equates, generatedBy, sizeof(generatedBy) - 1);
+    appendText(&pThis->equates, pThis->pScriptFilename, strlen(pThis->pScriptFilename));
+    appendText(&pThis->equates, doNotEdit, sizeof(doNotEdit) - 1);
+}
+
+static const char* createUniqueEquateLabel(DiskImageScriptEngine* pThis, const SizedString* pObjectFilename)
+{
+    const char*  pStart = pObjectFilename->pString;
+    const char*  pEnd = pStart + pObjectFilename->stringLength;
+    const char*  pExtension = NULL;
+    const char*  pCurr;
+    char*        pLabel;
+    char*        pDest;
+    size_t       baseLength;
+    unsigned int suffix;
+    
+    for (pCurr = pStart ; pCurr < pEnd ; pCurr++)
+    {
+        if (*pCurr == '/' || *pCurr == '\\')
+        {
+            pStart = pCurr + 1;
+            pExtension = NULL;
+        }
+        else if (*pCurr == '.')
+        {
+            pExtension = pCurr;
+        }
+    }
+    if (pExtension && pExtension > pStart)
+        pEnd = pExtension;
+    
+    /* Room for a leading '_' and a unique suffix such as _12. */
+    pLabel = allocateAndZero((pEnd - pStart) + 16);
+    pDest = pLabel;
+    if (pStart == pEnd || isdigit((unsigned char)*pStart))
+        *pDest++ = '_';
+    for (pCurr = pStart ; pCurr < pEnd ; pCurr++)
+        *pDest++ = isalnum((unsigned char)*pCurr) ? toupper((unsigned char)*pCurr) : '_';
+    baseLength = pDest - pLabel;
+    
+    /* An object placed by more than one line gets _2, _3, etc. appended to the labels of its later placements. */
+    for (suffix = 2 ; isEquateLabelUsed(pThis, pLabel) ; suffix++)
+        sprintf(pLabel + baseLength, "_%u", suffix);
+    
+    __try
+        rememberEquateLabel(pThis, pLabel);
+    __catch
+    {
+        free(pLabel);
+        __rethrow;
+    }
+    return pLabel;
+}
+
+static int isEquateLabelUsed(DiskImageScriptEngine* pThis, const char* pLabel)
+{
+    unsigned int i;
+    
+    for (i = 0 ; i < pThis->equateLabelCount ; i++)
+    {
+        if (0 == strcmp(pThis->ppEquateLabels[i], pLabel))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static void rememberEquateLabel(DiskImageScriptEngine* pThis, char* pLabel)
+{
+    if (pThis->equateLabelCount >= pThis->allocatedEquateLabelCount)
+    {
+        unsigned int newCount = pThis->allocatedEquateLabelCount ? 2 * pThis->allocatedEquateLabelCount : 64;
+        char**       ppRealloc = realloc(pThis->ppEquateLabels, newCount * sizeof(*ppRealloc));
+        
+        if (!ppRealloc)
+            __throw(outOfMemoryException);
+        pThis->ppEquateLabels = ppRealloc;
+        pThis->allocatedEquateLabelCount = newCount;
+    }
+    pThis->ppEquateLabels[pThis->equateLabelCount++] = pLabel;
+}
+
+static void appendEquate(DiskImageScriptEngine* pThis, const char* pLabel, const char* pField, const char* pValue)
+{
+    DiskImageText* pText = &pThis->equates;
+    
+    appendText(pText, pLabel, strlen(pLabel));
+    appendText(pText, "_", 1);
+    appendText(pText, pField, strlen(pField));
+    appendText(pText, " EQU ", 5);
+    appendText(pText, pValue, strlen(pValue));
+    appendText(pText, LINE_ENDING, sizeof(LINE_ENDING) - 1);
 }
 
 static void processImageTableUpdates(DiskImageScriptEngine* pThis, unsigned short newImageTableAddress)
 {
     unsigned short imageTableSize;
 
+    pThis->imageTableAddress = newImageTableAddress;
+    pThis->isResolvedFromObject = TRUE;
     DiskImage_UpdateImageTableFile(pThis->pDiskImage, newImageTableAddress);
     imageTableSize = getImageTableObjectSize(pThis->pDiskImage, newImageTableAddress);
     if (pThis->insert.length > imageTableSize)
@@ -321,9 +843,9 @@ static void processImageTableUpdates(DiskImageScriptEngine* pThis, unsigned shor
 
 static unsigned short getImageTableObjectSize(DiskImage* pDiskImage, unsigned short startImageTableAddress)
 {
-    unsigned char* pObject = pDiskImage->object.pBuffer;
-    unsigned char  imageCount;
-    unsigned short lastImageTableAddress;
+    const unsigned char* pObject = pDiskImage->pObject;
+    unsigned char        imageCount;
+    unsigned short       lastImageTableAddress;
     
     imageCount = *pObject++;
     pObject += (imageCount * 2);
@@ -333,6 +855,7 @@ static unsigned short getImageTableObjectSize(DiskImage* pDiskImage, unsigned sh
     return (lastImageTableAddress - startImageTableAddress);
 }
 
+static void reportInsertException(DiskImageScriptEngine* pThis, int exceptionCode);
 static void reportScriptLineException(DiskImageScriptEngine* pThis)
 {
     const SizedString* pFields = ParseCSV_FieldPointers(pThis->pParser);
@@ -349,7 +872,9 @@ static void reportScriptLineException(DiskImageScriptEngine* pThis)
              exceptionCode == invalidIntraBlockOffsetException ||
              exceptionCode == invalidIntraTrackOffsetException ||
              exceptionCode == invalidSourceOffsetException ||
-             exceptionCode == invalidLengthException );
+             exceptionCode == invalidLengthException ||
+             exceptionCode == diskFullException ||
+             exceptionCode == outOfMemoryException );
 
     /* Note: invalidArgumentException prints error text before throwing. */
     if (exceptionCode == fileOpenException)
@@ -358,12 +883,23 @@ static void reportScriptLineException(DiskImageScriptEngine* pThis)
     else if (exceptionCode == fileException)
         LOG_ERROR(pThis, "Failed to process '%.*s' object file.", 
                   pFields[1].stringLength, pFields[1].pString);
-    else if (exceptionCode == blockExceedsImageBoundsException)
-        LOG_ERROR(pThis, "Write starting at block %u offset %u won't fit in output image file.", 
-                  pThis->insert.block, pThis->insert.intraBlockOffset);
     else if (exceptionCode == invalidInsertionTypeException)
         LOG_ERROR(pThis, "%.*s insertion type isn't supported for this output image type.", 
                   pFields[0].stringLength, pFields[0].pString);
+    else
+        reportInsertException(pThis, exceptionCode);
+}
+
+static void reportInsertException(DiskImageScriptEngine* pThis, int exceptionCode)
+{
+    static const char* insertionTypeNames[] = { "RWTS16", "RW18", "BLOCK" };
+    
+    if (exceptionCode == blockExceedsImageBoundsException)
+        LOG_ERROR(pThis, "Write starting at block %u offset %u won't fit in output image file.", 
+                  pThis->insert.block, pThis->insert.intraBlockOffset);
+    else if (exceptionCode == invalidInsertionTypeException)
+        LOG_ERROR(pThis, "%s insertion type isn't supported for this output image type.", 
+                  insertionTypeNames[pThis->insert.type]);
     else if (exceptionCode == invalidSideException)
         LOG_ERROR(pThis, "0x%x specifies an invalid side.  Must be 0xa9, 0xad, 0x79.", pThis->insert.side);
     else if (exceptionCode == invalidSectorException)
@@ -384,6 +920,10 @@ static void reportScriptLineException(DiskImageScriptEngine* pThis)
     else if (exceptionCode == invalidLengthException)
         LOG_ERROR(pThis, "%u specifies an invalid legnth.", 
                   pThis->insert.length);
+    else if (exceptionCode == diskFullException)
+        LOG_ERROR(pThis, "No free space is left on side 0x%x for %u bytes.", pThis->insert.side, pThis->insert.length);
+    else if (exceptionCode == outOfMemoryException)
+        LOG_ERROR(pThis, "%s", "Ran out of memory.");
 }
 
 
@@ -407,59 +947,358 @@ static void DiskImageScriptEngine_ProcessScript(DiskImageScriptEngine* pThis,
 }
 
 
-static FILE* openFile(const char* pFilename, const char* pMode);
-static void determineObjectSizeFromFileHeader(DiskImage* pThis, FILE* pFile);
-static int wasSAVedFromAssembler(const char* pSignature);
-static int wasRW18SAVedFromAssembler(const char* pSignature);
-static void readInRW18SavHeaderToSetDefaultInsertOptions(DiskImage* pThis, FILE* pFile, void* pvPartialHeader);
-static RW18SavFileHeader readInRestOfRW18FileHeader(DiskImage* pThis, FILE* pFile, void* pPartialHeader);
-static long getFileSize(FILE* pFile);
-static unsigned int roundUpLengthToBlockSize(unsigned int length);
-__throws void DiskImage_ReadObjectFile(DiskImage* pThis, const char* pFilename)
+__throws DiskImageObjectCache* DiskImageObjectCache_Create(void)
 {
-    FILE*         pFile = NULL;
-    unsigned int  roundedObjectSize;
+    DiskImageObjectCache* pThis = allocateAndZero(sizeof(*pThis));
     
-    __try
-    {
-        pFile = openFile(pFilename, "rb");
-        memset(&pThis->insert, 0, sizeof(pThis->insert));
-        determineObjectSizeFromFileHeader(pThis, pFile);
-        roundedObjectSize = roundUpLengthToBlockSize(pThis->objectFileLength);
-        ByteBuffer_Allocate(&pThis->object, roundedObjectSize);
-        ByteBuffer_ReadPartialFromFile(&pThis->object, pThis->objectFileLength, pFile);
-    }
-    __catch
-    {
-        if (pFile)
-            fclose(pFile);
-        __rethrow;
-    }
-
-    fclose(pFile);    
+    pthread_mutex_init(&pThis->mutex, NULL);
+    pThis->referenceCount = 1;
+    return pThis;
 }
 
-static FILE* openFile(const char* pFilename, const char* pMode)
+
+static void freeCachedObjects(DiskImageObjectCache* pThis);
+void DiskImageObjectCache_Free(DiskImageObjectCache* pThis)
 {
-    FILE* pFile = fopen(pFilename, pMode);
-    if (!pFile)
-        __throw(fileOpenException);
-    return pFile;
+    unsigned int referenceCount;
+    
+    if (!pThis)
+        return;
+    
+    pthread_mutex_lock(&pThis->mutex);
+    referenceCount = --pThis->referenceCount;
+    pthread_mutex_unlock(&pThis->mutex);
+    if (referenceCount > 0)
+        return;
+    
+    freeCachedObjects(pThis);
+    pthread_mutex_destroy(&pThis->mutex);
+    free(pThis);
 }
 
-static void determineObjectSizeFromFileHeader(DiskImage* pThis, FILE* pFile)
+static void freeCachedObject(DiskImageCachedObject* pObject);
+static void freeCachedObjects(DiskImageObjectCache* pThis)
 {
-    SavFileHeader     header;
-    size_t            bytesRead;
+    DiskImageCachedObject* pObject = pThis->pObjects;
     
-    bytesRead = fread(&header, 1, sizeof(header), pFile);
-    if (bytesRead == sizeof(header) && wasSAVedFromAssembler(header.signature))
-    {
-        pThis->objectFileLength = header.length;
-    }
-    else if (bytesRead == sizeof(header) && wasRW18SAVedFromAssembler(header.signature))
+    while (pObject)
     {
-        readInRW18SavHeaderToSetDefaultInsertOptions(pThis, pFile, &header);
+        DiskImageCachedObject* pNext = pObject->pNext;
+        freeCachedObject(pObject);
+        pObject = pNext;
+    }
+}
+
+static void freeCachedObject(DiskImageCachedObject* pObject)
+{
+    ByteBuffer_Free(&pObject->data);
+    free(pObject);
+}
+
+
+void DiskImage_SetObjectCache(DiskImage* pThis, DiskImageObjectCache* pCache)
+{
+    pthread_mutex_lock(&pCache->mutex);
+    pCache->referenceCount++;
+    pthread_mutex_unlock(&pCache->mutex);
+    
+    releaseHeldObjects(pThis);
+    DiskImageObjectCache_Free(pThis->pObjectCache);
+    pThis->pObjectCache = pCache;
+}
+
+static void releaseHeldObjects(DiskImage* pThis)
+{
+    DiskImageObjectCache* pCache = pThis->pObjectCache;
+    unsigned int          i;
+    
+    if (!pCache)
+        return;
+    
+    pthread_mutex_lock(&pCache->mutex);
+    for (i = 0 ; i < pThis->heldObjectCount ; i++)
+    {
+        DiskImageCachedObject* pObject = pThis->ppHeldObjects[i];
+        
+        if (--pObject->referenceCount == 0 && pObject->isSuperseded)
+            freeCachedObject(pObject);
+    }
+    pthread_mutex_unlock(&pCache->mutex);
+    
+    free(pThis->ppHeldObjects);
+    pThis->ppHeldObjects = NULL;
+    pThis->heldObjectCount = 0;
+    pThis->heldObjectsAllocated = 0;
+}
+
+
+__throws void DiskImage_AddInMemoryObject(DiskImage*             pThis, 
+                                          const char*            pFilename, 
+                                          const unsigned char*   pData, 
+                                          unsigned int           length,
+                                          const DiskImageInsert* pDefaultInsert)
+{
+    size_t           filenameLength = strlen(pFilename);
+    DiskImageObject* pObject = allocateAndZero(sizeof(*pObject) + filenameLength + 1);
+    
+    memcpy(pObject->filename, pFilename, filenameLength + 1);
+    pObject->pData = pData;
+    pObject->length = length;
+    if (pDefaultInsert)
+        pObject->defaultInsert = *pDefaultInsert;
+    pObject->pNext = pThis->pInMemoryObjects;
+    pThis->pInMemoryObjects = pObject;
+}
+
+
+static DiskImageObject* findInMemoryObject(DiskImage* pThis, const char* pFilename);
+static void readInMemoryObject(DiskImage* pThis, DiskImageObject* pObject);
+static DiskImageCachedObject* findOrReadCachedObject(DiskImage*          pThis, 
+                                                     const char*         pFilename, 
+                                                     const VfsFileStamp* pStamp);
+static void growHeldObjectsIfNecessary(DiskImage* pThis);
+static DiskImageCachedObject* findCachedObject(DiskImageObjectCache* pCache, const char* pFilename);
+static void holdCachedObject(DiskImage* pThis, DiskImageCachedObject* pObject);
+static void useCachedObject(DiskImage* pThis, DiskImageCachedObject* pObject);
+static int isStampEqual(const VfsFileStamp* pStamp1, const VfsFileStamp* pStamp2);
+static void readObjectFromFile(DiskImage* pThis, const char* pFilename, ByteBuffer* pBuffer);
+static DiskImageCachedObject* cacheObject(DiskImage*             pThis, 
+                                          const char*            pFilename,
+                                          const VfsFileStamp*    pStamp,
+                                          ByteBuffer*            pBuffer,
+                                          DiskImageCachedObject* pStaleObject);
+static void useObjectCopy(DiskImage* pThis);
+static FILE* openFile(Vfs* pVfs, const char* pFilename, const char* pMode);
+static void determineObjectSizeFromFileHeader(DiskImage* pThis, FILE* pFile);
+static int wasSAVedFromAssembler(const char* pSignature);
+static int wasRW18SAVedFromAssembler(const char* pSignature);
+static void readInRW18SavHeaderToSetDefaultInsertOptions(DiskImage* pThis, FILE* pFile, void* pvPartialHeader);
+static RW18SavFileHeader readInRestOfRW18FileHeader(DiskImage* pThis, FILE* pFile, void* pPartialHeader);
+static long getFileSize(FILE* pFile);
+static unsigned int roundUpLengthToBlockSize(unsigned int length);
+__throws void DiskImage_ReadObjectFile(DiskImage* pThis, const char* pFilename)
+{
+    DiskImageObject* pInMemoryObject = findInMemoryObject(pThis, pFilename);
+    VfsFileStamp     stamp;
+    
+    pThis->pObject = NULL;
+    pThis->objectSize = 0;
+    pThis->isObjectUnpadded = FALSE;
+    pThis->pObjectFilename = NULL;
+    pThis->hasObjectStamp = FALSE;
+    if (pInMemoryObject)
+    {
+        readInMemoryObject(pThis, pInMemoryObject);
+        return;
+    }
+    
+    if (!Vfs_GetFileStamp(pThis->pVfs, pFilename, &stamp))
+    {
+        readObjectFromFile(pThis, pFilename, &pThis->objectCopy);
+        useObjectCopy(pThis);
+        return;
+    }
+    
+    useCachedObject(pThis, findOrReadCachedObject(pThis, pFilename, &stamp));
+}
+
+static DiskImageObject* findInMemoryObject(DiskImage* pThis, const char* pFilename)
+{
+    DiskImageObject* pObject = pThis->pInMemoryObjects;
+    
+    while (pObject && 0 != strcmp(pObject->filename, pFilename))
+        pObject = pObject->pNext;
+    return pObject;
+}
+
+static void readInMemoryObject(DiskImage* pThis, DiskImageObject* pObject)
+{
+    pThis->pObjectFilename = pObject->filename;
+    pThis->insert = pObject->defaultInsert;
+    pThis->objectFileLength = pObject->length;
+    pThis->pObject = pObject->pData;
+    pThis->objectSize = roundUpLengthToBlockSize(pObject->length);
+    pThis->isObjectUnpadded = TRUE;
+}
+
+static DiskImageCachedObject* findOrReadCachedObject(DiskImage*          pThis, 
+                                                     const char*         pFilename, 
+                                                     const VfsFileStamp* pStamp)
+{
+    DiskImageObjectCache*  pCache = pThis->pObjectCache;
+    DiskImageCachedObject* pCachedObject = NULL;
+    ByteBuffer             buffer = { NULL, 0 };
+    
+    /* The lock is held while reading the file so that images sharing the cache never read the same file twice. */
+    pthread_mutex_lock(&pCache->mutex);
+    __try
+    {
+        /* Room to hold the entry is made first so that nothing can fail once the buffer is owned by the cache. */
+        growHeldObjectsIfNecessary(pThis);
+        pCachedObject = findCachedObject(pCache, pFilename);
+        if (!pCachedObject || !isStampEqual(&pCachedObject->stamp, pStamp))
+        {
+            readObjectFromFile(pThis, pFilename, &buffer);
+            pCachedObject = cacheObject(pThis, pFilename, pStamp, &buffer, pCachedObject);
+        }
+        holdCachedObject(pThis, pCachedObject);
+    }
+    __catch
+    {
+        pthread_mutex_unlock(&pCache->mutex);
+        ByteBuffer_Free(&buffer);
+        __rethrow;
+    }
+    pthread_mutex_unlock(&pCache->mutex);
+    
+    return pCachedObject;
+}
+
+static void growHeldObjectsIfNecessary(DiskImage* pThis)
+{
+    DiskImageCachedObject** ppRealloc;
+    unsigned int            newCount;
+    
+    if (pThis->heldObjectCount < pThis->heldObjectsAllocated)
+        return;
+    newCount = pThis->heldObjectsAllocated ? 2 * pThis->heldObjectsAllocated : 16;
+    ppRealloc = realloc(pThis->ppHeldObjects, newCount * sizeof(*ppRealloc));
+    if (!ppRealloc)
+        __throw(outOfMemoryException);
+    pThis->ppHeldObjects = ppRealloc;
+    pThis->heldObjectsAllocated = newCount;
+}
+
+static DiskImageCachedObject* findCachedObject(DiskImageObjectCache* pCache, const char* pFilename)
+{
+    DiskImageCachedObject* pObject = pCache->pObjects;
+    
+    while (pObject && 0 != strcmp(pObject->filename, pFilename))
+        pObject = pObject->pNext;
+    return pObject;
+}
+
+static void holdCachedObject(DiskImage* pThis, DiskImageCachedObject* pObject)
+{
+    unsigned int i;
+    
+    /* Searched from the end since consecutive script lines tend to use the same object. */
+    for (i = pThis->heldObjectCount ; i > 0 ; i--)
+    {
+        if (pThis->ppHeldObjects[i - 1] == pObject)
+            return;
+    }
+    pThis->ppHeldObjects[pThis->heldObjectCount++] = pObject;
+    pObject->referenceCount++;
+}
+
+static void useCachedObject(DiskImage* pThis, DiskImageCachedObject* pObject)
+{
+    pThis->pObjectFilename = pObject->filename;
+    pThis->objectStamp = pObject->stamp;
+    pThis->hasObjectStamp = TRUE;
+    pThis->insert = pObject->defaultInsert;
+    pThis->objectFileLength = pObject->length;
+    pThis->pObject = pObject->data.pBuffer;
+    pThis->objectSize = pObject->data.bufferSize;
+}
+
+static int isStampEqual(const VfsFileStamp* pStamp1, const VfsFileStamp* pStamp2)
+{
+    return pStamp1->modificationTime == pStamp2->modificationTime &&
+           pStamp1->modificationNsec == pStamp2->modificationNsec &&
+           pStamp1->size == pStamp2->size;
+}
+
+static void readObjectFromFile(DiskImage* pThis, const char* pFilename, ByteBuffer* pBuffer)
+{
+    FILE*        pFile = NULL;
+    unsigned int roundedObjectSize;
+    
+    __try
+    {
+        pFile = openFile(pThis->pVfs, pFilename, "rb");
+        memset(&pThis->insert, 0, sizeof(pThis->insert));
+        determineObjectSizeFromFileHeader(pThis, pFile);
+        roundedObjectSize = roundUpLengthToBlockSize(pThis->objectFileLength);
+        ByteBuffer_Allocate(pBuffer, roundedObjectSize);
+        ByteBuffer_ReadPartialFromFile(pBuffer, pThis->objectFileLength, pFile);
+    }
+    __catch
+    {
+        if (pFile)
+            fclose(pFile);
+        __rethrow;
+    }
+
+    fclose(pFile);    
+}
+
+static void unlinkStaleObject(DiskImageObjectCache* pCache, DiskImageCachedObject* pStaleObject);
+static DiskImageCachedObject* cacheObject(DiskImage*             pThis, 
+                                          const char*            pFilename,
+                                          const VfsFileStamp*    pStamp,
+                                          ByteBuffer*            pBuffer,
+                                          DiskImageCachedObject* pStaleObject)
+{
+    DiskImageObjectCache*  pCache = pThis->pObjectCache;
+    size_t                 filenameLength = strlen(pFilename);
+    DiskImageCachedObject* pObject = allocateAndZero(sizeof(*pObject) + filenameLength + 1);
+    
+    memcpy(pObject->filename, pFilename, filenameLength + 1);
+    pObject->data = *pBuffer;
+    pObject->stamp = *pStamp;
+    pObject->defaultInsert = pThis->insert;
+    pObject->length = pThis->objectFileLength;
+    pObject->pNext = pCache->pObjects;
+    pCache->pObjects = pObject;
+    if (pStaleObject)
+        unlinkStaleObject(pCache, pStaleObject);
+    
+    return pObject;
+}
+
+static void unlinkStaleObject(DiskImageObjectCache* pCache, DiskImageCachedObject* pStaleObject)
+{
+    DiskImageCachedObject** ppPrev = &pCache->pObjects;
+    
+    while (*ppPrev != pStaleObject)
+        ppPrev = &(*ppPrev)->pNext;
+    *ppPrev = pStaleObject->pNext;
+    pStaleObject->pNext = NULL;
+    pStaleObject->isSuperseded = TRUE;
+    if (pStaleObject->referenceCount == 0)
+        freeCachedObject(pStaleObject);
+}
+
+static void useObjectCopy(DiskImage* pThis)
+{
+    pThis->pObject = pThis->objectCopy.pBuffer;
+    pThis->objectSize = pThis->objectCopy.bufferSize;
+    pThis->isObjectUnpadded = FALSE;
+}
+
+static FILE* openFile(Vfs* pVfs, const char* pFilename, const char* pMode)
+{
+    FILE* pFile = Vfs_Open(pVfs, pFilename, pMode);
+    if (!pFile)
+        __throw(fileOpenException);
+    return pFile;
+}
+
+static void determineObjectSizeFromFileHeader(DiskImage* pThis, FILE* pFile)
+{
+    SavFileHeader     header;
+    size_t            bytesRead;
+    
+    bytesRead = fread(&header, 1, sizeof(header), pFile);
+    if (bytesRead == sizeof(header) && wasSAVedFromAssembler(header.signature))
+    {
+        pThis->objectFileLength = header.length;
+    }
+    else if (bytesRead == sizeof(header) && wasRW18SAVedFromAssembler(header.signature))
+    {
+        readInRW18SavHeaderToSetDefaultInsertOptions(pThis, pFile, &header);
     }
     else
     {
@@ -470,12 +1309,15 @@ static void determineObjectSizeFromFileHeader(DiskImage* pThis, FILE* pFile)
 
 static int wasSAVedFromAssembler(const char* pSignature)
 {
-    return 0 == memcmp(pSignature, BINARY_BUFFER_SAV_SIGNATURE, 4);
+    /* The length in the header of a compressed object is its compressed length so it is inserted as is. */
+    return 0 == memcmp(pSignature, BINARY_BUFFER_SAV_SIGNATURE, 4) ||
+           0 == memcmp(pSignature, BINARY_BUFFER_LZSAV_SIGNATURE, 4);
 }
 
 static int wasRW18SAVedFromAssembler(const char* pSignature)
 {
-    return 0 == memcmp(pSignature, BINARY_BUFFER_RW18SAV_SIGNATURE, 4);
+    return 0 == memcmp(pSignature, BINARY_BUFFER_RW18SAV_SIGNATURE, 4) ||
+           0 == memcmp(pSignature, BINARY_BUFFER_LZRW18SAV_SIGNATURE, 4);
 }
 
 static void readInRW18SavHeaderToSetDefaultInsertOptions(DiskImage* pThis, FILE* pFile, void* pPartialHeader)
@@ -520,19 +1362,21 @@ static unsigned int roundUpLengthToBlockSize(unsigned int length)
 
 
 static void validateObjectFileHasValidImageTableHeader(DiskImage* pThis);
+static void makeObjectWritable(DiskImage* pThis);
 static void updateImageTableAddresses(DiskImage* pThis, unsigned short newImageTableAddress);
 __throws void DiskImage_UpdateImageTableFile(DiskImage* pThis, unsigned short newImageTableAddress)
 {
     validateObjectFileHasValidImageTableHeader(pThis);
+    makeObjectWritable(pThis);
     updateImageTableAddresses(pThis, newImageTableAddress);
 }
 
 static void validateObjectFileHasValidImageTableHeader(DiskImage* pThis)
 {
-    unsigned char* pObject = pThis->object.pBuffer;
-    unsigned char  imageCount;
-    unsigned short expectedStartAddress;
-    unsigned short actualStartAddress;
+    const unsigned char* pObject = pThis->pObject;
+    unsigned char        imageCount;
+    unsigned short       expectedStartAddress;
+    unsigned short       actualStartAddress;
     
     if (pThis->objectFileLength < 3)
         __throw(fileException);
@@ -545,9 +1389,21 @@ static void validateObjectFileHasValidImageTableHeader(DiskImage* pThis)
         __throw(fileException);
 }
 
+static void makeObjectWritable(DiskImage* pThis)
+{
+    const unsigned char* pSource = pThis->pObject;
+    
+    if (pSource == pThis->objectCopy.pBuffer)
+        return;
+    /* Only objectFileLength bytes are copied since in-memory objects aren't padded.  The rest stays zero filled. */
+    ByteBuffer_Allocate(&pThis->objectCopy, pThis->objectSize);
+    memcpy(pThis->objectCopy.pBuffer, pSource, pThis->objectFileLength);
+    useObjectCopy(pThis);
+}
+
 static void updateImageTableAddresses(DiskImage* pThis, unsigned short newImageTableAddress)
 {
-    unsigned char* pObject = pThis->object.pBuffer;
+    unsigned char* pObject = pThis->objectCopy.pBuffer;
     unsigned int   bytesLeft = pThis->objectFileLength;
     unsigned char  imageCount;
     unsigned char  i;
@@ -576,29 +1432,157 @@ static void updateImageTableAddresses(DiskImage* pThis, unsigned short newImageT
 
 
 static void validateSourceObjectParameters(DiskImage* pThis, DiskImageInsert* pInsert);
+static void addPlanEntry(DiskImage* pThis, const DiskImageInsert* pInsert);
+static void recordInsert(DiskImage* pThis, DiskImageInsert* pInsert);
 __throws void DiskImage_InsertObjectFile(DiskImage* pThis, DiskImageInsert* pInsert)
 {
     validateSourceObjectParameters(pThis, pInsert);
-    pThis->pVTable->insertData(pThis, pThis->object.pBuffer, pInsert);
+    /* An insert which reads into the zero padding after an in-memory object needs a padded copy to read from. */
+    if (pThis->isObjectUnpadded && pInsert->sourceOffset + pInsert->length > pThis->objectFileLength)
+        makeObjectWritable(pThis);
+    if (pThis->pPlan)
+        addPlanEntry(pThis, pInsert);
+    if (pThis->pManifest)
+        recordInsert(pThis, pInsert);
+    else
+        pThis->pVTable->insertData(pThis, pThis->pObject, pInsert);
 }
 
 static void validateSourceObjectParameters(DiskImage* pThis, DiskImageInsert* pInsert)
 {
     if (pInsert->sourceOffset >= pThis->objectFileLength)
         __throw(invalidSourceOffsetException);
-    if (pInsert->sourceOffset + pInsert->length > pThis->object.bufferSize)
+    if (pInsert->sourceOffset + pInsert->length > pThis->objectSize)
         __throw(invalidLengthException);
 }
 
+static void addPlanEntry(DiskImage* pThis, const DiskImageInsert* pInsert)
+{
+    DiskImageScriptEngine* pScript = &pThis->script;
+    DiskImagePlanEntry     entry;
+    
+    if (!pThis->pObjectFilename)
+    {
+        /* Objects which weren't cached have no name to be read back from when the plan is replayed so the plan is
+           abandoned. */
+        pThis->pPlan = NULL;
+        return;
+    }
+    
+    memset(&entry, 0, sizeof(entry));
+    entry.insert = *pInsert;
+    entry.lineNumber = pScript->lineNumber;
+    entry.imageTableAddress = pScript->imageTableAddress;
+    entry.isResolvedFromObject = pScript->isResolvedFromObject;
+    if (!pThis->pVTable->getInsertRegions(pThis, pInsert, &entry.firstRegion, &entry.lastRegion))
+        entry.firstRegion = entry.lastRegion = 0;
+    DiskImagePlan_AddEntry(pThis->pPlan, 
+                           &entry, 
+                           pThis->pObjectFilename, 
+                           pThis->hasObjectStamp ? &pThis->objectStamp : NULL);
+}
+
+static void recordInsert(DiskImage* pThis, DiskImageInsert* pInsert)
+{
+    unsigned int firstRegion;
+    unsigned int lastRegion;
+    
+    /* Validated as each line is recorded so that errors are reported in script order and for every line, including
+       the ones which an incremental build doesn't replay. */
+    pThis->pVTable->validateInsert(pThis, pInsert);
+    if (!pThis->pVTable->getInsertRegions(pThis, pInsert, &firstRegion, &lastRegion))
+    {
+        /* Inserts which can't touch the image are applied right away so that any error is still reported against
+           this script line. */
+        pThis->pVTable->insertData(pThis, pThis->pObject, pInsert);
+        return;
+    }
+    DiskImageManifest_AddEntry(pThis->pManifest, 
+                               pInsert, 
+                               pThis->pObject + pInsert->sourceOffset, 
+                               pThis->script.lineNumber, 
+                               firstRegion, 
+                               lastRegion);
+}
+
 
+static void writeSparseImage(DiskImage* pThis, FILE* pFile);
+static void seekTo(FILE* pFile, long offset);
 __throws void DiskImage_WriteImage(DiskImage* pThis, const char* pImageFilename)
 {
     FILE* pFile = NULL;
 
     __try
     {
-        pFile = openFile(pImageFilename, "wb");
-        ByteBuffer_WriteToFile(&pThis->image, pFile);
+        pThis->pVTable->flushImage(pThis);
+        pFile = openFile(pThis->pVfs, pImageFilename, "wb");
+        if (pThis->ppSparseRegions)
+            writeSparseImage(pThis, pFile);
+        else
+            ByteBuffer_WriteToFile(&pThis->image, pFile);
+    }
+    __catch
+    {
+        if (pFile)
+            fclose(pFile);
+        __rethrow;
+    }
+    
+    fclose(pFile);
+}
+
+static void writeSparseImage(DiskImage* pThis, FILE* pFile)
+{
+    static const unsigned char zero = 0;
+    unsigned int               regionCount = pThis->imageSize / pThis->regionSize;
+    unsigned int               region;
+    int                        isAfterHole = FALSE;
+    
+    for (region = 0 ; region < regionCount ; region++)
+    {
+        const unsigned char* pRegion = pThis->ppSparseRegions[region];
+        
+        if (!pRegion)
+        {
+            isAfterHole = TRUE;
+            continue;
+        }
+        if (isAfterHole)
+            seekTo(pFile, (long)region * pThis->regionSize);
+        if (pThis->regionSize != fwrite(pRegion, 1, pThis->regionSize, pFile))
+            __throw(fileException);
+        isAfterHole = FALSE;
+    }
+    
+    /* Seeking past the end of the file doesn't extend it so the last byte of a trailing hole has to be written. */
+    if (isAfterHole)
+    {
+        seekTo(pFile, (long)pThis->imageSize - 1);
+        if (1 != fwrite(&zero, 1, 1, pFile))
+            __throw(fileException);
+    }
+}
+
+static void seekTo(FILE* pFile, long offset)
+{
+    if (0 != fseek(pFile, offset, SEEK_SET))
+        __throw(fileException);
+}
+
+
+__throws void DiskImage_ReadImage(DiskImage* pThis, const char* pImageFilename)
+{
+    FILE* pFile = NULL;
+    
+    if (pThis->ppSparseRegions)
+        __throw(invalidArgumentException);
+    __try
+    {
+        pThis->pVTable->flushImage(pThis);
+        pFile = openFile(pThis->pVfs, pImageFilename, "rb");
+        if (getFileSize(pFile) != (long)pThis->image.bufferSize)
+            __throw(fileException);
+        ByteBuffer_ReadFromFile(&pThis->image, pFile);
     }
     __catch
     {
@@ -613,11 +1597,410 @@ __throws void DiskImage_WriteImage(DiskImage* pThis, const char* pImageFilename)
 
 unsigned char* DiskImage_GetImagePointer(DiskImage* pThis)
 {
+    pThis->pVTable->flushImage(pThis);
     return pThis->image.pBuffer;
 }
 
 
 size_t DiskImage_GetImageSize(DiskImage* pThis)
 {
-    return pThis->image.bufferSize;
+    return pThis->imageSize;
+}
+
+
+__throws unsigned char* DiskImage_GetRegionPointer(DiskImage* pThis, unsigned int region)
+{
+    unsigned char** ppRegion;
+    
+    if (!pThis->ppSparseRegions)
+        return pThis->image.pBuffer + region * pThis->regionSize;
+    
+    ppRegion = &pThis->ppSparseRegions[region];
+    if (!*ppRegion)
+        *ppRegion = allocateAndZero(pThis->regionSize);
+    return *ppRegion;
+}
+
+
+static char* buildFilenameWithSuffix(const char* pImageFilename, const char* pSuffix);
+static int loadPriorImage(DiskImage*         pThis, 
+                          DiskImageManifest* pManifest, 
+                          const char*        pImageFilename, 
+                          const char*        pManifestFilename);
+static int readImageFile(DiskImage* pThis, const char* pImageFilename);
+static void clearDirtyRegions(DiskImage* pThis, const unsigned char* pDirtyRegions, unsigned int regionCount);
+static void applySelectedEntries(DiskImage* pThis, DiskImageManifest* pManifest);
+static void applyEntry(DiskImage* pThis, DiskImageManifestEntry* pEntry);
+static void writeChangedRegions(DiskImage*           pThis, 
+                                const unsigned char* pOriginalImage,
+                                const unsigned char* pDirtyRegions, 
+                                unsigned int         regionCount,
+                                const char*          pImageFilename);
+static void writeRegion(DiskImage* pThis, FILE* pFile, unsigned int region);
+static void rebuildSparseImage(DiskImage* pThis, const char* pScriptFilename, const char* pImageFilename);
+__throws void DiskImage_UpdateImage(DiskImage* pThis, const char* pScriptFilename, const char* pImageFilename)
+{
+    DiskImageManifest oldManifest;
+    DiskImageManifest newManifest;
+    char*             pManifestFilename = NULL;
+    unsigned char*    pDirtyRegions = NULL;
+    ByteBuffer        originalImage = { NULL, 0 };
+    unsigned int      regionCount = pThis->image.bufferSize / pThis->regionSize;
+    unsigned int      priorErrorCount = pThis->script.errorCount;
+    int               isIncremental;
+    
+    if (pThis->ppSparseRegions)
+    {
+        rebuildSparseImage(pThis, pScriptFilename, pImageFilename);
+        return;
+    }
+    
+    memset(&oldManifest, 0, sizeof(oldManifest));
+    memset(&newManifest, 0, sizeof(newManifest));
+    newManifest.imageSize = pThis->image.bufferSize;
+    newManifest.regionSize = pThis->regionSize;
+    __try
+    {
+        pManifestFilename = buildFilenameWithSuffix(pImageFilename, DISK_IMAGE_MANIFEST_SUFFIX);
+        pDirtyRegions = allocateAndZero(regionCount);
+        
+        pThis->pManifest = &newManifest;
+        DiskImage_ProcessScriptFile(pThis, pScriptFilename);
+        pThis->pManifest = NULL;
+        
+        isIncremental = loadPriorImage(pThis, &oldManifest, pImageFilename, pManifestFilename);
+        if (DiskImageManifest_SelectEntries(isIncremental ? &oldManifest : NULL, 
+                                            &newManifest, 
+                                            pDirtyRegions, 
+                                            regionCount))
+        {
+            ByteBuffer_Allocate(&originalImage, pThis->image.bufferSize);
+            memcpy(originalImage.pBuffer, pThis->image.pBuffer, pThis->image.bufferSize);
+            clearDirtyRegions(pThis, pDirtyRegions, regionCount);
+            applySelectedEntries(pThis, &newManifest);
+            DiskImage_GetImagePointer(pThis);
+            if (isIncremental)
+                writeChangedRegions(pThis, originalImage.pBuffer, pDirtyRegions, regionCount, pImageFilename);
+            else
+                DiskImage_WriteImage(pThis, pImageFilename);
+            
+            /* Without a new manifest, lines which failed are checked again by the next update. */
+            newManifest.imageHash = DiskImageManifest_Hash(pThis->image.pBuffer, pThis->image.bufferSize);
+            if (pThis->script.errorCount == priorErrorCount)
+                DiskImageManifest_Write(&newManifest, pThis->pVfs, pManifestFilename);
+        }
+    }
+    __catch
+    {
+        pThis->pManifest = NULL;
+    }
+    
+    ByteBuffer_Free(&originalImage);
+    free(pDirtyRegions);
+    free(pManifestFilename);
+    DiskImageManifest_Free(&oldManifest);
+    DiskImageManifest_Free(&newManifest);
+    if (getExceptionCode())
+        __rethrow;
+}
+
+static void rebuildSparseImage(DiskImage* pThis, const char* pScriptFilename, const char* pImageFilename)
+{
+    /* Sparse images aren't held in one buffer which can be compared against the prior image so they are always
+       rebuilt in full.  Writing one only costs as much as the data it holds anyway. */
+    DiskImage_ProcessScriptFile(pThis, pScriptFilename);
+    DiskImage_WriteImage(pThis, pImageFilename);
+}
+
+static char* buildFilenameWithSuffix(const char* pImageFilename, const char* pSuffix)
+{
+    size_t imageFilenameLength = strlen(pImageFilename);
+    size_t suffixLength = strlen(pSuffix);
+    char*  pFilename = allocateAndZero(imageFilenameLength + suffixLength + 1);
+    
+    memcpy(pFilename, pImageFilename, imageFilenameLength);
+    memcpy(pFilename + imageFilenameLength, pSuffix, suffixLength + 1);
+    return pFilename;
+}
+
+static int loadPriorImage(DiskImage*         pThis, 
+                          DiskImageManifest* pManifest, 
+                          const char*        pImageFilename, 
+                          const char*        pManifestFilename)
+{
+    if (!readImageFile(pThis, pImageFilename))
+        return FALSE;
+    
+    /* The image hash catches images which were modified after the manifest was written. */
+    if (DiskImageManifest_Read(pManifest, pThis->pVfs, pManifestFilename) &&
+        pManifest->imageHash == DiskImageManifest_Hash(pThis->image.pBuffer, pThis->image.bufferSize))
+    {
+        return TRUE;
+    }
+    memset(pThis->image.pBuffer, 0, pThis->image.bufferSize);
+    return FALSE;
+}
+
+static int readImageFile(DiskImage* pThis, const char* pImageFilename)
+{
+    FILE* pFile = Vfs_Open(pThis->pVfs, pImageFilename, "rb");
+    int   result;
+    
+    if (!pFile)
+        return FALSE;
+    result = getFileSize(pFile) == (long)pThis->image.bufferSize &&
+             pThis->image.bufferSize == fread(pThis->image.pBuffer, 1, pThis->image.bufferSize, pFile);
+    fclose(pFile);
+    
+    if (!result)
+        memset(pThis->image.pBuffer, 0, pThis->image.bufferSize);
+    return result;
+}
+
+static void clearDirtyRegions(DiskImage* pThis, const unsigned char* pDirtyRegions, unsigned int regionCount)
+{
+    unsigned int region;
+    
+    for (region = 0 ; region < regionCount ; region++)
+    {
+        if (pDirtyRegions[region])
+            memset(pThis->image.pBuffer + region * pThis->regionSize, 0, pThis->regionSize);
+    }
+}
+
+static void applySelectedEntries(DiskImage* pThis, DiskImageManifest* pManifest)
+{
+    unsigned int i;
+    
+    for (i = 0 ; i < pManifest->entryCount ; i++)
+    {
+        if (pManifest->pEntries[i].isSelected)
+            applyEntry(pThis, &pManifest->pEntries[i]);
+    }
+}
+
+static void applyEntry(DiskImage* pThis, DiskImageManifestEntry* pEntry)
+{
+    DiskImageScriptEngine* pScript = &pThis->script;
+    
+    pScript->lineNumber = pEntry->lineNumber;
+    pScript->insert = pEntry->insert;
+    __try
+    {
+        pThis->pVTable->insertData(pThis, pEntry->pData, &pScript->insert);
+    }
+    __catch
+    {
+        reportInsertException(pScript, getExceptionCode());
+        __nothrow;
+    }
+}
+
+static void writeChangedRegions(DiskImage*           pThis, 
+                                const unsigned char* pOriginalImage,
+                                const unsigned char* pDirtyRegions, 
+                                unsigned int         regionCount,
+                                const char*          pImageFilename)
+{
+    FILE*        pFile = NULL;
+    unsigned int region;
+    
+    __try
+    {
+        for (region = 0 ; region < regionCount ; region++)
+        {
+            size_t offset = region * pThis->regionSize;
+            
+            if (!pDirtyRegions[region] || 
+                0 == memcmp(pOriginalImage + offset, pThis->image.pBuffer + offset, pThis->regionSize))
+            {
+                continue;
+            }
+            if (!pFile)
+                pFile = openFile(pThis->pVfs, pImageFilename, "r+b");
+            writeRegion(pThis, pFile, region);
+        }
+    }
+    __catch
+    {
+        if (pFile)
+            fclose(pFile);
+        __rethrow;
+    }
+    
+    if (pFile && 0 != fclose(pFile))
+        __throw(fileException);
+}
+
+static void writeRegion(DiskImage* pThis, FILE* pFile, unsigned int region)
+{
+    long offset = (long)region * pThis->regionSize;
+    
+    if (0 != fseek(pFile, offset, SEEK_SET) ||
+        pThis->regionSize != fwrite(pThis->image.pBuffer + offset, 1, pThis->regionSize, pFile))
+    {
+        __throw(fileException);
+    }
+}
+
+
+__throws void DiskImage_EnablePlan(DiskImage* pThis, const char* pImageFilename)
+{
+    char* pPlanFilename = buildFilenameWithSuffix(pImageFilename, DISK_IMAGE_PLAN_SUFFIX);
+    
+    free(pThis->pPlanFilename);
+    pThis->pPlanFilename = pPlanFilename;
+}
+
+
+__throws void DiskImage_EnableResolvedScript(DiskImage* pThis, const char* pImageFilename)
+{
+    char* pResolvedScriptFilename = buildFilenameWithSuffix(pImageFilename, DISK_IMAGE_RESOLVED_SCRIPT_SUFFIX);
+    
+    free(pThis->pResolvedScriptFilename);
+    pThis->pResolvedScriptFilename = pResolvedScriptFilename;
+}
+
+
+__throws void DiskImage_EnableEquates(DiskImage* pThis, const char* pImageFilename)
+{
+    char* pEquatesFilename = buildFilenameWithSuffix(pImageFilename, DISK_IMAGE_EQUATES_SUFFIX);
+    
+    free(pThis->pEquatesFilename);
+    pThis->pEquatesFilename = pEquatesFilename;
+}
+
+
+static int loadCurrentPlan(DiskImage* pThis, DiskImagePlan* pPlan, const VfsFileStamp* pScriptStamp);
+static int hasStaleEntriesResolvedFromObject(DiskImage* pThis, DiskImagePlan* pPlan);
+static void compilePlan(DiskImage*          pThis, 
+                        DiskImagePlan*      pPlan, 
+                        const char*         pScriptFilename, 
+                        const VfsFileStamp* pScriptStamp);
+static void runPlan(DiskImage* pThis, DiskImagePlan* pPlan, const char* pScriptFilename);
+static void runPlanEntry(DiskImage* pThis, DiskImagePlan* pPlan, DiskImagePlanEntry* pEntry);
+static void reportPlanEntryException(DiskImageScriptEngine* pThis, const char* pObjectFilename, int exceptionCode);
+static void processScriptFileWithPlan(DiskImage* pThis, const char* pScriptFilename, const VfsFileStamp* pStamp)
+{
+    DiskImagePlan plan;
+    
+    memset(&plan, 0, sizeof(plan));
+    __try
+    {
+        if (loadCurrentPlan(pThis, &plan, pStamp))
+            runPlan(pThis, &plan, pScriptFilename);
+        else
+            compilePlan(pThis, &plan, pScriptFilename, pStamp);
+    }
+    __catch
+    {
+        pThis->pPlan = NULL;
+    }
+    
+    DiskImagePlan_Free(&plan);
+    if (getExceptionCode())
+        __rethrow;
+}
+
+static int loadCurrentPlan(DiskImage* pThis, DiskImagePlan* pPlan, const VfsFileStamp* pScriptStamp)
+{
+    if (!DiskImagePlan_Read(pPlan, pThis->pVfs, pThis->pPlanFilename))
+        return FALSE;
+    
+    /* Lines whose object files changed are still replayed from the plan since the object is read again anyway.  Only
+       lines which took fields from an object file have to be parsed again. */
+    if (isStampEqual(&pPlan->scriptStamp, pScriptStamp) &&
+        pPlan->imageSize == pThis->imageSize &&
+        pPlan->regionSize == pThis->regionSize &&
+        !hasStaleEntriesResolvedFromObject(pThis, pPlan))
+    {
+        return TRUE;
+    }
+    DiskImagePlan_Free(pPlan);
+    return FALSE;
+}
+
+static int hasStaleEntriesResolvedFromObject(DiskImage* pThis, DiskImagePlan* pPlan)
+{
+    unsigned int i;
+    
+    if (0 == DiskImagePlan_MarkStaleEntries(pPlan, pThis->pVfs))
+        return FALSE;
+    for (i = 0 ; i < pPlan->entryCount ; i++)
+    {
+        if (pPlan->pEntries[i].isStale && pPlan->pEntries[i].isResolvedFromObject)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static void compilePlan(DiskImage*          pThis, 
+                        DiskImagePlan*      pPlan, 
+                        const char*         pScriptFilename, 
+                        const VfsFileStamp* pScriptStamp)
+{
+    int isComplete;
+    
+    pPlan->scriptStamp = *pScriptStamp;
+    pPlan->imageSize = pThis->imageSize;
+    pPlan->regionSize = pThis->regionSize;
+    
+    pThis->script.errorCount = 0;
+    pThis->pPlan = pPlan;
+    DiskImageScriptEngine_ProcessScriptFile(&pThis->script, pThis, pScriptFilename);
+    isComplete = pThis->pPlan != NULL;
+    pThis->pPlan = NULL;
+    
+    /* Lines with errors aren't in the plan so it is only kept once the script builds cleanly. */
+    if (isComplete && pThis->script.errorCount == 0)
+        DiskImagePlan_Write(pPlan, pThis->pVfs, pThis->pPlanFilename);
+}
+
+static void runPlan(DiskImage* pThis, DiskImagePlan* pPlan, const char* pScriptFilename)
+{
+    unsigned int priorErrorCount = pThis->script.errorCount;
+    unsigned int i;
+    
+    pThis->script.pDiskImage = pThis;
+    pThis->script.pScriptFilename = pScriptFilename;
+    /* Placement only changes when the plan is recompiled but the equates are still regenerated in case they were
+       enabled after the plan was written. */
+    startScriptOutputs(&pThis->script);
+    for (i = 0 ; i < pPlan->entryCount ; i++)
+        runPlanEntry(pThis, pPlan, &pPlan->pEntries[i]);
+    if (pThis->script.errorCount == priorErrorCount)
+        writeScriptOutputs(&pThis->script);
+}
+
+static void runPlanEntry(DiskImage* pThis, DiskImagePlan* pPlan, DiskImagePlanEntry* pEntry)
+{
+    DiskImageScriptEngine* pScript = &pThis->script;
+    const char*            pObjectFilename = pPlan->pObjects[pEntry->objectIndex].pFilename;
+    SizedString            objectFilename = SizedString_InitFromString(pObjectFilename);
+    
+    pScript->lineNumber = pEntry->lineNumber;
+    pScript->insert = pEntry->insert;
+    __try
+    {
+        DiskImage_ReadObjectFile(pThis, pObjectFilename);
+        if (pEntry->imageTableAddress != DISK_IMAGE_PLAN_NO_IMAGE_TABLE)
+            DiskImage_UpdateImageTableFile(pThis, (unsigned short)pEntry->imageTableAddress);
+        DiskImage_InsertObjectFile(pThis, &pScript->insert);
+        addEquates(pScript, &objectFilename, &pScript->insert);
+    }
+    __catch
+    {
+        reportPlanEntryException(pScript, pObjectFilename, getExceptionCode());
+        __nothrow;
+    }
+}
+
+static void reportPlanEntryException(DiskImageScriptEngine* pThis, const char* pObjectFilename, int exceptionCode)
+{
+    if (exceptionCode == fileOpenException)
+        LOG_ERROR(pThis, "Failed to open '%s' object file.", pObjectFilename);
+    else if (exceptionCode == fileException)
+        LOG_ERROR(pThis, "Failed to process '%s' object file.", pObjectFilename);
+    else
+        reportInsertException(pThis, exceptionCode);
 }
@@ -0,0 +1,369 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include "DiskImageManifest.h"
+#include "DiskImageTest.h"
+#include "util.h"
+
+
+#define MANIFEST_SIGNATURE "crackle-manifest"
+#define MANIFEST_VERSION   1
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME        0x100000001b3ULL
+
+
+void DiskImageManifest_Free(DiskImageManifest* pThis)
+{
+    unsigned int i;
+
+    if (!pThis)
+        return;
+    for (i = 0 ; i < pThis->entryCount ; i++)
+        free(pThis->pEntries[i].pData);
+    free(pThis->pEntries);
+    pThis->pEntries = NULL;
+    pThis->entryCount = 0;
+    pThis->allocatedCount = 0;
+}
+
+
+static void growEntryArrayIfNecessary(DiskImageManifest* pThis);
+static unsigned long long hashInsert(const DiskImageInsert* pInsert, const unsigned char* pData);
+static unsigned long long hashBytes(unsigned long long hash, const void* pData, size_t dataSize);
+static unsigned long long hashUnsigned(unsigned long long hash, unsigned int value);
+__throws void DiskImageManifest_AddEntry(DiskImageManifest*     pThis,
+                                         const DiskImageInsert* pInsert,
+                                         const unsigned char*   pData,
+                                         unsigned int           lineNumber,
+                                         unsigned int           firstRegion,
+                                         unsigned int           lastRegion)
+{
+    DiskImageManifestEntry* pEntry;
+    unsigned char*          pDataCopy;
+
+    growEntryArrayIfNecessary(pThis);
+    pDataCopy = allocateAndZero(pInsert->length ? pInsert->length : 1);
+    memcpy(pDataCopy, pData, pInsert->length);
+
+    pEntry = &pThis->pEntries[pThis->entryCount++];
+    memset(pEntry, 0, sizeof(*pEntry));
+    pEntry->insert = *pInsert;
+    pEntry->insert.sourceOffset = 0;
+    pEntry->pData = pDataCopy;
+    pEntry->hash = hashInsert(pInsert, pData);
+    pEntry->lineNumber = lineNumber;
+    pEntry->firstRegion = firstRegion;
+    pEntry->lastRegion = lastRegion;
+}
+
+static void growEntryArrayIfNecessary(DiskImageManifest* pThis)
+{
+    DiskImageManifestEntry* pRealloc;
+    unsigned int            newCount;
+
+    if (pThis->entryCount < pThis->allocatedCount)
+        return;
+    newCount = pThis->allocatedCount ? 2 * pThis->allocatedCount : 64;
+    pRealloc = realloc(pThis->pEntries, newCount * sizeof(*pRealloc));
+    if (!pRealloc)
+        __throw(outOfMemoryException);
+    pThis->pEntries = pRealloc;
+    pThis->allocatedCount = newCount;
+}
+
+static unsigned long long hashInsert(const DiskImageInsert* pInsert, const unsigned char* pData)
+{
+    unsigned long long hash = FNV_OFFSET_BASIS;
+
+    /* Only hash the fields used by this type of insert since the others are left over from earlier script lines. */
+    hash = hashUnsigned(hash, pInsert->type);
+    hash = hashUnsigned(hash, pInsert->length);
+    switch (pInsert->type)
+    {
+    case DISK_IMAGE_INSERTION_RWTS16:
+        hash = hashUnsigned(hash, pInsert->track);
+        hash = hashUnsigned(hash, pInsert->sector);
+        break;
+    case DISK_IMAGE_INSERTION_RW18:
+        hash = hashUnsigned(hash, pInsert->side);
+        hash = hashUnsigned(hash, pInsert->track);
+        hash = hashUnsigned(hash, pInsert->intraTrackOffset);
+        break;
+    case DISK_IMAGE_INSERTION_BLOCK:
+    default:
+        hash = hashUnsigned(hash, pInsert->block);
+        hash = hashUnsigned(hash, pInsert->intraBlockOffset);
+        break;
+    }
+
+    return hashBytes(hash, pData, pInsert->length);
+}
+
+static unsigned long long hashBytes(unsigned long long hash, const void* pData, size_t dataSize)
+{
+    const unsigned char* pCurr = (const unsigned char*)pData;
+
+    while (dataSize--)
+    {
+        hash ^= *pCurr++;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static unsigned long long hashUnsigned(unsigned long long hash, unsigned int value)
+{
+    unsigned char bytes[4];
+
+    bytes[0] = value & 0xFF;
+    bytes[1] = (value >> 8) & 0xFF;
+    bytes[2] = (value >> 16) & 0xFF;
+    bytes[3] = (value >> 24) & 0xFF;
+    return hashBytes(hash, bytes, sizeof(bytes));
+}
+
+
+unsigned long long DiskImageManifest_Hash(const unsigned char* pData, size_t dataSize)
+{
+    return hashBytes(FNV_OFFSET_BASIS, pData, dataSize);
+}
+
+
+static int readManifestFromFile(DiskImageManifest* pThis, FILE* pFile);
+int DiskImageManifest_Read(DiskImageManifest* pThis, Vfs* pVfs, const char* pFilename)
+{
+    FILE* pFile = Vfs_Open(pVfs, pFilename, "rb");
+    int   result = FALSE;
+
+    if (!pFile)
+        return FALSE;
+    __try
+    {
+        result = readManifestFromFile(pThis, pFile);
+    }
+    __catch
+    {
+        clearExceptionCode();
+        result = FALSE;
+    }
+    fclose(pFile);
+
+    if (!result)
+        DiskImageManifest_Free(pThis);
+    return result;
+}
+
+static int readManifestFromFile(DiskImageManifest* pThis, FILE* pFile)
+{
+    char         signature[32];
+    unsigned int version;
+
+    if (5 != fscanf(pFile, "%31s %u %u %u %llx",
+                    signature, &version, &pThis->imageSize, &pThis->regionSize, &pThis->imageHash))
+    {
+        return FALSE;
+    }
+    if (0 != strcmp(signature, MANIFEST_SIGNATURE) || version != MANIFEST_VERSION || pThis->regionSize == 0)
+        return FALSE;
+
+    for (;;)
+    {
+        DiskImageManifestEntry entry;
+        int                    fieldCount;
+
+        memset(&entry, 0, sizeof(entry));
+        fieldCount = fscanf(pFile, "%llx %u %u", &entry.hash, &entry.firstRegion, &entry.lastRegion);
+        if (fieldCount == EOF)
+            break;
+        if (fieldCount != 3)
+            return FALSE;
+        growEntryArrayIfNecessary(pThis);
+        pThis->pEntries[pThis->entryCount++] = entry;
+    }
+
+    return TRUE;
+}
+
+
+static void writeLine(FILE* pFile, const char* pLine, int lineLength);
+__throws void DiskImageManifest_Write(DiskImageManifest* pThis, Vfs* pVfs, const char* pFilename)
+{
+    FILE*        pFile = Vfs_Open(pVfs, pFilename, "wb");
+    char         line[128];
+    unsigned int i;
+
+    if (!pFile)
+        __throw(fileOpenException);
+
+    __try
+    {
+        writeLine(pFile, line, sprintf(line, "%s %u %u %u %016llx\n", MANIFEST_SIGNATURE, MANIFEST_VERSION, 
+                                       pThis->imageSize, pThis->regionSize, pThis->imageHash));
+        for (i = 0 ; i < pThis->entryCount ; i++)
+        {
+            DiskImageManifestEntry* pEntry = &pThis->pEntries[i];
+            writeLine(pFile, line, sprintf(line, "%016llx %u %u\n", 
+                                           pEntry->hash, pEntry->firstRegion, pEntry->lastRegion));
+        }
+    }
+    __catch
+    {
+        fclose(pFile);
+        __rethrow;
+    }
+    if (0 != fclose(pFile))
+        __throw(fileException);
+}
+
+static void writeLine(FILE* pFile, const char* pLine, int lineLength)
+{
+    if ((size_t)lineLength != fwrite(pLine, 1, lineLength, pFile))
+        __throw(fileException);
+}
+
+
+static unsigned int markAllRegions(unsigned char* pDirtyRegions, unsigned int regionCount);
+static int isManifestCompatible(const DiskImageManifest* pOld, const DiskImageManifest* pNew);
+static unsigned int markChangedEntries(const DiskImageManifest* pOld,
+                                       const DiskImageManifest* pNew,
+                                       unsigned char*           pDirtyRegions,
+                                       unsigned int             regionCount);
+static int isEntryUnchanged(const DiskImageManifestEntry* pOld, const DiskImageManifestEntry* pNew);
+static unsigned int markEntryRegions(const DiskImageManifestEntry* pEntry,
+                                     unsigned char*                pDirtyRegions,
+                                     unsigned int                  regionCount);
+static unsigned int selectEntriesTouchingDirtyRegions(DiskImageManifest* pNew,
+                                                      unsigned char*     pDirtyRegions,
+                                                      unsigned int       regionCount);
+static int doesEntryTouchDirtyRegion(const DiskImageManifestEntry* pEntry,
+                                     const unsigned char*          pDirtyRegions,
+                                     unsigned int                  regionCount);
+unsigned int DiskImageManifest_SelectEntries(const DiskImageManifest* pOld,
+                                             DiskImageManifest*       pNew,
+                                             unsigned char*           pDirtyRegions,
+                                             unsigned int             regionCount)
+{
+    unsigned int dirtyCount;
+    unsigned int newlyDirtyCount;
+
+    memset(pDirtyRegions, 0, regionCount);
+    if (!pOld || !isManifestCompatible(pOld, pNew))
+        dirtyCount = markAllRegions(pDirtyRegions, regionCount);
+    else
+        dirtyCount = markChangedEntries(pOld, pNew, pDirtyRegions, regionCount);
+
+    /* A replayed entry rewrites every region it touches so those regions have to be rebuilt from scratch as well,
+       which can pull in more entries.  Keep going until the set of dirty regions stops growing. */
+    do
+    {
+        newlyDirtyCount = selectEntriesTouchingDirtyRegions(pNew, pDirtyRegions, regionCount);
+        dirtyCount += newlyDirtyCount;
+    } while (newlyDirtyCount > 0);
+
+    return dirtyCount;
+}
+
+static unsigned int markAllRegions(unsigned char* pDirtyRegions, unsigned int regionCount)
+{
+    memset(pDirtyRegions, 1, regionCount);
+    return regionCount;
+}
+
+static int isManifestCompatible(const DiskImageManifest* pOld, const DiskImageManifest* pNew)
+{
+    return pOld->imageSize == pNew->imageSize && pOld->regionSize == pNew->regionSize;
+}
+
+static unsigned int markChangedEntries(const DiskImageManifest* pOld,
+                                       const DiskImageManifest* pNew,
+                                       unsigned char*           pDirtyRegions,
+                                       unsigned int             regionCount)
+{
+    unsigned int dirtyCount = 0;
+    unsigned int maxCount = pOld->entryCount > pNew->entryCount ? pOld->entryCount : pNew->entryCount;
+    unsigned int i;
+
+    for (i = 0 ; i < maxCount ; i++)
+    {
+        const DiskImageManifestEntry* pOldEntry = i < pOld->entryCount ? &pOld->pEntries[i] : NULL;
+        const DiskImageManifestEntry* pNewEntry = i < pNew->entryCount ? &pNew->pEntries[i] : NULL;
+
+        if (pOldEntry && pNewEntry && isEntryUnchanged(pOldEntry, pNewEntry))
+            continue;
+        if (pOldEntry)
+            dirtyCount += markEntryRegions(pOldEntry, pDirtyRegions, regionCount);
+        if (pNewEntry)
+            dirtyCount += markEntryRegions(pNewEntry, pDirtyRegions, regionCount);
+    }
+
+    return dirtyCount;
+}
+
+static int isEntryUnchanged(const DiskImageManifestEntry* pOld, const DiskImageManifestEntry* pNew)
+{
+    return pOld->hash == pNew->hash &&
+           pOld->firstRegion == pNew->firstRegion &&
+           pOld->lastRegion == pNew->lastRegion;
+}
+
+static unsigned int markEntryRegions(const DiskImageManifestEntry* pEntry,
+                                     unsigned char*                pDirtyRegions,
+                                     unsigned int                  regionCount)
+{
+    unsigned int markedCount = 0;
+    unsigned int region;
+
+    for (region = pEntry->firstRegion ; region <= pEntry->lastRegion && region < regionCount ; region++)
+    {
+        if (!pDirtyRegions[region])
+        {
+            pDirtyRegions[region] = 1;
+            markedCount++;
+        }
+    }
+    return markedCount;
+}
+
+static unsigned int selectEntriesTouchingDirtyRegions(DiskImageManifest* pNew,
+                                                      unsigned char*     pDirtyRegions,
+                                                      unsigned int       regionCount)
+{
+    unsigned int newlyDirtyCount = 0;
+    unsigned int i;
+
+    for (i = 0 ; i < pNew->entryCount ; i++)
+    {
+        DiskImageManifestEntry* pEntry = &pNew->pEntries[i];
+
+        if (pEntry->isSelected || !doesEntryTouchDirtyRegion(pEntry, pDirtyRegions, regionCount))
+            continue;
+        pEntry->isSelected = TRUE;
+        newlyDirtyCount += markEntryRegions(pEntry, pDirtyRegions, regionCount);
+    }
+    return newlyDirtyCount;
+}
+
+static int doesEntryTouchDirtyRegion(const DiskImageManifestEntry* pEntry,
+                                     const unsigned char*          pDirtyRegions,
+                                     unsigned int                  regionCount)
+{
+    unsigned int region;
+
+    for (region = pEntry->firstRegion ; region <= pEntry->lastRegion && region < regionCount ; region++)
+    {
+        if (pDirtyRegions[region])
+            return TRUE;
+    }
+    return FALSE;
+}
@@ -0,0 +1,64 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Record of the inserts made by each script line when an image was built.  It is saved next to the image so that a
+   later --update build can work out which tracks/blocks are affected by the lines which changed since then. */
+#ifndef _DISK_IMAGE_MANIFEST_H_
+#define _DISK_IMAGE_MANIFEST_H_
+
+#include "DiskImage.h"
+
+
+typedef struct DiskImageManifestEntry
+{
+    DiskImageInsert    insert;
+    unsigned char*     pData;
+    unsigned long long hash;
+    unsigned int       lineNumber;
+    unsigned int       firstRegion;
+    unsigned int       lastRegion;
+    int                isSelected;
+} DiskImageManifestEntry;
+
+typedef struct DiskImageManifest
+{
+    DiskImageManifestEntry* pEntries;
+    unsigned int            entryCount;
+    unsigned int            allocatedCount;
+    unsigned int            imageSize;
+    unsigned int            regionSize;
+    unsigned long long      imageHash;
+} DiskImageManifest;
+
+
+         void               DiskImageManifest_Free(DiskImageManifest* pThis);
+__throws void               DiskImageManifest_AddEntry(DiskImageManifest*     pThis,
+                                                       const DiskImageInsert* pInsert,
+                                                       const unsigned char*   pData,
+                                                       unsigned int           lineNumber,
+                                                       unsigned int           firstRegion,
+                                                       unsigned int           lastRegion);
+
+         int                DiskImageManifest_Read(DiskImageManifest* pThis, Vfs* pVfs, const char* pFilename);
+__throws void               DiskImageManifest_Write(DiskImageManifest* pThis, Vfs* pVfs, const char* pFilename);
+
+/* Marks every region (one byte per region in pDirtyRegions) which must be rebuilt to bring an image built from pOld up
+   to date with pNew and selects the entries of pNew which have to be replayed to do so.  A NULL pOld marks everything.
+   Returns the number of dirty regions. */
+         unsigned int       DiskImageManifest_SelectEntries(const DiskImageManifest* pOld,
+                                                            DiskImageManifest*       pNew,
+                                                            unsigned char*           pDirtyRegions,
+                                                            unsigned int             regionCount);
+
+         unsigned long long DiskImageManifest_Hash(const unsigned char* pData, size_t dataSize);
+
+#endif /* _DISK_IMAGE_MANIFEST_H_ */
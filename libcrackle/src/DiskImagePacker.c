@@ -0,0 +1,281 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include "DiskImagePacker.h"
+#include "DiskImageTest.h"
+#include "util.h"
+
+
+typedef struct GapIterator
+{
+    const DiskImagePacker* pPacker;
+    unsigned int           index;
+    unsigned int           position;
+    unsigned int           sideEnd;
+} GapIterator;
+
+
+void DiskImagePacker_Free(DiskImagePacker* pThis)
+{
+    if (!pThis)
+        return;
+    free(pThis->pRanges);
+    memset(pThis, 0, sizeof(*pThis));
+}
+
+
+static unsigned int sideStart(unsigned int side);
+static void reserveRange(DiskImagePacker* pThis, unsigned int start, unsigned int length);
+static void addRange(DiskImagePacker* pThis, unsigned int start, unsigned int length, int isPacked);
+static void growArrayIfNecessary(DiskImagePacker* pThis);
+__throws void DiskImagePacker_Reserve(DiskImagePacker* pThis, const DiskImageInsert* pInsert)
+{
+    unsigned int i;
+
+    if (pInsert->type == DISK_IMAGE_INSERTION_RW18)
+    {
+        reserveRange(pThis, 
+                     sideStart(pInsert->side) + 
+                        pInsert->track * DISK_IMAGE_RW18_BYTES_PER_TRACK + pInsert->intraTrackOffset,
+                     pInsert->length);
+    }
+    else if (pInsert->type == DISK_IMAGE_INSERTION_RWTS16 && pInsert->track < DISK_IMAGE_TRACKS_PER_SIDE)
+    {
+        /* The RW18 side of the image being built isn't known so clobber this track on all of them. */
+        for (i = 0 ; i < 3 ; i++)
+        {
+            reserveRange(pThis, 
+                         i * DISK_IMAGE_PACKER_SIDE_SIZE + pInsert->track * DISK_IMAGE_RW18_BYTES_PER_TRACK,
+                         DISK_IMAGE_RW18_BYTES_PER_TRACK);
+        }
+    }
+}
+
+static unsigned int sideStart(unsigned int side)
+{
+    if (side == DISK_IMAGE_RW18_SIDE_0)
+        return 0;
+    else if (side == DISK_IMAGE_RW18_SIDE_1)
+        return DISK_IMAGE_PACKER_SIDE_SIZE;
+    else if (side == DISK_IMAGE_RW18_SIDE_2)
+        return 2 * DISK_IMAGE_PACKER_SIDE_SIZE;
+    __throw(invalidSideException);
+}
+
+static void reserveRange(DiskImagePacker* pThis, unsigned int start, unsigned int length)
+{
+    unsigned int end = start + length;
+    unsigned int i;
+
+    for (i = 0 ; i < pThis->rangeCount ; i++)
+    {
+        const DiskImagePackerRange* pRange = &pThis->pRanges[i];
+
+        if (pRange->isPacked && pRange->start < end && start < pRange->end)
+            __throw(overlappingInsertException);
+    }
+    addRange(pThis, start, length, FALSE);
+}
+
+static void addRange(DiskImagePacker* pThis, unsigned int start, unsigned int length, int isPacked)
+{
+    unsigned int i;
+
+    if (length == 0)
+        return;
+    growArrayIfNecessary(pThis);
+    for (i = pThis->rangeCount ; i > 0 && pThis->pRanges[i - 1].start > start ; i--)
+        pThis->pRanges[i] = pThis->pRanges[i - 1];
+    pThis->pRanges[i].start = start;
+    pThis->pRanges[i].end = start + length;
+    pThis->pRanges[i].isPacked = isPacked;
+    pThis->rangeCount++;
+}
+
+static void growArrayIfNecessary(DiskImagePacker* pThis)
+{
+    DiskImagePackerRange* pRealloc;
+    unsigned int          newCount;
+
+    if (pThis->rangeCount < pThis->allocatedRangeCount)
+        return;
+    newCount = pThis->allocatedRangeCount ? 2 * pThis->allocatedRangeCount : 64;
+    pRealloc = realloc(pThis->pRanges, newCount * sizeof(*pRealloc));
+    if (!pRealloc)
+        __throw(outOfMemoryException);
+    pThis->pRanges = pRealloc;
+    pThis->allocatedRangeCount = newCount;
+}
+
+
+static int          canContinueGroup(DiskImagePacker* pThis, unsigned int sideBase, unsigned int length);
+static int          isRangeFree(DiskImagePacker* pThis, unsigned int start, unsigned int end);
+static unsigned int findBestFitWithinTrack(DiskImagePacker* pThis, unsigned int sideBase, unsigned int length);
+static unsigned int findFirstFitOnTrackBoundary(DiskImagePacker* pThis, unsigned int sideBase, unsigned int length);
+static unsigned int findFirstFit(DiskImagePacker* pThis, unsigned int sideBase, unsigned int length);
+static void         initGapIterator(GapIterator* pIterator, const DiskImagePacker* pPacker, unsigned int sideBase);
+static int          nextGap(GapIterator* pIterator, unsigned int* pStart, unsigned int* pEnd);
+__throws void DiskImagePacker_Pack(DiskImagePacker* pThis, DiskImageInsert* pInsert)
+{
+    unsigned int sideBase = sideStart(pInsert->side);
+    unsigned int length = pInsert->length;
+    unsigned int start = ~0U;
+
+    if (canContinueGroup(pThis, sideBase, length))
+        start = pThis->groupEnd;
+    else if (length <= DISK_IMAGE_RW18_BYTES_PER_TRACK)
+        start = findBestFitWithinTrack(pThis, sideBase, length);
+    else
+        start = findFirstFitOnTrackBoundary(pThis, sideBase, length);
+    if (start == ~0U)
+        start = findFirstFit(pThis, sideBase, length);
+    if (start == ~0U)
+        __throw(diskFullException);
+
+    addRange(pThis, start, length, TRUE);
+    pThis->groupEnd = start + length;
+    pThis->isGroupOpen = TRUE;
+    pInsert->track = (start - sideBase) / DISK_IMAGE_RW18_BYTES_PER_TRACK;
+    pInsert->intraTrackOffset = (start - sideBase) % DISK_IMAGE_RW18_BYTES_PER_TRACK;
+}
+
+static int canContinueGroup(DiskImagePacker* pThis, unsigned int sideBase, unsigned int length)
+{
+    return pThis->isGroupOpen &&
+           pThis->groupEnd > sideBase &&
+           pThis->groupEnd + length <= sideBase + DISK_IMAGE_PACKER_SIDE_SIZE &&
+           isRangeFree(pThis, pThis->groupEnd, pThis->groupEnd + length);
+}
+
+static int isRangeFree(DiskImagePacker* pThis, unsigned int start, unsigned int end)
+{
+    unsigned int i;
+
+    for (i = 0 ; i < pThis->rangeCount && pThis->pRanges[i].start < end ; i++)
+    {
+        if (start < pThis->pRanges[i].end)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static unsigned int findBestFitWithinTrack(DiskImagePacker* pThis, unsigned int sideBase, unsigned int length)
+{
+    GapIterator  iterator;
+    unsigned int gapStart;
+    unsigned int gapEnd;
+    unsigned int bestStart = ~0U;
+    unsigned int bestLeftover = ~0U;
+
+    initGapIterator(&iterator, pThis, sideBase);
+    while (nextGap(&iterator, &gapStart, &gapEnd))
+    {
+        unsigned int windowStart = gapStart;
+
+        while (windowStart < gapEnd)
+        {
+            unsigned int trackEnd = windowStart - (windowStart - sideBase) % DISK_IMAGE_RW18_BYTES_PER_TRACK +
+                                    DISK_IMAGE_RW18_BYTES_PER_TRACK;
+            unsigned int windowEnd = trackEnd < gapEnd ? trackEnd : gapEnd;
+            unsigned int windowLength = windowEnd - windowStart;
+
+            if (windowLength >= length && windowLength - length < bestLeftover)
+            {
+                bestStart = windowStart;
+                bestLeftover = windowLength - length;
+            }
+            windowStart = windowEnd;
+        }
+    }
+    return bestStart;
+}
+
+static unsigned int findFirstFitOnTrackBoundary(DiskImagePacker* pThis, unsigned int sideBase, unsigned int length)
+{
+    GapIterator  iterator;
+    unsigned int gapStart;
+    unsigned int gapEnd;
+
+    initGapIterator(&iterator, pThis, sideBase);
+    while (nextGap(&iterator, &gapStart, &gapEnd))
+    {
+        unsigned int intraTrackOffset = (gapStart - sideBase) % DISK_IMAGE_RW18_BYTES_PER_TRACK;
+        unsigned int start = intraTrackOffset ? gapStart - intraTrackOffset + DISK_IMAGE_RW18_BYTES_PER_TRACK : gapStart;
+
+        if (start < gapEnd && gapEnd - start >= length)
+            return start;
+    }
+    return ~0U;
+}
+
+static unsigned int findFirstFit(DiskImagePacker* pThis, unsigned int sideBase, unsigned int length)
+{
+    GapIterator  iterator;
+    unsigned int gapStart;
+    unsigned int gapEnd;
+
+    initGapIterator(&iterator, pThis, sideBase);
+    while (nextGap(&iterator, &gapStart, &gapEnd))
+    {
+        if (gapEnd - gapStart >= length)
+            return gapStart;
+    }
+    return ~0U;
+}
+
+static void initGapIterator(GapIterator* pIterator, const DiskImagePacker* pPacker, unsigned int sideBase)
+{
+    pIterator->pPacker = pPacker;
+    pIterator->index = 0;
+    pIterator->position = sideBase;
+    pIterator->sideEnd = sideBase + DISK_IMAGE_PACKER_SIDE_SIZE;
+}
+
+static int nextGap(GapIterator* pIterator, unsigned int* pStart, unsigned int* pEnd)
+{
+    const DiskImagePacker* pPacker = pIterator->pPacker;
+
+    /* Ranges are sorted by start but may overlap so the gap only starts once the furthest end seen so far is past. */
+    while (pIterator->position < pIterator->sideEnd)
+    {
+        unsigned int gapStart = pIterator->position;
+        unsigned int gapEnd = pIterator->sideEnd;
+
+        if (pIterator->index < pPacker->rangeCount && pPacker->pRanges[pIterator->index].start < pIterator->sideEnd)
+        {
+            const DiskImagePackerRange* pRange = &pPacker->pRanges[pIterator->index++];
+
+            gapEnd = pRange->start;
+            if (pRange->end > pIterator->position)
+                pIterator->position = pRange->end;
+        }
+        else
+        {
+            pIterator->position = pIterator->sideEnd;
+        }
+
+        if (gapEnd > gapStart)
+        {
+            *pStart = gapStart;
+            *pEnd = gapEnd;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+
+void DiskImagePacker_EndGroup(DiskImagePacker* pThis)
+{
+    pThis->isGroupOpen = FALSE;
+}
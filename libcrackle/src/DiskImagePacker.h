@@ -0,0 +1,59 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Allocator for the RW18 script lines which use '?' in their track and offset fields.  Each side of the disk is
+   treated as one run of 35 * 4608 bytes.  The space written by the other RW18 and RWTS16 script lines is reserved as
+   they are seen and the '?' lines are packed into whatever is left. */
+#ifndef _DISK_IMAGE_PACKER_H_
+#define _DISK_IMAGE_PACKER_H_
+
+#include "DiskImage.h"
+
+
+#define DISK_IMAGE_PACKER_SIDE_SIZE (DISK_IMAGE_TRACKS_PER_SIDE * DISK_IMAGE_RW18_BYTES_PER_TRACK)
+
+
+typedef struct DiskImagePackerRange
+{
+    /* Offsets from the start of the first side so that ranges on all sides can be kept in one sorted array. */
+    unsigned int start;
+    unsigned int end;
+    int          isPacked;
+} DiskImagePackerRange;
+
+typedef struct DiskImagePacker
+{
+    DiskImagePackerRange* pRanges;
+    unsigned int          rangeCount;
+    unsigned int          allocatedRangeCount;
+    /* Where the last packed insert ended while its load group is still open. */
+    unsigned int          groupEnd;
+    int                   isGroupOpen;
+} DiskImagePacker;
+
+
+         void DiskImagePacker_Free(DiskImagePacker* pThis);
+
+/* Marks the space written by a RW18 insert, or the whole track written by a RWTS16 insert on every side, as used.
+   Throws overlappingInsertException if it overlaps space already given to a packed insert. */
+__throws void DiskImagePacker_Reserve(DiskImagePacker* pThis, const DiskImageInsert* pInsert);
+
+/* Sets the track and intraTrackOffset of a RW18 insert.  Inserts packed one after another form a load group and are
+   placed back to back, on adjacent tracks, while there is room.  Otherwise an insert which fits within one track is
+   placed in the free space which it fills most tightly, and a larger one at the start of the first free track with
+   enough room after it.  Throws diskFullException if no free space on its side is large enough. */
+__throws void DiskImagePacker_Pack(DiskImagePacker* pThis, DiskImageInsert* pInsert);
+
+/* Closes the current load group so that the next packed insert doesn't have to follow the last one. */
+         void DiskImagePacker_EndGroup(DiskImagePacker* pThis);
+
+#endif /* _DISK_IMAGE_PACKER_H_ */
@@ -0,0 +1,390 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include "DiskImagePlan.h"
+#include "DiskImageTest.h"
+#include "util.h"
+
+
+#define PLAN_SIGNATURE           "CRKPLAN"
+#define PLAN_VERSION             1
+#define PLAN_MAX_FILENAME_LENGTH 4096
+
+
+void DiskImagePlan_Free(DiskImagePlan* pThis)
+{
+    unsigned int i;
+
+    if (!pThis)
+        return;
+    for (i = 0 ; i < pThis->objectCount ; i++)
+        free(pThis->pObjects[i].pFilename);
+    free(pThis->pObjects);
+    free(pThis->pEntries);
+    pThis->pObjects = NULL;
+    pThis->objectCount = 0;
+    pThis->allocatedObjectCount = 0;
+    pThis->pEntries = NULL;
+    pThis->entryCount = 0;
+    pThis->allocatedEntryCount = 0;
+}
+
+
+static unsigned int findOrAddObject(DiskImagePlan* pThis, const char* pFilename, const VfsFileStamp* pStamp);
+static unsigned int addObject(DiskImagePlan* pThis, char* pFilename, const VfsFileStamp* pStamp);
+static void growArrayIfNecessary(void** ppArray, unsigned int* pAllocatedCount, unsigned int count, size_t elementSize);
+__throws void DiskImagePlan_AddEntry(DiskImagePlan*            pThis,
+                                     const DiskImagePlanEntry* pEntry,
+                                     const char*               pObjectFilename,
+                                     const VfsFileStamp*       pObjectStamp)
+{
+    unsigned int objectIndex = findOrAddObject(pThis, pObjectFilename, pObjectStamp);
+
+    growArrayIfNecessary((void**)&pThis->pEntries, &pThis->allocatedEntryCount, pThis->entryCount, 
+                         sizeof(*pThis->pEntries));
+    pThis->pEntries[pThis->entryCount] = *pEntry;
+    pThis->pEntries[pThis->entryCount].objectIndex = objectIndex;
+    pThis->pEntries[pThis->entryCount].isStale = FALSE;
+    pThis->entryCount++;
+}
+
+static unsigned int findOrAddObject(DiskImagePlan* pThis, const char* pFilename, const VfsFileStamp* pStamp)
+{
+    char*        pFilenameCopy = NULL;
+    unsigned int i;
+
+    for (i = 0 ; i < pThis->objectCount ; i++)
+    {
+        if (0 == strcmp(pThis->pObjects[i].pFilename, pFilename))
+            return i;
+    }
+
+    pFilenameCopy = allocateAndZero(strlen(pFilename) + 1);
+    strcpy(pFilenameCopy, pFilename);
+    __try
+    {
+        addObject(pThis, pFilenameCopy, pStamp);
+    }
+    __catch
+    {
+        free(pFilenameCopy);
+        __rethrow;
+    }
+    return pThis->objectCount - 1;
+}
+
+static unsigned int addObject(DiskImagePlan* pThis, char* pFilename, const VfsFileStamp* pStamp)
+{
+    DiskImagePlanObject* pObject;
+
+    growArrayIfNecessary((void**)&pThis->pObjects, &pThis->allocatedObjectCount, pThis->objectCount, 
+                         sizeof(*pThis->pObjects));
+    pObject = &pThis->pObjects[pThis->objectCount];
+    memset(pObject, 0, sizeof(*pObject));
+    pObject->pFilename = pFilename;
+    if (pStamp)
+    {
+        pObject->stamp = *pStamp;
+        pObject->hasStamp = TRUE;
+    }
+    return pThis->objectCount++;
+}
+
+static void growArrayIfNecessary(void** ppArray, unsigned int* pAllocatedCount, unsigned int count, size_t elementSize)
+{
+    void*        pRealloc;
+    unsigned int newCount;
+
+    if (count < *pAllocatedCount)
+        return;
+    newCount = *pAllocatedCount ? 2 * *pAllocatedCount : 64;
+    pRealloc = realloc(*ppArray, newCount * elementSize);
+    if (!pRealloc)
+        __throw(outOfMemoryException);
+    *ppArray = pRealloc;
+    *pAllocatedCount = newCount;
+}
+
+
+static void readPlanFromFile(DiskImagePlan* pThis, FILE* pFile);
+static void readStamp(FILE* pFile, VfsFileStamp* pStamp);
+static void readObject(DiskImagePlan* pThis, FILE* pFile);
+static void readEntry(DiskImagePlan* pThis, FILE* pFile);
+static unsigned int readUInt32(FILE* pFile);
+static unsigned long long readUInt64(FILE* pFile);
+static void readBytes(FILE* pFile, void* pBuffer, size_t bufferSize);
+int DiskImagePlan_Read(DiskImagePlan* pThis, Vfs* pVfs, const char* pFilename)
+{
+    FILE* pFile = Vfs_Open(pVfs, pFilename, "rb");
+    int   result = TRUE;
+
+    if (!pFile)
+        return FALSE;
+    __try
+    {
+        readPlanFromFile(pThis, pFile);
+    }
+    __catch
+    {
+        clearExceptionCode();
+        result = FALSE;
+    }
+    fclose(pFile);
+
+    if (!result)
+        DiskImagePlan_Free(pThis);
+    return result;
+}
+
+static void readPlanFromFile(DiskImagePlan* pThis, FILE* pFile)
+{
+    char         signature[sizeof(PLAN_SIGNATURE)];
+    unsigned int objectCount;
+    unsigned int entryCount;
+    unsigned int i;
+
+    readBytes(pFile, signature, sizeof(signature));
+    if (0 != memcmp(signature, PLAN_SIGNATURE, sizeof(signature)) || readUInt32(pFile) != PLAN_VERSION)
+        __throw(fileException);
+    pThis->imageSize = readUInt32(pFile);
+    pThis->regionSize = readUInt32(pFile);
+    readStamp(pFile, &pThis->scriptStamp);
+    objectCount = readUInt32(pFile);
+    entryCount = readUInt32(pFile);
+
+    for (i = 0 ; i < objectCount ; i++)
+        readObject(pThis, pFile);
+    for (i = 0 ; i < entryCount ; i++)
+        readEntry(pThis, pFile);
+}
+
+static void readStamp(FILE* pFile, VfsFileStamp* pStamp)
+{
+    pStamp->modificationTime = (time_t)readUInt64(pFile);
+    pStamp->modificationNsec = (long)readUInt64(pFile);
+    pStamp->size = (long)readUInt64(pFile);
+}
+
+static void readObject(DiskImagePlan* pThis, FILE* pFile)
+{
+    VfsFileStamp stamp;
+    int          hasStamp;
+    unsigned int filenameLength;
+    char*        pFilename = NULL;
+
+    hasStamp = readUInt32(pFile);
+    readStamp(pFile, &stamp);
+    filenameLength = readUInt32(pFile);
+    if (filenameLength > PLAN_MAX_FILENAME_LENGTH)
+        __throw(fileException);
+
+    pFilename = allocateAndZero(filenameLength + 1);
+    __try
+    {
+        readBytes(pFile, pFilename, filenameLength);
+        addObject(pThis, pFilename, hasStamp ? &stamp : NULL);
+    }
+    __catch
+    {
+        free(pFilename);
+        __rethrow;
+    }
+}
+
+static void readEntry(DiskImagePlan* pThis, FILE* pFile)
+{
+    DiskImagePlanEntry entry;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.insert.type = (DiskImageInsertionType)readUInt32(pFile);
+    entry.insert.sourceOffset = readUInt32(pFile);
+    entry.insert.length = readUInt32(pFile);
+    /* The block fields share storage with side and track. */
+    entry.insert.side = readUInt32(pFile);
+    entry.insert.track = readUInt32(pFile);
+    entry.insert.sector = readUInt32(pFile);
+    entry.lineNumber = readUInt32(pFile);
+    entry.objectIndex = readUInt32(pFile);
+    entry.imageTableAddress = readUInt32(pFile);
+    entry.firstRegion = readUInt32(pFile);
+    entry.lastRegion = readUInt32(pFile);
+    entry.isResolvedFromObject = readUInt32(pFile);
+    if (entry.insert.type > DISK_IMAGE_INSERTION_BLOCK || 
+        entry.objectIndex >= pThis->objectCount ||
+        entry.firstRegion > entry.lastRegion)
+    {
+        __throw(fileException);
+    }
+
+    growArrayIfNecessary((void**)&pThis->pEntries, &pThis->allocatedEntryCount, pThis->entryCount, 
+                         sizeof(*pThis->pEntries));
+    pThis->pEntries[pThis->entryCount++] = entry;
+}
+
+static unsigned int readUInt32(FILE* pFile)
+{
+    unsigned char bytes[4];
+
+    readBytes(pFile, bytes, sizeof(bytes));
+    return (unsigned int)bytes[0] | 
+           ((unsigned int)bytes[1] << 8) | 
+           ((unsigned int)bytes[2] << 16) | 
+           ((unsigned int)bytes[3] << 24);
+}
+
+static unsigned long long readUInt64(FILE* pFile)
+{
+    unsigned long long low = readUInt32(pFile);
+
+    return low | ((unsigned long long)readUInt32(pFile) << 32);
+}
+
+static void readBytes(FILE* pFile, void* pBuffer, size_t bufferSize)
+{
+    if (bufferSize != fread(pBuffer, 1, bufferSize, pFile))
+        __throw(fileException);
+}
+
+
+static void writePlanToFile(DiskImagePlan* pThis, FILE* pFile);
+static void writeStamp(FILE* pFile, const VfsFileStamp* pStamp);
+static void writeObject(FILE* pFile, const DiskImagePlanObject* pObject);
+static void writeEntry(FILE* pFile, const DiskImagePlanEntry* pEntry);
+static void writeUInt32(FILE* pFile, unsigned int value);
+static void writeUInt64(FILE* pFile, unsigned long long value);
+static void writeBytes(FILE* pFile, const void* pData, size_t dataSize);
+__throws void DiskImagePlan_Write(DiskImagePlan* pThis, Vfs* pVfs, const char* pFilename)
+{
+    FILE* pFile = Vfs_Open(pVfs, pFilename, "wb");
+
+    if (!pFile)
+        __throw(fileOpenException);
+
+    __try
+    {
+        writePlanToFile(pThis, pFile);
+    }
+    __catch
+    {
+        fclose(pFile);
+        __rethrow;
+    }
+    if (0 != fclose(pFile))
+        __throw(fileException);
+}
+
+static void writePlanToFile(DiskImagePlan* pThis, FILE* pFile)
+{
+    unsigned int i;
+
+    writeBytes(pFile, PLAN_SIGNATURE, sizeof(PLAN_SIGNATURE));
+    writeUInt32(pFile, PLAN_VERSION);
+    writeUInt32(pFile, pThis->imageSize);
+    writeUInt32(pFile, pThis->regionSize);
+    writeStamp(pFile, &pThis->scriptStamp);
+    writeUInt32(pFile, pThis->objectCount);
+    writeUInt32(pFile, pThis->entryCount);
+    for (i = 0 ; i < pThis->objectCount ; i++)
+        writeObject(pFile, &pThis->pObjects[i]);
+    for (i = 0 ; i < pThis->entryCount ; i++)
+        writeEntry(pFile, &pThis->pEntries[i]);
+}
+
+static void writeStamp(FILE* pFile, const VfsFileStamp* pStamp)
+{
+    writeUInt64(pFile, (unsigned long long)pStamp->modificationTime);
+    writeUInt64(pFile, (unsigned long long)pStamp->modificationNsec);
+    writeUInt64(pFile, (unsigned long long)pStamp->size);
+}
+
+static void writeObject(FILE* pFile, const DiskImagePlanObject* pObject)
+{
+    size_t filenameLength = strlen(pObject->pFilename);
+
+    writeUInt32(pFile, pObject->hasStamp);
+    writeStamp(pFile, &pObject->stamp);
+    writeUInt32(pFile, filenameLength);
+    writeBytes(pFile, pObject->pFilename, filenameLength);
+}
+
+static void writeEntry(FILE* pFile, const DiskImagePlanEntry* pEntry)
+{
+    writeUInt32(pFile, pEntry->insert.type);
+    writeUInt32(pFile, pEntry->insert.sourceOffset);
+    writeUInt32(pFile, pEntry->insert.length);
+    writeUInt32(pFile, pEntry->insert.side);
+    writeUInt32(pFile, pEntry->insert.track);
+    writeUInt32(pFile, pEntry->insert.sector);
+    writeUInt32(pFile, pEntry->lineNumber);
+    writeUInt32(pFile, pEntry->objectIndex);
+    writeUInt32(pFile, pEntry->imageTableAddress);
+    writeUInt32(pFile, pEntry->firstRegion);
+    writeUInt32(pFile, pEntry->lastRegion);
+    writeUInt32(pFile, pEntry->isResolvedFromObject);
+}
+
+static void writeUInt32(FILE* pFile, unsigned int value)
+{
+    unsigned char bytes[4];
+
+    bytes[0] = value & 0xFF;
+    bytes[1] = (value >> 8) & 0xFF;
+    bytes[2] = (value >> 16) & 0xFF;
+    bytes[3] = (value >> 24) & 0xFF;
+    writeBytes(pFile, bytes, sizeof(bytes));
+}
+
+static void writeUInt64(FILE* pFile, unsigned long long value)
+{
+    writeUInt32(pFile, (unsigned int)value);
+    writeUInt32(pFile, (unsigned int)(value >> 32));
+}
+
+static void writeBytes(FILE* pFile, const void* pData, size_t dataSize)
+{
+    if (dataSize != fwrite(pData, 1, dataSize, pFile))
+        __throw(fileException);
+}
+
+
+static int hasObjectChanged(const DiskImagePlanObject* pObject, Vfs* pVfs);
+unsigned int DiskImagePlan_MarkStaleEntries(DiskImagePlan* pThis, Vfs* pVfs)
+{
+    unsigned int staleCount = 0;
+    unsigned int i;
+
+    for (i = 0 ; i < pThis->objectCount ; i++)
+    {
+        /* Reuse the stamp field to remember the answer for each object so that each file is only stat()ed once. */
+        pThis->pObjects[i].hasStamp = !hasObjectChanged(&pThis->pObjects[i], pVfs);
+    }
+    for (i = 0 ; i < pThis->entryCount ; i++)
+    {
+        DiskImagePlanEntry* pEntry = &pThis->pEntries[i];
+
+        pEntry->isStale = !pThis->pObjects[pEntry->objectIndex].hasStamp;
+        staleCount += pEntry->isStale;
+    }
+    return staleCount;
+}
+
+static int hasObjectChanged(const DiskImagePlanObject* pObject, Vfs* pVfs)
+{
+    VfsFileStamp stamp;
+
+    if (!pObject->hasStamp || !Vfs_GetFileStamp(pVfs, pObject->pFilename, &stamp))
+        return TRUE;
+    return stamp.modificationTime != pObject->stamp.modificationTime ||
+           stamp.modificationNsec != pObject->stamp.modificationNsec ||
+           stamp.size != pObject->stamp.size;
+}
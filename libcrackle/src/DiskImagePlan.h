@@ -0,0 +1,74 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Compiled form of a crackle script.  Each script line is kept as a fully resolved insert along with the object file
+   it reads and the regions (tracks or blocks) it writes, so that the script only has to be parsed again once it, or
+   an object file which one of its '*' fields was resolved from, changes. */
+#ifndef _DISK_IMAGE_PLAN_H_
+#define _DISK_IMAGE_PLAN_H_
+
+#include "DiskImage.h"
+
+
+#define DISK_IMAGE_PLAN_NO_IMAGE_TABLE 0xFFFFFFFF
+
+
+typedef struct DiskImagePlanObject
+{
+    char*        pFilename;
+    VfsFileStamp stamp;
+    /* Objects which can't be stamped, like those kept in memory, are always treated as changed. */
+    int          hasStamp;
+} DiskImagePlanObject;
+
+typedef struct DiskImagePlanEntry
+{
+    DiskImageInsert insert;
+    unsigned int    lineNumber;
+    unsigned int    objectIndex;
+    unsigned int    imageTableAddress;
+    unsigned int    firstRegion;
+    unsigned int    lastRegion;
+    /* Set when a '*' field or an image table update made the insert depend on the contents of the object file. */
+    int             isResolvedFromObject;
+    int             isStale;
+} DiskImagePlanEntry;
+
+typedef struct DiskImagePlan
+{
+    DiskImagePlanEntry*  pEntries;
+    unsigned int         entryCount;
+    unsigned int         allocatedEntryCount;
+    DiskImagePlanObject* pObjects;
+    unsigned int         objectCount;
+    unsigned int         allocatedObjectCount;
+    VfsFileStamp         scriptStamp;
+    unsigned int         imageSize;
+    unsigned int         regionSize;
+} DiskImagePlan;
+
+
+         void         DiskImagePlan_Free(DiskImagePlan* pThis);
+/* Copies *pEntry into the plan, pointing its objectIndex at pObjectFilename.  pObjectStamp is NULL for objects which
+   can't be stamped. */
+__throws void         DiskImagePlan_AddEntry(DiskImagePlan*            pThis,
+                                             const DiskImagePlanEntry* pEntry,
+                                             const char*               pObjectFilename,
+                                             const VfsFileStamp*       pObjectStamp);
+
+         int          DiskImagePlan_Read(DiskImagePlan* pThis, Vfs* pVfs, const char* pFilename);
+__throws void         DiskImagePlan_Write(DiskImagePlan* pThis, Vfs* pVfs, const char* pFilename);
+
+/* Sets isStale on the entries whose object file has changed since the plan was compiled and returns their count. */
+         unsigned int DiskImagePlan_MarkStaleEntries(DiskImagePlan* pThis, Vfs* pVfs);
+
+#endif /* _DISK_IMAGE_PLAN_H_ */
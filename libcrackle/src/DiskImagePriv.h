@@ -13,20 +13,39 @@
 #ifndef _DISK_IMAGE_PRIV_H_
 #define _DISK_IMAGE_PRIV_H_
 
+#include <pthread.h>
 #include "DiskImage.h"
 #include "TextFile.h"
 #include "ParseCSV.h"
 #include "ByteBuffer.h"
+#include "DiskImageManifest.h"
+#include "DiskImagePlan.h"
+#include "DiskImagePacker.h"
 
 
 typedef struct DiskImageVTable
 {
     void (*freeObject)(void *pThis);
     void (*insertData)(void* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
+    void (*flushImage)(void* pThis);
+    /* Returns the range of regions (tracks or blocks) which the insert would write to, or 0 if it writes nothing. */
+    int  (*getInsertRegions)(void* pThis, const DiskImageInsert* pInsert, unsigned int* pFirst, unsigned int* pLast);
+    /* Throws the same exception that insertData() would for pInsert but without writing anything to the image. */
+    void (*validateInsert)(void* pThis, const DiskImageInsert* pInsert);
 
 } DiskImageVTable;
 
 
+/* Text built up while processing a script and only written out once the whole script has been processed.  It is
+   kept '\0' terminated. */
+typedef struct DiskImageText
+{
+    char*  pText;
+    size_t length;
+    size_t allocatedLength;
+} DiskImageText;
+
+
 typedef struct DiskImageScriptEngine
 {
     DiskImage*      pDiskImage;
@@ -37,20 +56,124 @@ typedef struct DiskImageScriptEngine
     unsigned int    lineNumber;
     unsigned int    lastBlock;
     unsigned int    lastLength;
+    unsigned int    errorCount;
+    /* Inputs of the current line which a plan has to replay. */
+    unsigned int    imageTableAddress;
+    int             isResolvedFromObject;
+    /* Places the RW18 lines which use '?' for their track and offset. */
+    DiskImagePacker packer;
+    unsigned int    packedLineCount;
+    int             hasPackedLines;
+    int             isLinePacked;
+    /* Copy of the script with the '?' fields filled in.  Only built for scripts with '?' lines once
+       DiskImage_EnableResolvedScript() is called. */
+    DiskImageText   resolvedScript;
+    /* Only built once DiskImage_EnableEquates() is called.  The labels are kept to make each one unique. */
+    DiskImageText   equates;
+    char**          ppEquateLabels;
+    unsigned int    equateLabelCount;
+    unsigned int    allocatedEquateLabelCount;
 } DiskImageScriptEngine;
 
 
+typedef struct DiskImageObject
+{
+    struct DiskImageObject* pNext;
+    const unsigned char*    pData;
+    DiskImageInsert         defaultInsert;
+    unsigned int            length;
+    char                    filename[];
+} DiskImageObject;
+
+
+/* Object file loaded from the Vfs and kept around for later script lines which reference the same file.  It is
+   only reused while the file's stamp still matches. */
+typedef struct DiskImageCachedObject
+{
+    struct DiskImageCachedObject* pNext;
+    ByteBuffer                    data;
+    VfsFileStamp                  stamp;
+    DiskImageInsert               defaultInsert;
+    unsigned int                  length;
+    /* Number of images holding this entry. */
+    unsigned int                  referenceCount;
+    /* Set once a newer entry for the same file has replaced this one in the cache's list. */
+    int                           isSuperseded;
+    char                          filename[];
+} DiskImageCachedObject;
+
+
+/* Images built on different threads can share a cache so it is protected by a mutex, which also guards the
+   referenceCount and isSuperseded fields of its entries.  The data of an entry is never modified once added so it
+   can be used without holding the lock.  A file which changes gets a new entry which replaces the stale one in the
+   list.  The stale entry is freed right away if no image holds it, otherwise by the last image to release it. */
+struct DiskImageObjectCache
+{
+    DiskImageCachedObject* pObjects;
+    pthread_mutex_t        mutex;
+    unsigned int           referenceCount;
+};
+
+
 struct DiskImage
 {
-    DiskImageVTable*      pVTable;
-    ByteBuffer            image;
-    ByteBuffer            object;
-    DiskImageScriptEngine script;
-    DiskImageInsert       insert;
-    unsigned int          objectFileLength;
+    DiskImageVTable*       pVTable;
+    Vfs*                   pVfs;
+    DiskImageObject*       pInMemoryObjects;
+    DiskImageObjectCache*  pObjectCache;
+    ByteBuffer             image;
+    /* Sparse images leave image empty and instead keep each region in its own allocation which is only made once
+       something is written to that region.  NULL entries are holes which read as zero. */
+    unsigned char**        ppSparseRegions;
+    unsigned int           imageSize;
+    /* pObject is a read-only view of the current object's data which can point into a cached or in-memory object.
+       Anything which needs to modify the data first makes a private copy in objectCopy. */
+    const unsigned char*   pObject;
+    unsigned int           objectSize;
+    /* Set when pObject points at the caller's data for an in-memory object which has no zero padding after its
+       objectFileLength bytes. */
+    int                    isObjectUnpadded;
+    /* Name of the current object when it is kept in the in-memory or cached object lists which outlive the script,
+       NULL otherwise. */
+    const char*            pObjectFilename;
+    /* Stamp of the current object when it came from the object cache. */
+    VfsFileStamp           objectStamp;
+    int                    hasObjectStamp;
+    /* Every cached object which this image has used.  Each one is held until the image is freed since
+       pObjectFilename can be kept past the script line which read it, as the NibbleDiskImage writer records do. */
+    DiskImageCachedObject** ppHeldObjects;
+    unsigned int           heldObjectCount;
+    unsigned int           heldObjectsAllocated;
+    ByteBuffer             objectCopy;
+    DiskImageScriptEngine  script;
+    DiskImageInsert        insert;
+    unsigned int           objectFileLength;
+    /* Size in bytes of the image regions which --update builds rewrite as a unit. */
+    unsigned int           regionSize;
+    /* Non-NULL while recording the inserts of a script instead of applying them. */
+    DiskImageManifest*     pManifest;
+    /* Set by DiskImage_EnablePlan() and non-NULL pPlan while compiling a script into that plan. */
+    char*                  pPlanFilename;
+    DiskImagePlan*         pPlan;
+    /* Set by DiskImage_EnableResolvedScript(). */
+    char*                  pResolvedScriptFilename;
+    /* Set by DiskImage_EnableEquates(). */
+    char*                  pEquatesFilename;
 };
 
 
-__throws void DiskImage_Init(DiskImage* pThis, DiskImageVTable* pVTable, unsigned int imageSize);
+__throws void DiskImage_Init(DiskImage*       pThis, 
+                             DiskImageVTable* pVTable, 
+                             unsigned int     imageSize, 
+                             unsigned int     regionSize, 
+                             Vfs*             pVfs);
+__throws void DiskImage_InitSparse(DiskImage*       pThis, 
+                                   DiskImageVTable* pVTable, 
+                                   unsigned int     imageSize, 
+                                   unsigned int     regionSize, 
+                                   Vfs*             pVfs);
+
+/* Returns a writable pointer to the start of the given region, allocating it first for sparse images. */
+__throws unsigned char* DiskImage_GetRegionPointer(DiskImage* pThis, unsigned int region);
 
 #endif /* _DISK_IMAGE_PRIV_H_ */
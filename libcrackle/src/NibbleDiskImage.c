@@ -11,54 +11,103 @@
     GNU General Public License for more details.
 */
 #include <assert.h>
+#include <pthread.h>
 #include "NibbleDiskImage.h"
 #include "DiskImagePriv.h"
 #include "DiskImageTest.h"
+#include "NibbleEncoder.h"
 #include "BinaryBuffer.h"
 #include "TextFile.h"
 #include "ParseCSV.h"
 #include "util.h"
 
 
+typedef struct RW18TrackCache
+{
+    unsigned char data[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+    unsigned int  side;
+    int           isDirty;
+} RW18TrackCache;
+
+typedef struct RWTS16TrackCache
+{
+    unsigned char  sectors[NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK][DISK_IMAGE_BYTES_PER_SECTOR];
+    unsigned short dirtySectors;
+} RWTS16TrackCache;
+
+
+/* Regions are the pages of a RW18 track or the sectors of a RWTS16 track, depending on which type of insert last
+   wrote to the track. */
+typedef struct TrackWriters
+{
+    DiskImageInsertionType type;
+    unsigned int           side;
+    unsigned int           writtenRegions;
+    NibbleRegionWriter     regions[DISK_IMAGE_RW18_PAGES_PER_TRACK];
+} TrackWriters;
+
+
+typedef void (*TrackWorkFunction)(NibbleDiskImage* pImage, unsigned int track, void* pContext);
+
+typedef struct TrackWorker
+{
+    NibbleDiskImage*     pImage;
+    TrackWorkFunction    workFunction;
+    void*                pContext;
+    const unsigned char* pTracks;
+    unsigned int         trackCount;
+    unsigned int         firstIndex;
+    unsigned int         stride;
+} TrackWorker;
+
+
 struct NibbleDiskImage
 {
     DiskImage            super;
-    unsigned char*       pWrite;
-    const unsigned char* pRead;
+    RW18TrackCache       rw18Tracks[DISK_IMAGE_TRACKS_PER_SIDE];
+    RWTS16TrackCache     rwts16Tracks[DISK_IMAGE_TRACKS_PER_SIDE];
+    /* Only allocated once NibbleDiskImage_RecordWriters() has been called. */
+    TrackWriters*        pWriters;
     const unsigned char* pData;
-    unsigned char*       pCurrentTrack;
     unsigned int         side;
     unsigned int         track;
     unsigned int         sector;
     unsigned int         intraTrackOffset;
     unsigned int         bytesLeft;
-    unsigned char        checksum;
-    unsigned char        lastByte;
-    unsigned char        aux[86];
-    unsigned char        decode8to6[256];
+    unsigned int         encodeThreadCount;
 };
 
 
 static void freeObject(void* pThis);
 static void insertData(void* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
+static void flushImage(void* pThis);
+static int  getInsertRegions(void* pThis, const DiskImageInsert* pInsert, unsigned int* pFirst, unsigned int* pLast);
+static void validateInsert(void* pThis, const DiskImageInsert* pInsert);
 struct DiskImageVTable NibbleDiskImageVTable = 
 { 
     freeObject,
-    insertData 
+    insertData,
+    flushImage,
+    getInsertRegions,
+    validateInsert
 };
 
 
-static void initializeDecode8to6Table(NibbleDiskImage* pThis);
-static unsigned char encode6to8(unsigned char byte);
 __throws NibbleDiskImage* NibbleDiskImage_Create(void)
+{
+    return NibbleDiskImage_CreateWithVfs(NULL);
+}
+
+__throws NibbleDiskImage* NibbleDiskImage_CreateWithVfs(Vfs* pVfs)
 {
     NibbleDiskImage* pThis = NULL;
     
     __try
     {
         pThis = allocateAndZero(sizeof(*pThis));
-        DiskImage_Init(&pThis->super, &NibbleDiskImageVTable, NIBBLE_DISK_IMAGE_SIZE);
-        initializeDecode8to6Table(pThis);
+        DiskImage_Init(&pThis->super, &NibbleDiskImageVTable, NIBBLE_DISK_IMAGE_SIZE, 
+                       NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK, pVfs);
+        pThis->encodeThreadCount = 1;
     }
     __catch
     {
@@ -69,35 +118,11 @@ __throws NibbleDiskImage* NibbleDiskImage_Create(void)
     return pThis;
 }
 
-static void initializeDecode8to6Table(NibbleDiskImage* pThis)
-{
-    unsigned char i = 0;
-    memset(pThis->decode8to6, 0xFF, sizeof(pThis->decode8to6));
-    for (i = 0 ; i < 64 ; i++)
-        pThis->decode8to6[encode6to8(i)] = i;
-}
-
-static unsigned char encode6to8(unsigned char byte)
-{
-    static const unsigned char nibbleArray[64] =
-    {
-        0x96, 0x97, 0x9a, 0x9b, 0x9d, 0x9e, 0x9f, 0xa6,
-        0xa7, 0xab, 0xac, 0xad, 0xae, 0xaf, 0xb2, 0xb3,
-        0xb4, 0xb5, 0xb6, 0xb7, 0xb9, 0xba, 0xbb, 0xbc,
-        0xbd, 0xbe, 0xbf, 0xcb, 0xcd, 0xce, 0xcf, 0xd3,
-        0xd6, 0xd7, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde,
-        0xdf, 0xe5, 0xe6, 0xe7, 0xe9, 0xea, 0xeb, 0xec,
-        0xed, 0xee, 0xef, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6,
-        0xf7, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
-    };
-
-    assert ( byte < 64 );
-    return nibbleArray[byte];
-}
-
-
 static void freeObject(void* pThis)
 {
+    NibbleDiskImage* pNibbleImage = (NibbleDiskImage*)pThis;
+    
+    free(pNibbleImage->pWriters);
 }
 
 
@@ -133,47 +158,27 @@ static void insertData(void* pThis, const unsigned char* pData, DiskImageInsert*
 static void insertRWTS16Data(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
 static void prepareForFirstRWTS16Sector(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
 static void advanceToNextSector(NibbleDiskImage* pThis);
-static void writeRWTS16Sector(NibbleDiskImage* pThis);
+static void updateRWTS16Sector(NibbleDiskImage* pThis);
 static void validateRWTS16TrackAndSector(NibbleDiskImage* pThis);
-static void writeSectorLeadInSyncBytes(NibbleDiskImage* pThis);
-static void writeSyncBytes(NibbleDiskImage* pThis, size_t syncByteCount);
-static void writeRWTS16AddressField(NibbleDiskImage* pThis, unsigned char volume, unsigned char track, unsigned char sector);
-static void writeRWTS16AddressFieldProlog(NibbleDiskImage* pThis);
-static void initChecksum(NibbleDiskImage* pThis);
-static void write4and4Data(NibbleDiskImage* pThis, unsigned char byte);
-static void updateChecksum(NibbleDiskImage* pThis, unsigned char byte);
-static void writeRWTS16FieldEpilog(NibbleDiskImage* pThis);
-static void writeRWTS16DataField(NibbleDiskImage* pThis, const unsigned char* pData);
-static void writeRWTS16DataFieldProlog(NibbleDiskImage* pThis);
-static void write6and2Data(NibbleDiskImage* pThis, const unsigned char* pData);
-static void fillAuxBuffer(NibbleDiskImage* pThis, const unsigned char* pData);
-static unsigned char encodeAuxByte(NibbleDiskImage* pThis, size_t i, const unsigned char* pData);
-static unsigned char lowBitsByte(size_t i, const unsigned char* pData);
-static unsigned char lowBitOffset(size_t i);
-static unsigned char midBitsByte(size_t i, const unsigned char* pData);
-static unsigned char midBitOffset(size_t i);
-static unsigned char highBitsByte(size_t i, const unsigned char* pData);
-static unsigned char highBitOffset(size_t i);
-static void checksumNibbilizeAndWrite(NibbleDiskImage* pThis, const unsigned char* pData);
-static void checksumNibbilizeAndWriteAuxBuffer(NibbleDiskImage* pThis);
-static unsigned char nibbilizeByte(NibbleDiskImage* pThis, unsigned char byte);
-static void checksumNibbilizeAndWriteDataBuffer(NibbleDiskImage* pThis, const unsigned char* pData);
-static void nibbilizeAndWriteChecksum(NibbleDiskImage* pThis);
+static void recordWriters(NibbleDiskImage*       pThis, 
+                          DiskImageInsertionType type, 
+                          unsigned int           side, 
+                          unsigned int           firstRegion, 
+                          unsigned int           lastRegion);
+static void flushRW18Track(NibbleDiskImage* pThis, unsigned int track);
+static void flushRWTS16Track(NibbleDiskImage* pThis, unsigned int track);
 static void insertRW18Data(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
 static void prepareForFirstRW18Track(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
-static void writeRW18Track(NibbleDiskImage* pThis);
+static void updateRW18Track(NibbleDiskImage* pThis);
 static void validateRW18TrackAndOffset(NibbleDiskImage* pThis);
-static unsigned int initTrackData(NibbleDiskImage* pThis, unsigned char* pTrackData, size_t trackDataSize);
+static unsigned int updateRW18TrackCache(NibbleDiskImage* pThis, RW18TrackCache* pCache);
+static void loadRW18TrackCache(NibbleDiskImage* pThis, RW18TrackCache* pCache);
 static void readCurrentTrackContentsOrZeroFill(NibbleDiskImage* pThis, unsigned char* pTrackData, size_t trackDataSize);
-static void writeEncodedBytes(NibbleDiskImage* pThis, const char* pBytes, size_t byteCount);
-static void writeRW18Sector(NibbleDiskImage* pThis, unsigned char sector);
-static void writeRW18AddressField(NibbleDiskImage* pThis, unsigned char track, unsigned char sector);
-static void writeRW18AddressFieldProlog(NibbleDiskImage* pThis);
-static void writeRW18AddressFieldEpilog(NibbleDiskImage* pThis);
-static void writeRW18DataField(NibbleDiskImage* pThis, unsigned char sector);
-static void writeRW18BundleId(NibbleDiskImage* pThis);
-static void writeRW18Data(NibbleDiskImage* pThis, unsigned char sector);
-static void writeRW18DataFieldEpilog(NibbleDiskImage* pThis);
+static void readRW18Track(NibbleDiskImage* pThis,
+                          unsigned int side,
+                          unsigned int track,
+                          unsigned char* pTrackData,
+                          size_t trackDataSize);
 static void advanceToNextRW18Track(NibbleDiskImage* pThis, unsigned int bytesUsed);
 __throws void NibbleDiskImage_InsertData(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
 {
@@ -196,23 +201,29 @@ static void insertRWTS16Data(NibbleDiskImage* pThis, const unsigned char* pData,
     prepareForFirstRWTS16Sector(pThis, pData, pInsert);
     while (pThis->bytesLeft > 0)
     {
-        writeRWTS16Sector(pThis);
+        updateRWTS16Sector(pThis);
+        pThis->pData += DISK_IMAGE_BYTES_PER_SECTOR;
         advanceToNextSector(pThis);
     }
 }
 
+static void startAtFirstRWTS16Sector(NibbleDiskImage* pThis, const DiskImageInsert* pInsert);
 static void prepareForFirstRWTS16Sector(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
+{
+    startAtFirstRWTS16Sector(pThis, pInsert);
+    pThis->pData = pData + pInsert->sourceOffset;
+}
+
+static void startAtFirstRWTS16Sector(NibbleDiskImage* pThis, const DiskImageInsert* pInsert)
 {
     pThis->track = pInsert->track;
     pThis->sector = pInsert->sector;
     pThis->bytesLeft = pInsert->length;
-    pThis->pData = pData + pInsert->sourceOffset;
 }
 
 static void advanceToNextSector(NibbleDiskImage* pThis)
 {
     pThis->bytesLeft -= DISK_IMAGE_BYTES_PER_SECTOR;
-    pThis->pData += DISK_IMAGE_BYTES_PER_SECTOR;
     pThis->sector++;
     if (pThis->sector >= NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK)
     {
@@ -221,25 +232,17 @@ static void advanceToNextSector(NibbleDiskImage* pThis)
     }
 }
 
-static void writeRWTS16Sector(NibbleDiskImage* pThis)
+static void updateRWTS16Sector(NibbleDiskImage* pThis)
 {
-    static const unsigned char   volume = 0;
-    unsigned int                 imageOffset = NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * pThis->track + 
-                                               NIBBLE_DISK_IMAGE_RWTS16_GAP1_SYNC_BYTES +
-                                               NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR * pThis->sector;
-    const unsigned char*         pStart;
+    RWTS16TrackCache* pCache;
     
     validateRWTS16TrackAndSector(pThis);
-        
-    pThis->pWrite = DiskImage_GetImagePointer(&pThis->super) + imageOffset;
-    pStart = pThis->pWrite;
-    
-    writeSectorLeadInSyncBytes(pThis);
-    writeRWTS16AddressField(pThis, volume, pThis->track, pThis->sector);
-    writeSyncBytes(pThis, NIBBLE_DISK_IMAGE_RWTS16_GAP2_SYNC_BYTES);
-    writeRWTS16DataField(pThis, pThis->pData);
-    
-    assert ( pThis->pWrite - pStart == NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR - NIBBLE_DISK_IMAGE_RWTS16_GAP3_SYNC_BYTES);
+    flushRW18Track(pThis, pThis->track);
+
+    pCache = &pThis->rwts16Tracks[pThis->track];
+    memcpy(pCache->sectors[pThis->sector], pThis->pData, DISK_IMAGE_BYTES_PER_SECTOR);
+    pCache->dirtySectors |= 1 << pThis->sector;
+    recordWriters(pThis, DISK_IMAGE_INSERTION_RWTS16, 0, pThis->sector, pThis->sector);
 }
 
 static void validateRWTS16TrackAndSector(NibbleDiskImage* pThis)
@@ -252,482 +255,618 @@ static void validateRWTS16TrackAndSector(NibbleDiskImage* pThis)
         __throw(invalidLengthException);
 }
 
-static void writeSectorLeadInSyncBytes(NibbleDiskImage* pThis)
+static void recordWriters(NibbleDiskImage*       pThis, 
+                          DiskImageInsertionType type, 
+                          unsigned int           side, 
+                          unsigned int           firstRegion, 
+                          unsigned int           lastRegion)
 {
-    size_t leadInSyncByteCount;
+    TrackWriters* pTrack;
+    unsigned int  region;
     
-    if (pThis->sector == 0)
-        leadInSyncByteCount = NIBBLE_DISK_IMAGE_RWTS16_GAP1_SYNC_BYTES;
-    else
-        leadInSyncByteCount = NIBBLE_DISK_IMAGE_RWTS16_GAP3_SYNC_BYTES;
-    pThis->pWrite -= leadInSyncByteCount;
+    if (!pThis->pWriters)
+        return;
     
-    writeSyncBytes(pThis, leadInSyncByteCount);
-}
-
-static void writeSyncBytes(NibbleDiskImage* pThis, size_t syncByteCount)
-{
-    memset(pThis->pWrite, 0xff, syncByteCount);
-    pThis->pWrite += syncByteCount;
+    /* Regions written in another format or for another side no longer describe what is on the track. */
+    pTrack = &pThis->pWriters[pThis->track];
+    if (pTrack->type != type || pTrack->side != side)
+        memset(pTrack, 0, sizeof(*pTrack));
+    pTrack->type = type;
+    pTrack->side = side;
+    for (region = firstRegion ; region <= lastRegion ; region++)
+    {
+        pTrack->regions[region].lineNumber = pThis->super.script.lineNumber;
+        pTrack->regions[region].pObjectFilename = pThis->super.pObjectFilename;
+        pTrack->writtenRegions |= 1 << region;
+    }
 }
 
-static void writeRWTS16AddressField(NibbleDiskImage* pThis, unsigned char volume, unsigned char track, unsigned char sector)
+static void flushRWTS16Track(NibbleDiskImage* pThis, unsigned int track)
 {
-    writeRWTS16AddressFieldProlog(pThis);
-    
-    initChecksum(pThis);
-    write4and4Data(pThis, volume);
-    write4and4Data(pThis, track);
-    write4and4Data(pThis, sector);
-    write4and4Data(pThis, pThis->checksum);
+    RWTS16TrackCache* pCache = &pThis->rwts16Tracks[track];
+    unsigned int      sector;
     
-    writeRWTS16FieldEpilog(pThis);
+    if (!pCache->dirtySectors)
+        return;
+    for (sector = 0 ; sector < NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK ; sector++)
+    {
+        if (pCache->dirtySectors & (1 << sector))
+            NibbleEncoder_WriteRWTS16Sector(pThis->super.image.pBuffer, track, sector, pCache->sectors[sector]);
+    }
+    pCache->dirtySectors = 0;
 }
 
-static void writeRWTS16AddressFieldProlog(NibbleDiskImage* pThis)
+static void insertRW18Data(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
 {
-    memcpy(pThis->pWrite, "\xD5\xAA\x96", 3);
-    pThis->pWrite += 3;
+    prepareForFirstRW18Track(pThis, pData, pInsert);
+    while (pThis->bytesLeft > 0)
+        updateRW18Track(pThis);
 }
 
-static void initChecksum(NibbleDiskImage* pThis)
+static void startAtFirstRW18Track(NibbleDiskImage* pThis, const DiskImageInsert* pInsert);
+static void prepareForFirstRW18Track(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
 {
-    pThis->checksum = 0;
+    startAtFirstRW18Track(pThis, pInsert);
+    pThis->pData = pData + pInsert->sourceOffset;
 }
 
-static void write4and4Data(NibbleDiskImage* pThis, unsigned char byte)
+static void startAtFirstRW18Track(NibbleDiskImage* pThis, const DiskImageInsert* pInsert)
 {
-    char oddBits = byte & 0xAA;
-    char evenBits = byte & 0x55;
-    char encodedOddByte = 0xAA | (oddBits >> 1);
-    char encodedEvenByte = 0xAA | evenBits;
-    
-    updateChecksum(pThis, byte);
-    *pThis->pWrite++ = encodedOddByte;
-    *pThis->pWrite++ = encodedEvenByte;
+    pThis->side = pInsert->side;
+    pThis->track = pInsert->track;
+    pThis->intraTrackOffset = pInsert->intraTrackOffset;
+    pThis->bytesLeft = pInsert->length;
 }
 
-static void updateChecksum(NibbleDiskImage* pThis, unsigned char byte)
+static void updateRW18Track(NibbleDiskImage* pThis)
 {
-    pThis->checksum ^= byte;
+    unsigned int bytesUsed;
+    
+    validateRW18TrackAndOffset(pThis);
+    flushRWTS16Track(pThis, pThis->track);
+    bytesUsed = updateRW18TrackCache(pThis, &pThis->rw18Tracks[pThis->track]);
+    pThis->pData += bytesUsed;
+    advanceToNextRW18Track(pThis, bytesUsed);
 }
 
-static void writeRWTS16FieldEpilog(NibbleDiskImage* pThis)
+static void validateRW18TrackAndOffset(NibbleDiskImage* pThis)
 {
-    memcpy(pThis->pWrite, "\xDE\xAA\xEB", 3);
-    pThis->pWrite += 3;
+    if (pThis->track >= DISK_IMAGE_TRACKS_PER_SIDE)
+        __throw(invalidTrackException);
+    if (pThis->intraTrackOffset >= DISK_IMAGE_RW18_BYTES_PER_TRACK)
+        __throw(invalidIntraTrackOffsetException);
 }
 
-static void writeRWTS16DataField(NibbleDiskImage* pThis, const unsigned char* pData)
+static unsigned int updateRW18TrackCache(NibbleDiskImage* pThis, RW18TrackCache* pCache)
 {
-    writeRWTS16DataFieldProlog(pThis);
-    write6and2Data(pThis, pData);
-    writeRWTS16FieldEpilog(pThis);
+    unsigned int copyBytes = sizeof(pCache->data) - pThis->intraTrackOffset;
+    
+    loadRW18TrackCache(pThis, pCache);
+    if (copyBytes > pThis->bytesLeft)
+        copyBytes = pThis->bytesLeft;
+    memcpy(pCache->data + pThis->intraTrackOffset, pThis->pData, copyBytes);
+    pCache->isDirty = TRUE;
+    recordWriters(pThis, 
+                  DISK_IMAGE_INSERTION_RW18, 
+                  pThis->side, 
+                  pThis->intraTrackOffset / DISK_IMAGE_PAGE_SIZE, 
+                  (pThis->intraTrackOffset + copyBytes - 1) / DISK_IMAGE_PAGE_SIZE);
+    
+    return copyBytes;
 }
 
-static void writeRWTS16DataFieldProlog(NibbleDiskImage* pThis)
+static void loadRW18TrackCache(NibbleDiskImage* pThis, RW18TrackCache* pCache)
 {
-    memcpy(pThis->pWrite, "\xD5\xAA\xAD", 3);
-    pThis->pWrite += 3;
+    if (pCache->isDirty && pCache->side == pThis->side)
+        return;
+    
+    /* Pending data for another side wouldn't decode as this side once nibblized so it is dropped like before. */
+    if (pCache->isDirty)
+        memset(pCache->data, 0x00, sizeof(pCache->data));
+    else
+        readCurrentTrackContentsOrZeroFill(pThis, pCache->data, sizeof(pCache->data));
+    pCache->side = pThis->side;
 }
 
-static void write6and2Data(NibbleDiskImage* pThis, const unsigned char* pData)
+static void readCurrentTrackContentsOrZeroFill(NibbleDiskImage* pThis, unsigned char* pTrackData, size_t trackDataSize)
 {
-    fillAuxBuffer(pThis, pData);
-    checksumNibbilizeAndWrite(pThis, pData);
+    __try
+    {
+        readRW18Track(pThis, pThis->side, pThis->track, pTrackData, trackDataSize);
+    }
+    __catch
+    {
+        /* Track didn't already contain RW18 data so initialize it to all zeroes. */
+        memset(pTrackData, 0x00, trackDataSize);
+        clearExceptionCode();
+    }
 }
 
-static void fillAuxBuffer(NibbleDiskImage* pThis, const unsigned char* pData)
+static void flushRW18Track(NibbleDiskImage* pThis, unsigned int track)
 {
-    size_t i;
+    RW18TrackCache* pCache = &pThis->rw18Tracks[track];
     
-    for (i = 0; i < sizeof(pThis->aux) ; i++)
-        pThis->aux[i] = encodeAuxByte(pThis, i, pData);
+    if (!pCache->isDirty)
+        return;
+    NibbleEncoder_WriteRW18Track(pThis->super.image.pBuffer, pCache->side, track, pCache->data);
+    pCache->isDirty = FALSE;
 }
 
-static unsigned char encodeAuxByte(NibbleDiskImage* pThis, size_t i, const unsigned char* pData)
+static void advanceToNextRW18Track(NibbleDiskImage* pThis, unsigned int bytesUsed)
 {
-    unsigned char lowByte = lowBitsByte(i, pData);
-    unsigned char midByte = midBitsByte(i, pData);
-    unsigned char highByte = highBitsByte(i, pData);
-    unsigned char lowBits = ((lowByte & 1) << 1) |
-                            ((lowByte & 2) >> 1);
-    unsigned char midBits = ((midByte & 1) << 3) |
-                            ((midByte & 2) << 1);
-    unsigned char highBits = ((highByte & 1) << 5) |
-                             ((highByte & 2) << 3);
-    
-    return highBits | midBits | lowBits;
+    pThis->bytesLeft -= bytesUsed;
+    pThis->intraTrackOffset = 0;
+    pThis->track++;
 }
 
-static unsigned char lowBitsByte(size_t i, const unsigned char* pData)
+
+static void validateRWTS16Insert(NibbleDiskImage* pThis, const DiskImageInsert* pInsert);
+static void validateRW18Insert(NibbleDiskImage* pThis, const DiskImageInsert* pInsert);
+static void validateInsert(void* pThis, const DiskImageInsert* pInsert)
 {
-    return pData[lowBitOffset(i)];
+    switch (pInsert->type)
+    {
+    case DISK_IMAGE_INSERTION_RWTS16:
+        validateRWTS16Insert((NibbleDiskImage*)pThis, pInsert);
+        break;
+    case DISK_IMAGE_INSERTION_RW18:
+        validateRW18Insert((NibbleDiskImage*)pThis, pInsert);
+        break;
+    case DISK_IMAGE_INSERTION_BLOCK:
+    default:
+        __throw(invalidInsertionTypeException);
+    }
 }
 
-static unsigned char lowBitOffset(size_t i)
+static void validateRWTS16Insert(NibbleDiskImage* pThis, const DiskImageInsert* pInsert)
 {
-    return (unsigned char)(0x55 - i);
+    /* Walks the same sectors as insertRWTS16Data() but only validates each one. */
+    startAtFirstRWTS16Sector(pThis, pInsert);
+    while (pThis->bytesLeft > 0)
+    {
+        validateRWTS16TrackAndSector(pThis);
+        advanceToNextSector(pThis);
+    }
 }
 
-static unsigned char midBitsByte(size_t i, const unsigned char* pData)
+static void validateRW18Insert(NibbleDiskImage* pThis, const DiskImageInsert* pInsert)
 {
-    return pData[midBitOffset(i)];
+    /* Walks the same tracks as insertRW18Data() but only validates each one. */
+    startAtFirstRW18Track(pThis, pInsert);
+    while (pThis->bytesLeft > 0)
+    {
+        unsigned int bytesUsed = DISK_IMAGE_RW18_BYTES_PER_TRACK - pThis->intraTrackOffset;
+        
+        validateRW18TrackAndOffset(pThis);
+        if (bytesUsed > pThis->bytesLeft)
+            bytesUsed = pThis->bytesLeft;
+        advanceToNextRW18Track(pThis, bytesUsed);
+    }
 }
 
-static unsigned char midBitOffset(size_t i)
+
+static int getInsertRegions(void* pThis, const DiskImageInsert* pInsert, unsigned int* pFirst, unsigned int* pLast)
 {
-    return (unsigned char)(0xAB - i);
+    unsigned int lastTrack;
+    
+    if (pInsert->length == 0 || pInsert->track >= DISK_IMAGE_TRACKS_PER_SIDE)
+        return 0;
+    
+    switch (pInsert->type)
+    {
+    case DISK_IMAGE_INSERTION_RWTS16:
+        lastTrack = pInsert->track + 
+                    (pInsert->sector + (pInsert->length - 1) / DISK_IMAGE_BYTES_PER_SECTOR) / 
+                    NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK;
+        break;
+    case DISK_IMAGE_INSERTION_RW18:
+        lastTrack = pInsert->track + 
+                    (pInsert->intraTrackOffset + pInsert->length - 1) / DISK_IMAGE_RW18_BYTES_PER_TRACK;
+        break;
+    case DISK_IMAGE_INSERTION_BLOCK:
+    default:
+        return 0;
+    }
+    
+    *pFirst = pInsert->track;
+    *pLast = lastTrack < DISK_IMAGE_TRACKS_PER_SIDE ? lastTrack : DISK_IMAGE_TRACKS_PER_SIDE - 1;
+    return 1;
 }
 
-static unsigned char highBitsByte(size_t i, const unsigned char* pData)
+
+void NibbleDiskImage_SetEncodeThreadCount(NibbleDiskImage* pThis, unsigned int threadCount)
 {
-    return pData[highBitOffset(i)];
+    if (threadCount < 1)
+        threadCount = 1;
+    if (threadCount > DISK_IMAGE_TRACKS_PER_SIDE)
+        threadCount = DISK_IMAGE_TRACKS_PER_SIDE;
+    pThis->encodeThreadCount = threadCount;
 }
 
-static unsigned char highBitOffset(size_t i)
+
+static unsigned int collectDirtyTracks(NibbleDiskImage* pThis, unsigned char* pTracks);
+static int isTrackDirty(NibbleDiskImage* pThis, unsigned int track);
+static void runTrackWorkers(NibbleDiskImage*     pThis, 
+                            const unsigned char* pTracks, 
+                            unsigned int         trackCount,
+                            TrackWorkFunction    workFunction,
+                            void*                pContext);
+static void initTrackWorkers(NibbleDiskImage*     pThis, 
+                             TrackWorker*         pWorkers, 
+                             unsigned int         workerCount,
+                             const unsigned char* pTracks, 
+                             unsigned int         trackCount,
+                             TrackWorkFunction    workFunction,
+                             void*                pContext);
+static void* trackWorkerThread(void* pvWorker);
+static void processTracks(TrackWorker* pWorker);
+static void flushTrack(NibbleDiskImage* pThis, unsigned int track, void* pContext);
+static void flushImage(void* pThis)
 {
-    return (unsigned char)(0x101 - i);
+    NibbleDiskImage* pNibbleImage = (NibbleDiskImage*)pThis;
+    unsigned char    tracks[DISK_IMAGE_TRACKS_PER_SIDE];
+    unsigned int     trackCount = collectDirtyTracks(pNibbleImage, tracks);
+    
+    /* Each track's flush only touches the caches and image bytes of that track. */
+    runTrackWorkers(pNibbleImage, tracks, trackCount, flushTrack, NULL);
 }
 
-static void checksumNibbilizeAndWrite(NibbleDiskImage* pThis, const unsigned char* pData)
+static unsigned int collectDirtyTracks(NibbleDiskImage* pThis, unsigned char* pTracks)
 {
-    pThis->lastByte = 0;
-    initChecksum(pThis);
+    unsigned int trackCount = 0;
+    unsigned int track;
     
-    checksumNibbilizeAndWriteAuxBuffer(pThis);
-    checksumNibbilizeAndWriteDataBuffer(pThis, pData);
-    nibbilizeAndWriteChecksum(pThis);
+    for (track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+    {
+        if (isTrackDirty(pThis, track))
+            pTracks[trackCount++] = track;
+    }
+    return trackCount;
 }
 
-static void checksumNibbilizeAndWriteAuxBuffer(NibbleDiskImage* pThis)
+static int isTrackDirty(NibbleDiskImage* pThis, unsigned int track)
 {
-    unsigned char* pCurr = &pThis->aux[sizeof(pThis->aux)-1];
-    size_t         i;
-    
-    for (i = 0 ; i < sizeof(pThis->aux) ; i++)
-        *pThis->pWrite++ = nibbilizeByte(pThis, *pCurr--);
-    
+    return pThis->rw18Tracks[track].isDirty || pThis->rwts16Tracks[track].dirtySectors;
 }
 
-static unsigned char nibbilizeByte(NibbleDiskImage* pThis, unsigned char byte)
+static void runTrackWorkers(NibbleDiskImage*     pThis, 
+                            const unsigned char* pTracks, 
+                            unsigned int         trackCount,
+                            TrackWorkFunction    workFunction,
+                            void*                pContext)
 {
-    unsigned char encodedByte;
+    unsigned int workerCount = pThis->encodeThreadCount;
+    TrackWorker  workers[DISK_IMAGE_TRACKS_PER_SIDE];
+    pthread_t    threads[DISK_IMAGE_TRACKS_PER_SIDE];
+    int          threadStarted[DISK_IMAGE_TRACKS_PER_SIDE];
+    unsigned int i;
     
-    encodedByte = byte ^ pThis->lastByte;
-    pThis->lastByte = byte;
+    if (workerCount > trackCount)
+        workerCount = trackCount;
+    if (workerCount == 0)
+        return;
+    initTrackWorkers(pThis, workers, workerCount, pTracks, trackCount, workFunction, pContext);
 
-    return encode6to8(encodedByte);
+    for (i = 1 ; i < workerCount ; i++)
+        threadStarted[i] = (0 == pthread_create(&threads[i], NULL, trackWorkerThread, &workers[i]));
+    processTracks(&workers[0]);
+    for (i = 1 ; i < workerCount ; i++)
+    {
+        if (threadStarted[i])
+            pthread_join(threads[i], NULL);
+        else
+            processTracks(&workers[i]);
+    }
 }
 
-static void checksumNibbilizeAndWriteDataBuffer(NibbleDiskImage* pThis, const unsigned char* pData)
+static void initTrackWorkers(NibbleDiskImage*     pThis, 
+                             TrackWorker*         pWorkers, 
+                             unsigned int         workerCount,
+                             const unsigned char* pTracks, 
+                             unsigned int         trackCount,
+                             TrackWorkFunction    workFunction,
+                             void*                pContext)
 {
-    const unsigned char* pCurr = pData;
-    size_t         i;
-    
-    for (i = 0 ; i < DISK_IMAGE_BYTES_PER_SECTOR ; i++)
-        *pThis->pWrite++ = nibbilizeByte(pThis, (*pCurr++) >> 2);
+    unsigned int i;
     
+    for (i = 0 ; i < workerCount ; i++)
+    {
+        pWorkers[i].pImage = pThis;
+        pWorkers[i].workFunction = workFunction;
+        pWorkers[i].pContext = pContext;
+        pWorkers[i].pTracks = pTracks;
+        pWorkers[i].trackCount = trackCount;
+        pWorkers[i].firstIndex = i;
+        pWorkers[i].stride = workerCount;
+    }
 }
 
-static void nibbilizeAndWriteChecksum(NibbleDiskImage* pThis)
+static void* trackWorkerThread(void* pvWorker)
 {
-    *pThis->pWrite++ = nibbilizeByte(pThis, 0x00);
+    processTracks((TrackWorker*)pvWorker);
+    return NULL;
 }
 
-static void insertRW18Data(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
+static void processTracks(TrackWorker* pWorker)
 {
-    prepareForFirstRW18Track(pThis, pData, pInsert);
-    while (pThis->bytesLeft > 0)
-        writeRW18Track(pThis);
+    unsigned int i;
+    
+    for (i = pWorker->firstIndex ; i < pWorker->trackCount ; i += pWorker->stride)
+        pWorker->workFunction(pWorker->pImage, pWorker->pTracks[i], pWorker->pContext);
 }
 
-static void prepareForFirstRW18Track(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
+static void flushTrack(NibbleDiskImage* pThis, unsigned int track, void* pContext)
 {
-    pThis->side = pInsert->side;
-    pThis->track = pInsert->track;
-    pThis->intraTrackOffset = pInsert->intraTrackOffset;
-    pThis->bytesLeft = pInsert->length;
-    pThis->pData = pData + pInsert->sourceOffset;
+    flushRW18Track(pThis, track);
+    flushRWTS16Track(pThis, track);
 }
 
-static void writeRW18Track(NibbleDiskImage* pThis)
+
+__throws void NibbleDiskImage_WriteImage(NibbleDiskImage* pThis, const char* pImageFilename)
 {
-    unsigned int         bytesUsed = 0;
-    unsigned int         destOffset = NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * pThis->track;
-    unsigned char        sector = 5;
-    unsigned char        trackData[DISK_IMAGE_RW18_BYTES_PER_TRACK];
-    const unsigned char* pStart;
-    
-    validateRW18TrackAndOffset(pThis);
+    DiskImage_WriteImage(&pThis->super, pImageFilename);
+}
 
-    bytesUsed = initTrackData(pThis, trackData, sizeof(trackData));
-    pThis->pWrite = DiskImage_GetImagePointer(&pThis->super) + destOffset;
-    pThis->pCurrentTrack = trackData;
-    pStart = pThis->pWrite;
-    
-    writeSyncBytes(pThis, 403);
-    writeEncodedBytes(pThis, "\xa5\x96\xbf\xff\xfe\xaa\xbb\xaa\xaa\xff\xef\x9a", 12);
-    writeRW18Sector(pThis, sector);
-    
-    do
-    {
-        writeSyncBytes(pThis, 5);
-        writeRW18Sector(pThis, --sector);
-    } while (sector);
 
-    assert ( pThis->pWrite - pStart == NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK );
-    
-    advanceToNextRW18Track(pThis, bytesUsed);
+const unsigned char* NibbleDiskImage_GetImagePointer(NibbleDiskImage* pThis)
+{
+    return DiskImage_GetImagePointer(&pThis->super);
 }
 
-static void validateRW18TrackAndOffset(NibbleDiskImage* pThis)
+
+size_t NibbleDiskImage_GetImageSize(NibbleDiskImage* pThis)
 {
-    if (pThis->track >= DISK_IMAGE_TRACKS_PER_SIDE)
-        __throw(invalidTrackException);
-    if (pThis->intraTrackOffset >= DISK_IMAGE_RW18_BYTES_PER_TRACK)
-        __throw(invalidIntraTrackOffsetException);
+    return DiskImage_GetImageSize(&pThis->super);
 }
 
-static unsigned int initTrackData(NibbleDiskImage* pThis, unsigned char* pTrackData, size_t trackDataSize)
+
+static void validateReadRWTrackArguments(unsigned int track, size_t trackDataSize);
+__throws void NibbleDiskImage_ReadRW18Track(NibbleDiskImage* pThis,
+                                            unsigned int side,
+                                            unsigned int track,
+                                            unsigned char* pTrackData,
+                                            size_t trackDataSize)
 {
-    unsigned int         copyBytes = trackDataSize - pThis->intraTrackOffset;
-    const unsigned char* pSource = pThis->pData;
-    unsigned char*       pDest = pTrackData + pThis->intraTrackOffset;
-    
-    readCurrentTrackContentsOrZeroFill(pThis, pTrackData, trackDataSize);
-    if (copyBytes > pThis->bytesLeft)
-        copyBytes = pThis->bytesLeft;
-    memcpy(pDest, pSource, copyBytes);
-    
-    return copyBytes;
+    flushImage(pThis);
+    readRW18Track(pThis, side, track, pTrackData, trackDataSize);
 }
 
-static void readCurrentTrackContentsOrZeroFill(NibbleDiskImage* pThis, unsigned char* pTrackData, size_t trackDataSize)
+static void readRW18Track(NibbleDiskImage* pThis,
+                          unsigned int side,
+                          unsigned int track,
+                          unsigned char* pTrackData,
+                          size_t trackDataSize)
 {
-    __try
-    {
-        NibbleDiskImage_ReadRW18Track(pThis, pThis->side, pThis->track, pTrackData, trackDataSize);
-    }
-    __catch
-    {
-        /* Track didn't already contain RW18 data so initialize it to all zeroes. */
-        memset(pTrackData, 0x00, trackDataSize);
-        clearExceptionCode();
-    }
+    validateReadRWTrackArguments(track, trackDataSize);
+    if (NibbleEncoder_ReadRW18Track(pThis->super.image.pBuffer, track, pTrackData) != side)
+        __throw(badTrackException);
 }
 
-static void writeEncodedBytes(NibbleDiskImage* pThis, const char* pBytes, size_t byteCount)
+static void validateReadRWTrackArguments(unsigned int track, size_t trackDataSize)
 {
-    memcpy(pThis->pWrite, pBytes, byteCount);
-    pThis->pWrite += byteCount;
+    if (track >= DISK_IMAGE_TRACKS_PER_SIDE)
+        __throw(invalidTrackException);
+    if (trackDataSize != DISK_IMAGE_RW18_BYTES_PER_TRACK)
+        __throw(invalidArgumentException);
 }
 
-static void writeRW18Sector(NibbleDiskImage* pThis, unsigned char sector)
+
+__throws void NibbleDiskImage_ReadImage(NibbleDiskImage* pThis, const char* pImageFilename)
 {
-    writeRW18AddressField(pThis, pThis->track, sector);
-    writeSyncBytes(pThis, 2);
-    writeRW18DataField(pThis, sector);
-    writeSyncBytes(pThis, 1);
+    DiskImage_ReadImage(&pThis->super, pImageFilename);
 }
 
-static void writeRW18AddressField(NibbleDiskImage* pThis, unsigned char track, unsigned char sector)
+
+static void verifyTrack(NibbleDiskImage* pThis, unsigned int track, void* pvTracks);
+static int isAllZeroes(const unsigned char* pData, size_t dataSize);
+static int readRW18TrackStatus(const unsigned char* pImage, unsigned int track, NibbleTrackStatus* pStatus);
+static void readRWTS16TrackStatus(const unsigned char* pImage, unsigned int track, NibbleTrackStatus* pStatus);
+static int readRWTS16Sector(const unsigned char* pImage, unsigned int track, unsigned int sector, unsigned char* pData);
+__throws void NibbleDiskImage_VerifyTracks(NibbleDiskImage* pThis, NibbleTrackStatus* pTracks)
 {
-    writeRW18AddressFieldProlog(pThis);
+    unsigned char tracks[DISK_IMAGE_TRACKS_PER_SIDE];
+    unsigned int  track;
     
-    *pThis->pWrite++ = encode6to8(track);
-    *pThis->pWrite++ = encode6to8(sector);
-    *pThis->pWrite++ = encode6to8(track ^ sector);
+    flushImage(pThis);
+    for (track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+        tracks[track] = track;
     
-    writeRW18AddressFieldEpilog(pThis);
-}
-
-static void writeRW18AddressFieldProlog(NibbleDiskImage* pThis)
-{
-    memcpy(pThis->pWrite, "\xD5\x9D", 2);
-    pThis->pWrite += 2;
+    /* Decoding only reads the image and writes to the status of its own track. */
+    runTrackWorkers(pThis, tracks, DISK_IMAGE_TRACKS_PER_SIDE, verifyTrack, pTracks);
 }
 
-static void writeRW18AddressFieldEpilog(NibbleDiskImage* pThis)
+static void verifyTrack(NibbleDiskImage* pThis, unsigned int track, void* pvTracks)
 {
-    *pThis->pWrite++ = 0xAA;
+    const unsigned char* pImage = pThis->super.image.pBuffer;
+    NibbleTrackStatus*   pStatus = (NibbleTrackStatus*)pvTracks + track;
+    
+    memset(pStatus, 0, sizeof(*pStatus));
+    if (isAllZeroes(pImage + track * NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK, NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK))
+        pStatus->format = NIBBLE_TRACK_BLANK;
+    else if (!readRW18TrackStatus(pImage, track, pStatus))
+        readRWTS16TrackStatus(pImage, track, pStatus);
 }
 
-static void writeRW18DataField(NibbleDiskImage* pThis, unsigned char sector)
+static int isAllZeroes(const unsigned char* pData, size_t dataSize)
 {
-    writeRW18BundleId(pThis);
-    writeRW18Data(pThis, sector);
-    writeRW18DataFieldEpilog(pThis);
+    while (dataSize--)
+    {
+        if (*pData++)
+            return FALSE;
+    }
+    return TRUE;
 }
 
-static void writeRW18BundleId(NibbleDiskImage* pThis)
+static int readRW18TrackStatus(const unsigned char* pImage, unsigned int track, NibbleTrackStatus* pStatus)
 {
-    *pThis->pWrite++ = pThis->side;
+    __try
+    {
+        pStatus->side = NibbleEncoder_ReadRW18Track(pImage, track, pStatus->data);
+    }
+    __catch
+    {
+        memset(pStatus->data, 0, sizeof(pStatus->data));
+        __nothrow_and_return(FALSE);
+    }
+    pStatus->format = NIBBLE_TRACK_RW18;
+    return TRUE;
 }
 
-static void writeRW18Data(NibbleDiskImage* pThis, unsigned char sector)
+static void readRWTS16TrackStatus(const unsigned char* pImage, unsigned int track, NibbleTrackStatus* pStatus)
 {
-    unsigned char        checksum = 0;
-    const unsigned char* pPage0 = pThis->pCurrentTrack + sector * DISK_IMAGE_PAGE_SIZE;
-    const unsigned char* pPage1 = pThis->pCurrentTrack + (sector + 6) * DISK_IMAGE_PAGE_SIZE;
-    const unsigned char* pPage2 = pThis->pCurrentTrack + (sector + 12) * DISK_IMAGE_PAGE_SIZE;
-    int                  i = 0;
+    static const size_t sectorNibbles = NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR - 
+                                        NIBBLE_DISK_IMAGE_RWTS16_GAP3_SYNC_BYTES;
+    unsigned int        sector;
     
-    for ( i = 0 ; i < DISK_IMAGE_PAGE_SIZE ; i++)
+    for (sector = 0 ; sector < NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK ; sector++)
     {
-        unsigned char byte0 = *pPage0++;
-        unsigned char byte1 = *pPage1++;
-        unsigned char byte2 = *pPage2++;
-        unsigned char auxByte = ((byte0 & 0xC0) >> 2) | ((byte1 & 0xC0) >> 4) | ((byte2 & 0xC0) >> 6);
+        unsigned char* pSectorData = pStatus->data + sector * DISK_IMAGE_BYTES_PER_SECTOR;
         
-        *pThis->pWrite++ = encode6to8(auxByte);
-        *pThis->pWrite++ = encode6to8(byte0 & 0x3F);
-        *pThis->pWrite++ = encode6to8(byte1 & 0x3F);
-        *pThis->pWrite++ = encode6to8(byte2 & 0x3F);
-        
-        checksum ^= auxByte;
-        checksum ^= byte0 & 0x3F;
-        checksum ^= byte1 & 0x3F;
-        checksum ^= byte2 & 0x3F;
+        if (isAllZeroes(pImage + NibbleEncoder_GetRWTS16SectorOffset(track, sector), sectorNibbles))
+            continue;
+        if (readRWTS16Sector(pImage, track, sector, pSectorData))
+            pStatus->validSectors |= 1 << sector;
+        else
+            pStatus->badSectors |= 1 << sector;
     }
-    *pThis->pWrite++ = encode6to8(checksum);
-}
-
-static void writeRW18DataFieldEpilog(NibbleDiskImage* pThis)
-{
-    *pThis->pWrite++ = 0xD4;
+    
+    if (pStatus->validSectors && !pStatus->badSectors)
+        pStatus->format = NIBBLE_TRACK_RWTS16;
+    else
+        pStatus->format = NIBBLE_TRACK_BAD;
 }
 
-static void advanceToNextRW18Track(NibbleDiskImage* pThis, unsigned int bytesUsed)
+static int readRWTS16Sector(const unsigned char* pImage, unsigned int track, unsigned int sector, unsigned char* pData)
 {
-    pThis->bytesLeft -= bytesUsed;
-    pThis->pData += bytesUsed;
-    pThis->intraTrackOffset = 0;
-    pThis->track++;
+    __try
+    {
+        NibbleEncoder_ReadRWTS16Sector(pImage, track, sector, pData);
+    }
+    __catch
+    {
+        memset(pData, 0, DISK_IMAGE_BYTES_PER_SECTOR);
+        __nothrow_and_return(FALSE);
+    }
+    return TRUE;
 }
 
 
-__throws void NibbleDiskImage_WriteImage(NibbleDiskImage* pThis, const char* pImageFilename)
+static int doTracksMatch(const NibbleTrackStatus* pTrack, const NibbleTrackStatus* pExpectedTrack);
+unsigned int NibbleDiskImage_CompareTracks(NibbleTrackStatus* pTracks, const NibbleTrackStatus* pExpectedTracks)
 {
-    DiskImage_WriteImage(&pThis->super, pImageFilename);
+    unsigned int mismatchCount = 0;
+    unsigned int track;
+    
+    for (track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+    {
+        pTracks[track].isMismatched = !doTracksMatch(&pTracks[track], &pExpectedTracks[track]);
+        mismatchCount += pTracks[track].isMismatched;
+    }
+    return mismatchCount;
 }
 
-
-const unsigned char* NibbleDiskImage_GetImagePointer(NibbleDiskImage* pThis)
+static int doTracksMatch(const NibbleTrackStatus* pTrack, const NibbleTrackStatus* pExpectedTrack)
 {
-    return DiskImage_GetImagePointer(&pThis->super);
+    /* Sectors which weren't decoded are left zeroed so the whole data buffer can be compared.  A track which the script
+       itself leaves unreadable still matches when the image is damaged in exactly the same way. */
+    return pTrack->format == pExpectedTrack->format &&
+           pTrack->side == pExpectedTrack->side &&
+           pTrack->validSectors == pExpectedTrack->validSectors &&
+           pTrack->badSectors == pExpectedTrack->badSectors &&
+           0 == memcmp(pTrack->data, pExpectedTrack->data, sizeof(pTrack->data));
 }
 
 
-size_t NibbleDiskImage_GetImageSize(NibbleDiskImage* pThis)
+__throws void NibbleDiskImage_RecordWriters(NibbleDiskImage* pThis)
 {
-    return DiskImage_GetImageSize(&pThis->super);
+    if (!pThis->pWriters)
+        pThis->pWriters = allocateAndZero(DISK_IMAGE_TRACKS_PER_SIDE * sizeof(*pThis->pWriters));
 }
 
 
-static void validateReadRWTrackArguments(unsigned int track, size_t trackDataSize);
-static void validateSyncBytes(NibbleDiskImage* pThis, unsigned int expectedSyncBytes);
-static void validateByte(NibbleDiskImage* pThis, unsigned char expectedByte);
-static void validateBytes(NibbleDiskImage* pThis, const char* pExpectedBytes, size_t byteCount);
-static void extractRW18Sector(NibbleDiskImage* pThis, unsigned int sector);
-static void validateDecodedByte(NibbleDiskImage* pThis, unsigned char expectedByte);
-__throws void NibbleDiskImage_ReadRW18Track(NibbleDiskImage* pThis,
-                                            unsigned int side,
-                                            unsigned int track,
-                                            unsigned char* pTrackData,
-                                            size_t trackDataSize)
+const NibbleRegionWriter* NibbleDiskImage_GetRegionWriter(NibbleDiskImage* pThis, 
+                                                          unsigned int     track, 
+                                                          unsigned int     region)
 {
-    unsigned int sector = 5;
+    TrackWriters* pTrack;
     
-    validateReadRWTrackArguments(track, trackDataSize);
-    
-    pThis->pRead = DiskImage_GetImagePointer(&pThis->super) +  NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * track;
-    pThis->pCurrentTrack = pTrackData;
-    pThis->track = track;
-    pThis->side = side;
-
-    validateSyncBytes(pThis, 403);
-    validateBytes(pThis, "\xa5\x96\xbf\xff\xfe\xaa\xbb\xaa\xaa\xff\xef\x9a", 12);
-    extractRW18Sector(pThis, sector);
-    
-    do
-    {
-        validateSyncBytes(pThis, 5);
-        extractRW18Sector(pThis, --sector);
-    } while (sector > 0);
+    if (!pThis->pWriters || track >= DISK_IMAGE_TRACKS_PER_SIDE || region >= DISK_IMAGE_RW18_PAGES_PER_TRACK)
+        return NULL;
+    pTrack = &pThis->pWriters[track];
+    if (!(pTrack->writtenRegions & (1 << region)))
+        return NULL;
+    return &pTrack->regions[region];
 }
 
-static void validateReadRWTrackArguments(unsigned int track, size_t trackDataSize)
-{
-    if (track >= DISK_IMAGE_TRACKS_PER_SIDE)
-        __throw(invalidTrackException);
-    if (trackDataSize != DISK_IMAGE_RW18_BYTES_PER_TRACK)
-        __throw(invalidArgumentException);
-}
 
-static void validateSyncBytes(NibbleDiskImage* pThis, unsigned int expectedSyncBytes)
+typedef struct TrackDiffContext
 {
-    unsigned int i;
-    
-    for (i = 0 ; i < expectedSyncBytes ; i++)
-        validateByte(pThis, 0xFF);
-}
-
-static void validateByte(NibbleDiskImage* pThis, unsigned char expectedByte)
-{
-    if (*pThis->pRead++ != expectedByte)
-        __throw(badTrackException);
-}
+    const NibbleTrackStatus* pTracks1;
+    const NibbleTrackStatus* pTracks2;
+    NibbleTrackDiff*         pDiffs;
+} TrackDiffContext;
 
-static void validateBytes(NibbleDiskImage* pThis, const char* pExpectedBytes, size_t byteCount)
+static void diffTrack(NibbleDiskImage* pThis, unsigned int track, void* pvContext);
+static unsigned int diffSectorStatus(const NibbleTrackStatus* pTrack1, const NibbleTrackStatus* pTrack2);
+unsigned int NibbleDiskImage_DiffTracks(NibbleDiskImage*         pThis,
+                                        const NibbleTrackStatus* pTracks1, 
+                                        const NibbleTrackStatus* pTracks2, 
+                                        NibbleTrackDiff*         pDiffs)
 {
-    if (0 != memcmp(pThis->pRead, pExpectedBytes, byteCount))
-        __throw(badTrackException);
-    pThis->pRead += byteCount;
+    TrackDiffContext context;
+    unsigned char    tracks[DISK_IMAGE_TRACKS_PER_SIDE];
+    unsigned int     differentCount = 0;
+    unsigned int     track;
+    
+    context.pTracks1 = pTracks1;
+    context.pTracks2 = pTracks2;
+    context.pDiffs = pDiffs;
+    for (track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+        tracks[track] = track;
+    runTrackWorkers(pThis, tracks, DISK_IMAGE_TRACKS_PER_SIDE, diffTrack, &context);
+    
+    for (track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+        differentCount += (pDiffs[track].isFormatDifferent || pDiffs[track].differentRegions);
+    return differentCount;
 }
 
-static void extractRW18Sector(NibbleDiskImage* pThis, unsigned int sector)
+static void diffTrack(NibbleDiskImage* pThis, unsigned int track, void* pvContext)
 {
-    unsigned char  checksum = pThis->track ^ sector;
-    unsigned char* pPage0 = pThis->pCurrentTrack + sector * DISK_IMAGE_PAGE_SIZE;
-    unsigned char* pPage1 = pThis->pCurrentTrack + (sector + 6) * DISK_IMAGE_PAGE_SIZE;
-    unsigned char* pPage2 = pThis->pCurrentTrack + (sector + 12) * DISK_IMAGE_PAGE_SIZE;
-    int            i;
+    TrackDiffContext*        pContext = (TrackDiffContext*)pvContext;
+    const NibbleTrackStatus* pTrack1 = &pContext->pTracks1[track];
+    const NibbleTrackStatus* pTrack2 = &pContext->pTracks2[track];
+    NibbleTrackDiff*         pDiff = &pContext->pDiffs[track];
+    unsigned int             regionCount = DISK_IMAGE_RW18_PAGES_PER_TRACK;
+    unsigned int             region;
     
-    validateBytes(pThis, "\xd5\x9d", 2);
-    validateDecodedByte(pThis, pThis->track);
-    validateDecodedByte(pThis, sector);
-    validateDecodedByte(pThis, checksum);
-    validateBytes(pThis, "\xaa", 1);
-    validateSyncBytes(pThis, 2);
-    validateByte(pThis, pThis->side);
-    
-    checksum = 0;
-    for (i = 0 ; i < 256 ; i++)
+    memset(pDiff, 0, sizeof(*pDiff));
+    if (pTrack1->format != pTrack2->format || pTrack1->side != pTrack2->side)
     {
-        unsigned char auxByte = pThis->decode8to6[*pThis->pRead++];
-        unsigned char byte0 = pThis->decode8to6[*pThis->pRead++];
-        unsigned char byte1 = pThis->decode8to6[*pThis->pRead++];
-        unsigned char byte2 = pThis->decode8to6[*pThis->pRead++];
-        
-        checksum ^= (auxByte ^ byte0 ^ byte1 ^ byte2);
-        
-        auxByte <<= 2;
-        *pPage0++ = (auxByte & 0xC0) | byte0;
-        auxByte <<= 2;
-        *pPage1++ = (auxByte & 0xC0) | byte1;
-        auxByte <<= 2;
-        *pPage2++ = (auxByte & 0xC0) | byte2;
+        pDiff->isFormatDifferent = TRUE;
+        return;
+    }
+    if (pTrack1->format != NIBBLE_TRACK_RW18)
+    {
+        regionCount = NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK;
+        pDiff->differentRegions = diffSectorStatus(pTrack1, pTrack2);
     }
-    validateDecodedByte(pThis, checksum);
     
-    validateByte(pThis, 0xD4);
-    validateSyncBytes(pThis, 1);
+    /* Most tracks match so a single memcmp() over the whole track is tried before narrowing things down to pages or 
+       sectors, which are both DISK_IMAGE_PAGE_SIZE bytes. */
+    if (0 == memcmp(pTrack1->data, pTrack2->data, regionCount * DISK_IMAGE_PAGE_SIZE))
+        return;
+    for (region = 0 ; region < regionCount ; region++)
+    {
+        if (0 != memcmp(pTrack1->data + region * DISK_IMAGE_PAGE_SIZE, 
+                        pTrack2->data + region * DISK_IMAGE_PAGE_SIZE, 
+                        DISK_IMAGE_PAGE_SIZE))
+        {
+            pDiff->differentRegions |= 1 << region;
+        }
+    }
 }
 
-static void validateDecodedByte(NibbleDiskImage* pThis, unsigned char expectedByte)
+static unsigned int diffSectorStatus(const NibbleTrackStatus* pTrack1, const NibbleTrackStatus* pTrack2)
 {
-    unsigned char decodedByte = pThis->decode8to6[*pThis->pRead++];
-    if (decodedByte != expectedByte)
-        __throw(badTrackException);
+    return (pTrack1->validSectors ^ pTrack2->validSectors) | (pTrack1->badSectors ^ pTrack2->badSectors);
 }
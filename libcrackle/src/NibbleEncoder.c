@@ -0,0 +1,625 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <assert.h>
+#include <string.h>
+#include "NibbleEncoder.h"
+
+
+typedef struct NibbleEncoder
+{
+    unsigned char*       pImage;
+    unsigned char*       pWrite;
+    const unsigned char* pTrackData;
+    unsigned int         side;
+    unsigned int         track;
+    unsigned int         sector;
+    unsigned char        checksum;
+    unsigned char        aux[86];
+} NibbleEncoder;
+
+
+typedef struct NibbleDecoder
+{
+    const unsigned char* pRead;
+    unsigned char*       pTrackData;
+    unsigned int         side;
+    unsigned int         track;
+    unsigned char        aux[86];
+} NibbleDecoder;
+
+
+static const unsigned char g_encode6to8[64] =
+{
+    0x96, 0x97, 0x9a, 0x9b, 0x9d, 0x9e, 0x9f, 0xa6,
+    0xa7, 0xab, 0xac, 0xad, 0xae, 0xaf, 0xb2, 0xb3,
+    0xb4, 0xb5, 0xb6, 0xb7, 0xb9, 0xba, 0xbb, 0xbc,
+    0xbd, 0xbe, 0xbf, 0xcb, 0xcd, 0xce, 0xcf, 0xd3,
+    0xd6, 0xd7, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde,
+    0xdf, 0xe5, 0xe6, 0xe7, 0xe9, 0xea, 0xeb, 0xec,
+    0xed, 0xee, 0xef, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6,
+    0xf7, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+};
+
+/* Inverse of g_encode6to8.  Bytes which aren't valid disk nibbles decode to 0xFF. */
+static const unsigned char g_decode8to6[256] =
+{
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x01,
+    0xff, 0xff, 0x02, 0x03, 0xff, 0x04, 0x05, 0x06,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x07, 0x08,
+    0xff, 0xff, 0xff, 0x09, 0x0a, 0x0b, 0x0c, 0x0d,
+    0xff, 0xff, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13,
+    0xff, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0x1b, 0xff, 0x1c, 0x1d, 0x1e,
+    0xff, 0xff, 0xff, 0x1f, 0xff, 0xff, 0x20, 0x21,
+    0xff, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0x29, 0x2a, 0x2b,
+    0xff, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32,
+    0xff, 0xff, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38,
+    0xff, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f
+};
+
+/* Maps a 2-bit value to the same value with its two bits swapped, as required by the 6-and-2 auxiliary bytes. */
+static const unsigned char g_swap2Bits[4] = { 0x0, 0x2, 0x1, 0x3 };
+
+
+unsigned char NibbleEncoder_Encode6to8(unsigned char byte)
+{
+    assert ( byte < 64 );
+    return g_encode6to8[byte];
+}
+
+unsigned char NibbleEncoder_Decode8to6(unsigned char byte)
+{
+    return g_decode8to6[byte];
+}
+
+
+static void writeRWTS16Sector(NibbleEncoder* pThis, const unsigned char* pSectorData);
+static void writeSectorLeadInSyncBytes(NibbleEncoder* pThis);
+static void writeSyncBytes(NibbleEncoder* pThis, size_t syncByteCount);
+static void writeRWTS16AddressField(NibbleEncoder* pThis, unsigned char volume, unsigned char track, unsigned char sector);
+static void writeRWTS16AddressFieldProlog(NibbleEncoder* pThis);
+static void initChecksum(NibbleEncoder* pThis);
+static void write4and4Data(NibbleEncoder* pThis, unsigned char byte);
+static void updateChecksum(NibbleEncoder* pThis, unsigned char byte);
+static void writeRWTS16FieldEpilog(NibbleEncoder* pThis);
+static void writeRWTS16DataField(NibbleEncoder* pThis, const unsigned char* pData);
+static void writeRWTS16DataFieldProlog(NibbleEncoder* pThis);
+static void write6and2Data(NibbleEncoder* pThis, const unsigned char* pData);
+static void fillAuxBuffer(NibbleEncoder* pThis, const unsigned char* pData);
+static unsigned char encodeAuxByte(size_t i, const unsigned char* pData);
+static void checksumNibbilizeAndWrite(NibbleEncoder* pThis, const unsigned char* pData);
+void NibbleEncoder_WriteRWTS16Sector(unsigned char*       pImage,
+                                     unsigned int         track,
+                                     unsigned int         sector,
+                                     const unsigned char* pSectorData)
+{
+    NibbleEncoder encoder;
+    
+    encoder.pImage = pImage;
+    encoder.track = track;
+    encoder.sector = sector;
+    writeRWTS16Sector(&encoder, pSectorData);
+}
+
+static void writeRWTS16Sector(NibbleEncoder* pThis, const unsigned char* pSectorData)
+{
+    static const unsigned char   volume = 0;
+    const unsigned char*         pStart;
+    
+    pThis->pWrite = pThis->pImage + NibbleEncoder_GetRWTS16SectorOffset(pThis->track, pThis->sector);
+    pStart = pThis->pWrite;
+    
+    writeSectorLeadInSyncBytes(pThis);
+    writeRWTS16AddressField(pThis, volume, pThis->track, pThis->sector);
+    writeSyncBytes(pThis, NIBBLE_DISK_IMAGE_RWTS16_GAP2_SYNC_BYTES);
+    writeRWTS16DataField(pThis, pSectorData);
+    
+    assert ( pThis->pWrite - pStart == NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR - NIBBLE_DISK_IMAGE_RWTS16_GAP3_SYNC_BYTES);
+}
+
+static size_t sectorLeadInSyncByteCount(unsigned int sector);
+static void writeSectorLeadInSyncBytes(NibbleEncoder* pThis)
+{
+    size_t leadInSyncByteCount = sectorLeadInSyncByteCount(pThis->sector);
+    
+    pThis->pWrite -= leadInSyncByteCount;
+    
+    writeSyncBytes(pThis, leadInSyncByteCount);
+}
+
+static size_t sectorLeadInSyncByteCount(unsigned int sector)
+{
+    if (sector == 0)
+        return NIBBLE_DISK_IMAGE_RWTS16_GAP1_SYNC_BYTES;
+    else
+        return NIBBLE_DISK_IMAGE_RWTS16_GAP3_SYNC_BYTES;
+}
+
+static void writeSyncBytes(NibbleEncoder* pThis, size_t syncByteCount)
+{
+    memset(pThis->pWrite, 0xff, syncByteCount);
+    pThis->pWrite += syncByteCount;
+}
+
+static void writeRWTS16AddressField(NibbleEncoder* pThis, unsigned char volume, unsigned char track, unsigned char sector)
+{
+    writeRWTS16AddressFieldProlog(pThis);
+    
+    initChecksum(pThis);
+    write4and4Data(pThis, volume);
+    write4and4Data(pThis, track);
+    write4and4Data(pThis, sector);
+    write4and4Data(pThis, pThis->checksum);
+    
+    writeRWTS16FieldEpilog(pThis);
+}
+
+static void writeRWTS16AddressFieldProlog(NibbleEncoder* pThis)
+{
+    memcpy(pThis->pWrite, "\xD5\xAA\x96", 3);
+    pThis->pWrite += 3;
+}
+
+static void initChecksum(NibbleEncoder* pThis)
+{
+    pThis->checksum = 0;
+}
+
+static void write4and4Data(NibbleEncoder* pThis, unsigned char byte)
+{
+    char oddBits = byte & 0xAA;
+    char evenBits = byte & 0x55;
+    char encodedOddByte = 0xAA | (oddBits >> 1);
+    char encodedEvenByte = 0xAA | evenBits;
+    
+    updateChecksum(pThis, byte);
+    *pThis->pWrite++ = encodedOddByte;
+    *pThis->pWrite++ = encodedEvenByte;
+}
+
+static void updateChecksum(NibbleEncoder* pThis, unsigned char byte)
+{
+    pThis->checksum ^= byte;
+}
+
+static void writeRWTS16FieldEpilog(NibbleEncoder* pThis)
+{
+    memcpy(pThis->pWrite, "\xDE\xAA\xEB", 3);
+    pThis->pWrite += 3;
+}
+
+static void writeRWTS16DataField(NibbleEncoder* pThis, const unsigned char* pData)
+{
+    writeRWTS16DataFieldProlog(pThis);
+    write6and2Data(pThis, pData);
+    writeRWTS16FieldEpilog(pThis);
+}
+
+static void writeRWTS16DataFieldProlog(NibbleEncoder* pThis)
+{
+    memcpy(pThis->pWrite, "\xD5\xAA\xAD", 3);
+    pThis->pWrite += 3;
+}
+
+static void write6and2Data(NibbleEncoder* pThis, const unsigned char* pData)
+{
+    fillAuxBuffer(pThis, pData);
+    checksumNibbilizeAndWrite(pThis, pData);
+}
+
+static void fillAuxBuffer(NibbleEncoder* pThis, const unsigned char* pData)
+{
+    size_t i;
+    
+    for (i = 0; i < sizeof(pThis->aux) ; i++)
+        pThis->aux[i] = encodeAuxByte(i, pData);
+}
+
+static unsigned char encodeAuxByte(size_t i, const unsigned char* pData)
+{
+    unsigned char lowByte = pData[(unsigned char)(0x55 - i)];
+    unsigned char midByte = pData[(unsigned char)(0xAB - i)];
+    unsigned char highByte = pData[(unsigned char)(0x101 - i)];
+    
+    return (g_swap2Bits[highByte & 3] << 4) | (g_swap2Bits[midByte & 3] << 2) | g_swap2Bits[lowByte & 3];
+}
+
+static void checksumNibbilizeAndWrite(NibbleEncoder* pThis, const unsigned char* pData)
+{
+    unsigned char* pWrite = pThis->pWrite;
+    unsigned char  lastByte = 0;
+    size_t         i;
+    
+    /* Each 6-bit value is XORed with the previous one before nibblizing so that the final nibble, an encoded 0x00,
+       is the checksum of the whole data field. */
+    for (i = sizeof(pThis->aux) ; i-- > 0 ; )
+    {
+        unsigned char byte = pThis->aux[i];
+        *pWrite++ = g_encode6to8[byte ^ lastByte];
+        lastByte = byte;
+    }
+    for (i = 0 ; i < DISK_IMAGE_BYTES_PER_SECTOR ; i++)
+    {
+        unsigned char byte = pData[i] >> 2;
+        *pWrite++ = g_encode6to8[byte ^ lastByte];
+        lastByte = byte;
+    }
+    *pWrite++ = g_encode6to8[lastByte];
+    
+    pThis->pWrite = pWrite;
+}
+
+static void writeRW18Track(NibbleEncoder* pThis, const unsigned char* pTrackData);
+static void writeEncodedBytes(NibbleEncoder* pThis, const char* pBytes, size_t byteCount);
+static void writeRW18Sector(NibbleEncoder* pThis, unsigned char sector);
+static void writeRW18AddressField(NibbleEncoder* pThis, unsigned char track, unsigned char sector);
+static void writeRW18AddressFieldProlog(NibbleEncoder* pThis);
+static void writeRW18AddressFieldEpilog(NibbleEncoder* pThis);
+static void writeRW18DataField(NibbleEncoder* pThis, unsigned char sector);
+static void writeRW18BundleId(NibbleEncoder* pThis);
+static void writeRW18Data(NibbleEncoder* pThis, unsigned char sector);
+static void writeRW18DataFieldEpilog(NibbleEncoder* pThis);
+void NibbleEncoder_WriteRW18Track(unsigned char*       pImage,
+                                  unsigned int         side,
+                                  unsigned int         track,
+                                  const unsigned char* pTrackData)
+{
+    NibbleEncoder encoder;
+    
+    encoder.pImage = pImage;
+    encoder.side = side;
+    encoder.track = track;
+    writeRW18Track(&encoder, pTrackData);
+}
+
+static void writeRW18Track(NibbleEncoder* pThis, const unsigned char* pTrackData)
+{
+    unsigned int         destOffset = NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * pThis->track;
+    unsigned char        sector = 5;
+    const unsigned char* pStart;
+    
+    pThis->pWrite = pThis->pImage + destOffset;
+    pThis->pTrackData = pTrackData;
+    pStart = pThis->pWrite;
+    
+    writeSyncBytes(pThis, 403);
+    writeEncodedBytes(pThis, "\xa5\x96\xbf\xff\xfe\xaa\xbb\xaa\xaa\xff\xef\x9a", 12);
+    writeRW18Sector(pThis, sector);
+    
+    do
+    {
+        writeSyncBytes(pThis, 5);
+        writeRW18Sector(pThis, --sector);
+    } while (sector);
+
+    assert ( pThis->pWrite - pStart == NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK );
+}
+
+static void writeEncodedBytes(NibbleEncoder* pThis, const char* pBytes, size_t byteCount)
+{
+    memcpy(pThis->pWrite, pBytes, byteCount);
+    pThis->pWrite += byteCount;
+}
+
+static void writeRW18Sector(NibbleEncoder* pThis, unsigned char sector)
+{
+    writeRW18AddressField(pThis, pThis->track, sector);
+    writeSyncBytes(pThis, 2);
+    writeRW18DataField(pThis, sector);
+    writeSyncBytes(pThis, 1);
+}
+
+static void writeRW18AddressField(NibbleEncoder* pThis, unsigned char track, unsigned char sector)
+{
+    writeRW18AddressFieldProlog(pThis);
+    
+    *pThis->pWrite++ = NibbleEncoder_Encode6to8(track);
+    *pThis->pWrite++ = NibbleEncoder_Encode6to8(sector);
+    *pThis->pWrite++ = NibbleEncoder_Encode6to8(track ^ sector);
+    
+    writeRW18AddressFieldEpilog(pThis);
+}
+
+static void writeRW18AddressFieldProlog(NibbleEncoder* pThis)
+{
+    memcpy(pThis->pWrite, "\xD5\x9D", 2);
+    pThis->pWrite += 2;
+}
+
+static void writeRW18AddressFieldEpilog(NibbleEncoder* pThis)
+{
+    *pThis->pWrite++ = 0xAA;
+}
+
+static void writeRW18DataField(NibbleEncoder* pThis, unsigned char sector)
+{
+    writeRW18BundleId(pThis);
+    writeRW18Data(pThis, sector);
+    writeRW18DataFieldEpilog(pThis);
+}
+
+static void writeRW18BundleId(NibbleEncoder* pThis)
+{
+    *pThis->pWrite++ = pThis->side;
+}
+
+static void writeRW18Data(NibbleEncoder* pThis, unsigned char sector)
+{
+    unsigned char        checksum = 0;
+    unsigned char*       pWrite = pThis->pWrite;
+    const unsigned char* pPage0 = pThis->pTrackData + sector * DISK_IMAGE_PAGE_SIZE;
+    const unsigned char* pPage1 = pThis->pTrackData + (sector + 6) * DISK_IMAGE_PAGE_SIZE;
+    const unsigned char* pPage2 = pThis->pTrackData + (sector + 12) * DISK_IMAGE_PAGE_SIZE;
+    int                  i = 0;
+    
+    for ( i = 0 ; i < DISK_IMAGE_PAGE_SIZE ; i++)
+    {
+        unsigned char byte0 = pPage0[i];
+        unsigned char byte1 = pPage1[i];
+        unsigned char byte2 = pPage2[i];
+        unsigned char auxByte = ((byte0 & 0xC0) >> 2) | ((byte1 & 0xC0) >> 4) | ((byte2 & 0xC0) >> 6);
+        
+        pWrite[0] = g_encode6to8[auxByte];
+        pWrite[1] = g_encode6to8[byte0 & 0x3F];
+        pWrite[2] = g_encode6to8[byte1 & 0x3F];
+        pWrite[3] = g_encode6to8[byte2 & 0x3F];
+        pWrite += 4;
+        
+        checksum ^= auxByte ^ ((byte0 ^ byte1 ^ byte2) & 0x3F);
+    }
+    *pWrite++ = g_encode6to8[checksum];
+    
+    pThis->pWrite = pWrite;
+}
+
+static void writeRW18DataFieldEpilog(NibbleEncoder* pThis)
+{
+    *pThis->pWrite++ = 0xD4;
+}
+
+
+unsigned char NibbleEncoder_DecodeRW18Data(const unsigned char* pEncoded,
+                                           unsigned char*       pPage0,
+                                           unsigned char*       pPage1,
+                                           unsigned char*       pPage2)
+{
+    unsigned char checksum = 0;
+    int           i;
+    
+    for (i = 0 ; i < DISK_IMAGE_PAGE_SIZE ; i++)
+    {
+        unsigned char auxByte = g_decode8to6[pEncoded[0]];
+        unsigned char byte0 = g_decode8to6[pEncoded[1]];
+        unsigned char byte1 = g_decode8to6[pEncoded[2]];
+        unsigned char byte2 = g_decode8to6[pEncoded[3]];
+        pEncoded += 4;
+        
+        checksum ^= (auxByte ^ byte0 ^ byte1 ^ byte2);
+        
+        pPage0[i] = ((auxByte << 2) & 0xC0) | byte0;
+        pPage1[i] = ((auxByte << 4) & 0xC0) | byte1;
+        pPage2[i] = ((auxByte << 6) & 0xC0) | byte2;
+    }
+    
+    return checksum;
+}
+
+
+unsigned int NibbleEncoder_GetRWTS16SectorOffset(unsigned int track, unsigned int sector)
+{
+    return NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * track + 
+           NIBBLE_DISK_IMAGE_RWTS16_GAP1_SYNC_BYTES +
+           NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR * sector;
+}
+
+
+static void readRW18Sector(NibbleDecoder* pThis, unsigned int sector);
+static void validateSyncBytes(NibbleDecoder* pThis, size_t syncByteCount);
+static void validateByte(NibbleDecoder* pThis, unsigned char expectedByte);
+static void validateBytes(NibbleDecoder* pThis, const char* pExpectedBytes, size_t byteCount);
+static void validateDecodedByte(NibbleDecoder* pThis, unsigned char expectedByte);
+__throws unsigned int NibbleEncoder_ReadRW18Track(const unsigned char* pImage,
+                                                  unsigned int         track,
+                                                  unsigned char*       pTrackData)
+{
+    NibbleDecoder decoder;
+    unsigned int  sector = 5;
+    
+    decoder.pRead = pImage + NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * track;
+    decoder.pTrackData = pTrackData;
+    decoder.track = track;
+    
+    validateSyncBytes(&decoder, 403);
+    validateBytes(&decoder, "\xa5\x96\xbf\xff\xfe\xaa\xbb\xaa\xaa\xff\xef\x9a", 12);
+    readRW18Sector(&decoder, sector);
+    
+    do
+    {
+        validateSyncBytes(&decoder, 5);
+        readRW18Sector(&decoder, --sector);
+    } while (sector > 0);
+    
+    return decoder.side;
+}
+
+static void readRW18Sector(NibbleDecoder* pThis, unsigned int sector)
+{
+    unsigned char  checksum = pThis->track ^ sector;
+    unsigned char* pPage0 = pThis->pTrackData + sector * DISK_IMAGE_PAGE_SIZE;
+    unsigned char* pPage1 = pThis->pTrackData + (sector + 6) * DISK_IMAGE_PAGE_SIZE;
+    unsigned char* pPage2 = pThis->pTrackData + (sector + 12) * DISK_IMAGE_PAGE_SIZE;
+    
+    validateBytes(pThis, "\xd5\x9d", 2);
+    validateDecodedByte(pThis, pThis->track);
+    validateDecodedByte(pThis, sector);
+    validateDecodedByte(pThis, checksum);
+    validateBytes(pThis, "\xaa", 1);
+    validateSyncBytes(pThis, 2);
+    /* The first sector read determines the side which the rest of the track must then match. */
+    if (sector == 5)
+        pThis->side = *pThis->pRead;
+    validateByte(pThis, pThis->side);
+    
+    checksum = NibbleEncoder_DecodeRW18Data(pThis->pRead, pPage0, pPage1, pPage2);
+    pThis->pRead += 4 * DISK_IMAGE_PAGE_SIZE;
+    validateDecodedByte(pThis, checksum);
+    
+    validateByte(pThis, 0xD4);
+    validateSyncBytes(pThis, 1);
+}
+
+static void validateSyncBytes(NibbleDecoder* pThis, size_t syncByteCount)
+{
+    size_t i;
+    
+    for (i = 0 ; i < syncByteCount ; i++)
+        validateByte(pThis, 0xFF);
+}
+
+static void validateByte(NibbleDecoder* pThis, unsigned char expectedByte)
+{
+    if (*pThis->pRead++ != expectedByte)
+        __throw(badTrackException);
+}
+
+static void validateBytes(NibbleDecoder* pThis, const char* pExpectedBytes, size_t byteCount)
+{
+    if (0 != memcmp(pThis->pRead, pExpectedBytes, byteCount))
+        __throw(badTrackException);
+    pThis->pRead += byteCount;
+}
+
+static void validateDecodedByte(NibbleDecoder* pThis, unsigned char expectedByte)
+{
+    if (g_decode8to6[*pThis->pRead++] != expectedByte)
+        __throw(badTrackException);
+}
+
+
+static void readRWTS16AddressField(NibbleDecoder* pThis, unsigned char sector);
+static unsigned char read4and4Data(NibbleDecoder* pThis);
+static void read6and2Data(NibbleDecoder* pThis, unsigned char* pData);
+static unsigned char readDecodedByte(NibbleDecoder* pThis);
+static void decodeAuxBits(NibbleDecoder* pThis, unsigned char* pData);
+__throws void NibbleEncoder_ReadRWTS16Sector(const unsigned char* pImage,
+                                             unsigned int         track,
+                                             unsigned int         sector,
+                                             unsigned char*       pSectorData)
+{
+    NibbleDecoder decoder;
+    size_t        leadInSyncByteCount = sectorLeadInSyncByteCount(sector);
+    
+    decoder.pRead = pImage + NibbleEncoder_GetRWTS16SectorOffset(track, sector) - leadInSyncByteCount;
+    decoder.track = track;
+    
+    validateSyncBytes(&decoder, leadInSyncByteCount);
+    readRWTS16AddressField(&decoder, sector);
+    validateSyncBytes(&decoder, NIBBLE_DISK_IMAGE_RWTS16_GAP2_SYNC_BYTES);
+    validateBytes(&decoder, "\xD5\xAA\xAD", 3);
+    read6and2Data(&decoder, pSectorData);
+    validateBytes(&decoder, "\xDE\xAA\xEB", 3);
+}
+
+static void readRWTS16AddressField(NibbleDecoder* pThis, unsigned char sector)
+{
+    unsigned char volume;
+    
+    validateBytes(pThis, "\xD5\xAA\x96", 3);
+    volume = read4and4Data(pThis);
+    if (read4and4Data(pThis) != pThis->track ||
+        read4and4Data(pThis) != sector ||
+        read4and4Data(pThis) != (volume ^ pThis->track ^ sector))
+    {
+        __throw(badTrackException);
+    }
+    validateBytes(pThis, "\xDE\xAA\xEB", 3);
+}
+
+static unsigned char read4and4Data(NibbleDecoder* pThis)
+{
+    unsigned char encodedOddByte = *pThis->pRead++;
+    unsigned char encodedEvenByte = *pThis->pRead++;
+    
+    if ((encodedOddByte & 0xAA) != 0xAA || (encodedEvenByte & 0xAA) != 0xAA)
+        __throw(badTrackException);
+    return ((encodedOddByte << 1) | 0x01) & encodedEvenByte;
+}
+
+static void read6and2Data(NibbleDecoder* pThis, unsigned char* pData)
+{
+    unsigned char lastByte = 0;
+    size_t        i;
+    
+    /* Undoes the running XOR applied by checksumNibbilizeAndWrite(). */
+    for (i = sizeof(pThis->aux) ; i-- > 0 ; )
+    {
+        lastByte ^= readDecodedByte(pThis);
+        pThis->aux[i] = lastByte;
+    }
+    for (i = 0 ; i < DISK_IMAGE_BYTES_PER_SECTOR ; i++)
+    {
+        lastByte ^= readDecodedByte(pThis);
+        pData[i] = lastByte << 2;
+    }
+    if (readDecodedByte(pThis) != lastByte)
+        __throw(badTrackException);
+    
+    decodeAuxBits(pThis, pData);
+}
+
+static unsigned char readDecodedByte(NibbleDecoder* pThis)
+{
+    unsigned char decodedByte = g_decode8to6[*pThis->pRead++];
+    
+    if (decodedByte == 0xFF)
+        __throw(badTrackException);
+    return decodedByte;
+}
+
+static void decodeAuxBits(NibbleDecoder* pThis, unsigned char* pData)
+{
+    size_t i;
+    
+    /* The first two bytes of the sector have their low bits stored twice so those are just written over. */
+    for (i = 0 ; i < sizeof(pThis->aux) ; i++)
+    {
+        unsigned char  auxByte = pThis->aux[i];
+        unsigned char* pLowByte = &pData[(unsigned char)(0x55 - i)];
+        unsigned char* pMidByte = &pData[(unsigned char)(0xAB - i)];
+        unsigned char* pHighByte = &pData[(unsigned char)(0x101 - i)];
+        
+        *pLowByte = (*pLowByte & 0xFC) | g_swap2Bits[auxByte & 3];
+        *pMidByte = (*pMidByte & 0xFC) | g_swap2Bits[(auxByte >> 2) & 3];
+        *pHighByte = (*pHighByte & 0xFC) | g_swap2Bits[(auxByte >> 4) & 3];
+    }
+}
@@ -0,0 +1,53 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#ifndef _NIBBLE_ENCODER_H_
+#define _NIBBLE_ENCODER_H_
+
+#include "NibbleDiskImage.h"
+
+
+/* These routines only touch the image bytes belonging to the requested track so different tracks can be
+   encoded concurrently. */
+unsigned char NibbleEncoder_Encode6to8(unsigned char byte);
+unsigned char NibbleEncoder_Decode8to6(unsigned char byte);
+void          NibbleEncoder_WriteRWTS16Sector(unsigned char*       pImage,
+                                              unsigned int         track,
+                                              unsigned int         sector,
+                                              const unsigned char* pSectorData);
+void          NibbleEncoder_WriteRW18Track(unsigned char*       pImage,
+                                           unsigned int         side,
+                                           unsigned int         track,
+                                           const unsigned char* pTrackData);
+
+/* Decodes the 1024 data nibbles of a RW18 sector into its three pages and returns the XOR of all decoded 6-bit
+   values, which the caller compares against the checksum nibble that follows. */
+unsigned char NibbleEncoder_DecodeRW18Data(const unsigned char* pEncoded,
+                                           unsigned char*       pPage0,
+                                           unsigned char*       pPage1,
+                                           unsigned char*       pPage2);
+
+/* The readers validate the sync bytes, prologs, epilogs, address fields and checksums written by the routines above
+   and throw badTrackException if anything doesn't match.  NibbleEncoder_ReadRW18Track() returns the side found in
+   the track's bundle id bytes. */
+__throws unsigned int NibbleEncoder_ReadRW18Track(const unsigned char* pImage,
+                                                  unsigned int         track,
+                                                  unsigned char*       pTrackData);
+__throws void         NibbleEncoder_ReadRWTS16Sector(const unsigned char* pImage,
+                                                     unsigned int         track,
+                                                     unsigned int         sector,
+                                                     unsigned char*       pSectorData);
+
+/* Offset within the image of the address field prolog of a RWTS16 sector. */
+unsigned int  NibbleEncoder_GetRWTS16SectorOffset(unsigned int track, unsigned int sector);
+
+#endif /* _NIBBLE_ENCODER_H_ */
@@ -11,8 +11,11 @@
     GNU General Public License for more details.
 */
 #include <assert.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 // Include headers from C modules under test.
 extern "C"
@@ -34,6 +37,65 @@ static const char* g_savFilenameAllOnes = "BlockDiskImageTestOnes.sav";
 static const char* g_usrFilenameAllOnes = "BlockDiskImageTestOnes.usr";
 static const char* g_imgTableFilename = "BlockDiskImageTest.img";
 static const char* g_scriptFilename = "BlockDiskImageTest.script";
+static const char* g_manifestFilename = "BlockDiskImageTest.hdv" DISK_IMAGE_MANIFEST_SUFFIX;
+static const char* g_planFilename = "BlockDiskImageTest.hdv" DISK_IMAGE_PLAN_SUFFIX;
+static const char* g_resolvedScriptFilename = "BlockDiskImageTest.hdv" DISK_IMAGE_RESOLVED_SCRIPT_SUFFIX;
+static const char* g_equatesFilename = "BlockDiskImageTest.hdv" DISK_IMAGE_EQUATES_SUFFIX;
+
+static unsigned int g_imageWriteCount;
+static size_t       g_imageWriteByteCount;
+
+static size_t countingFwrite(const void* ptr, size_t size, size_t nitems, FILE* stream)
+{
+    // Smaller writes are lines of the manifest.
+    if (size * nitems >= DISK_IMAGE_BLOCK_SIZE)
+    {
+        g_imageWriteCount++;
+        g_imageWriteByteCount += size * nitems;
+    }
+    return fwrite(ptr, size, nitems, stream);
+}
+
+static int   g_outstandingAllocations;
+static void* (*g_pOriginalMalloc)(size_t size);
+static void* (*g_pOriginalRealloc)(void* ptr, size_t size);
+static void  (*g_pOriginalFree)(void* ptr);
+
+static void* countingMalloc(size_t size)
+{
+    void* pAllocation = g_pOriginalMalloc(size);
+    if (pAllocation)
+        g_outstandingAllocations++;
+    return pAllocation;
+}
+
+static void* countingRealloc(void* ptr, size_t size)
+{
+    void* pAllocation = g_pOriginalRealloc(ptr, size);
+    if (!ptr && pAllocation)
+        g_outstandingAllocations++;
+    return pAllocation;
+}
+
+static void countingFree(void* ptr)
+{
+    if (ptr)
+        g_outstandingAllocations--;
+    g_pOriginalFree(ptr);
+}
+
+static void* processScriptFileThread(void* pvDiskImage)
+{
+    __try
+    {
+        DiskImage_ProcessScriptFile((DiskImage*)pvDiskImage, g_scriptFilename);
+    }
+    __catch
+    {
+        return (void*)(size_t)getExceptionCode();
+    }
+    return NULL;
+}
 
 
 TEST_GROUP(BlockDiskImage)
@@ -41,7 +103,7 @@ TEST_GROUP(BlockDiskImage)
     BlockDiskImage*      m_pDiskImage;
     FILE*                m_pFile;
     unsigned char*       m_pImageOnDisk;
-    char                 m_buffer[256];
+    char                 m_buffer[1024];
     
     void setup()
     {
@@ -67,6 +129,10 @@ TEST_GROUP(BlockDiskImage)
         remove(g_usrFilenameAllOnes);
         remove(g_imgTableFilename);
         remove(g_scriptFilename);
+        remove(g_manifestFilename);
+        remove(g_planFilename);
+        remove(g_resolvedScriptFilename);
+        remove(g_equatesFilename);
     }
     
     char* copy(const char* pStringToCopy)
@@ -256,6 +322,30 @@ TEST_GROUP(BlockDiskImage)
         return size;
     }
     
+    long getImageFileSize()
+    {
+        m_pFile = fopen(g_imageFilename, "rb");
+        CHECK(m_pFile != NULL);
+        long size = getFileSize(m_pFile);
+        fclose(m_pFile);
+        m_pFile = NULL;
+        return size;
+    }
+    
+    const unsigned char* readBlockFromDisk(unsigned int block)
+    {
+        static unsigned char blockData[DISK_IMAGE_BLOCK_SIZE];
+        
+        m_pFile = fopen(g_imageFilename, "rb");
+        CHECK(m_pFile != NULL);
+        LONGS_EQUAL(0, fseek(m_pFile, (long)block * DISK_IMAGE_BLOCK_SIZE, SEEK_SET));
+        LONGS_EQUAL(DISK_IMAGE_BLOCK_SIZE, fread(blockData, 1, DISK_IMAGE_BLOCK_SIZE, m_pFile));
+        fclose(m_pFile);
+        m_pFile = NULL;
+        
+        return blockData;
+    }
+    
     void validateOutOfMemoryExceptionThrown()
     {
         validateExceptionThrown(outOfMemoryException);
@@ -291,11 +381,12 @@ TEST_GROUP(BlockDiskImage)
         createBlockObjectFile(g_savFilenameAllZeroes, blockData, sizeof(blockData));
     }
 
-    void createBlockObjectFile(const char* pFilename, unsigned char* pBlockData, size_t blockDataSize)
+    void createBlockObjectFile(const char* pFilename, const unsigned char* pBlockData, size_t blockDataSize,
+                               const char* pSignature = BINARY_BUFFER_SAV_SIGNATURE)
     {
         SavFileHeader header;
     
-        memcpy(header.signature, BINARY_BUFFER_SAV_SIGNATURE, sizeof(header.signature));
+        memcpy(header.signature, pSignature, sizeof(header.signature));
         header.address = 0;
         header.length = blockDataSize;
     
@@ -322,11 +413,12 @@ TEST_GROUP(BlockDiskImage)
                                    unsigned short side,
                                    unsigned short track,
                                    unsigned short sector,
-                                   unsigned short offset)
+                                   unsigned short offset,
+                                   const char*    pSignature = BINARY_BUFFER_RW18SAV_SIGNATURE)
     {
         RW18SavFileHeader header;
     
-        memcpy(header.signature, BINARY_BUFFER_RW18SAV_SIGNATURE, sizeof(header.signature));
+        memcpy(header.signature, pSignature, sizeof(header.signature));
         header.side = side;
         header.track = track;
         header.offset = DISK_IMAGE_BYTES_PER_SECTOR * sector + offset;
@@ -359,6 +451,115 @@ TEST_GROUP(BlockDiskImage)
         fclose(pFile);
     }
     
+    void updateImageWithNewDiskImageObject()
+    {
+        DiskImage_Free((DiskImage*)m_pDiskImage);
+        m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+        DiskImage_UpdateImage((DiskImage*)m_pDiskImage, g_scriptFilename, g_imageFilename);
+    }
+    
+    void processScriptFileWithPlan()
+    {
+        DiskImage_Free((DiskImage*)m_pDiskImage);
+        m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+        DiskImage_EnablePlan((DiskImage*)m_pDiskImage, g_imageFilename);
+        DiskImage_ProcessScriptFile((DiskImage*)m_pDiskImage, g_scriptFilename);
+    }
+    
+    void processScriptFileWithResolvedScript()
+    {
+        DiskImage_Free((DiskImage*)m_pDiskImage);
+        m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+        DiskImage_EnableResolvedScript((DiskImage*)m_pDiskImage, g_imageFilename);
+        DiskImage_ProcessScriptFile((DiskImage*)m_pDiskImage, g_scriptFilename);
+    }
+    
+    void processScriptFileWithEquates(int usePlan)
+    {
+        DiskImage_Free((DiskImage*)m_pDiskImage);
+        m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+        if (usePlan)
+            DiskImage_EnablePlan((DiskImage*)m_pDiskImage, g_imageFilename);
+        DiskImage_EnableEquates((DiskImage*)m_pDiskImage, g_imageFilename);
+        DiskImage_ProcessScriptFile((DiskImage*)m_pDiskImage, g_scriptFilename);
+    }
+    
+    const char* readTextFile(const char* pFilename)
+    {
+        FILE*  pFile = fopen(pFilename, "rb");
+        size_t bytesRead;
+        
+        CHECK(pFile != NULL);
+        bytesRead = fread(m_buffer, 1, sizeof(m_buffer) - 1, pFile);
+        fclose(pFile);
+        m_buffer[bytesRead] = '\0';
+        return m_buffer;
+    }
+    
+    void setFileModificationTime(const char* pFilename, time_t modificationTime)
+    {
+        struct timespec times[2];
+        
+        memset(times, 0, sizeof(times));
+        times[0].tv_sec = modificationTime;
+        times[1].tv_sec = modificationTime;
+        CHECK(0 == utimensat(AT_FDCWD, pFilename, times, 0));
+    }
+    
+    time_t getFileModificationTime(const char* pFilename)
+    {
+        struct stat fileStat;
+        
+        CHECK(0 == stat(pFilename, &fileStat));
+        return fileStat.st_mtime;
+    }
+    
+    void rewriteTextFileKeepingStamp(const char* pFilename, const char* pText)
+    {
+        struct stat     fileStat;
+        struct timespec times[2];
+        
+        CHECK(0 == stat(pFilename, &fileStat));
+        createTextFile(pFilename, pText);
+        times[0] = fileStat.st_atim;
+        times[1] = fileStat.st_mtim;
+        CHECK(0 == utimensat(AT_FDCWD, pFilename, times, 0));
+    }
+    
+    void startCountingAllocations()
+    {
+        g_outstandingAllocations = 0;
+        g_pOriginalMalloc = hook_malloc;
+        g_pOriginalRealloc = hook_realloc;
+        g_pOriginalFree = hook_free;
+        hook_malloc = countingMalloc;
+        hook_realloc = countingRealloc;
+        hook_free = countingFree;
+    }
+    
+    void stopCountingAllocations()
+    {
+        hook_malloc = g_pOriginalMalloc;
+        hook_realloc = g_pOriginalRealloc;
+        hook_free = g_pOriginalFree;
+    }
+    
+    void readObjectFileWithNewImageSharingCache(DiskImageObjectCache* pCache)
+    {
+        BlockDiskImage* pImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+        
+        DiskImage_SetObjectCache((DiskImage*)pImage, pCache);
+        BlockDiskImage_ReadObjectFile(pImage, g_savFilenameAllOnes);
+        DiskImage_Free((DiskImage*)pImage);
+    }
+    
+    void startCountingWrites()
+    {
+        g_imageWriteCount = 0;
+        g_imageWriteByteCount = 0;
+        hook_fwrite = countingFwrite;
+    }
+    
     unsigned short createImageTable(unsigned char imageCount, ...)
     {
         va_list argList;
@@ -429,7 +630,7 @@ TEST_GROUP(BlockDiskImage)
 
 TEST(BlockDiskImage, FailAllAllocationInCreate)
 {
-    static const int allocationsToFail = 3;
+    static const int allocationsToFail = 4;
     for (int i = 1 ; i <= allocationsToFail ; i++)
     {
         MallocFailureInject_FailAllocation(i);
@@ -674,6 +875,52 @@ TEST(BlockDiskImage, ReadObjectFileAndWriteToImage)
     validateBlocksAreOnes(pImage, 0, 0);
 }
 
+TEST(BlockDiskImage, ReadObjectFileTwiceShouldOnlyOpenItOnce)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createOnesBlockObjectFile();
+    BlockDiskImage_ReadObjectFile(m_pDiskImage, g_savFilenameAllOnes);
+    fopenFail(NULL);
+        BlockDiskImage_ReadObjectFile(m_pDiskImage, g_savFilenameAllOnes);
+    fopenRestore();
+
+    DiskImageInsert insert;
+    insert.sourceOffset = 0;
+    insert.length = DISK_IMAGE_BLOCK_SIZE;
+    insert.type = DISK_IMAGE_INSERTION_BLOCK;
+    insert.block = 0;
+    insert.intraBlockOffset = 0;
+    BlockDiskImage_InsertObjectFile(m_pDiskImage, &insert);
+    
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreZeroes(pImage, 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+    validateBlocksAreOnes(pImage, 0, 0);
+}
+
+TEST(BlockDiskImage, ReadObjectFileAgainAfterItChanges)
+{
+    unsigned char zeroes[DISK_IMAGE_BLOCK_SIZE + 1];
+    
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    writeOnesBlocks(0, 1);
+    createOnesBlockRawObjectFile();
+    BlockDiskImage_ReadObjectFile(m_pDiskImage, g_savFilenameAllOnes);
+    memset(zeroes, 0, sizeof(zeroes));
+    createBlockRawObjectFile(g_savFilenameAllOnes, zeroes, sizeof(zeroes));
+    BlockDiskImage_ReadObjectFile(m_pDiskImage, g_savFilenameAllOnes);
+
+    DiskImageInsert insert;
+    insert.sourceOffset = 0;
+    insert.length = DISK_IMAGE_BLOCK_SIZE;
+    insert.type = DISK_IMAGE_INSERTION_BLOCK;
+    insert.block = 0;
+    insert.intraBlockOffset = 0;
+    BlockDiskImage_InsertObjectFile(m_pDiskImage, &insert);
+    
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreZeroes(pImage, 0, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+}
+
 TEST(BlockDiskImage, ReadRawObjectFileAndWriteToImage)
 {
     m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
@@ -886,6 +1133,20 @@ TEST(BlockDiskImage, ProcessOneLineTextScriptWithAsteriskForLength)
     validateBlocksAreOnes(pImage, 0, 0);
 }
 
+TEST(BlockDiskImage, ProcessOneLineTextScriptWithAsteriskForLengthOfCompressedObject)
+{
+    static const unsigned char compressedData[] = { 0x01, 0xff, 0x00 };
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createBlockObjectFile(g_savFilenameAllOnes, compressedData, sizeof(compressedData), BINARY_BUFFER_LZSAV_SIGNATURE);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,BlockDiskImageTestOnes.sav,0,*,0" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    CHECK(0 == memcmp(compressedData, pImage, sizeof(compressedData)));
+    LONGS_EQUAL(0x00, pImage[sizeof(compressedData)]);
+    validateBlocksAreZeroes(pImage, 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+}
+
 TEST(BlockDiskImage, ProcessOneLineTextScriptWithNoNewLineAtEnd)
 {
     m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
@@ -977,6 +1238,142 @@ TEST(BlockDiskImage, ProcessOneRW18LineTextScriptWithAsteriskForAllFieldsSoThatF
                                        DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17);
 }
 
+TEST(BlockDiskImage, ProcessOneRW18LineTextScriptWithAsteriskForAllFieldsOfCompressedObject)
+{
+    unsigned char sectorData[DISK_IMAGE_BYTES_PER_SECTOR];
+    
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    memset(sectorData, 0xff, sizeof(sectorData));
+    createSectorUSRObjectFile(g_usrFilenameAllOnes, sectorData, sizeof(sectorData),
+                              DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17, 0, 
+                              BINARY_BUFFER_LZRW18SAV_SIGNATURE);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("RW18,BlockDiskImageTestOnes.usr,0,*,*,*,*" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateRW18SectorsAreZeroes(pImage, DISK_IMAGE_RW18_SIDE_0, 0, 0, 
+                                         DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 16);
+    validateRW18SectorsAreOnes(pImage, DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17, 
+                                       DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17);
+}
+
+TEST(BlockDiskImage, ProcessRW18ScriptLineUsingInMemoryObjectDefaultsWithoutTouchingDisk)
+{
+    unsigned char   sectorData[DISK_IMAGE_PAGE_SIZE];
+    DiskImageInsert defaults;
+    
+    memset(sectorData, 0xff, sizeof(sectorData));
+    memset(&defaults, 0, sizeof(defaults));
+    defaults.type = DISK_IMAGE_INSERTION_RW18;
+    defaults.length = sizeof(sectorData);
+    defaults.side = DISK_IMAGE_RW18_SIDE_2;
+    defaults.track = DISK_IMAGE_TRACKS_PER_SIDE - 1;
+    defaults.intraTrackOffset = 17 * DISK_IMAGE_PAGE_SIZE;
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_AddInMemoryObject((DiskImage*)m_pDiskImage, "InMemory.usr", sectorData, sizeof(sectorData), &defaults);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("RW18,InMemory.usr,0,*,*,*,*" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateRW18SectorsAreZeroes(pImage, DISK_IMAGE_RW18_SIDE_0, 0, 0, 
+                                         DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 16);
+    validateRW18SectorsAreOnes(pImage, DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17, 
+                                       DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17);
+}
+
+TEST(BlockDiskImage, ProcessBlockScriptLineUsingInMemoryObjectWithNoDefaults)
+{
+    unsigned char blockData[DISK_IMAGE_BLOCK_SIZE];
+    
+    memset(blockData, 0xff, sizeof(blockData));
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_AddInMemoryObject((DiskImage*)m_pDiskImage, "InMemory.sav", blockData, sizeof(blockData), NULL);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,InMemory.sav,0,*,1" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreZeroes(pImage, 0, 0);
+    validateBlocksAreOnes(pImage, 1, 1);
+    validateBlocksAreZeroes(pImage, 2, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+}
+
+TEST(BlockDiskImage, FailAllocationInAddInMemoryObject)
+{
+    static const unsigned char data[1] = { 0xff };
+    
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( DiskImage_AddInMemoryObject((DiskImage*)m_pDiskImage, "InMemory.sav", data, sizeof(data), NULL) );
+    validateOutOfMemoryExceptionThrown();
+}
+
+TEST(BlockDiskImage, ReadInMemoryObjectShouldNotCopyItsData)
+{
+    unsigned char   blockData[DISK_IMAGE_BLOCK_SIZE];
+    DiskImageInsert insert;
+    
+    memset(blockData, 0xff, sizeof(blockData));
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_AddInMemoryObject((DiskImage*)m_pDiskImage, "InMemory.sav", blockData, sizeof(blockData), NULL);
+    MallocFailureInject_FailAllocation(1);
+    BlockDiskImage_ReadObjectFile(m_pDiskImage, "InMemory.sav");
+    MallocFailureInject_Restore();
+    
+    memset(&insert, 0, sizeof(insert));
+    insert.type = DISK_IMAGE_INSERTION_BLOCK;
+    insert.length = sizeof(blockData);
+    insert.block = 1;
+    BlockDiskImage_InsertObjectFile(m_pDiskImage, &insert);
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreZeroes(pImage, 0, 0);
+    validateBlocksAreOnes(pImage, 1, 1);
+    validateBlocksAreZeroes(pImage, 2, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+}
+
+TEST(BlockDiskImage, InsertPastEndOfInMemoryObjectShouldReadZeroPadding)
+{
+    unsigned char partialBlockData[DISK_IMAGE_BLOCK_SIZE / 2];
+    unsigned char expectedBlock[DISK_IMAGE_BLOCK_SIZE];
+    
+    memset(partialBlockData, 0xff, sizeof(partialBlockData));
+    memset(expectedBlock, 0, sizeof(expectedBlock));
+    memset(expectedBlock, 0xff, sizeof(partialBlockData));
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_AddInMemoryObject((DiskImage*)m_pDiskImage, "InMemory.sav", partialBlockData, sizeof(partialBlockData), NULL);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,InMemory.sav,0,512,1" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocks(pImage, 1, 1, expectedBlock);
+}
+
+TEST(BlockDiskImage, UpdateImageTableOfInMemoryObjectShouldNotModifyCallersData)
+{
+    static const unsigned char imageTable[] = { 1, 0x05, 0x60, 0x15, 0x60, 
+                                                0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                                                0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    unsigned char              callersData[sizeof(imageTable)];
+    DiskImageInsert            insert;
+    
+    memcpy(callersData, imageTable, sizeof(callersData));
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_AddInMemoryObject((DiskImage*)m_pDiskImage, "InMemory.img", callersData, sizeof(callersData), NULL);
+    BlockDiskImage_ReadObjectFile(m_pDiskImage, "InMemory.img");
+    BlockDiskImage_UpdateImageTableFile(m_pDiskImage, 0x9F00);
+    memset(&insert, 0, sizeof(insert));
+    insert.type = DISK_IMAGE_INSERTION_BLOCK;
+    insert.length = sizeof(callersData);
+    BlockDiskImage_InsertObjectFile(m_pDiskImage, &insert);
+
+    CHECK(0 == memcmp(imageTable, callersData, sizeof(imageTable)));
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    LONGS_EQUAL(1, pImage[0]);
+    LONGS_EQUAL(0x05, pImage[1]);
+    LONGS_EQUAL(0x9F, pImage[2]);
+    LONGS_EQUAL(0x15, pImage[3]);
+    LONGS_EQUAL(0x9F, pImage[4]);
+}
+
 TEST(BlockDiskImage, ProcessOneRW18LineTextScriptWithOverridesForAllFileHeaderFields)
 {
     m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
@@ -1005,6 +1402,23 @@ TEST(BlockDiskImage, ProcessOneRW18LineTextScriptWithImageTableUpdate)
     validateUpdatedImageTable(pImage, startBlock, newStartAddress, 8, IMAGE_SIZES);
 }
 
+TEST(BlockDiskImage, ImageTableUpdateShouldNotModifyCachedObjectFile)
+{
+    static const unsigned short newStartAddress = 0x9F00;
+    static const unsigned int   startBlock = 16;
+    #define IMAGE_SIZES 0x66, 0x92, 0x92, 0x92, 0x62, 0xB0, 0xB0, 0x92
+    
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createImageTable(8, IMAGE_SIZES);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("RW18,BlockDiskImageTest.img,0,*,0xa9,0,0,0x9F00" LINE_ENDING
+                                                    "BLOCK,BlockDiskImageTest.img,0,*,0" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateUpdatedImageTable(pImage, startBlock, newStartAddress, 8, IMAGE_SIZES);
+    validateUpdatedImageTable(pImage, 0, 0x6000, 8, IMAGE_SIZES);
+}
+
 TEST(BlockDiskImage, UpdateImageTableFileThatShouldBeTruncatedAndWriteToImage)
 {
     static const unsigned short newStartAddress = 0x9F00;
@@ -1218,3 +1632,777 @@ TEST(BlockDiskImage, FailToAllocateTextFileInProcessScriptFile)
     __try_and_catch( BlockDiskImage_ProcessScriptFile(m_pDiskImage, g_scriptFilename) );
     validateOutOfMemoryExceptionThrown();
 }
+
+TEST(BlockDiskImage, UpdateImageWithNoExistingImageShouldBuildWholeImageAndManifest)
+{
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestOnes.sav,0,512,1599" LINE_ENDING);
+
+    updateImageWithNewDiskImageObject();
+
+    const unsigned char* pImage = readDiskImageIntoMemory();
+    validateBlocksAreZeroes(pImage, 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 2);
+    validateBlocksAreOnes(pImage, 0, 0);
+    validateBlocksAreOnes(pImage, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+    m_pFile = fopen(g_manifestFilename, "rb");
+    CHECK(m_pFile != NULL);
+}
+
+TEST(BlockDiskImage, UpdateImageWithNoChangesShouldNotWriteAnything)
+{
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING);
+    updateImageWithNewDiskImageObject();
+
+    startCountingWrites();
+        updateImageWithNewDiskImageObject();
+    fwriteRestore();
+    LONGS_EQUAL(0, g_imageWriteCount);
+}
+
+TEST(BlockDiskImage, UpdateImageShouldOnlyRewriteBlocksWhoseContentChanged)
+{
+    unsigned char ones[DISK_IMAGE_BLOCK_SIZE];
+    
+    createOnesBlockObjectFile();
+    createZeroesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestZeroes.sav,0,512,10" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestZeroes.sav,0,512,1599" LINE_ENDING);
+    updateImageWithNewDiskImageObject();
+    memset(ones, 0xff, sizeof(ones));
+    createBlockObjectFile(g_savFilenameAllZeroes, ones, sizeof(ones));
+
+    startCountingWrites();
+        updateImageWithNewDiskImageObject();
+    fwriteRestore();
+    LONGS_EQUAL(2, g_imageWriteCount);
+    LONGS_EQUAL(2 * DISK_IMAGE_BLOCK_SIZE, g_imageWriteByteCount);
+    
+    const unsigned char* pImage = readDiskImageIntoMemory();
+    validateBlocksAreOnes(pImage, 0, 0);
+    validateBlocksAreZeroes(pImage, 1, 9);
+    validateBlocksAreOnes(pImage, 10, 10);
+    validateBlocksAreZeroes(pImage, 11, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 2);
+    validateBlocksAreOnes(pImage, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+}
+
+TEST(BlockDiskImage, UpdateImageShouldClearBlocksNoLongerWrittenByScript)
+{
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestOnes.sav,0,512,1" LINE_ENDING);
+    updateImageWithNewDiskImageObject();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING);
+
+    startCountingWrites();
+        updateImageWithNewDiskImageObject();
+    fwriteRestore();
+    LONGS_EQUAL(1, g_imageWriteCount);
+
+    const unsigned char* pImage = readDiskImageIntoMemory();
+    validateBlocksAreOnes(pImage, 0, 0);
+    validateBlocksAreZeroes(pImage, 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+}
+
+TEST(BlockDiskImage, UpdateImageShouldRebuildWholeImageIfItWasModifiedSinceManifestWasWritten)
+{
+    unsigned char ones[DISK_IMAGE_BLOCK_SIZE];
+    
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING);
+    updateImageWithNewDiskImageObject();
+    memset(ones, 0xff, sizeof(ones));
+    m_pFile = fopen(g_imageFilename, "r+b");
+    fseek(m_pFile, 5 * DISK_IMAGE_BLOCK_SIZE, SEEK_SET);
+    fwrite(ones, 1, sizeof(ones), m_pFile);
+    fclose(m_pFile);
+    m_pFile = NULL;
+
+    updateImageWithNewDiskImageObject();
+
+    const unsigned char* pImage = readDiskImageIntoMemory();
+    validateBlocksAreOnes(pImage, 0, 0);
+    validateBlocksAreZeroes(pImage, 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+}
+
+TEST(BlockDiskImage, UpdateImageShouldReportInsertErrorsAgainstScriptLine)
+{
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestOnes.sav,0,512,1599,1" LINE_ENDING);
+
+    updateImageWithNewDiskImageObject();
+    STRCMP_EQUAL("BlockDiskImageTest.script:2: error: Write starting at block 1599 offset 1 won't fit in output image file." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(BlockDiskImage, UpdateImageShouldReportInsertErrorsForLinesOutsideOfImage)
+{
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,1600" LINE_ENDING);
+
+    updateImageWithNewDiskImageObject();
+    STRCMP_EQUAL("BlockDiskImageTest.script:1: error: Write starting at block 1600 offset 0 won't fit in output image file." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(BlockDiskImage, UpdateImageShouldReportInsertErrorsInScriptLineOrder)
+{
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,1599,1" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestOnes.sav,0,512,1600" LINE_ENDING);
+
+    updateImageWithNewDiskImageObject();
+    STRCMP_EQUAL("BlockDiskImageTest.script:2: error: Write starting at block 1600 offset 0 won't fit in output image file." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(BlockDiskImage, UpdateImageWithInsertErrorsShouldNotWriteManifest)
+{
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestOnes.sav,0,512,1599,1" LINE_ENDING);
+
+    updateImageWithNewDiskImageObject();
+    m_pFile = fopen(g_manifestFilename, "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+}
+
+TEST(BlockDiskImage, UpdateImageShouldReportInsertErrorsAgainOnNextUpdate)
+{
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestOnes.sav,0,512,1599,1" LINE_ENDING);
+    updateImageWithNewDiskImageObject();
+    printfSpy_Unhook();
+    printfSpy_Hook(512);
+
+    updateImageWithNewDiskImageObject();
+    STRCMP_EQUAL("BlockDiskImageTest.script:2: error: Write starting at block 1599 offset 1 won't fit in output image file." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(BlockDiskImage, FailToOpenImageForUpdate)
+{
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING);
+    updateImageWithNewDiskImageObject();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,1" LINE_ENDING);
+
+    fopenFail(NULL);
+        __try_and_catch( updateImageWithNewDiskImageObject() );
+    fopenRestore();
+    validateExceptionThrown(fileOpenException);
+}
+
+TEST(BlockDiskImage, ImagesSharingObjectCacheShouldOnlyReadObjectFileOnce)
+{
+    DiskImageObjectCache* pCache = DiskImageObjectCache_Create();
+    BlockDiskImage*       pOtherImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_SetObjectCache((DiskImage*)m_pDiskImage, pCache);
+    DiskImage_SetObjectCache((DiskImage*)pOtherImage, pCache);
+    DiskImageObjectCache_Free(pCache);
+    createOnesBlockObjectFile();
+    BlockDiskImage_ReadObjectFile(m_pDiskImage, g_savFilenameAllOnes);
+    DiskImage_Free((DiskImage*)m_pDiskImage);
+    m_pDiskImage = pOtherImage;
+    fopenFail(NULL);
+        BlockDiskImage_ReadObjectFile(m_pDiskImage, g_savFilenameAllOnes);
+    fopenRestore();
+
+    DiskImageInsert insert;
+    insert.sourceOffset = 0;
+    insert.length = DISK_IMAGE_BLOCK_SIZE;
+    insert.type = DISK_IMAGE_INSERTION_BLOCK;
+    insert.block = 0;
+    insert.intraBlockOffset = 0;
+    BlockDiskImage_InsertObjectFile(m_pDiskImage, &insert);
+    
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreOnes(pImage, 0, 0);
+    validateBlocksAreZeroes(pImage, 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+}
+
+TEST(BlockDiskImage, SharedObjectCacheShouldNotGrowWhenObjectFileKeepsChanging)
+{
+    DiskImageObjectCache* pCache = DiskImageObjectCache_Create();
+    
+    createOnesBlockObjectFile();
+    readObjectFileWithNewImageSharingCache(pCache);
+    startCountingAllocations();
+    for (int i = 1 ; i <= 3 ; i++)
+    {
+        setFileModificationTime(g_savFilenameAllOnes, i * 1000);
+        readObjectFileWithNewImageSharingCache(pCache);
+    }
+    stopCountingAllocations();
+    LONGS_EQUAL(0, g_outstandingAllocations);
+    DiskImageObjectCache_Free(pCache);
+}
+
+TEST(BlockDiskImage, StaleCachedObjectShouldStayValidWhileImageStillHoldsIt)
+{
+    DiskImageObjectCache* pCache = DiskImageObjectCache_Create();
+    BlockDiskImage*       pOtherImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    unsigned char         zeroes[DISK_IMAGE_BLOCK_SIZE];
+    DiskImageInsert       insert;
+    
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_SetObjectCache((DiskImage*)m_pDiskImage, pCache);
+    DiskImage_SetObjectCache((DiskImage*)pOtherImage, pCache);
+    DiskImageObjectCache_Free(pCache);
+    createOnesBlockObjectFile();
+    setFileModificationTime(g_savFilenameAllOnes, 1000);
+    BlockDiskImage_ReadObjectFile(m_pDiskImage, g_savFilenameAllOnes);
+    memset(zeroes, 0, sizeof(zeroes));
+    createBlockObjectFile(g_savFilenameAllOnes, zeroes, sizeof(zeroes));
+    setFileModificationTime(g_savFilenameAllOnes, 2000);
+    BlockDiskImage_ReadObjectFile(pOtherImage, g_savFilenameAllOnes);
+    DiskImage_Free((DiskImage*)pOtherImage);
+
+    memset(&insert, 0, sizeof(insert));
+    insert.type = DISK_IMAGE_INSERTION_BLOCK;
+    insert.length = DISK_IMAGE_BLOCK_SIZE;
+    BlockDiskImage_InsertObjectFile(m_pDiskImage, &insert);
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreOnes(pImage, 0, 0);
+}
+
+TEST(BlockDiskImage, ProcessScriptFilesConcurrentlyWithSharedObjectCache)
+{
+    static const unsigned int imageCount = 4;
+    DiskImageObjectCache*     pCache = DiskImageObjectCache_Create();
+    BlockDiskImage*           pImages[imageCount];
+    pthread_t                 threads[imageCount];
+    
+    createOnesBlockObjectFile();
+    createZeroesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestZeroes.sav,0,512,1" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestOnes.sav,0,512,1599" LINE_ENDING);
+    for (unsigned int i = 0 ; i < imageCount ; i++)
+    {
+        pImages[i] = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+        DiskImage_SetObjectCache((DiskImage*)pImages[i], pCache);
+    }
+    DiskImageObjectCache_Free(pCache);
+    
+    for (unsigned int i = 0 ; i < imageCount ; i++)
+        LONGS_EQUAL(0, pthread_create(&threads[i], NULL, processScriptFileThread, pImages[i]));
+    for (unsigned int i = 0 ; i < imageCount ; i++)
+    {
+        void* pResult = (void*)1;
+        
+        pthread_join(threads[i], &pResult);
+        POINTERS_EQUAL(NULL, pResult);
+        const unsigned char* pImage = BlockDiskImage_GetImagePointer(pImages[i]);
+        validateBlocksAreOnes(pImage, 0, 0);
+        validateBlocksAreZeroes(pImage, 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 2);
+        validateBlocksAreOnes(pImage, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+    }
+    for (unsigned int i = 0 ; i < imageCount ; i++)
+        DiskImage_Free((DiskImage*)pImages[i]);
+}
+
+TEST(BlockDiskImage, FailAllAllocationsInCreateSparse)
+{
+    static const int allocationsToFail = 4;
+    for (int i = 1 ; i <= allocationsToFail ; i++)
+    {
+        MallocFailureInject_FailAllocation(i);
+        __try_and_catch( m_pDiskImage = BlockDiskImage_CreateSparse(BLOCK_DISK_IMAGE_32M_BLOCK_COUNT, NULL) );
+        POINTERS_EQUAL(NULL, m_pDiskImage);
+        validateOutOfMemoryExceptionThrown();
+    }
+
+    MallocFailureInject_FailAllocation(allocationsToFail + 1);
+    m_pDiskImage = BlockDiskImage_CreateSparse(BLOCK_DISK_IMAGE_32M_BLOCK_COUNT, NULL);
+    CHECK_TRUE(m_pDiskImage != NULL);
+}
+
+TEST(BlockDiskImage, SparseImageHasNoImagePointer)
+{
+    m_pDiskImage = BlockDiskImage_CreateSparse(BLOCK_DISK_IMAGE_32M_BLOCK_COUNT, NULL);
+    POINTERS_EQUAL(NULL, BlockDiskImage_GetImagePointer(m_pDiskImage));
+    LONGS_EQUAL(BLOCK_DISK_IMAGE_32M_DISK_SIZE, BlockDiskImage_GetImageSize(m_pDiskImage));
+}
+
+TEST(BlockDiskImage, WriteSparseImageShouldOnlyWriteTouchedBlocks)
+{
+    m_pDiskImage = BlockDiskImage_CreateSparse(BLOCK_DISK_IMAGE_32M_BLOCK_COUNT, NULL);
+    writeOnesBlocks(0, 1);
+    writeOnesBlocks(1000, 2);
+    
+    startCountingWrites();
+        BlockDiskImage_WriteImage(m_pDiskImage, g_imageFilename);
+    fwriteRestore();
+    
+    LONGS_EQUAL(3, g_imageWriteCount);
+    LONGS_EQUAL(3 * DISK_IMAGE_BLOCK_SIZE, g_imageWriteByteCount);
+    LONGS_EQUAL(BLOCK_DISK_IMAGE_32M_DISK_SIZE, getImageFileSize());
+    validateAllOnes(readBlockFromDisk(0), DISK_IMAGE_BLOCK_SIZE);
+    validateAllZeroes(readBlockFromDisk(1), DISK_IMAGE_BLOCK_SIZE);
+    validateAllZeroes(readBlockFromDisk(999), DISK_IMAGE_BLOCK_SIZE);
+    validateAllOnes(readBlockFromDisk(1000), DISK_IMAGE_BLOCK_SIZE);
+    validateAllOnes(readBlockFromDisk(1001), DISK_IMAGE_BLOCK_SIZE);
+    validateAllZeroes(readBlockFromDisk(BLOCK_DISK_IMAGE_32M_BLOCK_COUNT - 1), DISK_IMAGE_BLOCK_SIZE);
+}
+
+TEST(BlockDiskImage, WriteSparseImageWithLastBlockWritten)
+{
+    m_pDiskImage = BlockDiskImage_CreateSparse(BLOCK_DISK_IMAGE_32M_BLOCK_COUNT, NULL);
+    writeOnesBlocks(BLOCK_DISK_IMAGE_32M_BLOCK_COUNT - 1, 1);
+    BlockDiskImage_WriteImage(m_pDiskImage, g_imageFilename);
+    
+    LONGS_EQUAL(BLOCK_DISK_IMAGE_32M_DISK_SIZE, getImageFileSize());
+    validateAllZeroes(readBlockFromDisk(0), DISK_IMAGE_BLOCK_SIZE);
+    validateAllOnes(readBlockFromDisk(BLOCK_DISK_IMAGE_32M_BLOCK_COUNT - 1), DISK_IMAGE_BLOCK_SIZE);
+}
+
+TEST(BlockDiskImage, InsertUnalignedDataAcrossSparseBlocks)
+{
+    unsigned char data[DISK_IMAGE_BLOCK_SIZE + 2];
+    unsigned char expected[DISK_IMAGE_BLOCK_SIZE];
+    DiskImageInsert insert;
+    
+    m_pDiskImage = BlockDiskImage_CreateSparse(BLOCK_DISK_IMAGE_32M_BLOCK_COUNT, NULL);
+    memset(data, 0xff, sizeof(data));
+    insert.type = DISK_IMAGE_INSERTION_BLOCK;
+    insert.sourceOffset = 0;
+    insert.length = sizeof(data);
+    insert.block = 10;
+    insert.intraBlockOffset = DISK_IMAGE_BLOCK_SIZE - 1;
+    BlockDiskImage_InsertData(m_pDiskImage, data, &insert);
+    BlockDiskImage_WriteImage(m_pDiskImage, g_imageFilename);
+    
+    memset(expected, 0x00, sizeof(expected));
+    expected[DISK_IMAGE_BLOCK_SIZE - 1] = 0xff;
+    CHECK(0 == memcmp(expected, readBlockFromDisk(10), sizeof(expected)));
+    validateAllOnes(readBlockFromDisk(11), DISK_IMAGE_BLOCK_SIZE);
+    memset(expected, 0x00, sizeof(expected));
+    expected[0] = 0xff;
+    CHECK(0 == memcmp(expected, readBlockFromDisk(12), sizeof(expected)));
+}
+
+TEST(BlockDiskImage, FailAllocationOfSparseBlockInInsertData)
+{
+    m_pDiskImage = BlockDiskImage_CreateSparse(BLOCK_DISK_IMAGE_32M_BLOCK_COUNT, NULL);
+    MallocFailureInject_FailAllocation(1);
+        writeOnesBlocks(0, 1);
+    MallocFailureInject_Restore();
+    validateOutOfMemoryExceptionThrown();
+}
+
+TEST(BlockDiskImage, FailFSeekInWriteSparseImage)
+{
+    m_pDiskImage = BlockDiskImage_CreateSparse(BLOCK_DISK_IMAGE_32M_BLOCK_COUNT, NULL);
+    writeOnesBlocks(1, 1);
+    fseekSetFailureCode(-1);
+        __try_and_catch( BlockDiskImage_WriteImage(m_pDiskImage, g_imageFilename) );
+    fseekRestore();
+    validateFileExceptionThrown();
+}
+
+TEST(BlockDiskImage, FailFWriteInWriteSparseImage)
+{
+    m_pDiskImage = BlockDiskImage_CreateSparse(BLOCK_DISK_IMAGE_32M_BLOCK_COUNT, NULL);
+    writeOnesBlocks(0, 1);
+    fwriteFail(0);
+        __try_and_catch( BlockDiskImage_WriteImage(m_pDiskImage, g_imageFilename) );
+    fwriteRestore();
+    validateFileExceptionThrown();
+}
+
+TEST(BlockDiskImage, ProcessScriptFileWithPlanShouldBuildImageAndWritePlan)
+{
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestOnes.sav,0,512,1599" LINE_ENDING);
+    
+    processScriptFileWithPlan();
+    
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreOnes(pImage, 0, 0);
+    validateBlocksAreZeroes(pImage, 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 2);
+    validateBlocksAreOnes(pImage, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+    m_pFile = fopen(g_planFilename, "rb");
+    CHECK(m_pFile != NULL);
+}
+
+TEST(BlockDiskImage, ProcessScriptFileWithPlanShouldReplayPlanWhileScriptStampMatches)
+{
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,1" LINE_ENDING);
+    processScriptFileWithPlan();
+    rewriteTextFileKeepingStamp(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,2" LINE_ENDING);
+    
+    processScriptFileWithPlan();
+    
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreOnes(pImage, 1, 1);
+    validateBlocksAreZeroes(pImage, 2, 2);
+}
+
+TEST(BlockDiskImage, ProcessScriptFileWithPlanShouldRecompileWhenScriptChanges)
+{
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,1" LINE_ENDING);
+    processScriptFileWithPlan();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,20" LINE_ENDING);
+    
+    processScriptFileWithPlan();
+    
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreZeroes(pImage, 1, 1);
+    validateBlocksAreOnes(pImage, 20, 20);
+}
+
+TEST(BlockDiskImage, ProcessScriptFileWithPlanShouldReplayLinesWithNewObjectContents)
+{
+    unsigned char zeroes[DISK_IMAGE_BLOCK_SIZE];
+    
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,1" LINE_ENDING);
+    processScriptFileWithPlan();
+    rewriteTextFileKeepingStamp(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,2" LINE_ENDING);
+    memset(zeroes, 0, sizeof(zeroes));
+    zeroes[0] = 0x5a;
+    createBlockObjectFile(g_savFilenameAllOnes, zeroes, sizeof(zeroes));
+    
+    processScriptFileWithPlan();
+    
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    LONGS_EQUAL(0x5a, pImage[1 * DISK_IMAGE_BLOCK_SIZE]);
+    validateBlocksAreZeroes(pImage, 2, 2);
+}
+
+TEST(BlockDiskImage, ProcessScriptFileWithPlanShouldRecompileWhenObjectUsedByAsteriskFieldChanges)
+{
+    unsigned char ones[2 * DISK_IMAGE_BLOCK_SIZE];
+    
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,*,1" LINE_ENDING);
+    processScriptFileWithPlan();
+    memset(ones, 0xff, sizeof(ones));
+    createBlockObjectFile(g_savFilenameAllOnes, ones, sizeof(ones));
+    
+    processScriptFileWithPlan();
+    
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreOnes(pImage, 1, 2);
+}
+
+TEST(BlockDiskImage, ProcessScriptFileWithPlanShouldNotWritePlanForScriptWithErrors)
+{
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestMissing.sav,0,512,1" LINE_ENDING);
+    
+    processScriptFileWithPlan();
+    
+    STRCMP_EQUAL("BlockDiskImageTest.script:2: error: Failed to open 'BlockDiskImageTestMissing.sav' object file." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+    POINTERS_EQUAL(NULL, fopen(g_planFilename, "rb"));
+}
+
+TEST(BlockDiskImage, ProcessScriptFileWithPlanShouldReportErrorsAgainstScriptLineWhenReplaying)
+{
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "# Comment" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING);
+    processScriptFileWithPlan();
+    remove(g_savFilenameAllOnes);
+    
+    processScriptFileWithPlan();
+    
+    STRCMP_EQUAL("BlockDiskImageTest.script:2: error: Failed to open 'BlockDiskImageTestOnes.sav' object file." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(BlockDiskImage, UpdateImageWithPlanShouldOnlyRewriteBlocksWhoseContentChanged)
+{
+    unsigned char ones[DISK_IMAGE_BLOCK_SIZE];
+    
+    createOnesBlockObjectFile();
+    createZeroesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestZeroes.sav,0,512,10" LINE_ENDING);
+    DiskImage_Free((DiskImage*)m_pDiskImage);
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_EnablePlan((DiskImage*)m_pDiskImage, g_imageFilename);
+    DiskImage_UpdateImage((DiskImage*)m_pDiskImage, g_scriptFilename, g_imageFilename);
+    memset(ones, 0xff, sizeof(ones));
+    createBlockObjectFile(g_savFilenameAllZeroes, ones, sizeof(ones));
+
+    DiskImage_Free((DiskImage*)m_pDiskImage);
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_EnablePlan((DiskImage*)m_pDiskImage, g_imageFilename);
+    startCountingWrites();
+        DiskImage_UpdateImage((DiskImage*)m_pDiskImage, g_scriptFilename, g_imageFilename);
+    fwriteRestore();
+    LONGS_EQUAL(1, g_imageWriteCount);
+    
+    const unsigned char* pImage = readDiskImageIntoMemory();
+    validateBlocksAreOnes(pImage, 0, 0);
+    validateBlocksAreOnes(pImage, 10, 10);
+}
+
+TEST(BlockDiskImage, FailAllocationInEnablePlan)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( DiskImage_EnablePlan((DiskImage*)m_pDiskImage, g_imageFilename) );
+    validateOutOfMemoryExceptionThrown();
+}
+
+TEST(BlockDiskImage, UpdateSparseImageShouldRebuildWholeImageWithoutManifest)
+{
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,20000" LINE_ENDING);
+    m_pDiskImage = BlockDiskImage_CreateSparse(BLOCK_DISK_IMAGE_32M_BLOCK_COUNT, NULL);
+    
+    DiskImage_UpdateImage((DiskImage*)m_pDiskImage, g_scriptFilename, g_imageFilename);
+    
+    LONGS_EQUAL(BLOCK_DISK_IMAGE_32M_DISK_SIZE, getImageFileSize());
+    validateAllOnes(readBlockFromDisk(20000), DISK_IMAGE_BLOCK_SIZE);
+    POINTERS_EQUAL(NULL, fopen(g_manifestFilename, "rb"));
+}
+
+TEST(BlockDiskImage, ProcessRW18ScriptLinesWithQuestionMarksShouldPackObjectsBackToBack)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_1, 20, 5, 0);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("RW18,BlockDiskImageTestOnes.usr,0,*,*,?,?" LINE_ENDING
+                                                    "RW18,BlockDiskImageTestOnes.usr,0,*,*,?,?" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateRW18SectorsAreZeroes(pImage, DISK_IMAGE_RW18_SIDE_0, 0, 0, 
+                                         DISK_IMAGE_RW18_SIDE_0, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17);
+    validateRW18SectorsAreOnes(pImage, DISK_IMAGE_RW18_SIDE_1, 0, 0, DISK_IMAGE_RW18_SIDE_1, 0, 1);
+    validateRW18SectorsAreZeroes(pImage, DISK_IMAGE_RW18_SIDE_1, 0, 2, 
+                                         DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17);
+}
+
+TEST(BlockDiskImage, ProcessRW18ScriptLineWithQuestionMarksShouldPackAroundEarlierFixedLines)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_0, 0, 0, 0);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("RW18,BlockDiskImageTestOnes.usr,0,*,*,*,*" LINE_ENDING
+                                                    "RW18,BlockDiskImageTestOnes.usr,0,*,*,?,?" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateRW18SectorsAreOnes(pImage, DISK_IMAGE_RW18_SIDE_0, 0, 0, DISK_IMAGE_RW18_SIDE_0, 0, 1);
+    validateRW18SectorsAreZeroes(pImage, DISK_IMAGE_RW18_SIDE_0, 0, 2, 
+                                         DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17);
+}
+
+TEST(BlockDiskImage, PassQuestionMarkForOnlyTrackToProcessScript)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_0, 0, 0, 0);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("RW18,BlockDiskImageTestOnes.usr,0,*,*,?,0" LINE_ENDING));
+    STRCMP_EQUAL("<null>:1: error: Line must use '?' for both the track and offset fields or for neither." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(BlockDiskImage, ProcessRW18ScriptLineWithQuestionMarksShouldPackAroundLaterFixedLines)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_0, 0, 0, 0);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("RW18,BlockDiskImageTestOnes.usr,0,*,*,?,?" LINE_ENDING
+                                                    "RW18,BlockDiskImageTestOnes.usr,0,*,*,0,0" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateRW18SectorsAreOnes(pImage, DISK_IMAGE_RW18_SIDE_0, 0, 0, DISK_IMAGE_RW18_SIDE_0, 0, 1);
+    validateRW18SectorsAreZeroes(pImage, DISK_IMAGE_RW18_SIDE_0, 0, 2, 
+                                         DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17);
+    STRCMP_EQUAL("", printfSpy_GetLastErrorOutput());
+}
+
+TEST(BlockDiskImage, ProcessRW18ScriptLinesWithQuestionMarksShouldStayGroupedAcrossComments)
+{
+    unsigned char data[2 * DISK_IMAGE_BYTES_PER_SECTOR];
+    memset(data, 0xff, sizeof(data));
+    createSectorUSRObjectFile(g_usrFilenameAllOnes, data, sizeof(data), DISK_IMAGE_RW18_SIDE_0, 0, 0, 0);
+    /* Without the grouping, the second '?' line would be packed into the tighter gap at the start of track 0. */
+    createTextFile(g_scriptFilename, "RW18,BlockDiskImageTestOnes.usr,0,256,*,0,0x100" LINE_ENDING
+                                     "RW18,BlockDiskImageTestOnes.usr,0,256,*,1,0x300" LINE_ENDING
+                                     "RW18,BlockDiskImageTestOnes.usr,0,*,*,?,?" LINE_ENDING
+                                     "# Same level" LINE_ENDING
+                                     "RW18,BlockDiskImageTestOnes.usr,0,256,*,?,?" LINE_ENDING);
+    
+    processScriptFileWithResolvedScript();
+    
+    STRCMP_EQUAL("RW18,BlockDiskImageTestOnes.usr,0,256,*,0,0x100" LINE_ENDING
+                 "RW18,BlockDiskImageTestOnes.usr,0,256,*,1,0x300" LINE_ENDING
+                 "RW18,BlockDiskImageTestOnes.usr,0,*,*,1,0x0" LINE_ENDING
+                 "# Same level" LINE_ENDING
+                 "RW18,BlockDiskImageTestOnes.usr,0,256,*,1,0x200" LINE_ENDING,
+                 readTextFile(g_resolvedScriptFilename));
+}
+
+TEST(BlockDiskImage, ProcessScriptFileWithResolvedScriptShouldFillInPackedFields)
+{
+    createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_0, 0, 0, 0);
+    createTextFile(g_scriptFilename, "RW18,BlockDiskImageTestOnes.usr,0,*,*,*,*" LINE_ENDING
+                                     "# Level 1" LINE_ENDING
+                                     "RW18,BlockDiskImageTest.img,0,*,0xa9,?,?,0x9F00" LINE_ENDING);
+    createImageTable(1, 0x10);
+    
+    processScriptFileWithResolvedScript();
+    
+    STRCMP_EQUAL("RW18,BlockDiskImageTestOnes.usr,0,*,*,*,*" LINE_ENDING
+                 "# Level 1" LINE_ENDING
+                 "RW18,BlockDiskImageTest.img,0,*,0xa9,0,0x100,0x9F00" LINE_ENDING,
+                 readTextFile(g_resolvedScriptFilename));
+}
+
+TEST(BlockDiskImage, ProcessScriptFileWithResolvedScriptShouldNotRewriteUnchangedPlacement)
+{
+    createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_0, 0, 0, 0);
+    createTextFile(g_scriptFilename, "RW18,BlockDiskImageTestOnes.usr,0,*,*,?,?" LINE_ENDING);
+    processScriptFileWithResolvedScript();
+    setFileModificationTime(g_resolvedScriptFilename, 1000);
+    
+    processScriptFileWithResolvedScript();
+    LONGS_EQUAL(1000, getFileModificationTime(g_resolvedScriptFilename));
+    
+    createTextFile(g_scriptFilename, "RW18,BlockDiskImageTestOnes.usr,0,*,*,*,*" LINE_ENDING
+                                     "RW18,BlockDiskImageTestOnes.usr,0,*,*,?,?" LINE_ENDING);
+    processScriptFileWithResolvedScript();
+    STRCMP_EQUAL("RW18,BlockDiskImageTestOnes.usr,0,*,*,*,*" LINE_ENDING
+                 "RW18,BlockDiskImageTestOnes.usr,0,*,*,0,0x100" LINE_ENDING,
+                 readTextFile(g_resolvedScriptFilename));
+}
+
+TEST(BlockDiskImage, ProcessScriptFileWithResolvedScriptShouldNotWriteItForScriptWithoutQuestionMarks)
+{
+    createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_0, 0, 0, 0);
+    createTextFile(g_scriptFilename, "RW18,BlockDiskImageTestOnes.usr,0,*,*,*,*" LINE_ENDING);
+    
+    processScriptFileWithResolvedScript();
+    
+    POINTERS_EQUAL(NULL, fopen(g_resolvedScriptFilename, "rb"));
+}
+
+TEST(BlockDiskImage, ProcessScriptFileWithResolvedScriptShouldNotWriteItForScriptWithErrors)
+{
+    createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_0, 0, 0, 0);
+    createTextFile(g_scriptFilename, "RW18,BlockDiskImageTestOnes.usr,0,*,*,?,?" LINE_ENDING
+                                     "RW18,BlockDiskImageTestOnes.usr,0,*,0x42,0,0" LINE_ENDING);
+    
+    processScriptFileWithResolvedScript();
+    
+    POINTERS_EQUAL(NULL, fopen(g_resolvedScriptFilename, "rb"));
+}
+
+TEST(BlockDiskImage, FailFOpenWhenWritingResolvedScript)
+{
+    createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_0, 0, 0, 0);
+    createTextFile(g_scriptFilename, "RW18,BlockDiskImageTestOnes.usr,0,*,*,?,?" LINE_ENDING);
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_EnableResolvedScript((DiskImage*)m_pDiskImage, "NoSuchDirectory/BlockDiskImageTest.hdv");
+    
+    __try_and_catch( DiskImage_ProcessScriptFile((DiskImage*)m_pDiskImage, g_scriptFilename) );
+    
+    validateExceptionThrown(fileOpenException);
+    STRCMP_EQUAL("BlockDiskImageTest.script:2: error: Failed to write resolved script to "
+                 "NoSuchDirectory/BlockDiskImageTest.hdv" DISK_IMAGE_RESOLVED_SCRIPT_SUFFIX "." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(BlockDiskImage, ProcessScriptFileWithEquatesShouldWriteEquatesForEachRW18Line)
+{
+    createOnesBlockObjectFile();
+    createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_1, 3, 2, 0);
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING
+                                     "RW18,BlockDiskImageTestOnes.usr,0,*,*,*,*" LINE_ENDING
+                                     "RW18,BlockDiskImageTestOnes.usr,0,0x80,*,?,?" LINE_ENDING);
+    
+    processScriptFileWithEquates(FALSE);
+    
+    STRCMP_EQUAL("* Generated by crackle from BlockDiskImageTest.script.  Do not edit." LINE_ENDING
+                 "BLOCKDISKIMAGETESTONES_SIDE EQU $AD" LINE_ENDING
+                 "BLOCKDISKIMAGETESTONES_TRACK EQU 3" LINE_ENDING
+                 "BLOCKDISKIMAGETESTONES_OFFSET EQU $0200" LINE_ENDING
+                 "BLOCKDISKIMAGETESTONES_LENGTH EQU $0100" LINE_ENDING
+                 "BLOCKDISKIMAGETESTONES_2_SIDE EQU $AD" LINE_ENDING
+                 "BLOCKDISKIMAGETESTONES_2_TRACK EQU 3" LINE_ENDING
+                 "BLOCKDISKIMAGETESTONES_2_OFFSET EQU $0000" LINE_ENDING
+                 "BLOCKDISKIMAGETESTONES_2_LENGTH EQU $0080" LINE_ENDING,
+                 readTextFile(g_equatesFilename));
+}
+
+TEST(BlockDiskImage, EquateLabelsShouldDropDirectoryAndExtensionOfObjectFilename)
+{
+    unsigned char   sectorData[DISK_IMAGE_PAGE_SIZE];
+    DiskImageInsert defaults;
+    
+    memset(sectorData, 0xff, sizeof(sectorData));
+    memset(&defaults, 0, sizeof(defaults));
+    defaults.type = DISK_IMAGE_INSERTION_RW18;
+    defaults.side = DISK_IMAGE_RW18_SIDE_0;
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_EnableEquates((DiskImage*)m_pDiskImage, g_imageFilename);
+    DiskImage_AddInMemoryObject((DiskImage*)m_pDiskImage, "obj/1level-a.usr", sectorData, sizeof(sectorData), &defaults);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("RW18,obj/1level-a.usr,0,*,*,?,?" LINE_ENDING));
+
+    STRCMP_EQUAL("* Generated by crackle from <null>.  Do not edit." LINE_ENDING
+                 "_1LEVEL_A_SIDE EQU $A9" LINE_ENDING
+                 "_1LEVEL_A_TRACK EQU 0" LINE_ENDING
+                 "_1LEVEL_A_OFFSET EQU $0000" LINE_ENDING
+                 "_1LEVEL_A_LENGTH EQU $0100" LINE_ENDING,
+                 readTextFile(g_equatesFilename));
+}
+
+TEST(BlockDiskImage, ProcessScriptFileWithEquatesShouldNotRewriteUnchangedPlacement)
+{
+    createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_0, 0, 0, 0);
+    createTextFile(g_scriptFilename, "RW18,BlockDiskImageTestOnes.usr,0,*,*,?,?" LINE_ENDING);
+    processScriptFileWithEquates(FALSE);
+    setFileModificationTime(g_equatesFilename, 1000);
+    
+    processScriptFileWithEquates(FALSE);
+    LONGS_EQUAL(1000, getFileModificationTime(g_equatesFilename));
+    
+    createTextFile(g_scriptFilename, "RW18,BlockDiskImageTestOnes.usr,0,*,*,1,0" LINE_ENDING);
+    processScriptFileWithEquates(FALSE);
+    CHECK(1000 != getFileModificationTime(g_equatesFilename));
+}
+
+TEST(BlockDiskImage, ProcessScriptFileWithEquatesShouldNotWriteThemForScriptWithErrors)
+{
+    createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_0, 0, 0, 0);
+    createTextFile(g_scriptFilename, "RW18,BlockDiskImageTestOnes.usr,0,*,*,*,*" LINE_ENDING
+                                     "RW18,BlockDiskImageTestOnes.usr,0,*,0x42,0,0" LINE_ENDING);
+    
+    processScriptFileWithEquates(FALSE);
+    
+    POINTERS_EQUAL(NULL, fopen(g_equatesFilename, "rb"));
+}
+
+TEST(BlockDiskImage, ReplayingPlanShouldStillWriteEquates)
+{
+    createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_0, 4, 0, 0);
+    createTextFile(g_scriptFilename, "RW18,BlockDiskImageTestOnes.usr,0,*,*,*,*" LINE_ENDING);
+    processScriptFileWithPlan();
+    rewriteTextFileKeepingStamp(g_scriptFilename, "RW18,BlockDiskImageTestOnes.usr,0,*,*,5,*" LINE_ENDING);
+    
+    processScriptFileWithEquates(TRUE);
+    
+    STRCMP_EQUAL("* Generated by crackle from BlockDiskImageTest.script.  Do not edit." LINE_ENDING
+                 "BLOCKDISKIMAGETESTONES_SIDE EQU $A9" LINE_ENDING
+                 "BLOCKDISKIMAGETESTONES_TRACK EQU 4" LINE_ENDING
+                 "BLOCKDISKIMAGETESTONES_OFFSET EQU $0000" LINE_ENDING
+                 "BLOCKDISKIMAGETESTONES_LENGTH EQU $0100" LINE_ENDING,
+                 readTextFile(g_equatesFilename));
+}
@@ -29,7 +29,7 @@ static const char g_usageString[] = "Usage:";
 
 TEST_GROUP(CrackleCommandLine)
 {
-    const char*        m_argv[10];
+    const char*        m_argv[16];
     CrackleCommandLine m_commandLine;
     int                m_argc;
     
@@ -132,9 +132,11 @@ TEST(CrackleCommandLine, ValidFormatOfNib_5_25)
     addArg("pop1.nib");
     m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
     LONGS_EQUAL(0, printfSpy_GetCallCount());
-    STRCMP_EQUAL("pop1.crackle", m_commandLine.pScriptFilename);
-    STRCMP_EQUAL("pop1.nib", m_commandLine.pOutputImageFilename);
-    LONGS_EQUAL(FORMAT_NIB_5_25, m_commandLine.imageFormat);
+    STRCMP_EQUAL("pop1.crackle", m_commandLine.images[0].pScriptFilename);
+    STRCMP_EQUAL("pop1.nib", m_commandLine.images[0].pOutputImageFilename);
+    LONGS_EQUAL(FORMAT_NIB_5_25, m_commandLine.images[0].imageFormat);
+    CHECK_FALSE(m_commandLine.usePlans);
+    CHECK_FALSE(m_commandLine.writeEquates);
 }
 
 TEST(CrackleCommandLine, ValidFormatOfHDV_3_5)
@@ -145,9 +147,22 @@ TEST(CrackleCommandLine, ValidFormatOfHDV_3_5)
     addArg("pop1.nib");
     m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
     LONGS_EQUAL(0, printfSpy_GetCallCount());
-    STRCMP_EQUAL("pop1.crackle", m_commandLine.pScriptFilename);
-    STRCMP_EQUAL("pop1.nib", m_commandLine.pOutputImageFilename);
-    LONGS_EQUAL(FORMAT_HDV_3_5, m_commandLine.imageFormat);
+    STRCMP_EQUAL("pop1.crackle", m_commandLine.images[0].pScriptFilename);
+    STRCMP_EQUAL("pop1.nib", m_commandLine.images[0].pOutputImageFilename);
+    LONGS_EQUAL(FORMAT_HDV_3_5, m_commandLine.images[0].imageFormat);
+}
+
+TEST(CrackleCommandLine, ValidFormatOfHDV_32M)
+{
+    addArg("--format");
+    addArg("hdv_32m");
+    addArg("hd.crackle");
+    addArg("hd.hdv");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    STRCMP_EQUAL("hd.crackle", m_commandLine.images[0].pScriptFilename);
+    STRCMP_EQUAL("hd.hdv", m_commandLine.images[0].pOutputImageFilename);
+    LONGS_EQUAL(FORMAT_HDV_32M, m_commandLine.images[0].imageFormat);
 }
 
 TEST(CrackleCommandLine, InvalidCaseOfTooManyFilenames)
@@ -160,3 +175,340 @@ TEST(CrackleCommandLine, InvalidCaseOfTooManyFilenames)
     __try_and_catch ( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
     validateInvalidArgumentExceptionThrown();
 }
+
+TEST(CrackleCommandLine, NoSnapSourcesByDefault)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, m_commandLine.snapSourceCount);
+    POINTERS_EQUAL(NULL, m_commandLine.pPutDirectories);
+    LONGS_EQUAL(1, m_commandLine.threadCount);
+    LONGS_EQUAL(0, m_commandLine.images[0].updateImage);
+}
+
+TEST(CrackleCommandLine, TwoSnapSourcesWithPutDirectories)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--snap");
+    addArg("boot.S");
+    addArg("--SNAP");
+    addArg("rw18.S");
+    addArg("--putdirs");
+    addArg("inc;..");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    LONGS_EQUAL(2, m_commandLine.snapSourceCount);
+    STRCMP_EQUAL("boot.S", m_commandLine.pSnapSourceFilenames[0]);
+    STRCMP_EQUAL("rw18.S", m_commandLine.pSnapSourceFilenames[1]);
+    STRCMP_EQUAL("inc;..", m_commandLine.pPutDirectories);
+    STRCMP_EQUAL("pop1.crackle", m_commandLine.images[0].pScriptFilename);
+    STRCMP_EQUAL("pop1.nib", m_commandLine.images[0].pOutputImageFilename);
+}
+
+TEST(CrackleCommandLine, MissingSnapSourceFilename)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    addArg("--snap");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, MissingPutDirectories)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    addArg("--putdirs");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, TooManySnapSources)
+{
+    const char* argv[2 * CRACKLE_COMMAND_LINE_MAX_SNAP_SOURCES + 2];
+    
+    for (int i = 0 ; i < CRACKLE_COMMAND_LINE_MAX_SNAP_SOURCES + 1 ; i++)
+    {
+        argv[2 * i] = "--snap";
+        argv[2 * i + 1] = "source.S";
+    }
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(ARRAYSIZE(argv), argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, ValidThreadCount)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--threads");
+    addArg("4");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    LONGS_EQUAL(4, m_commandLine.threadCount);
+}
+
+TEST(CrackleCommandLine, PlanFlag)
+{
+    addArg("--plan");
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    CHECK_TRUE(m_commandLine.usePlans);
+    STRCMP_EQUAL("pop1.crackle", m_commandLine.images[0].pScriptFilename);
+    STRCMP_EQUAL("pop1.nib", m_commandLine.images[0].pOutputImageFilename);
+}
+
+TEST(CrackleCommandLine, EquatesFlag)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    addArg("--equates");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    CHECK_TRUE(m_commandLine.writeEquates);
+    CHECK_FALSE(m_commandLine.usePlans);
+    STRCMP_EQUAL("pop1.nib", m_commandLine.images[0].pOutputImageFilename);
+}
+
+TEST(CrackleCommandLine, MissingThreadCount)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    addArg("--threads");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidZeroThreadCount)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--threads");
+    addArg("0");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidNonNumericThreadCount)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--threads");
+    addArg("4x");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, ValidUpdateImage)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--update");
+    addArg("pop1.nib");
+    addArg("pop1.crackle");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    STRCMP_EQUAL("pop1.crackle", m_commandLine.images[0].pScriptFilename);
+    STRCMP_EQUAL("pop1.nib", m_commandLine.images[0].pOutputImageFilename);
+    LONGS_EQUAL(1, m_commandLine.images[0].updateImage);
+}
+
+TEST(CrackleCommandLine, MissingUpdateImageFilename)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("pop1.crackle");
+    addArg("--update");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidUpdateImageWithOutputImageFilename)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--update");
+    addArg("pop1.nib");
+    addArg("pop1.crackle");
+    addArg("pop2.nib");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, FormatAfterFilenamesShouldApplyToFirstImage)
+{
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    addArg("--format");
+    addArg("nib_5.25");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(1, m_commandLine.imageCount);
+    LONGS_EQUAL(FORMAT_NIB_5_25, m_commandLine.images[0].imageFormat);
+}
+
+TEST(CrackleCommandLine, ThreeImages)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("side1.crackle");
+    addArg("side1.nib");
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--update");
+    addArg("side2.nib");
+    addArg("side2.crackle");
+    addArg("--format");
+    addArg("hdv_3.5");
+    addArg("hd.crackle");
+    addArg("hd.hdv");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    LONGS_EQUAL(3, m_commandLine.imageCount);
+    STRCMP_EQUAL("side1.crackle", m_commandLine.images[0].pScriptFilename);
+    STRCMP_EQUAL("side1.nib", m_commandLine.images[0].pOutputImageFilename);
+    LONGS_EQUAL(FORMAT_NIB_5_25, m_commandLine.images[0].imageFormat);
+    LONGS_EQUAL(0, m_commandLine.images[0].updateImage);
+    STRCMP_EQUAL("side2.crackle", m_commandLine.images[1].pScriptFilename);
+    STRCMP_EQUAL("side2.nib", m_commandLine.images[1].pOutputImageFilename);
+    LONGS_EQUAL(FORMAT_NIB_5_25, m_commandLine.images[1].imageFormat);
+    LONGS_EQUAL(1, m_commandLine.images[1].updateImage);
+    STRCMP_EQUAL("hd.crackle", m_commandLine.images[2].pScriptFilename);
+    STRCMP_EQUAL("hd.hdv", m_commandLine.images[2].pOutputImageFilename);
+    LONGS_EQUAL(FORMAT_HDV_3_5, m_commandLine.images[2].imageFormat);
+}
+
+TEST(CrackleCommandLine, InvalidIncompleteSecondImage)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("side1.crackle");
+    addArg("side1.nib");
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("side2.crackle");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, TooManyImages)
+{
+    static const char* args[] = { "--format", "nib_5.25", "a.crackle", "a.nib" };
+    const char*        argv[4 * (CRACKLE_COMMAND_LINE_MAX_IMAGES + 1)];
+    
+    for (size_t i = 0 ; i < ARRAYSIZE(argv) ; i++)
+        argv[i] = args[i % ARRAYSIZE(args)];
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(ARRAYSIZE(argv) - 4, argv) );
+    LONGS_EQUAL(noException, getExceptionCode());
+    LONGS_EQUAL(CRACKLE_COMMAND_LINE_MAX_IMAGES, m_commandLine.imageCount);
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(ARRAYSIZE(argv), argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, ValidVerifyImageWithoutScript)
+{
+    addArg("--verify");
+    addArg("pop1.nib");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    STRCMP_EQUAL("pop1.nib", m_commandLine.pVerifyImageFilename);
+    POINTERS_EQUAL(NULL, m_commandLine.images[0].pScriptFilename);
+    LONGS_EQUAL(FORMAT_NIB_5_25, m_commandLine.images[0].imageFormat);
+}
+
+TEST(CrackleCommandLine, ValidVerifyImageWithScript)
+{
+    addArg("--threads");
+    addArg("4");
+    addArg("--verify");
+    addArg("pop1.nib");
+    addArg("pop1.crackle");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    STRCMP_EQUAL("pop1.nib", m_commandLine.pVerifyImageFilename);
+    STRCMP_EQUAL("pop1.crackle", m_commandLine.images[0].pScriptFilename);
+    LONGS_EQUAL(4, m_commandLine.threadCount);
+}
+
+TEST(CrackleCommandLine, MissingVerifyImageFilename)
+{
+    addArg("--verify");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidVerifyImageWithOutputImageFilename)
+{
+    addArg("--verify");
+    addArg("pop1.nib");
+    addArg("pop1.crackle");
+    addArg("pop2.nib");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidVerifyOfBlockImage)
+{
+    addArg("--format");
+    addArg("hdv_3.5");
+    addArg("--verify");
+    addArg("pop1.hdv");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, ValidDiffImagesWithScript)
+{
+    addArg("--diff");
+    addArg("golden.nib");
+    addArg("pop1.nib");
+    addArg("pop1.crackle");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    STRCMP_EQUAL("golden.nib", m_commandLine.pDiffImageFilenames[0]);
+    STRCMP_EQUAL("pop1.nib", m_commandLine.pDiffImageFilenames[1]);
+    STRCMP_EQUAL("pop1.crackle", m_commandLine.images[0].pScriptFilename);
+    POINTERS_EQUAL(NULL, m_commandLine.pVerifyImageFilename);
+    LONGS_EQUAL(FORMAT_NIB_5_25, m_commandLine.images[0].imageFormat);
+}
+
+TEST(CrackleCommandLine, MissingSecondDiffImageFilename)
+{
+    addArg("--diff");
+    addArg("golden.nib");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidDiffAndVerifyTogether)
+{
+    addArg("--diff");
+    addArg("golden.nib");
+    addArg("pop1.nib");
+    addArg("--verify");
+    addArg("pop1.nib");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
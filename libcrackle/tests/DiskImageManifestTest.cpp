@@ -0,0 +1,191 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "../src/DiskImageManifest.h"
+    #include "MallocFailureInject.h"
+    #include "FileFailureInject.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+static const char* g_manifestFilename = "DiskImageManifestTest.manifest";
+
+
+TEST_GROUP(DiskImageManifest)
+{
+    DiskImageManifest m_old;
+    DiskImageManifest m_new;
+    DiskImageManifest m_read;
+    unsigned char     m_dirty[8];
+    unsigned char     m_data[16];
+
+    void setup()
+    {
+        clearExceptionCode();
+        memset(&m_old, 0, sizeof(m_old));
+        memset(&m_new, 0, sizeof(m_new));
+        memset(&m_read, 0, sizeof(m_read));
+        memset(m_data, 0, sizeof(m_data));
+        m_old.imageSize = m_new.imageSize = sizeof(m_dirty) * 16;
+        m_old.regionSize = m_new.regionSize = 16;
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        MallocFailureInject_Restore();
+        DiskImageManifest_Free(&m_old);
+        DiskImageManifest_Free(&m_new);
+        DiskImageManifest_Free(&m_read);
+        remove(g_manifestFilename);
+    }
+
+    void addEntry(DiskImageManifest* pManifest, unsigned char fill, unsigned int firstRegion, unsigned int lastRegion)
+    {
+        DiskImageInsert insert;
+
+        memset(&insert, 0, sizeof(insert));
+        insert.type = DISK_IMAGE_INSERTION_BLOCK;
+        insert.length = sizeof(m_data);
+        insert.block = firstRegion;
+        memset(m_data, fill, sizeof(m_data));
+        DiskImageManifest_AddEntry(pManifest, &insert, m_data, pManifest->entryCount + 1, firstRegion, lastRegion);
+    }
+
+    void validateDirtyRegions(const char* pExpected)
+    {
+        for (size_t i = 0 ; i < sizeof(m_dirty) ; i++)
+            LONGS_EQUAL(pExpected[i] == '1', m_dirty[i]);
+    }
+};
+
+
+TEST(DiskImageManifest, SelectEverythingWithoutOldManifest)
+{
+    addEntry(&m_new, 0x11, 0, 0);
+    addEntry(&m_new, 0x22, 5, 6);
+
+    LONGS_EQUAL(8, DiskImageManifest_SelectEntries(NULL, &m_new, m_dirty, sizeof(m_dirty)));
+    validateDirtyRegions("11111111");
+    CHECK_TRUE(m_new.pEntries[0].isSelected);
+    CHECK_TRUE(m_new.pEntries[1].isSelected);
+}
+
+TEST(DiskImageManifest, SelectNothingWhenManifestsMatch)
+{
+    addEntry(&m_old, 0x11, 0, 0);
+    addEntry(&m_old, 0x22, 5, 6);
+    addEntry(&m_new, 0x11, 0, 0);
+    addEntry(&m_new, 0x22, 5, 6);
+
+    LONGS_EQUAL(0, DiskImageManifest_SelectEntries(&m_old, &m_new, m_dirty, sizeof(m_dirty)));
+    validateDirtyRegions("00000000");
+    CHECK_FALSE(m_new.pEntries[0].isSelected);
+    CHECK_FALSE(m_new.pEntries[1].isSelected);
+}
+
+TEST(DiskImageManifest, SelectEverythingWhenImageGeometryDiffers)
+{
+    addEntry(&m_old, 0x11, 0, 0);
+    addEntry(&m_new, 0x11, 0, 0);
+    m_old.regionSize = 32;
+
+    LONGS_EQUAL(8, DiskImageManifest_SelectEntries(&m_old, &m_new, m_dirty, sizeof(m_dirty)));
+    CHECK_TRUE(m_new.pEntries[0].isSelected);
+}
+
+TEST(DiskImageManifest, ChangedEntryShouldPullInOverlappingEntriesUntilClosed)
+{
+    addEntry(&m_old, 0x11, 0, 1);
+    addEntry(&m_old, 0x22, 1, 2);
+    addEntry(&m_old, 0x33, 2, 3);
+    addEntry(&m_old, 0x44, 6, 6);
+    addEntry(&m_new, 0x11, 0, 1);
+    addEntry(&m_new, 0x22, 1, 2);
+    addEntry(&m_new, 0x55, 3, 3);
+    addEntry(&m_new, 0x44, 6, 6);
+
+    LONGS_EQUAL(4, DiskImageManifest_SelectEntries(&m_old, &m_new, m_dirty, sizeof(m_dirty)));
+    validateDirtyRegions("11110000");
+    CHECK_TRUE(m_new.pEntries[0].isSelected);
+    CHECK_TRUE(m_new.pEntries[1].isSelected);
+    CHECK_TRUE(m_new.pEntries[2].isSelected);
+    CHECK_FALSE(m_new.pEntries[3].isSelected);
+}
+
+TEST(DiskImageManifest, RemovedEntryShouldDirtyItsOldRegions)
+{
+    addEntry(&m_old, 0x11, 0, 0);
+    addEntry(&m_old, 0x22, 4, 4);
+    addEntry(&m_new, 0x11, 0, 0);
+
+    LONGS_EQUAL(1, DiskImageManifest_SelectEntries(&m_old, &m_new, m_dirty, sizeof(m_dirty)));
+    validateDirtyRegions("00001000");
+    CHECK_FALSE(m_new.pEntries[0].isSelected);
+}
+
+TEST(DiskImageManifest, WriteAndReadBack)
+{
+    addEntry(&m_new, 0x11, 0, 0);
+    addEntry(&m_new, 0x22, 5, 6);
+    m_new.imageHash = DiskImageManifest_Hash(m_data, sizeof(m_data));
+    DiskImageManifest_Write(&m_new, NULL, g_manifestFilename);
+
+    CHECK_TRUE(DiskImageManifest_Read(&m_read, NULL, g_manifestFilename));
+    LONGS_EQUAL(m_new.imageSize, m_read.imageSize);
+    LONGS_EQUAL(m_new.regionSize, m_read.regionSize);
+    CHECK(m_new.imageHash == m_read.imageHash);
+    LONGS_EQUAL(2, m_read.entryCount);
+    CHECK(m_new.pEntries[1].hash == m_read.pEntries[1].hash);
+    LONGS_EQUAL(5, m_read.pEntries[1].firstRegion);
+    LONGS_EQUAL(6, m_read.pEntries[1].lastRegion);
+    LONGS_EQUAL(0, DiskImageManifest_SelectEntries(&m_read, &m_new, m_dirty, sizeof(m_dirty)));
+}
+
+TEST(DiskImageManifest, ReadMissingManifest)
+{
+    CHECK_FALSE(DiskImageManifest_Read(&m_read, NULL, g_manifestFilename));
+}
+
+TEST(DiskImageManifest, ReadCorruptManifest)
+{
+    FILE* pFile = fopen(g_manifestFilename, "wb");
+    fputs("crackle-manifest 1 128 16 0123\nnot-a-hash 1 2\n", pFile);
+    fclose(pFile);
+
+    CHECK_FALSE(DiskImageManifest_Read(&m_read, NULL, g_manifestFilename));
+    LONGS_EQUAL(0, m_read.entryCount);
+}
+
+TEST(DiskImageManifest, FailToOpenManifestForWrite)
+{
+    fopenFail(NULL);
+        __try_and_catch( DiskImageManifest_Write(&m_new, NULL, g_manifestFilename) );
+    fopenRestore();
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    clearExceptionCode();
+}
+
+TEST(DiskImageManifest, FailAllocationInAddEntry)
+{
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( addEntry(&m_new, 0x11, 0, 0) );
+    LONGS_EQUAL(outOfMemoryException, getExceptionCode());
+    clearExceptionCode();
+    LONGS_EQUAL(0, m_new.entryCount);
+}
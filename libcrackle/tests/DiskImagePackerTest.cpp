@@ -0,0 +1,199 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "../src/DiskImagePacker.h"
+    #include "MallocFailureInject.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+
+TEST_GROUP(DiskImagePacker)
+{
+    DiskImagePacker m_packer;
+    DiskImageInsert m_insert;
+
+    void setup()
+    {
+        clearExceptionCode();
+        memset(&m_packer, 0, sizeof(m_packer));
+        memset(&m_insert, 0, sizeof(m_insert));
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        MallocFailureInject_Restore();
+        DiskImagePacker_Free(&m_packer);
+    }
+
+    void reserve(unsigned int side, unsigned int track, unsigned int offset, unsigned int length)
+    {
+        m_insert.type = DISK_IMAGE_INSERTION_RW18;
+        m_insert.side = side;
+        m_insert.track = track;
+        m_insert.intraTrackOffset = offset;
+        m_insert.length = length;
+        DiskImagePacker_Reserve(&m_packer, &m_insert);
+    }
+
+    void pack(unsigned int side, unsigned int length)
+    {
+        m_insert.type = DISK_IMAGE_INSERTION_RW18;
+        m_insert.side = side;
+        m_insert.track = ~0U;
+        m_insert.intraTrackOffset = ~0U;
+        m_insert.length = length;
+        DiskImagePacker_Pack(&m_packer, &m_insert);
+    }
+
+    void validatePlacement(unsigned int track, unsigned int offset)
+    {
+        LONGS_EQUAL(track, m_insert.track);
+        LONGS_EQUAL(offset, m_insert.intraTrackOffset);
+    }
+
+    void validateExceptionThrown(int expectedExceptionCode)
+    {
+        LONGS_EQUAL(expectedExceptionCode, getExceptionCode());
+        clearExceptionCode();
+    }
+};
+
+
+TEST(DiskImagePacker, PackFirstObjectAtStartOfSide)
+{
+    pack(DISK_IMAGE_RW18_SIDE_0, 100);
+    validatePlacement(0, 0);
+}
+
+TEST(DiskImagePacker, PackObjectsOfGroupBackToBackAcrossTrackBoundary)
+{
+    pack(DISK_IMAGE_RW18_SIDE_0, 4000);
+    validatePlacement(0, 0);
+    pack(DISK_IMAGE_RW18_SIDE_0, 1000);
+    validatePlacement(0, 4000);
+    pack(DISK_IMAGE_RW18_SIDE_0, 10);
+    validatePlacement(1, 392);
+}
+
+TEST(DiskImagePacker, PackAfterEndGroupShouldUseTightestFitWithinOneTrack)
+{
+    reserve(DISK_IMAGE_RW18_SIDE_0, 0, 1000, DISK_IMAGE_RW18_BYTES_PER_TRACK - 1000);
+    reserve(DISK_IMAGE_RW18_SIDE_0, 1, 600, DISK_IMAGE_RW18_BYTES_PER_TRACK - 600);
+    pack(DISK_IMAGE_RW18_SIDE_0, 500);
+    validatePlacement(1, 0);
+    
+    DiskImagePacker_EndGroup(&m_packer);
+    pack(DISK_IMAGE_RW18_SIDE_0, 900);
+    validatePlacement(0, 0);
+}
+
+TEST(DiskImagePacker, PackGroupShouldSkipToFreeSpaceWhenNextObjectDoesNotFitAfterLast)
+{
+    reserve(DISK_IMAGE_RW18_SIDE_0, 0, 200, 100);
+    pack(DISK_IMAGE_RW18_SIDE_0, 200);
+    validatePlacement(0, 0);
+    pack(DISK_IMAGE_RW18_SIDE_0, 200);
+    validatePlacement(0, 300);
+}
+
+TEST(DiskImagePacker, PackObjectLargerThanTrackShouldStartOnTrackBoundary)
+{
+    reserve(DISK_IMAGE_RW18_SIDE_0, 0, 0, 10);
+    pack(DISK_IMAGE_RW18_SIDE_0, DISK_IMAGE_RW18_BYTES_PER_TRACK + 1);
+    validatePlacement(1, 0);
+}
+
+TEST(DiskImagePacker, PackShouldFallBackToSpaceWhichSpansTracks)
+{
+    reserve(DISK_IMAGE_RW18_SIDE_0, 0, 0, 4000);
+    reserve(DISK_IMAGE_RW18_SIDE_0, 1, 392, DISK_IMAGE_PACKER_SIDE_SIZE - DISK_IMAGE_RW18_BYTES_PER_TRACK - 392);
+    pack(DISK_IMAGE_RW18_SIDE_0, 1000);
+    validatePlacement(0, 4000);
+}
+
+TEST(DiskImagePacker, PackOnSide1ShouldIgnoreSpaceUsedOnSide0)
+{
+    reserve(DISK_IMAGE_RW18_SIDE_0, 0, 0, DISK_IMAGE_PACKER_SIDE_SIZE);
+    pack(DISK_IMAGE_RW18_SIDE_1, 100);
+    validatePlacement(0, 0);
+    pack(DISK_IMAGE_RW18_SIDE_2, 100);
+    validatePlacement(0, 0);
+}
+
+TEST(DiskImagePacker, ReserveRWTS16TrackShouldReserveThatTrackOnAllSides)
+{
+    m_insert.type = DISK_IMAGE_INSERTION_RWTS16;
+    m_insert.track = 0;
+    m_insert.sector = 3;
+    m_insert.length = 256;
+    DiskImagePacker_Reserve(&m_packer, &m_insert);
+    
+    pack(DISK_IMAGE_RW18_SIDE_1, 100);
+    validatePlacement(1, 0);
+}
+
+TEST(DiskImagePacker, ReserveBlockInsertShouldBeIgnored)
+{
+    m_insert.type = DISK_IMAGE_INSERTION_BLOCK;
+    m_insert.block = 0;
+    m_insert.length = 512;
+    DiskImagePacker_Reserve(&m_packer, &m_insert);
+    
+    pack(DISK_IMAGE_RW18_SIDE_0, 100);
+    validatePlacement(0, 0);
+}
+
+TEST(DiskImagePacker, ReserveOverlappingPackedObjectShouldThrow)
+{
+    pack(DISK_IMAGE_RW18_SIDE_0, 100);
+    __try_and_catch( reserve(DISK_IMAGE_RW18_SIDE_0, 0, 99, 10) );
+    validateExceptionThrown(overlappingInsertException);
+}
+
+TEST(DiskImagePacker, ReserveOverlappingOtherReservedRangeShouldBeAllowed)
+{
+    reserve(DISK_IMAGE_RW18_SIDE_0, 0, 0, 100);
+    reserve(DISK_IMAGE_RW18_SIDE_0, 0, 50, 100);
+    pack(DISK_IMAGE_RW18_SIDE_0, 10);
+    validatePlacement(0, 150);
+}
+
+TEST(DiskImagePacker, PackWithNoRoomLeftOnSideShouldThrow)
+{
+    reserve(DISK_IMAGE_RW18_SIDE_0, 0, 0, DISK_IMAGE_PACKER_SIDE_SIZE - 10);
+    __try_and_catch( pack(DISK_IMAGE_RW18_SIDE_0, 11) );
+    validateExceptionThrown(diskFullException);
+    pack(DISK_IMAGE_RW18_SIDE_0, 10);
+    validatePlacement(DISK_IMAGE_TRACKS_PER_SIDE - 1, DISK_IMAGE_RW18_BYTES_PER_TRACK - 10);
+}
+
+TEST(DiskImagePacker, PackToInvalidSideShouldThrow)
+{
+    __try_and_catch( pack(0x42, 100) );
+    validateExceptionThrown(invalidSideException);
+}
+
+TEST(DiskImagePacker, FailAllocationInPack)
+{
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( pack(DISK_IMAGE_RW18_SIDE_0, 100) );
+    validateExceptionThrown(outOfMemoryException);
+}
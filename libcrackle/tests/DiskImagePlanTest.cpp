@@ -0,0 +1,227 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include <unistd.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "../src/DiskImagePlan.h"
+    #include "MallocFailureInject.h"
+    #include "FileFailureInject.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+static const char* g_planFilename = "DiskImagePlanTest.plan";
+static const char* g_objectFilename = "DiskImagePlanTest.sav";
+
+
+TEST_GROUP(DiskImagePlan)
+{
+    DiskImagePlan m_plan;
+    DiskImagePlan m_read;
+
+    void setup()
+    {
+        clearExceptionCode();
+        memset(&m_plan, 0, sizeof(m_plan));
+        memset(&m_read, 0, sizeof(m_read));
+        m_plan.imageSize = 128;
+        m_plan.regionSize = 16;
+        m_plan.scriptStamp.modificationTime = 0x123456789LL;
+        m_plan.scriptStamp.modificationNsec = 42;
+        m_plan.scriptStamp.size = 100;
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        MallocFailureInject_Restore();
+        DiskImagePlan_Free(&m_plan);
+        DiskImagePlan_Free(&m_read);
+        remove(g_planFilename);
+        remove(g_objectFilename);
+    }
+
+    void addEntry(const char* pObjectFilename, const VfsFileStamp* pStamp, unsigned int block, int isResolvedFromObject)
+    {
+        DiskImagePlanEntry entry;
+
+        memset(&entry, 0, sizeof(entry));
+        entry.insert.type = DISK_IMAGE_INSERTION_BLOCK;
+        entry.insert.length = 512;
+        entry.insert.block = block;
+        entry.insert.intraBlockOffset = 3;
+        entry.lineNumber = m_plan.entryCount + 1;
+        entry.imageTableAddress = DISK_IMAGE_PLAN_NO_IMAGE_TABLE;
+        entry.firstRegion = block;
+        entry.lastRegion = block;
+        entry.isResolvedFromObject = isResolvedFromObject;
+        DiskImagePlan_AddEntry(&m_plan, &entry, pObjectFilename, pStamp);
+    }
+
+    VfsFileStamp createObjectFile(const char* pContents)
+    {
+        VfsFileStamp stamp;
+        FILE*        pFile = fopen(g_objectFilename, "wb");
+
+        fputs(pContents, pFile);
+        fclose(pFile);
+        CHECK_TRUE(Vfs_GetFileStamp(NULL, g_objectFilename, &stamp));
+        return stamp;
+    }
+};
+
+
+TEST(DiskImagePlan, AddEntriesShouldShareObjectsWithTheSameName)
+{
+    VfsFileStamp stamp = m_plan.scriptStamp;
+
+    addEntry("a.sav", &stamp, 0, FALSE);
+    addEntry("b.sav", NULL, 1, FALSE);
+    addEntry("a.sav", &stamp, 2, TRUE);
+
+    LONGS_EQUAL(3, m_plan.entryCount);
+    LONGS_EQUAL(2, m_plan.objectCount);
+    STRCMP_EQUAL("a.sav", m_plan.pObjects[0].pFilename);
+    CHECK_TRUE(m_plan.pObjects[0].hasStamp);
+    STRCMP_EQUAL("b.sav", m_plan.pObjects[1].pFilename);
+    CHECK_FALSE(m_plan.pObjects[1].hasStamp);
+    LONGS_EQUAL(0, m_plan.pEntries[0].objectIndex);
+    LONGS_EQUAL(1, m_plan.pEntries[1].objectIndex);
+    LONGS_EQUAL(0, m_plan.pEntries[2].objectIndex);
+}
+
+TEST(DiskImagePlan, WriteAndReadBack)
+{
+    VfsFileStamp stamp = m_plan.scriptStamp;
+
+    addEntry("a.sav", &stamp, 0, FALSE);
+    addEntry("b.sav", NULL, 5, TRUE);
+    DiskImagePlan_Write(&m_plan, NULL, g_planFilename);
+
+    CHECK_TRUE(DiskImagePlan_Read(&m_read, NULL, g_planFilename));
+    LONGS_EQUAL(m_plan.imageSize, m_read.imageSize);
+    LONGS_EQUAL(m_plan.regionSize, m_read.regionSize);
+    CHECK(m_plan.scriptStamp.modificationTime == m_read.scriptStamp.modificationTime);
+    LONGS_EQUAL(m_plan.scriptStamp.modificationNsec, m_read.scriptStamp.modificationNsec);
+    LONGS_EQUAL(m_plan.scriptStamp.size, m_read.scriptStamp.size);
+    LONGS_EQUAL(2, m_read.objectCount);
+    STRCMP_EQUAL("b.sav", m_read.pObjects[1].pFilename);
+    CHECK_FALSE(m_read.pObjects[1].hasStamp);
+    LONGS_EQUAL(2, m_read.entryCount);
+    LONGS_EQUAL(0, memcmp(&m_plan.pEntries[1].insert, &m_read.pEntries[1].insert, sizeof(DiskImageInsert)));
+    LONGS_EQUAL(2, m_read.pEntries[1].lineNumber);
+    LONGS_EQUAL(1, m_read.pEntries[1].objectIndex);
+    LONGS_EQUAL(DISK_IMAGE_PLAN_NO_IMAGE_TABLE, m_read.pEntries[1].imageTableAddress);
+    LONGS_EQUAL(5, m_read.pEntries[1].firstRegion);
+    LONGS_EQUAL(5, m_read.pEntries[1].lastRegion);
+    CHECK_TRUE(m_read.pEntries[1].isResolvedFromObject);
+}
+
+TEST(DiskImagePlan, ReadMissingPlan)
+{
+    CHECK_FALSE(DiskImagePlan_Read(&m_read, NULL, g_planFilename));
+}
+
+TEST(DiskImagePlan, ReadTruncatedPlan)
+{
+    addEntry("a.sav", NULL, 0, FALSE);
+    addEntry("b.sav", NULL, 1, FALSE);
+    DiskImagePlan_Write(&m_plan, NULL, g_planFilename);
+    truncate(g_planFilename, 80);
+
+    CHECK_FALSE(DiskImagePlan_Read(&m_read, NULL, g_planFilename));
+    LONGS_EQUAL(0, m_read.entryCount);
+    LONGS_EQUAL(0, m_read.objectCount);
+}
+
+TEST(DiskImagePlan, ReadCorruptPlan)
+{
+    FILE* pFile = fopen(g_planFilename, "wb");
+    fputs("crackle-manifest 1 128 16 0123\n", pFile);
+    fclose(pFile);
+
+    CHECK_FALSE(DiskImagePlan_Read(&m_read, NULL, g_planFilename));
+}
+
+TEST(DiskImagePlan, MarkStaleEntriesWhoseObjectChangedOrCantBeStamped)
+{
+    VfsFileStamp stamp = createObjectFile("1234");
+    VfsFileStamp oldStamp = stamp;
+
+    oldStamp.size--;
+    addEntry(g_objectFilename, &stamp, 0, FALSE);
+    addEntry("DiskImagePlanTest.missing", &stamp, 1, FALSE);
+    addEntry("DiskImagePlanTest.inMemory", NULL, 2, FALSE);
+    LONGS_EQUAL(2, DiskImagePlan_MarkStaleEntries(&m_plan, NULL));
+    CHECK_FALSE(m_plan.pEntries[0].isStale);
+    CHECK_TRUE(m_plan.pEntries[1].isStale);
+    CHECK_TRUE(m_plan.pEntries[2].isStale);
+
+    createObjectFile("12345");
+    LONGS_EQUAL(3, DiskImagePlan_MarkStaleEntries(&m_plan, NULL));
+    CHECK_TRUE(m_plan.pEntries[0].isStale);
+}
+
+TEST(DiskImagePlan, FailToOpenPlanForWrite)
+{
+    fopenFail(NULL);
+        __try_and_catch( DiskImagePlan_Write(&m_plan, NULL, g_planFilename) );
+    fopenRestore();
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    clearExceptionCode();
+}
+
+TEST(DiskImagePlan, FailWriteOfPlan)
+{
+    addEntry("a.sav", NULL, 0, FALSE);
+    fwriteFail(0);
+        __try_and_catch( DiskImagePlan_Write(&m_plan, NULL, g_planFilename) );
+    fwriteRestore();
+    LONGS_EQUAL(fileException, getExceptionCode());
+    clearExceptionCode();
+}
+
+TEST(DiskImagePlan, FailAllocationOfObjectNameInAddEntry)
+{
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( addEntry("a.sav", NULL, 0, FALSE) );
+    LONGS_EQUAL(outOfMemoryException, getExceptionCode());
+    clearExceptionCode();
+    LONGS_EQUAL(0, m_plan.objectCount);
+    LONGS_EQUAL(0, m_plan.entryCount);
+}
+
+TEST(DiskImagePlan, FailAllocationOfObjectListInAddEntry)
+{
+    MallocFailureInject_FailAllocation(2);
+    __try_and_catch( addEntry("a.sav", NULL, 0, FALSE) );
+    LONGS_EQUAL(outOfMemoryException, getExceptionCode());
+    clearExceptionCode();
+    LONGS_EQUAL(0, m_plan.objectCount);
+    LONGS_EQUAL(0, m_plan.entryCount);
+}
+
+TEST(DiskImagePlan, FailAllocationOfEntryListInAddEntry)
+{
+    MallocFailureInject_FailAllocation(3);
+    __try_and_catch( addEntry("a.sav", NULL, 0, FALSE) );
+    LONGS_EQUAL(outOfMemoryException, getExceptionCode());
+    clearExceptionCode();
+    LONGS_EQUAL(1, m_plan.objectCount);
+    LONGS_EQUAL(0, m_plan.entryCount);
+}
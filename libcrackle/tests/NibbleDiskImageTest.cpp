@@ -16,6 +16,7 @@
 extern "C"
 {
     #include "NibbleDiskImage.h"
+    #include "MemoryVfs.h"
     #include "BinaryBuffer.h"
     #include "MallocFailureInject.h"
     #include "FileFailureInject.h"
@@ -30,6 +31,7 @@ static const char* g_imageFilename = "NibbleDiskImageTest.nib";
 static const char* g_savFilenameAllZeroes = "NibbleDiskImageTestAllZeroes.sav";
 static const char* g_savFilenameAllOnes = "NibbleDiskImageAllOnes.sav";
 static const char* g_scriptFilename = "NibbleDiskImageTest.script";
+static const char* g_manifestFilename = "NibbleDiskImageTest.nib" DISK_IMAGE_MANIFEST_SUFFIX;
 
 
 TEST_GROUP(NibbleDiskImage)
@@ -64,6 +66,7 @@ TEST_GROUP(NibbleDiskImage)
         remove(g_savFilenameAllZeroes);
         remove(g_savFilenameAllOnes);
         remove(g_scriptFilename);
+        remove(g_manifestFilename);
     }
     
     char* copy(const char* pStringToCopy)
@@ -349,7 +352,7 @@ TEST_GROUP(NibbleDiskImage)
 
 TEST(NibbleDiskImage, FailAllAllocationsInCreate)
 {
-    static const int allocationsToFail = 3;
+    static const int allocationsToFail = 4;
     for (int i = 1 ; i <= allocationsToFail ; i++)
     {
         MallocFailureInject_FailAllocation(i);
@@ -576,6 +579,120 @@ TEST(NibbleDiskImage, InsertRW18SectorsAcrossTracks0and1)
     validateRWTS16SectorsAreClear(pImage, 2, 0, 34, 15);
 }
 
+TEST(NibbleDiskImage, ManySmallRW18InsertsOnSameTrackMatchOneLargeInsert)
+{
+    NibbleDiskImage* pExpectedImage = NULL;
+    
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    writeOnesRW18Sectors(3, 0x0000, DISK_IMAGE_RW18_PAGES_PER_TRACK + 1);
+    pExpectedImage = m_pNibbleDiskImage;
+    
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    for (unsigned int page = 0 ; page < DISK_IMAGE_RW18_PAGES_PER_TRACK ; page++)
+        writeOnesRW18Sectors(3, page * DISK_IMAGE_PAGE_SIZE, 1);
+    writeOnesRW18Sectors(4, 0x0000, 1);
+    
+    CHECK(0 == memcmp(NibbleDiskImage_GetImagePointer(pExpectedImage), 
+                      NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage),
+                      NIBBLE_DISK_IMAGE_SIZE));
+    DiskImage_Free((DiskImage*)pExpectedImage);
+}
+
+TEST(NibbleDiskImage, ParallelTrackEncodingMatchesSerialEncoding)
+{
+    NibbleDiskImage* pExpectedImage = NULL;
+    
+    for (int i = 0 ; i < 2 ; i++)
+    {
+        m_pNibbleDiskImage = NibbleDiskImage_Create();
+        NibbleDiskImage_SetEncodeThreadCount(m_pNibbleDiskImage, i == 0 ? 1 : 4);
+        for (unsigned int track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track += 2)
+            writeOnesRW18Sectors(track, 0x0000, DISK_IMAGE_RW18_PAGES_PER_TRACK);
+        writeZeroRWTS16Sectors(1, 0, 4 * NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK);
+        if (i == 0)
+            pExpectedImage = m_pNibbleDiskImage;
+    }
+    
+    CHECK(0 == memcmp(NibbleDiskImage_GetImagePointer(pExpectedImage), 
+                      NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage),
+                      NIBBLE_DISK_IMAGE_SIZE));
+    DiskImage_Free((DiskImage*)pExpectedImage);
+}
+
+TEST(NibbleDiskImage, RW18InsertForAnotherSideDropsPendingDataOnThatTrack)
+{
+    unsigned char   trackBuffer[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+    unsigned char   pageData[DISK_IMAGE_PAGE_SIZE];
+    DiskImageInsert insert;
+    
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    writeOnesRW18Sectors(0, 0x0000, 1);
+    memset(pageData, 0xff, sizeof(pageData));
+    insert.type = DISK_IMAGE_INSERTION_RW18;
+    insert.sourceOffset = 0;
+    insert.length = sizeof(pageData);
+    insert.side = 0xad;
+    insert.track = 0;
+    insert.intraTrackOffset = 0x0100;
+    NibbleDiskImage_InsertData(m_pNibbleDiskImage, pageData, &insert);
+
+    NibbleDiskImage_ReadRW18Track(m_pNibbleDiskImage, 0xad, 0, trackBuffer, sizeof(trackBuffer));
+    validateAllZeroes(trackBuffer, DISK_IMAGE_PAGE_SIZE);
+    validateAllOnes(trackBuffer + DISK_IMAGE_PAGE_SIZE, DISK_IMAGE_PAGE_SIZE);
+    validateAllZeroes(trackBuffer + 2 * DISK_IMAGE_PAGE_SIZE, 16 * DISK_IMAGE_PAGE_SIZE);
+    __try_and_catch( NibbleDiskImage_ReadRW18Track(m_pNibbleDiskImage, 0xa9, 0, trackBuffer, sizeof(trackBuffer)) );
+    validateExceptionThrown(badTrackException);
+}
+
+TEST(NibbleDiskImage, RWTS16InsertOverwritesPendingRW18Track)
+{
+    unsigned char trackBuffer[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    writeOnesRW18Sectors(0, 0x0000, DISK_IMAGE_RW18_PAGES_PER_TRACK);
+    writeZeroRWTS16Sectors(0, 1, 1);
+    
+    const unsigned char* pImage = NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage);
+    validateRWTS16SectorContainsZeroData(pImage, 0, 1);
+    __try_and_catch( NibbleDiskImage_ReadRW18Track(m_pNibbleDiskImage, 0xa9, 0, trackBuffer, sizeof(trackBuffer)) );
+    validateExceptionThrown(badTrackException);
+}
+
+TEST(NibbleDiskImage, LaterRWTS16InsertReplacesPendingSector)
+{
+    unsigned char   sectorData[DISK_IMAGE_BYTES_PER_SECTOR];
+    DiskImageInsert insert;
+    
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    memset(sectorData, 0xff, sizeof(sectorData));
+    insert.type = DISK_IMAGE_INSERTION_RWTS16;
+    insert.sourceOffset = 0;
+    insert.length = sizeof(sectorData);
+    insert.track = 1;
+    insert.sector = 2;
+    NibbleDiskImage_InsertData(m_pNibbleDiskImage, sectorData, &insert);
+    writeZeroRWTS16Sectors(1, 2, 1);
+    
+    const unsigned char* pImage = NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage);
+    validateRWTS16SectorContainsZeroData(pImage, 1, 2);
+    validateRWTS16SectorsAreClear(pImage, 0, 0, 1, 1);
+    validateRWTS16SectorsAreClear(pImage, 1, 3, 34, 15);
+}
+
+TEST(NibbleDiskImage, RW18InsertOverwritesPendingRWTS16Track)
+{
+    unsigned char trackBuffer[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    writeZeroRWTS16Sectors(0, 0, 1);
+    writeOnesRW18Sectors(0, 0x0100, 1);
+    
+    NibbleDiskImage_ReadRW18Track(m_pNibbleDiskImage, 0xa9, 0, trackBuffer, sizeof(trackBuffer));
+    validateAllZeroes(trackBuffer, DISK_IMAGE_PAGE_SIZE);
+    validateAllOnes(trackBuffer + DISK_IMAGE_PAGE_SIZE, DISK_IMAGE_PAGE_SIZE);
+    validateAllZeroes(trackBuffer + 2 * DISK_IMAGE_PAGE_SIZE, 16 * DISK_IMAGE_PAGE_SIZE);
+}
+
 TEST(NibbleDiskImage, FailToInsertTrack35AsRW18)
 {
     m_pNibbleDiskImage = NibbleDiskImage_Create();
@@ -960,6 +1077,77 @@ TEST(NibbleDiskImage, ProcessTwoLineScriptFile)
     validateRWTS16SectorContainsZeroData(pImage, 34, 15);
 }
 
+TEST(NibbleDiskImage, ProcessScriptFileAndWriteImageThroughMemoryVfs)
+{
+    static const char   script[] = "RWTS16,InMemory.sav,0,256,34,15" LINE_ENDING;
+    unsigned char       objectFile[sizeof(SavFileHeader) + 256];
+    SavFileHeader       header;
+    MemoryVfs*          pMemoryVfs = MemoryVfs_Create();
+    size_t              imageSize = 0;
+    
+    memcpy(header.signature, BINARY_BUFFER_SAV_SIGNATURE, sizeof(header.signature));
+    header.address = 0;
+    header.length = 256;
+    memcpy(objectFile, &header, sizeof(header));
+    memset(objectFile + sizeof(header), 0, 256);
+    MemoryVfs_AddFile(pMemoryVfs, "InMemory.sav", objectFile, sizeof(objectFile));
+    MemoryVfs_AddFile(pMemoryVfs, "InMemory.script", script, sizeof(script) - 1);
+    m_pNibbleDiskImage = NibbleDiskImage_CreateWithVfs(MemoryVfs_GetVfs(pMemoryVfs));
+
+    NibbleDiskImage_ProcessScriptFile(m_pNibbleDiskImage, "InMemory.script");
+    NibbleDiskImage_WriteImage(m_pNibbleDiskImage, "InMemory.nib");
+    
+    const unsigned char* pImage = NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage);
+    validateRWTS16SectorContainsZeroData(pImage, 34, 15);
+    const unsigned char* pImageInVfs = MemoryVfs_GetFileData(pMemoryVfs, "InMemory.nib", &imageSize);
+    CHECK(pImageInVfs != NULL);
+    LONGS_EQUAL(NIBBLE_DISK_IMAGE_SIZE, imageSize);
+    CHECK(0 == memcmp(pImage, pImageInVfs, imageSize));
+    m_pFile = fopen("InMemory.nib", "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+    MemoryVfs_Free(pMemoryVfs);
+}
+
+TEST(NibbleDiskImage, UpdateImageThroughMemoryVfsShouldRewriteTrackWhoseObjectChanged)
+{
+    static const char   script[] = "RWTS16,InMemory.sav,0,256,0,0" LINE_ENDING
+                                   "RWTS16,InMemoryOther.sav,0,256,34,15" LINE_ENDING;
+    unsigned char       objectFile[sizeof(SavFileHeader) + 256];
+    SavFileHeader       header;
+    MemoryVfs*          pMemoryVfs = MemoryVfs_Create();
+    size_t              imageSize = 0;
+    
+    memcpy(header.signature, BINARY_BUFFER_SAV_SIGNATURE, sizeof(header.signature));
+    header.address = 0;
+    header.length = 256;
+    memcpy(objectFile, &header, sizeof(header));
+    memset(objectFile + sizeof(header), 0, 256);
+    MemoryVfs_AddFile(pMemoryVfs, "InMemory.sav", objectFile, sizeof(objectFile));
+    MemoryVfs_AddFile(pMemoryVfs, "InMemoryOther.sav", objectFile, sizeof(objectFile));
+    MemoryVfs_AddFile(pMemoryVfs, "InMemory.script", script, sizeof(script) - 1);
+    m_pNibbleDiskImage = NibbleDiskImage_CreateWithVfs(MemoryVfs_GetVfs(pMemoryVfs));
+    DiskImage_UpdateImage((DiskImage*)m_pNibbleDiskImage, "InMemory.script", "InMemory.nib");
+    DiskImage_Free((DiskImage*)m_pNibbleDiskImage);
+    memset(objectFile + sizeof(header), 0xff, 256);
+    MemoryVfs_AddFile(pMemoryVfs, "InMemory.sav", objectFile, sizeof(objectFile));
+
+    m_pNibbleDiskImage = NibbleDiskImage_CreateWithVfs(MemoryVfs_GetVfs(pMemoryVfs));
+    DiskImage_UpdateImage((DiskImage*)m_pNibbleDiskImage, "InMemory.script", "InMemory.nib");
+    DiskImage_Free((DiskImage*)m_pNibbleDiskImage);
+
+    m_pNibbleDiskImage = NibbleDiskImage_CreateWithVfs(MemoryVfs_GetVfs(pMemoryVfs));
+    NibbleDiskImage_ProcessScriptFile(m_pNibbleDiskImage, "InMemory.script");
+    const unsigned char* pExpectedImage = NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage);
+    const unsigned char* pImageInVfs = MemoryVfs_GetFileData(pMemoryVfs, "InMemory.nib", &imageSize);
+    CHECK(pImageInVfs != NULL);
+    LONGS_EQUAL(NIBBLE_DISK_IMAGE_SIZE, imageSize);
+    CHECK(0 == memcmp(pExpectedImage, pImageInVfs, imageSize));
+    STRCMP_EQUAL("", printfSpy_GetLastErrorOutput());
+    m_pFile = fopen("InMemory.nib", "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+    MemoryVfs_Free(pMemoryVfs);
+}
+
 TEST(NibbleDiskImage, FailToAllocateTextFileInProcessScriptFile)
 {
     m_pNibbleDiskImage = NibbleDiskImage_Create();
@@ -972,3 +1160,272 @@ TEST(NibbleDiskImage, FailToAllocateTextFileInProcessScriptFile)
     validateOutOfMemoryExceptionThrown();
 }
 
+TEST(NibbleDiskImage, UpdateImageAfterObjectChangesShouldMatchFullBuild)
+{
+    static const char script[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,0" LINE_ENDING
+                                 "RW18,NibbleDiskImageTestAllZeroes.sav,0,256,0xa9,3,0" LINE_ENDING
+                                 "RWTS16,NibbleDiskImageTestAllZeroes.sav,0,256,3,15" LINE_ENDING
+                                 "RW18,NibbleDiskImageAllOnes.sav,0,256,0xa9,34,4352" LINE_ENDING;
+    unsigned char ones[DISK_IMAGE_BYTES_PER_SECTOR];
+
+    createZeroSectorObjectFile();
+    createOnesSectorObjectFile();
+    createTextFile(g_scriptFilename, script);
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    DiskImage_UpdateImage((DiskImage*)m_pNibbleDiskImage, g_scriptFilename, g_imageFilename);
+    DiskImage_Free((DiskImage*)m_pNibbleDiskImage);
+    memset(ones, 0xff, sizeof(ones));
+    createSectorObjectFile(g_savFilenameAllZeroes, ones, sizeof(ones));
+
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    DiskImage_UpdateImage((DiskImage*)m_pNibbleDiskImage, g_scriptFilename, g_imageFilename);
+    DiskImage_Free((DiskImage*)m_pNibbleDiskImage);
+
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    NibbleDiskImage_ProcessScriptFile(m_pNibbleDiskImage, g_scriptFilename);
+    const unsigned char* pExpectedImage = NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage);
+    const unsigned char* pImageOnDisk = readNibbleDiskImageIntoMemory();
+    CHECK(0 == memcmp(pExpectedImage, pImageOnDisk, NIBBLE_DISK_IMAGE_SIZE));
+}
+
+TEST(NibbleDiskImage, UpdateImageShouldReportInvalidRWTS16LengthOnEveryUpdate)
+{
+    createZeroSectorObjectFile();
+    createTextFile(g_scriptFilename, "RWTS16,NibbleDiskImageTestAllZeroes.sav,0,256,0,0" LINE_ENDING
+                                     "RWTS16,NibbleDiskImageTestAllZeroes.sav,0,255,24,2" LINE_ENDING);
+    for (int i = 0 ; i < 2 ; i++)
+    {
+        printfSpy_Unhook();
+        printfSpy_Hook(512);
+        DiskImage_Free((DiskImage*)m_pNibbleDiskImage);
+        m_pNibbleDiskImage = NibbleDiskImage_Create();
+        DiskImage_UpdateImage((DiskImage*)m_pNibbleDiskImage, g_scriptFilename, g_imageFilename);
+        STRCMP_EQUAL("NibbleDiskImageTest.script:2: error: 255 specifies an invalid legnth." LINE_ENDING,
+                     printfSpy_GetLastErrorOutput());
+    }
+}
+
+TEST(NibbleDiskImage, VerifyTracksOfBlankImage)
+{
+    NibbleTrackStatus tracks[DISK_IMAGE_TRACKS_PER_SIDE];
+    
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    NibbleDiskImage_VerifyTracks(m_pNibbleDiskImage, tracks);
+    for (unsigned int track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+        LONGS_EQUAL(NIBBLE_TRACK_BLANK, tracks[track].format);
+}
+
+TEST(NibbleDiskImage, VerifyTracksDecodesRW18AndRWTS16Tracks)
+{
+    NibbleTrackStatus tracks[DISK_IMAGE_TRACKS_PER_SIDE];
+    
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    NibbleDiskImage_SetEncodeThreadCount(m_pNibbleDiskImage, 4);
+    writeOnesRW18Sectors(1, 0x0100, 17);
+    writeZeroRWTS16Sectors(2, 3, 2);
+    NibbleDiskImage_VerifyTracks(m_pNibbleDiskImage, tracks);
+    
+    LONGS_EQUAL(NIBBLE_TRACK_BLANK, tracks[0].format);
+    LONGS_EQUAL(NIBBLE_TRACK_RW18, tracks[1].format);
+    LONGS_EQUAL(0xa9, tracks[1].side);
+    validateAllZeroes(tracks[1].data, DISK_IMAGE_PAGE_SIZE);
+    validateAllOnes(tracks[1].data + DISK_IMAGE_PAGE_SIZE, 17 * DISK_IMAGE_PAGE_SIZE);
+    LONGS_EQUAL(NIBBLE_TRACK_RWTS16, tracks[2].format);
+    LONGS_EQUAL((1 << 3) | (1 << 4), tracks[2].validSectors);
+    LONGS_EQUAL(0, tracks[2].badSectors);
+    LONGS_EQUAL(NIBBLE_TRACK_BLANK, tracks[3].format);
+}
+
+TEST(NibbleDiskImage, VerifyTracksDecodesRWTS16SectorData)
+{
+    NibbleTrackStatus tracks[DISK_IMAGE_TRACKS_PER_SIDE];
+    unsigned char     sectorData[DISK_IMAGE_BYTES_PER_SECTOR];
+    DiskImageInsert   insert;
+    
+    for (size_t i = 0 ; i < sizeof(sectorData) ; i++)
+        sectorData[i] = (unsigned char)(i * 7 + 3);
+    memset(&insert, 0, sizeof(insert));
+    insert.type = DISK_IMAGE_INSERTION_RWTS16;
+    insert.length = sizeof(sectorData);
+    insert.track = 34;
+    insert.sector = 15;
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    NibbleDiskImage_InsertData(m_pNibbleDiskImage, sectorData, &insert);
+    NibbleDiskImage_VerifyTracks(m_pNibbleDiskImage, tracks);
+    
+    LONGS_EQUAL(NIBBLE_TRACK_RWTS16, tracks[34].format);
+    LONGS_EQUAL(1 << 15, tracks[34].validSectors);
+    CHECK(0 == memcmp(sectorData, tracks[34].data + 15 * DISK_IMAGE_BYTES_PER_SECTOR, sizeof(sectorData)));
+}
+
+TEST(NibbleDiskImage, VerifyTracksFlagsCorruptTracks)
+{
+    NibbleTrackStatus tracks[DISK_IMAGE_TRACKS_PER_SIDE];
+    
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    writeOnesRW18Sectors(0, 0, 18);
+    writeZeroRWTS16Sectors(1, 0, 2);
+    unsigned char* pImage = DiskImage_GetImagePointer((DiskImage*)m_pNibbleDiskImage);
+    pImage[1000] ^= 0x01;
+    pImage[NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK + NIBBLE_DISK_IMAGE_RWTS16_GAP1_SYNC_BYTES + 100] = 0x00;
+    NibbleDiskImage_VerifyTracks(m_pNibbleDiskImage, tracks);
+    
+    LONGS_EQUAL(NIBBLE_TRACK_BAD, tracks[0].format);
+    LONGS_EQUAL(NIBBLE_TRACK_BAD, tracks[1].format);
+    LONGS_EQUAL(1 << 1, tracks[1].validSectors);
+    LONGS_EQUAL(1 << 0, tracks[1].badSectors);
+}
+
+TEST(NibbleDiskImage, CompareTracksAgainstExpectedImage)
+{
+    NibbleTrackStatus* pTracks = (NibbleTrackStatus*)malloc(2 * DISK_IMAGE_TRACKS_PER_SIDE * sizeof(*pTracks));
+    NibbleTrackStatus* pExpectedTracks = pTracks + DISK_IMAGE_TRACKS_PER_SIDE;
+    
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    writeOnesRW18Sectors(0, 0, 18);
+    writeZeroRWTS16Sectors(1, 0, 1);
+    NibbleDiskImage_VerifyTracks(m_pNibbleDiskImage, pExpectedTracks);
+    writeZeroRW18Sectors(0, 0x0200, 1);
+    writeZeroRWTS16Sectors(1, 5, 1);
+    writeZeroRWTS16Sectors(2, 0, 1);
+    NibbleDiskImage_VerifyTracks(m_pNibbleDiskImage, pTracks);
+    
+    LONGS_EQUAL(3, NibbleDiskImage_CompareTracks(pTracks, pExpectedTracks));
+    CHECK_TRUE(pTracks[0].isMismatched);
+    CHECK_TRUE(pTracks[1].isMismatched);
+    CHECK_TRUE(pTracks[2].isMismatched);
+    CHECK_FALSE(pTracks[3].isMismatched);
+    LONGS_EQUAL(0, NibbleDiskImage_CompareTracks(pExpectedTracks, pExpectedTracks));
+    free(pTracks);
+}
+
+TEST(NibbleDiskImage, ReadImageWrittenByWriteImage)
+{
+    NibbleTrackStatus tracks[DISK_IMAGE_TRACKS_PER_SIDE];
+    
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    writeOnesRW18Sectors(5, 0, 18);
+    NibbleDiskImage_WriteImage(m_pNibbleDiskImage, g_imageFilename);
+    DiskImage_Free((DiskImage*)m_pNibbleDiskImage);
+    
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    NibbleDiskImage_ReadImage(m_pNibbleDiskImage, g_imageFilename);
+    NibbleDiskImage_VerifyTracks(m_pNibbleDiskImage, tracks);
+    LONGS_EQUAL(NIBBLE_TRACK_RW18, tracks[5].format);
+    validateAllOnes(tracks[5].data, DISK_IMAGE_RW18_BYTES_PER_TRACK);
+}
+
+TEST(NibbleDiskImage, FailFOpenInReadImage)
+{
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    __try_and_catch( NibbleDiskImage_ReadImage(m_pNibbleDiskImage, g_imageFilename) );
+    validateExceptionThrown(fileOpenException);
+}
+
+TEST(NibbleDiskImage, FailToReadImageOfWrongSize)
+{
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    createTextFile(g_imageFilename, "Not a nibble image");
+    __try_and_catch( NibbleDiskImage_ReadImage(m_pNibbleDiskImage, g_imageFilename) );
+    validateFileExceptionThrown();
+}
+
+TEST(NibbleDiskImage, DiffTracksReportsDifferentPagesSectorsAndFormats)
+{
+    NibbleTrackStatus* pTracks = (NibbleTrackStatus*)malloc(2 * DISK_IMAGE_TRACKS_PER_SIDE * sizeof(*pTracks));
+    NibbleTrackStatus* pTracks2 = pTracks + DISK_IMAGE_TRACKS_PER_SIDE;
+    NibbleTrackDiff    diffs[DISK_IMAGE_TRACKS_PER_SIDE];
+    
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    NibbleDiskImage_SetEncodeThreadCount(m_pNibbleDiskImage, 4);
+    writeZeroRW18Sectors(0, 0, 18);
+    writeZeroRWTS16Sectors(1, 0, 16);
+    writeZeroRWTS16Sectors(2, 0, 1);
+    NibbleDiskImage_VerifyTracks(m_pNibbleDiskImage, pTracks);
+    writeOnesRW18Sectors(0, 0x0300, 2);
+    writeOnesRW18Sectors(2, 0, 1);
+    NibbleDiskImage_VerifyTracks(m_pNibbleDiskImage, pTracks2);
+    pTracks2[1].data[5 * DISK_IMAGE_BYTES_PER_SECTOR + 17] = 0x01;
+    
+    LONGS_EQUAL(3, NibbleDiskImage_DiffTracks(m_pNibbleDiskImage, pTracks, pTracks2, diffs));
+    LONGS_EQUAL((1 << 3) | (1 << 4), diffs[0].differentRegions);
+    CHECK_FALSE(diffs[0].isFormatDifferent);
+    LONGS_EQUAL(1 << 5, diffs[1].differentRegions);
+    CHECK_FALSE(diffs[1].isFormatDifferent);
+    CHECK_TRUE(diffs[2].isFormatDifferent);
+    LONGS_EQUAL(0, diffs[3].differentRegions);
+    CHECK_FALSE(diffs[3].isFormatDifferent);
+    LONGS_EQUAL(0, NibbleDiskImage_DiffTracks(m_pNibbleDiskImage, pTracks, pTracks, diffs));
+    free(pTracks);
+}
+
+TEST(NibbleDiskImage, DiffTracksReportsSectorsWhichOnlyDifferInValidity)
+{
+    NibbleTrackStatus* pTracks = (NibbleTrackStatus*)malloc(2 * DISK_IMAGE_TRACKS_PER_SIDE * sizeof(*pTracks));
+    NibbleTrackStatus* pTracks2 = pTracks + DISK_IMAGE_TRACKS_PER_SIDE;
+    NibbleTrackDiff    diffs[DISK_IMAGE_TRACKS_PER_SIDE];
+    
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    writeZeroRWTS16Sectors(4, 0, 2);
+    NibbleDiskImage_VerifyTracks(m_pNibbleDiskImage, pTracks);
+    writeZeroRWTS16Sectors(4, 9, 1);
+    NibbleDiskImage_VerifyTracks(m_pNibbleDiskImage, pTracks2);
+    
+    LONGS_EQUAL(1, NibbleDiskImage_DiffTracks(m_pNibbleDiskImage, pTracks, pTracks2, diffs));
+    LONGS_EQUAL(1 << 9, diffs[4].differentRegions);
+    free(pTracks);
+}
+
+TEST(NibbleDiskImage, GetRegionWriterReturnsNullWhenNotRecording)
+{
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    writeZeroRW18Sectors(0, 0, 1);
+    POINTERS_EQUAL(NULL, NibbleDiskImage_GetRegionWriter(m_pNibbleDiskImage, 0, 0));
+}
+
+TEST(NibbleDiskImage, RecordWritersOfScriptLines)
+{
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    NibbleDiskImage_RecordWriters(m_pNibbleDiskImage);
+    createZeroSectorObjectFile();
+    createOnesSectorObjectFile();
+    NibbleDiskImage_ProcessScript(m_pNibbleDiskImage, copy("RWTS16,NibbleDiskImageTestAllZeroes.sav,0,256,3,5" LINE_ENDING
+                                                           "RW18,NibbleDiskImageTestAllZeroes.sav,0,256,0xa9,4,0x180" LINE_ENDING
+                                                           "RW18,NibbleDiskImageAllOnes.sav,0,256,0xa9,4,0x300" LINE_ENDING));
+    
+    const NibbleRegionWriter* pWriter = NibbleDiskImage_GetRegionWriter(m_pNibbleDiskImage, 3, 5);
+    CHECK_TRUE(pWriter != NULL);
+    LONGS_EQUAL(1, pWriter->lineNumber);
+    STRCMP_EQUAL(g_savFilenameAllZeroes, pWriter->pObjectFilename);
+    POINTERS_EQUAL(NULL, NibbleDiskImage_GetRegionWriter(m_pNibbleDiskImage, 3, 4));
+    
+    pWriter = NibbleDiskImage_GetRegionWriter(m_pNibbleDiskImage, 4, 1);
+    LONGS_EQUAL(2, pWriter->lineNumber);
+    pWriter = NibbleDiskImage_GetRegionWriter(m_pNibbleDiskImage, 4, 2);
+    LONGS_EQUAL(2, pWriter->lineNumber);
+    pWriter = NibbleDiskImage_GetRegionWriter(m_pNibbleDiskImage, 4, 3);
+    LONGS_EQUAL(3, pWriter->lineNumber);
+    STRCMP_EQUAL(g_savFilenameAllOnes, pWriter->pObjectFilename);
+    POINTERS_EQUAL(NULL, NibbleDiskImage_GetRegionWriter(m_pNibbleDiskImage, 4, 4));
+    POINTERS_EQUAL(NULL, NibbleDiskImage_GetRegionWriter(m_pNibbleDiskImage, 35, 0));
+}
+
+TEST(NibbleDiskImage, RecordWritersForgetsRegionsWrittenInAnotherFormat)
+{
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    NibbleDiskImage_RecordWriters(m_pNibbleDiskImage);
+    createZeroSectorObjectFile();
+    NibbleDiskImage_ProcessScript(m_pNibbleDiskImage, copy("RWTS16,NibbleDiskImageTestAllZeroes.sav,0,256,3,5" LINE_ENDING
+                                                           "RW18,NibbleDiskImageTestAllZeroes.sav,0,256,0xa9,3,0" LINE_ENDING));
+    
+    POINTERS_EQUAL(NULL, NibbleDiskImage_GetRegionWriter(m_pNibbleDiskImage, 3, 5));
+    LONGS_EQUAL(2, NibbleDiskImage_GetRegionWriter(m_pNibbleDiskImage, 3, 0)->lineNumber);
+}
+
+TEST(NibbleDiskImage, FailAllocationInRecordWriters)
+{
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( NibbleDiskImage_RecordWriters(m_pNibbleDiskImage) );
+    validateOutOfMemoryExceptionThrown();
+}
@@ -0,0 +1,275 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "../src/NibbleEncoder.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+static const unsigned char g_validNibbles[64] =
+{
+    0x96, 0x97, 0x9a, 0x9b, 0x9d, 0x9e, 0x9f, 0xa6,
+    0xa7, 0xab, 0xac, 0xad, 0xae, 0xaf, 0xb2, 0xb3,
+    0xb4, 0xb5, 0xb6, 0xb7, 0xb9, 0xba, 0xbb, 0xbc,
+    0xbd, 0xbe, 0xbf, 0xcb, 0xcd, 0xce, 0xcf, 0xd3,
+    0xd6, 0xd7, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde,
+    0xdf, 0xe5, 0xe6, 0xe7, 0xe9, 0xea, 0xeb, 0xec,
+    0xed, 0xee, 0xef, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6,
+    0xf7, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+};
+
+
+TEST_GROUP(NibbleEncoder)
+{
+    unsigned char m_image[NIBBLE_DISK_IMAGE_SIZE];
+    unsigned char m_trackData[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+    unsigned char m_expected[4 * DISK_IMAGE_PAGE_SIZE + 1];
+    unsigned int  m_seed;
+
+    void setup()
+    {
+        memset(m_image, 0, sizeof(m_image));
+        m_seed = 0x12345678;
+        for (size_t i = 0 ; i < sizeof(m_trackData) ; i++)
+            m_trackData[i] = nextRandomByte();
+    }
+
+    void teardown()
+    {
+    }
+
+    unsigned char nextRandomByte()
+    {
+        m_seed = m_seed * 1103515245 + 12345;
+        return (unsigned char)(m_seed >> 16);
+    }
+
+    unsigned char swapLowBits(unsigned char byte)
+    {
+        return ((byte & 1) << 1) | ((byte & 2) >> 1);
+    }
+
+    size_t buildExpected6and2Data(const unsigned char* pData)
+    {
+        unsigned char values[86 + 256];
+        unsigned char lastByte = 0;
+        size_t        i;
+
+        for (i = 0 ; i < 86 ; i++)
+        {
+            values[85 - i] = (swapLowBits(pData[(unsigned char)(0x101 - i)]) << 4) |
+                             (swapLowBits(pData[(unsigned char)(0xAB - i)]) << 2) |
+                             swapLowBits(pData[(unsigned char)(0x55 - i)]);
+        }
+        for (i = 0 ; i < 256 ; i++)
+            values[86 + i] = pData[i] >> 2;
+        for (i = 0 ; i < sizeof(values) ; i++)
+        {
+            m_expected[i] = g_validNibbles[values[i] ^ lastByte];
+            lastByte = values[i];
+        }
+        m_expected[i++] = g_validNibbles[lastByte];
+
+        return i;
+    }
+
+    size_t buildExpectedRW18Data(unsigned int sector)
+    {
+        const unsigned char* pPage0 = m_trackData + sector * DISK_IMAGE_PAGE_SIZE;
+        const unsigned char* pPage1 = m_trackData + (sector + 6) * DISK_IMAGE_PAGE_SIZE;
+        const unsigned char* pPage2 = m_trackData + (sector + 12) * DISK_IMAGE_PAGE_SIZE;
+        unsigned char        checksum = 0;
+        size_t               j = 0;
+
+        for (size_t i = 0 ; i < DISK_IMAGE_PAGE_SIZE ; i++)
+        {
+            unsigned char values[4];
+
+            values[0] = ((pPage0[i] >> 6) << 4) | ((pPage1[i] >> 6) << 2) | (pPage2[i] >> 6);
+            values[1] = pPage0[i] & 0x3F;
+            values[2] = pPage1[i] & 0x3F;
+            values[3] = pPage2[i] & 0x3F;
+            for (size_t k = 0 ; k < 4 ; k++)
+            {
+                m_expected[j++] = g_validNibbles[values[k]];
+                checksum ^= values[k];
+            }
+        }
+        m_expected[j++] = g_validNibbles[checksum];
+
+        return j;
+    }
+
+    const unsigned char* rw18DataPointer(unsigned int track, unsigned int sector)
+    {
+        static const unsigned int firstDataOffset = 403 + 12 + 9;
+        static const unsigned int sectorStride = 4 * DISK_IMAGE_PAGE_SIZE + 3 + 5 + 9;
+
+        return m_image + NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * track + firstDataOffset + (5 - sector) * sectorStride;
+    }
+
+    const unsigned char* rwts16DataPointer(unsigned int track, unsigned int sector)
+    {
+        return m_image + NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * track +
+                         NIBBLE_DISK_IMAGE_RWTS16_GAP1_SYNC_BYTES +
+                         NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR * sector +
+                         14 + NIBBLE_DISK_IMAGE_RWTS16_GAP2_SYNC_BYTES + 3;
+    }
+};
+
+
+TEST(NibbleEncoder, Encode6to8MatchesValidNibbleTable)
+{
+    for (unsigned char i = 0 ; i < 64 ; i++)
+        LONGS_EQUAL(g_validNibbles[i], NibbleEncoder_Encode6to8(i));
+}
+
+TEST(NibbleEncoder, Decode8to6InvertsEncodeAndRejectsInvalidNibbles)
+{
+    unsigned int validCount = 0;
+
+    for (unsigned int i = 0 ; i < 256 ; i++)
+    {
+        unsigned char decoded = NibbleEncoder_Decode8to6((unsigned char)i);
+        if (decoded == 0xFF)
+            continue;
+        LONGS_EQUAL(i, NibbleEncoder_Encode6to8(decoded));
+        validCount++;
+    }
+    LONGS_EQUAL(64, validCount);
+}
+
+TEST(NibbleEncoder, RW18DataFieldsMatchReferenceEncoding)
+{
+    NibbleEncoder_WriteRW18Track(m_image, 0xa9, 17, m_trackData);
+
+    for (unsigned int sector = 0 ; sector < 6 ; sector++)
+    {
+        size_t length = buildExpectedRW18Data(sector);
+        const unsigned char* pActual = rw18DataPointer(17, sector);
+
+        CHECK(0 == memcmp(m_expected, pActual, length));
+        LONGS_EQUAL(0xD4, pActual[length]);
+    }
+}
+
+TEST(NibbleEncoder, RW18DecodeRoundTripsEncodedTrack)
+{
+    unsigned char decoded[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+
+    NibbleEncoder_WriteRW18Track(m_image, 0xa9, 3, m_trackData);
+    for (unsigned int sector = 0 ; sector < 6 ; sector++)
+    {
+        const unsigned char* pData = rw18DataPointer(3, sector);
+        unsigned char        checksum;
+
+        checksum = NibbleEncoder_DecodeRW18Data(pData,
+                                                decoded + sector * DISK_IMAGE_PAGE_SIZE,
+                                                decoded + (sector + 6) * DISK_IMAGE_PAGE_SIZE,
+                                                decoded + (sector + 12) * DISK_IMAGE_PAGE_SIZE);
+        LONGS_EQUAL(NibbleEncoder_Decode8to6(pData[4 * DISK_IMAGE_PAGE_SIZE]), checksum);
+    }
+    CHECK(0 == memcmp(m_trackData, decoded, sizeof(decoded)));
+}
+
+TEST(NibbleEncoder, RW18DecodeOfInvalidNibbleChangesChecksum)
+{
+    unsigned char decoded[3 * DISK_IMAGE_PAGE_SIZE];
+
+    NibbleEncoder_WriteRW18Track(m_image, 0xa9, 0, m_trackData);
+    unsigned char* pData = (unsigned char*)rw18DataPointer(0, 5);
+    pData[100] = 0x00;
+
+    unsigned char checksum = NibbleEncoder_DecodeRW18Data(pData,
+                                                          decoded,
+                                                          decoded + DISK_IMAGE_PAGE_SIZE,
+                                                          decoded + 2 * DISK_IMAGE_PAGE_SIZE);
+    CHECK(NibbleEncoder_Decode8to6(pData[4 * DISK_IMAGE_PAGE_SIZE]) != checksum);
+}
+
+TEST(NibbleEncoder, RWTS16DataFieldsMatchReferenceEncoding)
+{
+    for (unsigned int sector = 0 ; sector < NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK ; sector++)
+    {
+        const unsigned char* pSectorData = m_trackData + sector * DISK_IMAGE_BYTES_PER_SECTOR;
+
+        NibbleEncoder_WriteRWTS16Sector(m_image, 34, sector, pSectorData);
+
+        size_t length = buildExpected6and2Data(pSectorData);
+        const unsigned char* pActual = rwts16DataPointer(34, sector);
+        CHECK(0 == memcmp(m_expected, pActual, length));
+        CHECK(0 == memcmp("\xDE\xAA\xEB", pActual + length, 3));
+    }
+}
+
+TEST(NibbleEncoder, RW18ReadTrackReturnsSideAndData)
+{
+    unsigned char decoded[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+
+    NibbleEncoder_WriteRW18Track(m_image, 0xad, 12, m_trackData);
+    LONGS_EQUAL(0xad, NibbleEncoder_ReadRW18Track(m_image, 12, decoded));
+    CHECK(0 == memcmp(m_trackData, decoded, sizeof(decoded)));
+}
+
+TEST(NibbleEncoder, RW18ReadTrackThrowsOnCorruptData)
+{
+    unsigned char decoded[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+
+    NibbleEncoder_WriteRW18Track(m_image, 0xa9, 0, m_trackData);
+    unsigned char* pData = (unsigned char*)rw18DataPointer(0, 2);
+    pData[10] = NibbleEncoder_Encode6to8(NibbleEncoder_Decode8to6(pData[10]) ^ 0x01);
+    __try_and_catch( NibbleEncoder_ReadRW18Track(m_image, 0, decoded) );
+    LONGS_EQUAL(badTrackException, getExceptionCode());
+    clearExceptionCode();
+}
+
+TEST(NibbleEncoder, RWTS16ReadSectorRoundTripsEncodedSector)
+{
+    unsigned char decoded[DISK_IMAGE_BYTES_PER_SECTOR];
+
+    for (unsigned int sector = 0 ; sector < NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK ; sector++)
+    {
+        const unsigned char* pSectorData = m_trackData + sector * DISK_IMAGE_BYTES_PER_SECTOR;
+
+        NibbleEncoder_WriteRWTS16Sector(m_image, 7, sector, pSectorData);
+        NibbleEncoder_ReadRWTS16Sector(m_image, 7, sector, decoded);
+        CHECK(0 == memcmp(pSectorData, decoded, sizeof(decoded)));
+    }
+}
+
+TEST(NibbleEncoder, RWTS16ReadSectorThrowsOnCorruptDataOrWrongTrack)
+{
+    unsigned char decoded[DISK_IMAGE_BYTES_PER_SECTOR];
+
+    NibbleEncoder_WriteRWTS16Sector(m_image, 7, 9, m_trackData);
+    __try_and_catch( NibbleEncoder_ReadRWTS16Sector(m_image, 7, 8, decoded) );
+    LONGS_EQUAL(badTrackException, getExceptionCode());
+    clearExceptionCode();
+
+    unsigned char* pData = (unsigned char*)rwts16DataPointer(7, 9);
+    memcpy(m_image + NibbleEncoder_GetRWTS16SectorOffset(8, 9), m_image + NibbleEncoder_GetRWTS16SectorOffset(7, 9),
+           NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR);
+    __try_and_catch( NibbleEncoder_ReadRWTS16Sector(m_image, 8, 9, decoded) );
+    LONGS_EQUAL(badTrackException, getExceptionCode());
+    clearExceptionCode();
+
+    pData[200] = 0x00;
+    __try_and_catch( NibbleEncoder_ReadRWTS16Sector(m_image, 7, 9, decoded) );
+    LONGS_EQUAL(badTrackException, getExceptionCode());
+    clearExceptionCode();
+}
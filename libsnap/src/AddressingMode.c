@@ -197,7 +197,9 @@ static AddressingMode indirectIndexedAddressing(Assembler* pAssembler, SizedStri
         reportAndThrowOnInvalidIndexRegister(pAssembler, &indexRegister);
         
     addressingMode.expression = ExpressionEval(pAssembler, &beforeCloseParen);
-    if (addressingMode.expression.type != TYPE_ZEROPAGE)
+    /* Forward references are checked again once the referenced label has been defined. */
+    if (addressingMode.expression.type != TYPE_ZEROPAGE && 
+        !(addressingMode.expression.flags & EXPRESSION_FLAG_FORWARD_REFERENCE))
     {
         LOG_ERROR(pAssembler, "'%.*s' isn't in page zero as required for indirect indexed addressing.", 
                   beforeCloseParen.stringLength, beforeCloseParen.pString);
@@ -15,17 +15,22 @@
 #include <strings.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <fcntl.h>
 #include "AssemblerPriv.h"
 #include "ExpressionEval.h"
 #include "AddressingMode.h"
 #include "InstructionSets.h"
 #include "TextFileSource.h"
 #include "LupSource.h"
+#include "OpcodeCycles.h"
+#include "Peephole.h"
 
 
 static void commonObjectInit(Assembler* pThis, const AssemblerInitParams* pParams, TextFile* pTextFile);
+static Vfs* getVfs(const AssemblerInitParams* pParams);
 static FILE* createListFileOrRedirectToStdOut(Assembler* pThis, const AssemblerInitParams* pParams);
 static void createParseObjectForPutSearchPath(Assembler* ptThis, const AssemblerInitParams* pParams);
+static void prefetchPutFiles(Assembler* pThis, const TextFile* pMainTextFile);
 static void createFullInstructionSetTables(Assembler* pThis); 
 static void create6502InstructionSetTable(Assembler* pThis);
 static int compareInstructionSetEntries(const void* pv1, const void* pv2);
@@ -76,8 +81,9 @@ static void commonObjectInit(Assembler* pThis, const AssemblerInitParams* pParam
         pThis->pObjectBuffer = BinaryBuffer_Create(SIZE_OF_OBJECT_AND_DUMMY_BUFFERS);
         pThis->pDummyBuffer = BinaryBuffer_Create(SIZE_OF_OBJECT_AND_DUMMY_BUFFERS);
         createParseObjectForPutSearchPath(pThis, pParams);
-        createFullInstructionSetTables(pThis);
         pThis->pInitParams = pParams;
+        prefetchPutFiles(pThis, TextSource_GetTextFile(pTextSource));
+        createFullInstructionSetTables(pThis);
         pThis->pLineInfo = &pThis->linesHead;
         pThis->pCurrentBuffer = pThis->pObjectBuffer;
         setOrgInAssemblerAndBinaryBufferModules(pThis, 0x8000);
@@ -90,12 +96,17 @@ static void commonObjectInit(Assembler* pThis, const AssemblerInitParams* pParam
     }
 }
 
+static Vfs* getVfs(const AssemblerInitParams* pParams)
+{
+    return pParams ? pParams->pVfs : NULL;
+}
+
 static FILE* createListFileOrRedirectToStdOut(Assembler* pThis, const AssemblerInitParams* pParams)
 {
     if (!pParams || !pParams->pListFilename)
         return stdout;
         
-    pThis->pFileForListing = fopen(pParams->pListFilename, "wb");
+    pThis->pFileForListing = Vfs_Open(pParams->pVfs, pParams->pListFilename, "wb");
     if (!pThis->pFileForListing)
         __throw(fileOpenException);
     return pThis->pFileForListing;
@@ -123,6 +134,102 @@ static void createParseObjectForPutSearchPath(Assembler* pThis, const AssemblerI
     pThis->pPutSearchPath = pParser;
 }
 
+static int isPutDirective(const ParsedLine* pParsedLine);
+static void prefetchPutFile(Assembler* pThis, const SizedString* pFilename);
+static void prefetchPutFiles(Assembler* pThis, const TextFile* pMainTextFile)
+{
+    TextFile* pTextFile = NULL;
+    
+    /* Files which can't be found are left for handlePUT() to report when the first pass gets to their directive. */
+    __try
+    {
+        pTextFile = TextFile_CreateFromTextFile(pMainTextFile);
+        while (!TextFile_IsEndOfFile(pTextFile))
+        {
+            SizedString nextLine = TextFile_GetNextLine(pTextFile);
+            ParsedLine  parsedLine;
+            
+            ParseLine(&parsedLine, &nextLine);
+            if (isPutDirective(&parsedLine))
+                prefetchPutFile(pThis, &parsedLine.operands);
+        }
+    }
+    __catch
+    {
+        TextFile_Free(pTextFile);
+        __rethrow;
+    }
+    TextFile_Free(pTextFile);
+}
+
+static int isPutDirective(const ParsedLine* pParsedLine)
+{
+    return 0 == SizedString_strcasecmp(&pParsedLine->op, "PUT") && !SizedString_IsNull(&pParsedLine->operands);
+}
+
+static size_t getPutDirectoryCount(Assembler* pThis);
+static const SizedString* getPutDirectory(Assembler* pThis, size_t directoryIndex);
+static PutFileEntry* findPutFileEntry(Assembler* pThis, const SizedString* pFilename);
+static PutFileEntry* rememberPutFileDirectory(Assembler* pThis, const SizedString* pFilename, size_t directoryIndex);
+static void adviseOsToReadAhead(FILE* pFile);
+static void prefetchPutFile(Assembler* pThis, const SizedString* pFilename)
+{
+    size_t directoryCount = getPutDirectoryCount(pThis);
+    size_t i;
+    
+    /* Find the file in the search path now, using plain opens rather than exceptions for each miss, and keep it open
+       for handlePUT() while the OS starts reading it in the background. */
+    if (findPutFileEntry(pThis, pFilename))
+        return;
+    for (i = 0 ; i < directoryCount ; i++)
+    {
+        char*         pFullFilename = TextFile_AllocateMergedFilename(getPutDirectory(pThis, i), pFilename, ".S");
+        FILE*         pFile = Vfs_Open(getVfs(pThis->pInitParams), pFullFilename, "rb");
+        PutFileEntry* pEntry = NULL;
+        
+        if (!pFile)
+        {
+            free(pFullFilename);
+            continue;
+        }
+        __try
+        {
+            pEntry = rememberPutFileDirectory(pThis, pFilename, i);
+        }
+        __catch
+        {
+            fclose(pFile);
+            free(pFullFilename);
+            __rethrow;
+        }
+        pEntry->pPrefetchedFilename = pFullFilename;
+        pEntry->pPrefetchedFile = pFile;
+        adviseOsToReadAhead(pFile);
+        return;
+    }
+}
+
+static size_t getPutDirectoryCount(Assembler* pThis)
+{
+    return pThis->pPutSearchPath ? ParseCSV_FieldCount(pThis->pPutSearchPath) : 1;
+}
+
+static const SizedString* getPutDirectory(Assembler* pThis, size_t directoryIndex)
+{
+    return pThis->pPutSearchPath ? &ParseCSV_FieldPointers(pThis->pPutSearchPath)[directoryIndex] : NULL;
+}
+
+static void adviseOsToReadAhead(FILE* pFile)
+{
+#ifdef POSIX_FADV_WILLNEED
+    /* Files from a Vfs which isn't backed by the OS have no file descriptor. */
+    int fileDescriptor = fileno(pFile);
+    
+    if (fileDescriptor >= 0)
+        posix_fadvise(fileDescriptor, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+}
+
 static void createFullInstructionSetTables(Assembler* pThis)
 {
     create6502InstructionSetTable(pThis);
@@ -274,7 +381,7 @@ __throws Assembler* Assembler_CreateFromFile(const char* pSourceFilename, const
         
         SizedString sourceFilename = SizedString_InitFromString(pSourceFilename);
         pThis = allocateAndZero(sizeof(*pThis));
-        pTextFile = TextFile_CreateFromFile(NULL, &sourceFilename, NULL);
+        pTextFile = TextFile_CreateFromVfsFile(getVfs(pParams), NULL, &sourceFilename, NULL);
         commonObjectInit(pThis, pParams, pTextFile);
     }
     __catch
@@ -290,6 +397,7 @@ __throws Assembler* Assembler_CreateFromFile(const char* pSourceFilename, const
 static void freeLines(Assembler* pThis);
 static void freeConditionals(Assembler* pThis);
 static void freeInstructionSets(Assembler* pThis);
+static void freePutFileEntries(Assembler* pThis);
 void Assembler_Free(Assembler* pThis)
 {
     if (!pThis)
@@ -298,6 +406,9 @@ void Assembler_Free(Assembler* pThis)
     freeLines(pThis);
     freeConditionals(pThis);
     freeInstructionSets(pThis);
+    freePutFileEntries(pThis);
+    free(pThis->pRelaxationHints);
+    free(pThis->pPeepholeHints);
     ParseCSV_Free(pThis->pPutSearchPath);
     ListFile_Free(pThis->pListFile);
     BinaryBuffer_Free(pThis->pDummyBuffer);
@@ -343,8 +454,26 @@ static void freeInstructionSets(Assembler* pThis)
     }
 }
 
+static void freePutFileEntries(Assembler* pThis)
+{
+    PutFileEntry* pCurr = pThis->pPutFiles;
+    
+    while (pCurr)
+    {
+        PutFileEntry* pNext = pCurr->pNext;
+        if (pCurr->pPrefetchedFile)
+            fclose(pCurr->pPrefetchedFile);
+        free(pCurr->pPrefetchedFilename);
+        free(pCurr->pName);
+        free(pCurr);
+        pCurr = pNext;
+    }
+}
+
 
 static void firstPass(Assembler* pThis);
+static int  shouldRunRelaxationPass(Assembler* pThis);
+static void resetForRelaxationPass(Assembler* pThis);
 static int getNextSourceLine(Assembler* pThis, SizedString* pLine);
 static int attemptToPopTextFileAndGetNextLine(Assembler* pThis, SizedString* pLine);
 static void parseLine(Assembler* pThis, const SizedString* pLine);
@@ -452,13 +581,23 @@ static void clearLupDirectiveFlag(Assembler* pThis);
 static void checkForUndefinedSymbols(Assembler* pThis);
 static void checkSymbolForOutstandingForwardReferences(Assembler* pThis, Symbol* pSymbol);
 static void checkForOpenConditionals(Assembler* pThis);
+static void chainBranches(Assembler* pThis);
+static void checkTimingCriticalLines(Assembler* pThis);
 static void secondPass(Assembler* pThis);
 static void outputListFile(Assembler* pThis);
+static int shouldKeepObjectsInMemory(const AssemblerInitParams* pParams);
 void Assembler_Run(Assembler* pThis)
 {
     firstPass(pThis);
+    while (shouldRunRelaxationPass(pThis))
+    {
+        resetForRelaxationPass(pThis);
+        firstPass(pThis);
+    }
     checkForUndefinedSymbols(pThis);
     checkForOpenConditionals(pThis);
+    chainBranches(pThis);
+    checkTimingCriticalLines(pThis);
     secondPass(pThis);
 }
 
@@ -469,6 +608,167 @@ static void firstPass(Assembler* pThis)
         parseLine(pThis, &line);
 }
 
+static void reportForwardReferencesWhichWerentRelaxed(Assembler* pThis);
+static int  compareRelaxationHints(const void* pv1, const void* pv2);
+static void sortRelaxationHints(Assembler* pThis);
+static int  findPeepholeRewrites(Assembler* pThis);
+static int shouldRunRelaxationPass(Assembler* pThis)
+{
+    int haveRelaxationHintsChanged = pThis->relaxationHintCount != pThis->relaxationHintsBeforePass || 
+                                     pThis->relaxationHintsRemoved != 0;
+    
+    if (pThis->errorCount > 0)
+    {
+        if (haveRelaxationHintsChanged)
+            reportForwardReferencesWhichWerentRelaxed(pThis);
+        return FALSE;
+    }
+    /* Peephole rewrites which remove bytes also move the code after them so they are applied by reassembling. */
+    if (!findPeepholeRewrites(pThis) && !haveRelaxationHintsChanged)
+        return FALSE;
+    
+    sortRelaxationHints(pThis);
+    pThis->relaxationHintsBeforePass = pThis->relaxationHintCount;
+    pThis->relaxationHintsRemoved = 0;
+    return TRUE;
+}
+
+static LineInfo* findLineByOrdinal(Assembler* pThis, unsigned int lineOrdinal);
+static void reportForwardReferencesWhichWerentRelaxed(Assembler* pThis)
+{
+    size_t i;
+    
+    for (i = pThis->relaxationHintsBeforePass ; i < pThis->relaxationHintCount ; i++)
+    {
+        LineInfo*  pLineInfo = findLineByOrdinal(pThis, pThis->pRelaxationHints[i]);
+        ParsedLine parsedLine;
+        
+        ParseLine(&parsedLine, &pLineInfo->lineText);
+        /* Short branches are the only 2 byte instructions which ask to be relaxed into a longer form. */
+        if (pLineInfo->machineCodeSize == 2)
+            LOG_LINE_ERROR(pThis, pLineInfo, "Relative offset of '%.*s' exceeds the allowed -128 to 127 range.", 
+                           parsedLine.operands.stringLength, parsedLine.operands.pString);
+        else
+            LOG_LINE_ERROR(pThis, pLineInfo, "Couldn't properly infer size of a forward reference in '%.*s' operand.", 
+                           parsedLine.operands.stringLength, parsedLine.operands.pString);
+    }
+}
+
+static LineInfo* findLineByOrdinal(Assembler* pThis, unsigned int lineOrdinal)
+{
+    LineInfo* pCurr = pThis->linesHead.pNext;
+    
+    while (--lineOrdinal)
+        pCurr = pCurr->pNext;
+    return pCurr;
+}
+
+static void sortRelaxationHints(Assembler* pThis)
+{
+    size_t i;
+    size_t uniqueCount = 0;
+    
+    qsort(pThis->pRelaxationHints, pThis->relaxationHintCount, sizeof(*pThis->pRelaxationHints), compareRelaxationHints);
+    for (i = 0 ; i < pThis->relaxationHintCount ; i++)
+    {
+        if (pThis->pRelaxationHints[i] == 0)
+            continue;
+        if (uniqueCount == 0 || pThis->pRelaxationHints[i] != pThis->pRelaxationHints[uniqueCount - 1])
+            pThis->pRelaxationHints[uniqueCount++] = pThis->pRelaxationHints[i];
+    }
+    pThis->relaxationHintCount = uniqueCount;
+}
+
+static int compareRelaxationHints(const void* pv1, const void* pv2)
+{
+    unsigned int hint1 = *(const unsigned int*)pv1;
+    unsigned int hint2 = *(const unsigned int*)pv2;
+    
+    return hint1 < hint2 ? -1 : (hint1 > hint2 ? 1 : 0);
+}
+
+static size_t countLines(Assembler* pThis);
+static int findPeepholeRewrites(Assembler* pThis)
+{
+    PeepholeHint* pHints;
+    LineInfo*     pCurr;
+    unsigned int  lineOrdinal = 0;
+    size_t        hintCount = 0;
+    
+    if (pThis->relaxationPass >= MAXIMUM_RELAXATION_PASSES)
+        return FALSE;
+    /* Room for a hint on every line is allocated first so that running out of memory can't leave rewrites flagged
+       on lines which won't be reassembled with them. */
+    pHints = malloc(countLines(pThis) * sizeof(*pHints));
+    if (!pHints || Peephole_FindRewrites(pThis->linesHead.pNext) == 0)
+    {
+        free(pHints);
+        return FALSE;
+    }
+    
+    for (pCurr = pThis->linesHead.pNext ; pCurr ; pCurr = pCurr->pNext)
+    {
+        lineOrdinal++;
+        if (pCurr->peepholeRewrite == PEEPHOLE_NONE)
+            continue;
+        pHints[hintCount].lineOrdinal = lineOrdinal;
+        pHints[hintCount].rewrite = pCurr->peepholeRewrite;
+        hintCount++;
+    }
+    free(pThis->pPeepholeHints);
+    pThis->pPeepholeHints = pHints;
+    pThis->peepholeHintCount = hintCount;
+    return TRUE;
+}
+
+static size_t countLines(Assembler* pThis)
+{
+    LineInfo* pCurr;
+    size_t    lineCount = 0;
+    
+    for (pCurr = pThis->linesHead.pNext ; pCurr ; pCurr = pCurr->pNext)
+        lineCount++;
+    return lineCount;
+}
+
+static void resetForRelaxationPass(Assembler* pThis)
+{
+    TextSource* pMainTextSource = pThis->linesHead.pTextSource;
+    
+    /* Start over from the top of the main source file with nothing but the relaxation hints carried across. */
+    freeLines(pThis);
+    freeConditionals(pThis);
+    SymbolTable_Free(pThis->pSymbols);
+    BinaryBuffer_Free(pThis->pDummyBuffer);
+    BinaryBuffer_Free(pThis->pObjectBuffer);
+    pThis->linesHead.pNext = NULL;
+    pThis->pConditionals = NULL;
+    pThis->pSymbols = NULL;
+    pThis->pDummyBuffer = NULL;
+    pThis->pObjectBuffer = NULL;
+    memset(&pThis->globalLabel, 0, sizeof(pThis->globalLabel));
+    memset(&pThis->parsedLine, 0, sizeof(pThis->parsedLine));
+    pThis->pLineInfo = &pThis->linesHead;
+    pThis->instructionSet = INSTRUCTION_SET_6502;
+    pThis->flags = 0;
+    pThis->warningCount = 0;
+    pThis->programCounterBeforeDUM = 0;
+    pThis->lineOrdinal = 0;
+    pThis->nextRelaxationHint = 0;
+    pThis->nextPeepholeHint = 0;
+    pThis->relaxationPass++;
+
+    pThis->pSymbols = SymbolTable_Create(NUMBER_OF_SYMBOL_TABLE_HASH_BUCKETS);
+    pThis->pObjectBuffer = BinaryBuffer_Create(SIZE_OF_OBJECT_AND_DUMMY_BUFFERS);
+    pThis->pDummyBuffer = BinaryBuffer_Create(SIZE_OF_OBJECT_AND_DUMMY_BUFFERS);
+    pThis->pCurrentBuffer = pThis->pObjectBuffer;
+    setOrgInAssemblerAndBinaryBufferModules(pThis, 0x8000);
+    initParameterVariablesTo0(pThis);
+    TextFile_Reset(TextSource_GetTextFile(pMainTextSource));
+    pThis->pTextSourceStack = NULL;
+    TextSource_StackPush(&pThis->pTextSourceStack, pMainTextSource);
+}
+
 static int getNextSourceLine(Assembler* pThis, SizedString* pLine)
 {
     if (TextSource_IsEndOfFile(pThis->pTextSourceStack))
@@ -507,6 +807,8 @@ static int shouldSkipSourceLines(Assembler* pThis)
     return (int)(pThis->pLineInfo->flags & CONDITIONAL_SKIP_STATES_MASK);
 }
 
+static int isLineHintedToRelax(Assembler* pThis);
+static PeepholeRewrite getPeepholeRewriteHint(Assembler* pThis);
 static void prepareLineInfoForThisLine(Assembler* pThis, const SizedString* pLine)
 {
     LineInfo* pLineInfo = allocateAndZero(sizeof(*pLineInfo));
@@ -517,10 +819,50 @@ static void prepareLineInfoForThisLine(Assembler* pThis, const SizedString* pLin
     pLineInfo->instructionSet = pThis->instructionSet;
     pLineInfo->indentation = (TextSource_StackDepth(pThis->pTextSourceStack)-1) * 4;
     pLineInfo->flags = pThis->pConditionals ? pThis->pConditionals->flags & CONDITIONAL_SKIP_STATES_MASK : 0;
+    if (pThis->flags & ASSEMBLER_CYC)
+        pLineInfo->flags |= LINEINFO_FLAG_CYCLES;
+    if (pThis->flags & ASSEMBLER_TIMED)
+        pLineInfo->flags |= LINEINFO_FLAG_TIMING_CRITICAL;
+    if (pThis->flags & ASSEMBLER_LBR)
+        pLineInfo->flags |= LINEINFO_FLAG_ALLOW_LONG_BRANCH;
+    if (pThis->flags & ASSEMBLER_OPT)
+        pLineInfo->flags |= LINEINFO_FLAG_OPTIMIZE;
+    if (isLineHintedToRelax(pThis))
+        pLineInfo->flags |= LINEINFO_FLAG_RELAXATION_HINT;
+    pLineInfo->peepholeRewrite = getPeepholeRewriteHint(pThis);
     pThis->pLineInfo->pNext = pLineInfo;
     pThis->pLineInfo = pLineInfo;
 }
 
+static int isLineHintedToRelax(Assembler* pThis)
+{
+    size_t hintCount = pThis->relaxationHintsBeforePass;
+    
+    pThis->lineOrdinal++;
+    while (pThis->nextRelaxationHint < hintCount && 
+           pThis->pRelaxationHints[pThis->nextRelaxationHint] < pThis->lineOrdinal)
+    {
+        pThis->nextRelaxationHint++;
+    }
+    return pThis->nextRelaxationHint < hintCount && 
+           pThis->pRelaxationHints[pThis->nextRelaxationHint] == pThis->lineOrdinal;
+}
+
+static PeepholeRewrite getPeepholeRewriteHint(Assembler* pThis)
+{
+    while (pThis->nextPeepholeHint < pThis->peepholeHintCount && 
+           pThis->pPeepholeHints[pThis->nextPeepholeHint].lineOrdinal < pThis->lineOrdinal)
+    {
+        pThis->nextPeepholeHint++;
+    }
+    if (pThis->nextPeepholeHint < pThis->peepholeHintCount && 
+        pThis->pPeepholeHints[pThis->nextPeepholeHint].lineOrdinal == pThis->lineOrdinal)
+    {
+        return pThis->pPeepholeHints[pThis->nextPeepholeHint].rewrite;
+    }
+    return PEEPHOLE_NONE;
+}
+
 static void rememberLabelIfGlobal(Assembler* pThis)
 {
     if (!doesLineContainALabel(pThis) || shouldSkipSourceLines(pThis) || !isGlobalLabelName(&pThis->parsedLine.label))
@@ -697,6 +1039,7 @@ static int compareInstructionSetEntryToOperatorSizedString(const void* pvKey, co
     return SizedString_strcasecmp(pKey, pEntry->pOperator);
 }
 
+static void handlePeepholeRewrite(Assembler* pThis);
 static void handleOpcode(Assembler* pThis, const OpCodeEntry* pOpcodeEntry)
 {
     AddressingMode addressingMode;
@@ -717,6 +1060,12 @@ static void handleOpcode(Assembler* pThis, const OpCodeEntry* pOpcodeEntry)
         return;
     }
     
+    if (pThis->pLineInfo->peepholeRewrite != PEEPHOLE_NONE)
+    {
+        handlePeepholeRewrite(pThis);
+        return;
+    }
+    
     __try
         addressingMode = AddressingMode_Eval(pThis, &pThis->parsedLine.operands);
     __catch
@@ -755,6 +1104,25 @@ static void handleOpcode(Assembler* pThis, const OpCodeEntry* pOpcodeEntry)
     }
 }
 
+static void handlePeepholeRewrite(Assembler* pThis)
+{
+    AddressingMode addressingMode;
+    
+    /* Rewrites found by an earlier pass are assembled in their optimized form and removed instructions emit no code. */
+    if (pThis->pLineInfo->peepholeRewrite == PEEPHOLE_ADC_TO_INC)
+    {
+        emitSingleByteInstruction(pThis, 0x1A);
+    }
+    else if (pThis->pLineInfo->peepholeRewrite == PEEPHOLE_JSR_TO_JMP)
+    {
+        __try
+            addressingMode = AddressingMode_Eval(pThis, &pThis->parsedLine.operands);
+        __catch
+            __nothrow;
+        emitThreeByteInstruction(pThis, 0x4C, addressingMode.expression.value);
+    }
+}
+
 static int isOpcodeSkippable(const OpCodeEntry* pOpcodeEntry)
 {
     return pOpcodeEntry->directiveHandler != handleELSE &&
@@ -785,6 +1153,7 @@ static void emitSingleByteInstruction(Assembler* pThis, unsigned char opCode)
         allocateLineInfoMachineCodeBytes(pThis, 1);
     __catch
         __nothrow;
+    pThis->pLineInfo->flags |= LINEINFO_FLAG_INSTRUCTION;
     pThis->pLineInfo->pMachineCode[0] = opCode;
 }
 
@@ -801,14 +1170,48 @@ static int isMachineCodeAlreadyAllocatedFromForwardReference(Assembler* pThis)
     return pThis->pLineInfo->pMachineCode != NULL;
 }
 
+static int recordRelaxationHint(Assembler* pThis);
 static void verifyThatMachineCodeSizeFromForwardReferenceMatches(Assembler* pThis, size_t bytesToAllocate)
 {
-    if (pThis->pLineInfo->machineCodeSize != bytesToAllocate)
-    {
+    if (pThis->pLineInfo->machineCodeSize == bytesToAllocate)
+        return;
+    
+    /* A forward reference which turned out to be in page zero gets fixed up by reassembling with a hint to use the
+       shorter form for this line right from the start. */
+    if (bytesToAllocate > pThis->pLineInfo->machineCodeSize || !recordRelaxationHint(pThis))
         LOG_ERROR(pThis, "Couldn't properly infer size of a forward reference in '%.*s' operand.", 
                   pThis->parsedLine.operands.stringLength, pThis->parsedLine.operands.pString);
-        __throw(invalidArgumentException);
+    __throw(invalidArgumentException);
+}
+
+static unsigned int getLineOrdinal(Assembler* pThis, LineInfo* pLineInfo);
+static int recordRelaxationHint(Assembler* pThis)
+{
+    if (pThis->relaxationPass >= MAXIMUM_RELAXATION_PASSES)
+        return FALSE;
+    
+    if (pThis->relaxationHintCount >= pThis->relaxationHintsAllocated)
+    {
+        size_t        newCount = pThis->relaxationHintsAllocated ? 2 * pThis->relaxationHintsAllocated : 16;
+        unsigned int* pRealloc = realloc(pThis->pRelaxationHints, newCount * sizeof(*pRealloc));
+        
+        if (!pRealloc)
+            return FALSE;
+        pThis->pRelaxationHints = pRealloc;
+        pThis->relaxationHintsAllocated = newCount;
     }
+    pThis->pRelaxationHints[pThis->relaxationHintCount++] = getLineOrdinal(pThis, pThis->pLineInfo);
+    return TRUE;
+}
+
+static unsigned int getLineOrdinal(Assembler* pThis, LineInfo* pLineInfo)
+{
+    LineInfo*    pCurr;
+    unsigned int lineOrdinal = 1;
+    
+    for (pCurr = pThis->linesHead.pNext ; pCurr != pLineInfo ; pCurr = pCurr->pNext)
+        lineOrdinal++;
+    return lineOrdinal;
 }
 
 static void reallocLineInfoMachineCodeBytes(Assembler* pThis, size_t bytesToAllocate)
@@ -843,11 +1246,17 @@ static void handleZeroPageAbsoluteOrRelativeAddressingMode(Assembler*         pT
                                             pOpcodeEntry->opcodeZeroPage, pOpcodeEntry->opcodeAbsolute);
 }
 
+static void handleRelativeOrLongBranch(Assembler* pThis, AddressingMode* pAddressingMode, unsigned char opcodeRelative);
 static void handleRelativeAddressingMode(Assembler* pThis, AddressingMode* pAddressingMode, unsigned char opcodeRelative)
 {
     unsigned short nextInstructionAddress = pThis->pLineInfo->address + 2;
     int            offset = (int)pAddressingMode->expression.value - (int)nextInstructionAddress;
     
+    if (pThis->pLineInfo->flags & LINEINFO_FLAG_ALLOW_LONG_BRANCH)
+    {
+        handleRelativeOrLongBranch(pThis, pAddressingMode, opcodeRelative);
+        return;
+    }
     if (!expressionContainsForwardReference(&pAddressingMode->expression) && (offset < -128 || offset > 127))
     {
         LOG_ERROR(pThis, "Relative offset of '%.*s' exceeds the allowed -128 to 127 range.", 
@@ -863,12 +1272,105 @@ static int expressionContainsForwardReference(Expression* pExpression)
     return pExpression->flags & EXPRESSION_FLAG_FORWARD_REFERENCE;
 }
 
+static int  isRelativeOffsetInRange(Assembler* pThis, unsigned short targetAddress);
+static void emitLongBranch(Assembler* pThis, unsigned char opcodeRelative, unsigned short targetAddress);
+static void requestRemovalOfRelaxationHint(Assembler* pThis);
+static void handleRelativeOrLongBranch(Assembler* pThis, AddressingMode* pAddressingMode, unsigned char opcodeRelative)
+{
+    unsigned short targetAddress = pAddressingMode->expression.value;
+    unsigned short offset = targetAddress - (pThis->pLineInfo->address + 2);
+    
+    if (expressionContainsForwardReference(&pAddressingMode->expression))
+    {
+        /* Forward branches start out short unless an earlier pass found them to be out of range. */
+        if (pThis->pLineInfo->flags & LINEINFO_FLAG_RELAXATION_HINT)
+            emitLongBranch(pThis, opcodeRelative, targetAddress);
+        else
+            emitTwoByteInstruction(pThis, opcodeRelative, offset);
+    }
+    else if (!isMachineCodeAlreadyAllocatedFromForwardReference(pThis))
+    {
+        if (isRelativeOffsetInRange(pThis, targetAddress))
+            emitTwoByteInstruction(pThis, opcodeRelative, offset);
+        else
+            emitLongBranch(pThis, opcodeRelative, targetAddress);
+    }
+    else if (pThis->pLineInfo->machineCodeSize == 2)
+    {
+        if (!isRelativeOffsetInRange(pThis, targetAddress) && !recordRelaxationHint(pThis))
+            LOG_ERROR(pThis, "Relative offset of '%.*s' exceeds the allowed -128 to 127 range.", 
+                      pThis->parsedLine.operands.stringLength, pThis->parsedLine.operands.pString);
+        emitTwoByteInstruction(pThis, opcodeRelative, offset);
+    }
+    else
+    {
+        emitLongBranch(pThis, opcodeRelative, targetAddress);
+        if (isRelativeOffsetInRange(pThis, targetAddress))
+            requestRemovalOfRelaxationHint(pThis);
+    }
+}
+
+static int isRelativeOffsetInRange(Assembler* pThis, unsigned short targetAddress)
+{
+    int offset = (int)targetAddress - (int)(pThis->pLineInfo->address + 2);
+    
+    return offset >= -128 && offset <= 127;
+}
+
+static void emitLongBranch(Assembler* pThis, unsigned char opcodeRelative, unsigned short targetAddress)
+{
+    /* BRA becomes a JMP and the other branches skip over a JMP with the opposite condition. */
+    int    isBranchAlways = opcodeRelative == 0x80;
+    size_t jmpOffset = isBranchAlways ? 0 : 2;
+    
+    __try
+        allocateLineInfoMachineCodeBytes(pThis, jmpOffset + 3);
+    __catch
+        __nothrow;
+    pThis->pLineInfo->flags |= LINEINFO_FLAG_INSTRUCTION | LINEINFO_FLAG_LONG_BRANCH;
+    if (!isBranchAlways)
+    {
+        pThis->pLineInfo->pMachineCode[0] = opcodeRelative ^ 0x20;
+        pThis->pLineInfo->pMachineCode[1] = 3;
+    }
+    pThis->pLineInfo->pMachineCode[jmpOffset] = 0x4C;
+    pThis->pLineInfo->pMachineCode[jmpOffset + 1] = LO_BYTE(targetAddress);
+    pThis->pLineInfo->pMachineCode[jmpOffset + 2] = HI_BYTE(targetAddress);
+}
+
+static void requestRemovalOfRelaxationHint(Assembler* pThis)
+{
+    unsigned int lineOrdinal;
+    size_t       i;
+    
+    if (pThis->relaxationPass >= MAXIMUM_RELAXATION_PASSES)
+        return;
+    lineOrdinal = getLineOrdinal(pThis, pThis->pLineInfo);
+    for (i = 0 ; i < pThis->relaxationHintsBeforePass ; i++)
+    {
+        if (pThis->pRelaxationHints[i] == lineOrdinal)
+        {
+            /* Line ordinals start at 1 so a 0 hint never matches and gets dropped before the next pass. */
+            pThis->pRelaxationHints[i] = 0;
+            pThis->relaxationHintsRemoved++;
+            return;
+        }
+    }
+}
+
+static int isZeroPageExpressionOrHint(Assembler* pThis, Expression* pExpression)
+{
+    if (expressionContainsForwardReference(pExpression))
+        return pThis->pLineInfo->flags & LINEINFO_FLAG_RELAXATION_HINT;
+    return pExpression->type == TYPE_ZEROPAGE;
+}
+
 static void handleZeroPageOrAbsoluteAddressingModes(Assembler*         pThis, 
                                                     AddressingMode*    pAddressingMode, 
                                                     unsigned char      opcodeZeroPage,
                                                     unsigned char      opcodeAbsolute)
 {
-    if (pAddressingMode->expression.type == TYPE_ZEROPAGE && opcodeZeroPage != _xXX)
+    if (isZeroPageExpressionOrHint(pThis, &pAddressingMode->expression) && opcodeZeroPage != _xXX)
         emitTwoByteInstruction(pThis, opcodeZeroPage, pAddressingMode->expression.value);
     else if (opcodeAbsolute != _xXX)
         emitThreeByteInstruction(pThis, opcodeAbsolute, pAddressingMode->expression.value);
@@ -882,6 +1384,7 @@ static void emitTwoByteInstruction(Assembler* pThis, unsigned char opCode, unsig
         allocateLineInfoMachineCodeBytes(pThis, 2);
     __catch
         __nothrow;
+    pThis->pLineInfo->flags |= LINEINFO_FLAG_INSTRUCTION;
     pThis->pLineInfo->pMachineCode[0] = opCode;
     pThis->pLineInfo->pMachineCode[1] = LO_BYTE(value);
 }
@@ -892,6 +1395,7 @@ static void emitThreeByteInstruction(Assembler* pThis, unsigned char opCode, uns
         allocateLineInfoMachineCodeBytes(pThis, 3);
     __catch
         __nothrow;
+    pThis->pLineInfo->flags |= LINEINFO_FLAG_INSTRUCTION;
     pThis->pLineInfo->pMachineCode[0] = opCode;
     pThis->pLineInfo->pMachineCode[1] = LO_BYTE(value);
     pThis->pLineInfo->pMachineCode[2] = HI_BYTE(value);
@@ -1478,6 +1982,46 @@ static void handleXC(Assembler* pThis)
     }
 }
 
+static void handleLBR(Assembler* pThis)
+{
+    if (0 == SizedString_strcasecmp(&pThis->parsedLine.operands, "OFF"))
+        pThis->flags &= ~ASSEMBLER_LBR;
+    else
+        pThis->flags |= ASSEMBLER_LBR;
+}
+
+static void handleLZ(Assembler* pThis)
+{
+    if (0 == SizedString_strcasecmp(&pThis->parsedLine.operands, "OFF"))
+        BinaryBuffer_SetCompression(pThis->pObjectBuffer, FALSE);
+    else
+        BinaryBuffer_SetCompression(pThis->pObjectBuffer, TRUE);
+}
+
+static void handleOPT(Assembler* pThis)
+{
+    if (0 == SizedString_strcasecmp(&pThis->parsedLine.operands, "OFF"))
+        pThis->flags &= ~ASSEMBLER_OPT;
+    else
+        pThis->flags |= ASSEMBLER_OPT;
+}
+
+static void handleTIMED(Assembler* pThis)
+{
+    if (0 == SizedString_strcasecmp(&pThis->parsedLine.operands, "OFF"))
+        pThis->flags &= ~ASSEMBLER_TIMED;
+    else
+        pThis->flags |= ASSEMBLER_TIMED;
+}
+
+static void handleCYC(Assembler* pThis)
+{
+    if (0 == SizedString_strcasecmp(&pThis->parsedLine.operands, "OFF"))
+        pThis->flags &= ~ASSEMBLER_CYC;
+    else
+        pThis->flags |= ASSEMBLER_CYC;
+}
+
 static void handlePUT(Assembler* pThis)
 {
     TextFile*    pIncludedFile = NULL;
@@ -1507,37 +2051,122 @@ static void handlePUT(Assembler* pThis)
     }
 }
 
+static TextFile* openCachedPutFile(Assembler* pThis, const SizedString* pFilename);
+static TextFile* openTextFileInDirectory(Vfs* pVfs, const SizedString* pDirectory, const SizedString* pFilename);
 static TextFile* openPutFileUsingSearchPath(Assembler* pThis, const SizedString* pFilename)
 {
+    Vfs*               pVfs = getVfs(pThis->pInitParams);
     TextFile*          pTextFile = NULL;
     size_t             fieldCount;
     const SizedString* pFields;
     size_t             i;
     
+    pTextFile = openCachedPutFile(pThis, pFilename);
+    if (pTextFile)
+        return pTextFile;
     if (!pThis->pPutSearchPath)
-        return TextFile_CreateFromFile(NULL, pFilename, ".S");
+        return TextFile_CreateFromVfsFile(pVfs, NULL, pFilename, ".S");
         
     fieldCount = ParseCSV_FieldCount(pThis->pPutSearchPath);
     pFields = ParseCSV_FieldPointers(pThis->pPutSearchPath);
     for (i = 0 ; i < fieldCount ; i++)
     {
-        __try
-        {
-            pTextFile = TextFile_CreateFromFile(&pFields[i], pFilename, ".S");
+        pTextFile = openTextFileInDirectory(pVfs, &pFields[i], pFilename);
+        if (pTextFile)
             break;
-        }
-        __catch
-        {
-            // Failed to open in this directory so clear exception and try again.
-            clearExceptionCode();
-        }
     }
     
     if (i == fieldCount)
         __throw(fileOpenException);
+    __try
+    {
+        rememberPutFileDirectory(pThis, pFilename, i);
+    }
+    __catch
+    {
+        TextFile_Free(pTextFile);
+        __rethrow;
+    }
     return pTextFile;
 }
 
+static TextFile* takePrefetchedPutFile(PutFileEntry* pEntry);
+static TextFile* openCachedPutFile(Assembler* pThis, const SizedString* pFilename)
+{
+    PutFileEntry* pEntry = findPutFileEntry(pThis, pFilename);
+    
+    if (!pEntry)
+        return NULL;
+    if (pEntry->pPrefetchedFile)
+        return takePrefetchedPutFile(pEntry);
+    return openTextFileInDirectory(getVfs(pThis->pInitParams), getPutDirectory(pThis, pEntry->directoryIndex), 
+                                   pFilename);
+}
+
+static TextFile* takePrefetchedPutFile(PutFileEntry* pEntry)
+{
+    FILE* pFile = pEntry->pPrefetchedFile;
+    
+    /* TextFile_CreateFromOpenFile() closes the file even if it fails. */
+    pEntry->pPrefetchedFile = NULL;
+    return TextFile_CreateFromOpenFile(pFile, pEntry->pPrefetchedFilename);
+}
+
+static TextFile* openTextFileInDirectory(Vfs* pVfs, const SizedString* pDirectory, const SizedString* pFilename)
+{
+    TextFile* pTextFile = NULL;
+    
+    __try
+    {
+        pTextFile = TextFile_CreateFromVfsFile(pVfs, pDirectory, pFilename, ".S");
+    }
+    __catch
+    {
+        /* Failed to open in this directory so clear exception and let caller try the next one. */
+        __nothrow_and_return(NULL);
+    }
+    return pTextFile;
+}
+
+static PutFileEntry* rememberPutFileDirectory(Assembler* pThis, const SizedString* pFilename, size_t directoryIndex)
+{
+    PutFileEntry* pEntry = findPutFileEntry(pThis, pFilename);
+    
+    if (pEntry)
+    {
+        pEntry->directoryIndex = directoryIndex;
+        return pEntry;
+    }
+    
+    pEntry = allocateAndZero(sizeof(*pEntry));
+    __try
+    {
+        pEntry->pName = SizedString_strdup(pFilename);
+    }
+    __catch
+    {
+        free(pEntry);
+        __rethrow;
+    }
+    pEntry->directoryIndex = directoryIndex;
+    pEntry->pNext = pThis->pPutFiles;
+    pThis->pPutFiles = pEntry;
+    
+    return pEntry;
+}
+
+static PutFileEntry* findPutFileEntry(Assembler* pThis, const SizedString* pFilename)
+{
+    PutFileEntry* pEntry;
+    
+    for (pEntry = pThis->pPutFiles ; pEntry ; pEntry = pEntry->pNext)
+    {
+        if (0 == SizedString_strcmp(pFilename, pEntry->pName))
+            return pEntry;
+    }
+    return NULL;
+}
+
 static int isProcessingTextFromPutFile(Assembler* pThis)
 {
     return TextSource_StackDepth(pThis->pTextSourceStack) > 1;
@@ -1883,14 +2512,134 @@ static void checkForOpenConditionals(Assembler* pThis)
         LOG_LINE_WARNING(pThis, pThis->pConditionals->pLineInfo, "%s directive is missing matching FIN directive.", "DO/IF");
 }
 
+static void chainBranches(Assembler* pThis)
+{
+    if (pThis->errorCount > 0)
+        return;
+    Peephole_ChainBranches(pThis->linesHead.pNext);
+}
+
+static int  isTimingCriticalInstruction(LineInfo* pLineInfo);
+static void checkTimingCriticalBranch(Assembler* pThis, LineInfo* pLineInfo);
+static void checkTimingCriticalTableAccess(Assembler* pThis, LineInfo* pLineInfo);
+static void checkTimingCriticalLines(Assembler* pThis)
+{
+    LineInfo* pCurr;
+    
+    for (pCurr = pThis->linesHead.pNext ; pCurr ; pCurr = pCurr->pNext)
+    {
+        OpcodeCycles cycles;
+        
+        if (!isTimingCriticalInstruction(pCurr))
+            continue;
+        cycles = OpcodeCycles_Get(pCurr->instructionSet, pCurr->address, pCurr->pMachineCode, pCurr->machineCodeSize);
+        if (cycles.isBranch && cycles.maxCycles - cycles.minCycles > 1)
+            checkTimingCriticalBranch(pThis, pCurr);
+        else if (!cycles.isBranch && cycles.maxCycles > cycles.minCycles && pCurr->machineCodeSize == 3)
+            checkTimingCriticalTableAccess(pThis, pCurr);
+    }
+}
+
+static int isTimingCriticalInstruction(LineInfo* pLineInfo)
+{
+    const unsigned int flags = LINEINFO_FLAG_TIMING_CRITICAL | LINEINFO_FLAG_INSTRUCTION;
+    
+    return (pLineInfo->flags & flags) == flags && !(pLineInfo->flags & CONDITIONAL_SKIP_STATES_MASK);
+}
+
+static unsigned short getPaddingToMoveToStartOfNextPage(unsigned short address);
+static void checkTimingCriticalBranch(Assembler* pThis, LineInfo* pLineInfo)
+{
+    unsigned short nextInstructionAddress = pLineInfo->address + 2;
+    unsigned short targetAddress = nextInstructionAddress + (signed char)pLineInfo->pMachineCode[1];
+    unsigned short paddingAddress = targetAddress < nextInstructionAddress ? targetAddress : pLineInfo->address;
+    unsigned short lowestAddress = targetAddress < nextInstructionAddress ? targetAddress : nextInstructionAddress;
+
+    /* Padding inserted before the lower of the two addresses moves both of them so that they share a page. */
+    LOG_LINE_WARNING(pThis, pLineInfo, 
+                     "Taken branch from $%04X to $%04X crosses a page in timing critical code. "
+                     "Padding $%04X with %u bytes would fix it.", 
+                     pLineInfo->address, targetAddress, paddingAddress, getPaddingToMoveToStartOfNextPage(lowestAddress));
+}
+
+static unsigned short getPaddingToMoveToStartOfNextPage(unsigned short address)
+{
+    return 0x100 - (address & 0xFF);
+}
+
+static LineInfo*    findLabelledDataLineContainingAddress(Assembler* pThis, unsigned short address);
+static unsigned int getLabelledDataSize(LineInfo* pLabelledLine);
+static void checkTimingCriticalTableAccess(Assembler* pThis, LineInfo* pLineInfo)
+{
+    unsigned short baseAddress = pLineInfo->pMachineCode[1] | (pLineInfo->pMachineCode[2] << 8);
+    LineInfo*      pTableLine = findLabelledDataLineContainingAddress(pThis, baseAddress);
+    unsigned int   tableSize;
+    unsigned int   tableEnd;
+    
+    /* Only tables laid out by this source have a known extent. */
+    if (!pTableLine)
+        return;
+    tableSize = getLabelledDataSize(pTableLine);
+    tableEnd = pTableLine->address + tableSize - 1;
+    if ((baseAddress & 0xFF00) == (tableEnd & 0xFF00))
+        return;
+    
+    if (tableSize > 0x100)
+        LOG_LINE_WARNING(pThis, pLineInfo, 
+                         "Indexed access to $%04X-$%04X crosses a page in timing critical code. "
+                         "The %u byte table can't fit in one page.", 
+                         baseAddress, tableEnd, tableSize);
+    else
+        LOG_LINE_WARNING(pThis, pLineInfo, 
+                         "Indexed access to $%04X-$%04X crosses a page in timing critical code. "
+                         "Padding $%04X with %u bytes would fix it.", 
+                         baseAddress, tableEnd, pTableLine->address, getPaddingToMoveToStartOfNextPage(pTableLine->address));
+}
+
+static LineInfo* findLabelledDataLineContainingAddress(Assembler* pThis, unsigned short address)
+{
+    LineInfo* pCurr;
+    
+    for (pCurr = pThis->linesHead.pNext ; pCurr ; pCurr = pCurr->pNext)
+    {
+        unsigned int size;
+        
+        if (!LineInfo_IsLabelled(pCurr) || pCurr->address > address)
+            continue;
+        size = getLabelledDataSize(pCurr);
+        if (size > 0 && address < pCurr->address + size)
+            return pCurr;
+    }
+    return NULL;
+}
+
+static unsigned int getLabelledDataSize(LineInfo* pLabelledLine)
+{
+    LineInfo*    pCurr = pLabelledLine;
+    unsigned int size = 0;
+    
+    /* The table runs from its label through the contiguous data which follows, up to the next label. */
+    do
+    {
+        if (pCurr->flags & LINEINFO_FLAG_INSTRUCTION)
+            break;
+        if (pCurr->machineCodeSize > 0 && pCurr->address != pLabelledLine->address + size)
+            break;
+        size += pCurr->machineCodeSize;
+        pCurr = pCurr->pNext;
+    } while (pCurr && !LineInfo_IsLabelled(pCurr));
+    
+    return size;
+}
+
 static void secondPass(Assembler* pThis)
 {
     outputListFile(pThis);
-    if (pThis->errorCount > 0)
+    if (pThis->errorCount > 0 || shouldKeepObjectsInMemory(pThis->pInitParams))
         return;
     __try
     {
-        BinaryBuffer_ProcessWriteFileQueue(pThis->pObjectBuffer);
+        BinaryBuffer_ProcessWriteFileQueue(pThis->pObjectBuffer, getVfs(pThis->pInitParams));
     }
     __catch
     {
@@ -1899,6 +2648,11 @@ static void secondPass(Assembler* pThis)
     }
 }
 
+static int shouldKeepObjectsInMemory(const AssemblerInitParams* pParams)
+{
+    return pParams ? pParams->keepObjectsInMemory : FALSE;
+}
+
 static void outputListFile(Assembler* pThis)
 {
     LineInfo* pCurr = pThis->linesHead.pNext;
@@ -1923,6 +2677,41 @@ unsigned int Assembler_GetWarningCount(Assembler* pThis)
 }
 
 
+void Assembler_ObjectFileEnumStart(Assembler* pThis)
+{
+    BinaryBuffer_WriteFileQueueEnumStart(pThis->pObjectBuffer);
+}
+
+
+int Assembler_ObjectFileEnumNext(Assembler* pThis, BinaryBufferOutput* pOutput)
+{
+    return BinaryBuffer_WriteFileQueueEnumNext(pThis->pObjectBuffer, pOutput);
+}
+
+
+LineInfo* Assembler_GetFirstLine(Assembler* pThis)
+{
+    return pThis->linesHead.pNext;
+}
+
+
+__throws unsigned short Assembler_GetLabelValue(Assembler*               pThis, 
+                                                const char*              pLabelName, 
+                                                InstructionSetSupported* pInstructionSet)
+{
+    SizedString globalLabel = SizedString_InitFromString(pLabelName);
+    SizedString localLabel = SizedString_InitFromString(NULL);
+    Symbol*     pSymbol = SymbolTable_Find(pThis->pSymbols, &globalLabel, &localLabel);
+    
+    if (!pSymbol || !pSymbol->pDefinedLine)
+        __throw(invalidArgumentException);
+    if (pInstructionSet)
+        *pInstructionSet = pSymbol->pDefinedLine->instructionSet;
+    
+    return pSymbol->expression.value;
+}
+
+
 static void throwIfForwardReferencesAreDisallowed(Assembler* pThis);
 static int areForwardReferencesDisallowed(Assembler* pThis);
 __throws Symbol* Assembler_FindLabel(Assembler* pThis, SizedString* pLabelName)
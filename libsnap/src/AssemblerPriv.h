@@ -32,6 +32,13 @@
 
 /* Bits in the Assembler::flags fields. */
 #define ASSEMBLER_LUP       1
+#define ASSEMBLER_CYC       2
+#define ASSEMBLER_TIMED     4
+#define ASSEMBLER_LBR       8
+#define ASSEMBLER_OPT       16
+
+/* Maximum number of times that the source will be reassembled to shrink forward references to page zero. */
+#define MAXIMUM_RELAXATION_PASSES 16
 
 /* Bits in the Conditional::flags field. */
 #define CONDITIONAL_SKIP_SOURCE           1
@@ -60,6 +67,23 @@ typedef struct OpCodeEntry
 } OpCodeEntry;
 
 
+typedef struct PeepholeHint
+{
+    unsigned int    lineOrdinal;
+    PeepholeRewrite rewrite;
+} PeepholeHint;
+
+
+typedef struct PutFileEntry
+{
+    struct PutFileEntry* pNext;
+    char*                pName;
+    char*                pPrefetchedFilename;
+    FILE*                pPrefetchedFile;
+    size_t               directoryIndex;
+} PutFileEntry;
+
+
 typedef struct Conditional
 {
     struct Conditional* pPrev;
@@ -76,6 +100,7 @@ struct Assembler
     ListFile*                  pListFile;
     FILE*                      pFileForListing;
     ParseCSV*                  pPutSearchPath;
+    PutFileEntry*              pPutFiles;
     LineInfo*                  pLineInfo;
     SizedString                globalLabel;
     Conditional*               pConditionals;
@@ -86,6 +111,17 @@ struct Assembler
     size_t                     instructionSetSizes[INSTRUCTION_SET_INVALID];
     ParsedLine                 parsedLine;
     LineInfo                   linesHead;
+    unsigned int*              pRelaxationHints;
+    size_t                     relaxationHintCount;
+    size_t                     relaxationHintsAllocated;
+    size_t                     relaxationHintsBeforePass;
+    size_t                     relaxationHintsRemoved;
+    size_t                     nextRelaxationHint;
+    PeepholeHint*              pPeepholeHints;
+    size_t                     peepholeHintCount;
+    size_t                     nextPeepholeHint;
+    unsigned int               lineOrdinal;
+    unsigned int               relaxationPass;
     InstructionSetSupported    instructionSet;
     unsigned int               flags;
     unsigned int               errorCount;
@@ -101,7 +137,9 @@ struct Assembler
 #define LOG_LINE_ERROR(pASSEMBLER, pLINEINFO, FORMAT, ...) LOG_ISSUE(pLINEINFO, "error", FORMAT, __VA_ARGS__), \
                                            pASSEMBLER->errorCount++
 
-#define LOG_WARNING(pASSEMBLER, FORMAT, ...) LOG_ISSUE(pASSEMBLER->pLineInfo, "warning", FORMAT, __VA_ARGS__), \
+/* Warnings were already issued by the first pass so they aren't repeated when relaxation reassembles the source. */
+#define LOG_WARNING(pASSEMBLER, FORMAT, ...) (pASSEMBLER->relaxationPass ? 0 : \
+                                             LOG_ISSUE(pASSEMBLER->pLineInfo, "warning", FORMAT, __VA_ARGS__)), \
                                            pASSEMBLER->warningCount++
 
 #define LOG_LINE_WARNING(pASSEMBLER, pLINEINFO, FORMAT, ...) LOG_ISSUE(pLINEINFO, "warning", FORMAT, __VA_ARGS__), \
@@ -13,6 +13,7 @@
 #include <string.h>
 #include "BinaryBuffer.h"
 #include "BinaryBufferTest.h"
+#include "LzPack.h"
 #include "util.h"
 
 
@@ -20,7 +21,9 @@ typedef struct FileWriteEntry
 {
     struct FileWriteEntry* pNext;
     unsigned char*         pBase;
+    unsigned char*         pCompressed;
     size_t                 contentLength;
+    size_t                 compressedLength;
     size_t                 headerLength;
     union
     {
@@ -41,8 +44,10 @@ struct BinaryBuffer
     unsigned char*  pBase;
     FileWriteEntry* pFileWriteHead;
     FileWriteEntry* pFileWriteTail;
+    FileWriteEntry* pFileWriteEnum;
     size_t          allocationToFail;
     unsigned short  baseAddress;
+    int             compressOutput;
 };
 
 static void* allocateAndZero(size_t sizeToAllocate);
@@ -81,6 +86,7 @@ static void freeFileWriteEntries(BinaryBuffer* pThis)
     while (pEntry)
     {
         FileWriteEntry* pNext = pEntry->pNext;
+        free(pEntry->pCompressed);
         free(pEntry);
         pEntry = pNext;
     }
@@ -146,6 +152,12 @@ unsigned short BinaryBuffer_GetOrigin(BinaryBuffer* pThis)
 }
 
 
+void BinaryBuffer_SetCompression(BinaryBuffer* pThis, int compressOutput)
+{
+    pThis->compressOutput = compressOutput;
+}
+
+
 static FileWriteEntry* queueWriteToFile(BinaryBuffer* pThis, 
                                         const char*   pDirectoryName, 
                                         SizedString*  pFilename,
@@ -155,6 +167,7 @@ static void initializeBaseFileWriteEntry(BinaryBuffer*   pThis,
                                          const char*     pDirectoryName,
                                          SizedString*    pFilename,
                                          const char*     pFilenameSuffix);
+static void allocateCompressionBufferIfNeeded(BinaryBuffer* pThis, FileWriteEntry* pEntry);
 static void addFileWriteEntryToList(BinaryBuffer* pThis, FileWriteEntry* pEntry);
 __throws void BinaryBuffer_QueueWriteToFile(BinaryBuffer* pThis, 
                                             const char*   pDirectoryName, 
@@ -162,12 +175,15 @@ __throws void BinaryBuffer_QueueWriteToFile(BinaryBuffer* pThis,
                                             const char*   pFilenameSuffix)
 {
     static const unsigned char signature[4] = BINARY_BUFFER_SAV_SIGNATURE;
+    static const unsigned char lzSignature[4] = BINARY_BUFFER_LZSAV_SIGNATURE;
     FileWriteEntry*            pEntry = NULL;
     
     __try
     {
         pEntry = queueWriteToFile(pThis, pDirectoryName, pFilename, pFilenameSuffix);
-        memcpy(pEntry->savFileHeader.signature, signature, sizeof(pEntry->savFileHeader.signature));
+        memcpy(pEntry->savFileHeader.signature, 
+               pEntry->pCompressed ? lzSignature : signature, 
+               sizeof(pEntry->savFileHeader.signature));
         pEntry->savFileHeader.address = pThis->baseAddress;
         pEntry->savFileHeader.length = pEntry->contentLength;
         pEntry->headerLength = sizeof(pEntry->savFileHeader);
@@ -189,6 +205,7 @@ static FileWriteEntry* queueWriteToFile(BinaryBuffer* pThis,
     {
         pEntry = allocateAndZero(sizeof(*pEntry));
         initializeBaseFileWriteEntry(pThis, pEntry, pDirectoryName, pFilename, pFilenameSuffix);
+        allocateCompressionBufferIfNeeded(pThis, pEntry);
         addFileWriteEntryToList(pThis, pEntry);
     }
     __catch
@@ -226,6 +243,16 @@ static void initializeBaseFileWriteEntry(BinaryBuffer*   pThis,
     pEntry->contentLength = pThis->pCurrent - pThis->pBase;
 }
 
+static void allocateCompressionBufferIfNeeded(BinaryBuffer* pThis, FileWriteEntry* pEntry)
+{
+    /* The content is only compressed once it is written out since forward references can still patch it. */
+    if (!pThis->compressOutput)
+        return;
+    pEntry->pCompressed = malloc(LzPack_MaximumCompressedSize(pEntry->contentLength));
+    if (!pEntry->pCompressed)
+        __throw(outOfMemoryException);
+}
+
 static void addFileWriteEntryToList(BinaryBuffer* pThis, FileWriteEntry* pEntry)
 {
     if (!pThis->pFileWriteTail)
@@ -250,10 +277,13 @@ __throws void BinaryBuffer_QueueRW18WriteToFile(BinaryBuffer*  pThis,
                                                 unsigned short offset)
 {
     static const unsigned char signature[4] = BINARY_BUFFER_RW18SAV_SIGNATURE;
+    static const unsigned char lzSignature[4] = BINARY_BUFFER_LZRW18SAV_SIGNATURE;
     FileWriteEntry*            pEntry = NULL;
     
     pEntry = queueWriteToFile(pThis, pDirectoryName, pFilename, pFilenameSuffix);
-    memcpy(pEntry->rw18FileHeader.signature, signature, sizeof(pEntry->rw18FileHeader.signature));
+    memcpy(pEntry->rw18FileHeader.signature, 
+           pEntry->pCompressed ? lzSignature : signature, 
+           sizeof(pEntry->rw18FileHeader.signature));
     pEntry->rw18FileHeader.side = side;
     pEntry->rw18FileHeader.track = track;
     pEntry->rw18FileHeader.offset = offset;
@@ -262,8 +292,10 @@ __throws void BinaryBuffer_QueueRW18WriteToFile(BinaryBuffer*  pThis,
 }
 
 
-static void writeEntryToDisk(FileWriteEntry* pEntry);
-__throws void BinaryBuffer_ProcessWriteFileQueue(BinaryBuffer* pThis)
+static void writeEntryToDisk(FileWriteEntry* pEntry, Vfs* pVfs);
+static void compressEntryIfNeeded(FileWriteEntry* pEntry);
+static int isRW18Entry(FileWriteEntry* pEntry);
+__throws void BinaryBuffer_ProcessWriteFileQueue(BinaryBuffer* pThis, Vfs* pVfs)
 {
     FileWriteEntry* pEntry = pThis->pFileWriteHead;
     int             exceptionThrown = noException;
@@ -271,7 +303,7 @@ __throws void BinaryBuffer_ProcessWriteFileQueue(BinaryBuffer* pThis)
     while (pEntry)
     {
         __try
-            writeEntryToDisk(pEntry);
+            writeEntryToDisk(pEntry, pVfs);
         __catch
             exceptionThrown = getExceptionCode();
         pEntry = pEntry->pNext;
@@ -281,18 +313,86 @@ __throws void BinaryBuffer_ProcessWriteFileQueue(BinaryBuffer* pThis)
         __throw(exceptionThrown);
 }
 
-static void writeEntryToDisk(FileWriteEntry* pEntry)
+static void writeEntryToDisk(FileWriteEntry* pEntry, Vfs* pVfs)
 {
+    const unsigned char*       pContent = pEntry->pBase;
+    size_t                     contentLength = pEntry->contentLength;
     size_t                     bytesWritten;
     FILE*                      pFile;
     
-    pFile = fopen(pEntry->filename, "wb");
+    compressEntryIfNeeded(pEntry);
+    if (pEntry->pCompressed)
+    {
+        pContent = pEntry->pCompressed;
+        contentLength = pEntry->compressedLength;
+    }
+    
+    pFile = Vfs_Open(pVfs, pEntry->filename, "wb");
     if (!pFile)
         __throw(fileException);
     
     bytesWritten = fwrite(&pEntry->savFileHeader, 1, pEntry->headerLength, pFile);
-    bytesWritten += fwrite(pEntry->pBase, 1, pEntry->contentLength, pFile);
+    bytesWritten += fwrite(pContent, 1, contentLength, pFile);
     fclose(pFile);
-    if (bytesWritten != pEntry->contentLength + pEntry->headerLength)
+    if (bytesWritten != contentLength + pEntry->headerLength)
         __throw(fileException);
 }
+
+static void compressEntryIfNeeded(FileWriteEntry* pEntry)
+{
+    if (!pEntry->pCompressed)
+        return;
+    
+    pEntry->compressedLength = LzPack_Compress(pEntry->pCompressed, pEntry->pBase, pEntry->contentLength);
+    if (isRW18Entry(pEntry))
+        pEntry->rw18FileHeader.length = pEntry->compressedLength;
+    else
+        pEntry->savFileHeader.length = pEntry->compressedLength;
+}
+
+
+void BinaryBuffer_WriteFileQueueEnumStart(BinaryBuffer* pThis)
+{
+    pThis->pFileWriteEnum = pThis->pFileWriteHead;
+}
+
+int BinaryBuffer_WriteFileQueueEnumNext(BinaryBuffer* pThis, BinaryBufferOutput* pOutput)
+{
+    FileWriteEntry* pEntry = pThis->pFileWriteEnum;
+    
+    if (!pEntry)
+        return FALSE;
+    
+    compressEntryIfNeeded(pEntry);
+    memset(pOutput, 0, sizeof(*pOutput));
+    pOutput->pFilename = pEntry->filename;
+    pOutput->pContent = pEntry->pBase;
+    pOutput->contentLength = pEntry->contentLength;
+    pOutput->baseAddress = pEntry->baseAddress;
+    if (pEntry->pCompressed)
+    {
+        pOutput->isCompressed = TRUE;
+        pOutput->pCompressedContent = pEntry->pCompressed;
+        pOutput->compressedLength = pEntry->compressedLength;
+    }
+    if (isRW18Entry(pEntry))
+    {
+        pOutput->isRW18 = TRUE;
+        pOutput->side = pEntry->rw18FileHeader.side;
+        pOutput->track = pEntry->rw18FileHeader.track;
+        pOutput->offset = pEntry->rw18FileHeader.offset;
+    }
+    pThis->pFileWriteEnum = pEntry->pNext;
+    
+    return TRUE;
+}
+
+static int isRW18Entry(FileWriteEntry* pEntry)
+{
+    static const unsigned char signature[4] = BINARY_BUFFER_RW18SAV_SIGNATURE;
+    static const unsigned char lzSignature[4] = BINARY_BUFFER_LZRW18SAV_SIGNATURE;
+
+    return pEntry->headerLength == sizeof(pEntry->rw18FileHeader) &&
+           (0 == memcmp(pEntry->rw18FileHeader.signature, signature, sizeof(signature)) ||
+            0 == memcmp(pEntry->rw18FileHeader.signature, lzSignature, sizeof(lzSignature)));
+}
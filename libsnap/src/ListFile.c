@@ -13,14 +13,29 @@
 #include <string.h>
 #include "ListFile.h"
 #include "ListFileTest.h"
+#include "OpcodeCycles.h"
 #include "util.h"
 
+/* Appended to lines which were changed by a peephole rewrite, indexed by PeepholeRewrite. */
+static const char* g_peepholeRewriteNotes[] =
+{
+    "",
+    "  (optimized: JSR/RTS to JMP)",
+    "  (optimized: RTS removed)",
+    "  (optimized: redundant load removed)",
+    "  (optimized: CLC removed)",
+    "  (optimized: CLC/ADC #1 to INC)",
+    "  (optimized: chained branch)"
+};
+
 struct ListFile
 {
     FILE*          pFile;
     unsigned char* pMachineCode;
     size_t         machineCodeSize;
     int            flags;
+    unsigned int   minCyclesTotal;
+    unsigned int   maxCyclesTotal;
     unsigned short address;
 };
 
@@ -44,30 +59,95 @@ void ListFile_Free(ListFile* pThis)
 }
 
 
+void ListFile_OutputLine(ListFile* pThis, LineInfo* pLineInfo)
+{
+    ListFile_OutputAnnotatedLine(pThis, pLineInfo, "");
+}
+
+
 static void initMachineCodeFields(ListFile* pThis, LineInfo* pLineInfo);
 static void fillAddressBuffer(LineInfo* pLineInfo, char* pOutputBuffer);
 static void fillMachineCodeOrSymbolBuffer(ListFile* pThis, LineInfo* pLineInfo, char* pOutputBuffer);
 static void fillMachineCodeBuffer(ListFile* pThis, char* pOutputBuffer);
 static void listOverflowMachineCodeLine(ListFile* pThis);
-void ListFile_OutputLine(ListFile* pThis, LineInfo* pLineInfo)
+static void fillCyclesBuffer(ListFile* pThis, LineInfo* pLineInfo, char* pOutputBuffer);
+void ListFile_OutputAnnotatedLine(ListFile* pThis, LineInfo* pLineInfo, const char* pAnnotation)
 {
     char           addressString[4+1] = "    ";
     char           machineCodeOrSymbol[2+1+2+1+2+1] = "        ";
+    char           cycles[64] = "";
     
+    fillCyclesBuffer(pThis, pLineInfo, cycles);
     initMachineCodeFields(pThis, pLineInfo);
     fillAddressBuffer(pLineInfo, addressString);
     fillMachineCodeOrSymbolBuffer(pThis, pLineInfo, machineCodeOrSymbol);
-    fprintf(pThis->pFile, "%4s: %8s %*s% 5d %.*s" LINE_ENDING, 
+    fprintf(pThis->pFile, "%4s: %8s %*s% 5d %.*s%s%s%s%s" LINE_ENDING, 
             addressString,
             machineCodeOrSymbol,
             pLineInfo->indentation, "",
             pLineInfo->lineNumber, 
-            pLineInfo->lineText.stringLength, pLineInfo->lineText.pString);
+            pLineInfo->lineText.stringLength, pLineInfo->lineText.pString,
+            (pLineInfo->flags & LINEINFO_FLAG_LONG_BRANCH) ? "  (long branch)" : "",
+            g_peepholeRewriteNotes[pLineInfo->peepholeRewrite],
+            cycles,
+            pAnnotation);
             
     while (pThis->machineCodeSize > 0)
         listOverflowMachineCodeLine(pThis);
 }
 
+static void fillCyclesText(char* pOutputBuffer, OpcodeCycles* pCycles);
+static void fillTotalText(char* pOutputBuffer, unsigned int minTotal, unsigned int maxTotal);
+static void fillCyclesBuffer(ListFile* pThis, LineInfo* pLineInfo, char* pOutputBuffer)
+{
+    OpcodeCycles cycles;
+    char         cyclesText[16];
+    char         totalText[24];
+    
+    /* Running totals cover the instructions from the most recent label (or CYC directive) up to this line. */
+    if (!(pLineInfo->flags & LINEINFO_FLAG_CYCLES) || LineInfo_IsLabelled(pLineInfo))
+        pThis->minCyclesTotal = pThis->maxCyclesTotal = 0;
+    if ((pLineInfo->flags & (LINEINFO_FLAG_CYCLES | LINEINFO_FLAG_INSTRUCTION)) != 
+        (LINEINFO_FLAG_CYCLES | LINEINFO_FLAG_INSTRUCTION))
+        return;
+    cycles = OpcodeCycles_Get(pLineInfo->instructionSet, pLineInfo->address, pLineInfo->pMachineCode, 
+                              (pLineInfo->flags & LINEINFO_FLAG_LONG_BRANCH) ? 2 : pLineInfo->machineCodeSize);
+    if (cycles.maxCycles == 0)
+        return;
+    if ((pLineInfo->flags & LINEINFO_FLAG_LONG_BRANCH) && cycles.isBranch)
+    {
+        /* The inverted branch is taken when the original isn't and falls through to the JMP when it is. */
+        unsigned int notTakenCycles = cycles.maxCycles;
+        
+        cycles.maxCycles = cycles.minCycles + 3;
+        cycles.minCycles = notTakenCycles;
+    }
+        
+    pThis->minCyclesTotal += cycles.minCycles;
+    pThis->maxCyclesTotal += cycles.maxCycles;
+    fillCyclesText(cyclesText, &cycles);
+    fillTotalText(totalText, pThis->minCyclesTotal, pThis->maxCyclesTotal);
+    sprintf(pOutputBuffer, "  (cycles %s, total %s)", cyclesText, totalText);
+}
+
+static void fillCyclesText(char* pOutputBuffer, OpcodeCycles* pCycles)
+{
+    if (pCycles->isBranch)
+        sprintf(pOutputBuffer, "%u/%u", pCycles->minCycles, pCycles->maxCycles);
+    else if (pCycles->maxCycles != pCycles->minCycles)
+        sprintf(pOutputBuffer, "%u+%u", pCycles->minCycles, pCycles->maxCycles - pCycles->minCycles);
+    else
+        sprintf(pOutputBuffer, "%u", pCycles->minCycles);
+}
+
+static void fillTotalText(char* pOutputBuffer, unsigned int minTotal, unsigned int maxTotal)
+{
+    if (maxTotal != minTotal)
+        sprintf(pOutputBuffer, "%u-%u", minTotal, maxTotal);
+    else
+        sprintf(pOutputBuffer, "%u", minTotal);
+}
+
 static void initMachineCodeFields(ListFile* pThis, LineInfo* pLineInfo)
 {
     pThis->address = pLineInfo->address;
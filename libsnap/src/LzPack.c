@@ -0,0 +1,159 @@
+/*  Copyright (C) 2012  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include "LzPack.h"
+#include "util.h"
+
+
+/* Matches are found by hashing the next 4 bytes and looking up the last location which had the same hash. */
+#define HASH_BITS   12
+#define HASH_SIZE   (1 << HASH_BITS)
+
+
+size_t LzPack_MaximumCompressedSize(size_t srcLength)
+{
+    size_t literalRunCount = (srcLength + LZPACK_MAXIMUM_LITERALS - 1) / LZPACK_MAXIMUM_LITERALS;
+    
+    return srcLength + literalRunCount + 1;
+}
+
+
+static unsigned int hashNextBytes(const unsigned char* p);
+static size_t matchLength(const unsigned char* p1, const unsigned char* p2, const unsigned char* pEnd);
+static unsigned char* emitLiterals(unsigned char* pDest, const unsigned char* pLiterals, size_t literalCount);
+size_t LzPack_Compress(unsigned char* pDest, const unsigned char* pSrc, size_t srcLength)
+{
+    /* Entries hold the offset of the last location with that hash + 1 so that 0 can mean unused. */
+    size_t               hashTable[HASH_SIZE];
+    const unsigned char* pEnd = pSrc + srcLength;
+    const unsigned char* pCurr = pSrc;
+    const unsigned char* pLiterals = pSrc;
+    unsigned char*       pOut = pDest;
+    
+    memset(hashTable, 0, sizeof(hashTable));
+    while (pEnd - pCurr >= LZPACK_MINIMUM_MATCH)
+    {
+        unsigned int         hash = hashNextBytes(pCurr);
+        const unsigned char* pCandidate = hashTable[hash] ? pSrc + hashTable[hash] - 1 : NULL;
+        const unsigned char* pMatchEnd;
+        size_t               length;
+        size_t               distance;
+        
+        hashTable[hash] = pCurr - pSrc + 1;
+        if (!pCandidate || (size_t)(pCurr - pCandidate) > LZPACK_MAXIMUM_DISTANCE)
+        {
+            pCurr++;
+            continue;
+        }
+        length = matchLength(pCandidate, pCurr, pEnd);
+        if (length < LZPACK_MINIMUM_MATCH)
+        {
+            pCurr++;
+            continue;
+        }
+        
+        distance = pCurr - pCandidate;
+        pOut = emitLiterals(pOut, pLiterals, pCurr - pLiterals);
+        *pOut++ = LZPACK_MATCH_TOKEN | (length - LZPACK_MINIMUM_MATCH);
+        *pOut++ = LO_BYTE(distance);
+        *pOut++ = HI_BYTE(distance);
+        
+        /* Hash the locations within the match as well so that later repeats of them can be found. */
+        pMatchEnd = pCurr + length;
+        while (++pCurr < pMatchEnd && pEnd - pCurr >= LZPACK_MINIMUM_MATCH)
+            hashTable[hashNextBytes(pCurr)] = pCurr - pSrc + 1;
+        pCurr = pMatchEnd;
+        pLiterals = pCurr;
+    }
+    pOut = emitLiterals(pOut, pLiterals, pEnd - pLiterals);
+    *pOut++ = LZPACK_END_TOKEN;
+    
+    return pOut - pDest;
+}
+
+static unsigned int hashNextBytes(const unsigned char* p)
+{
+    unsigned int value = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+    
+    return (value * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static size_t matchLength(const unsigned char* p1, const unsigned char* p2, const unsigned char* pEnd)
+{
+    size_t maximumLength = (size_t)(pEnd - p2) < LZPACK_MAXIMUM_MATCH ? (size_t)(pEnd - p2) : LZPACK_MAXIMUM_MATCH;
+    size_t length = 0;
+    
+    while (length < maximumLength && p1[length] == p2[length])
+        length++;
+    return length;
+}
+
+static unsigned char* emitLiterals(unsigned char* pDest, const unsigned char* pLiterals, size_t literalCount)
+{
+    while (literalCount > 0)
+    {
+        size_t runLength = literalCount < LZPACK_MAXIMUM_LITERALS ? literalCount : LZPACK_MAXIMUM_LITERALS;
+        
+        *pDest++ = runLength;
+        memcpy(pDest, pLiterals, runLength);
+        pDest += runLength;
+        pLiterals += runLength;
+        literalCount -= runLength;
+    }
+    return pDest;
+}
+
+
+__throws size_t LzPack_Decompress(unsigned char* pDest, size_t destSize, const unsigned char* pSrc, size_t srcLength)
+{
+    const unsigned char* pSrcEnd = pSrc + srcLength;
+    size_t               destLength = 0;
+    
+    for (;;)
+    {
+        unsigned char token;
+        size_t        length;
+        
+        if (pSrc >= pSrcEnd)
+            __throw(bufferOverrunException);
+        token = *pSrc++;
+        if (token == LZPACK_END_TOKEN)
+            return destLength;
+        
+        if (token < LZPACK_MATCH_TOKEN)
+        {
+            length = token;
+            if (length > (size_t)(pSrcEnd - pSrc) || length > destSize - destLength)
+                __throw(bufferOverrunException);
+            memcpy(pDest + destLength, pSrc, length);
+            pSrc += length;
+        }
+        else
+        {
+            size_t distance;
+            size_t i;
+            
+            length = (token & ~LZPACK_MATCH_TOKEN) + LZPACK_MINIMUM_MATCH;
+            if (pSrcEnd - pSrc < 2 || length > destSize - destLength)
+                __throw(bufferOverrunException);
+            distance = pSrc[0] | (pSrc[1] << 8);
+            pSrc += 2;
+            if (distance == 0 || distance > destLength)
+                __throw(invalidArgumentException);
+            /* Byte at a time copy, just like the 6502 version, so that overlapping matches repeat earlier output. */
+            for (i = 0 ; i < length ; i++)
+                pDest[destLength + i] = pDest[destLength + i - distance];
+        }
+        destLength += length;
+    }
+}
@@ -0,0 +1,128 @@
+/*  Copyright (C) 2012  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include "OpcodeCycles.h"
+#include "util.h"
+
+
+/* Each table entry holds the base cycle count in its low nibble along with these flags. */
+#define PAGE_PENALTY  0x10
+#define BRANCH        0x20
+#define ALWAYS_TAKEN  0x40
+#define CYCLES_MASK   0x0F
+
+#define __    0
+#define P(C)  ((C) | PAGE_PENALTY)
+#define B(C)  ((C) | BRANCH)
+#define A(C)  ((C) | BRANCH | ALWAYS_TAKEN)
+
+static const unsigned char g_6502Cycles[256] =
+{
+/*         0     1     2     3     4     5     6     7     8     9     A     B     C     D     E     F */
+/* 0 */    7,    6,   __,   __,   __,    3,    5,   __,    3,    2,    2,   __,   __,    4,    6,   __,
+/* 1 */ B(2), P(5),   __,   __,   __,    4,    6,   __,    2, P(4),   __,   __,   __, P(4),    7,   __,
+/* 2 */    6,    6,   __,   __,    3,    3,    5,   __,    4,    2,    2,   __,    4,    4,    6,   __,
+/* 3 */ B(2), P(5),   __,   __,   __,    4,    6,   __,    2, P(4),   __,   __,   __, P(4),    7,   __,
+/* 4 */    6,    6,   __,   __,   __,    3,    5,   __,    3,    2,    2,   __,    3,    4,    6,   __,
+/* 5 */ B(2), P(5),   __,   __,   __,    4,    6,   __,    2, P(4),   __,   __,   __, P(4),    7,   __,
+/* 6 */    6,    6,   __,   __,   __,    3,    5,   __,    4,    2,    2,   __,    5,    4,    6,   __,
+/* 7 */ B(2), P(5),   __,   __,   __,    4,    6,   __,    2, P(4),   __,   __,   __, P(4),    7,   __,
+/* 8 */   __,    6,   __,   __,    3,    3,    3,   __,    2,   __,    2,   __,    4,    4,    4,   __,
+/* 9 */ B(2),    6,   __,   __,    4,    4,    4,   __,    2,    5,    2,   __,   __,    5,   __,   __,
+/* A */    2,    6,    2,   __,    3,    3,    3,   __,    2,    2,    2,   __,    4,    4,    4,   __,
+/* B */ B(2), P(5),   __,   __,    4,    4,    4,   __,    2, P(4),    2,   __, P(4), P(4), P(4),   __,
+/* C */    2,    6,   __,   __,    3,    3,    5,   __,    2,    2,    2,   __,    4,    4,    6,   __,
+/* D */ B(2), P(5),   __,   __,   __,    4,    6,   __,    2, P(4),   __,   __,   __, P(4),    7,   __,
+/* E */    2,    6,   __,   __,    3,    3,    5,   __,    2,    2,    2,   __,    4,    4,    6,   __,
+/* F */ B(2), P(5),   __,   __,   __,    4,    6,   __,    2, P(4),   __,   __,   __, P(4),    7,   __
+};
+
+/* The 65C02 adds the (zp) mode, BRA, STZ, TRB, TSB and the X/Y stack operations, fixes JMP (abs) to take 6 cycles
+   and only takes the extra cycle on shifts/rotates with abs,X when a page is crossed.  The extra cycle which ADC/SBC
+   take in decimal mode isn't counted. */
+static const unsigned char g_65c02Cycles[256] =
+{
+/*         0     1     2     3     4     5     6     7     8     9     A     B     C     D     E     F */
+/* 0 */    7,    6,   __,   __,    5,    3,    5,   __,    3,    2,    2,   __,    6,    4,    6,   __,
+/* 1 */ B(2), P(5),    5,   __,    5,    4,    6,   __,    2, P(4),    2,   __,    6, P(4), P(6),   __,
+/* 2 */    6,    6,   __,   __,    3,    3,    5,   __,    4,    2,    2,   __,    4,    4,    6,   __,
+/* 3 */ B(2), P(5),    5,   __,    4,    4,    6,   __,    2, P(4),    2,   __, P(4), P(4), P(6),   __,
+/* 4 */    6,    6,   __,   __,   __,    3,    5,   __,    3,    2,    2,   __,    3,    4,    6,   __,
+/* 5 */ B(2), P(5),    5,   __,   __,    4,    6,   __,    2, P(4),    3,   __,   __, P(4), P(6),   __,
+/* 6 */    6,    6,   __,   __,    3,    3,    5,   __,    4,    2,    2,   __,    6,    4,    6,   __,
+/* 7 */ B(2), P(5),    5,   __,    4,    4,    6,   __,    2, P(4),    4,   __,    6, P(4), P(6),   __,
+/* 8 */ A(2),    6,   __,   __,    3,    3,    3,   __,    2,    2,    2,   __,    4,    4,    4,   __,
+/* 9 */ B(2),    6,    5,   __,    4,    4,    4,   __,    2,    5,    2,   __,    4,    5,    5,   __,
+/* A */    2,    6,    2,   __,    3,    3,    3,   __,    2,    2,    2,   __,    4,    4,    4,   __,
+/* B */ B(2), P(5),    5,   __,    4,    4,    4,   __,    2, P(4),    2,   __, P(4), P(4), P(4),   __,
+/* C */    2,    6,   __,   __,    3,    3,    5,   __,    2,    2,    2,   __,    4,    4,    6,   __,
+/* D */ B(2), P(5),    5,   __,   __,    4,    6,   __,    2, P(4),    3,   __,   __, P(4),    7,   __,
+/* E */    2,    6,   __,   __,    3,    3,    5,   __,    2,    2,    2,   __,    4,    4,    6,   __,
+/* F */ B(2), P(5),    5,   __,   __,    4,    6,   __,    2, P(4),    4,   __,   __, P(4),    7,   __
+};
+
+
+static const unsigned char* getCycleTable(InstructionSetSupported instructionSet);
+static int canIndexedReadCrossPage(const unsigned char* pMachineCode, size_t machineCodeSize);
+static unsigned int getTakenBranchCycles(unsigned short address, const unsigned char* pMachineCode);
+OpcodeCycles OpcodeCycles_Get(InstructionSetSupported instructionSet, 
+                              unsigned short          address, 
+                              const unsigned char*    pMachineCode, 
+                              size_t                  machineCodeSize)
+{
+    const unsigned char* pCycleTable = getCycleTable(instructionSet);
+    OpcodeCycles         cycles;
+    unsigned char        entry;
+    
+    memset(&cycles, 0, sizeof(cycles));
+    if (!pCycleTable || machineCodeSize == 0)
+        return cycles;
+    entry = pCycleTable[pMachineCode[0]];
+    
+    cycles.minCycles = entry & CYCLES_MASK;
+    cycles.maxCycles = cycles.minCycles;
+    if ((entry & PAGE_PENALTY) && canIndexedReadCrossPage(pMachineCode, machineCodeSize))
+        cycles.maxCycles++;
+    if ((entry & BRANCH) && machineCodeSize == 2)
+    {
+        cycles.maxCycles += getTakenBranchCycles(address, pMachineCode);
+        if (entry & ALWAYS_TAKEN)
+            cycles.minCycles = cycles.maxCycles;
+        else
+            cycles.isBranch = TRUE;
+    }
+    return cycles;
+}
+
+static const unsigned char* getCycleTable(InstructionSetSupported instructionSet)
+{
+    if (instructionSet == INSTRUCTION_SET_6502)
+        return g_6502Cycles;
+    if (instructionSet == INSTRUCTION_SET_65C02)
+        return g_65c02Cycles;
+    return NULL;
+}
+
+static int canIndexedReadCrossPage(const unsigned char* pMachineCode, size_t machineCodeSize)
+{
+    /* Adding X or Y to an absolute base address at the start of a page can never leave that page. */
+    return !(machineCodeSize == 3 && pMachineCode[1] == 0x00);
+}
+
+static unsigned int getTakenBranchCycles(unsigned short address, const unsigned char* pMachineCode)
+{
+    unsigned short nextInstructionAddress = address + 2;
+    unsigned short targetAddress = nextInstructionAddress + (signed char)pMachineCode[1];
+    
+    return (nextInstructionAddress & 0xFF00) == (targetAddress & 0xFF00) ? 1 : 2;
+}
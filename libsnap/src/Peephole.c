@@ -0,0 +1,437 @@
+/*  Copyright (C) 2012  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include "Peephole.h"
+#include "ParseLine.h"
+#include "util.h"
+
+
+/* Processor status flags which are tracked to make sure that a rewrite doesn't change a value which is used later. */
+#define FLAG_C      0x01
+#define FLAG_Z      0x02
+#define FLAG_V      0x40
+#define FLAG_N      0x80
+#define FLAGS_NZ    (FLAG_N | FLAG_Z)
+#define FLAGS_ALL   (FLAG_N | FLAG_V | FLAG_Z | FLAG_C)
+
+/* Maximum number of jumps and branches that will be followed when chaining a branch. */
+#define MAXIMUM_BRANCH_CHAIN 8
+
+/* Apple II addresses from the I/O soft switches at $C000 upwards aren't plain RAM.  Reads can have side effects and
+   don't have to return the value which was just written. */
+#define FIRST_NON_RAM_ADDRESS 0xC000
+
+typedef struct FlagEffects
+{
+    unsigned char opcodes[10];
+    size_t        opcodeCount;
+    unsigned char flagsRead;
+    unsigned char flagsWritten;
+    int           transfersControl;
+} FlagEffects;
+
+/* Instructions which aren't listed here (stores, pushes, NOP, etc.) neither read nor write the tracked flags. */
+static const FlagEffects g_flagEffects[] =
+{
+    /* ADC and SBC */
+    { { 0x69, 0x65, 0x75, 0x6D, 0x7D, 0x79, 0x61, 0x71, 0x72 }, 9, FLAG_C, FLAGS_ALL, FALSE },
+    { { 0xE9, 0xE5, 0xF5, 0xED, 0xFD, 0xF9, 0xE1, 0xF1, 0xF2 }, 9, FLAG_C, FLAGS_ALL, FALSE },
+    /* AND, ORA, EOR and LDA */
+    { { 0x29, 0x25, 0x35, 0x2D, 0x3D, 0x39, 0x21, 0x31, 0x32 }, 9, 0, FLAGS_NZ, FALSE },
+    { { 0x09, 0x05, 0x15, 0x0D, 0x1D, 0x19, 0x01, 0x11, 0x12 }, 9, 0, FLAGS_NZ, FALSE },
+    { { 0x49, 0x45, 0x55, 0x4D, 0x5D, 0x59, 0x41, 0x51, 0x52 }, 9, 0, FLAGS_NZ, FALSE },
+    { { 0xA9, 0xA5, 0xB5, 0xAD, 0xBD, 0xB9, 0xA1, 0xB1, 0xB2 }, 9, 0, FLAGS_NZ, FALSE },
+    /* LDX and LDY */
+    { { 0xA2, 0xA6, 0xB6, 0xAE, 0xBE, 0xA0, 0xA4, 0xB4, 0xAC, 0xBC }, 10, 0, FLAGS_NZ, FALSE },
+    /* CMP, CPX and CPY */
+    { { 0xC9, 0xC5, 0xD5, 0xCD, 0xDD, 0xD9, 0xC1, 0xD1, 0xD2 }, 9, 0, FLAGS_NZ | FLAG_C, FALSE },
+    { { 0xE0, 0xE4, 0xEC, 0xC0, 0xC4, 0xCC }, 6, 0, FLAGS_NZ | FLAG_C, FALSE },
+    /* ASL and LSR */
+    { { 0x0A, 0x06, 0x16, 0x0E, 0x1E, 0x4A, 0x46, 0x56, 0x4E, 0x5E }, 10, 0, FLAGS_NZ | FLAG_C, FALSE },
+    /* ROL and ROR */
+    { { 0x2A, 0x26, 0x36, 0x2E, 0x3E, 0x6A, 0x66, 0x76, 0x6E, 0x7E }, 10, FLAG_C, FLAGS_NZ | FLAG_C, FALSE },
+    /* INC and DEC */
+    { { 0x1A, 0xE6, 0xF6, 0xEE, 0xFE, 0x3A, 0xC6, 0xD6, 0xCE, 0xDE }, 10, 0, FLAGS_NZ, FALSE },
+    /* INX, INY, DEX, DEY, TAX, TAY, TXA, TYA and TSX */
+    { { 0xE8, 0xC8, 0xCA, 0x88, 0xAA, 0xA8, 0x8A, 0x98, 0xBA }, 9, 0, FLAGS_NZ, FALSE },
+    /* PLA, PLX and PLY */
+    { { 0x68, 0xFA, 0x7A }, 3, 0, FLAGS_NZ, FALSE },
+    /* BIT, and then BIT immediate, TSB and TRB which only update Z */
+    { { 0x24, 0x2C, 0x34, 0x3C }, 4, 0, FLAGS_NZ | FLAG_V, FALSE },
+    { { 0x89, 0x04, 0x0C, 0x14, 0x1C }, 5, 0, FLAG_Z, FALSE },
+    /* CLC, SEC and CLV */
+    { { 0x18, 0x38 }, 2, 0, FLAG_C, FALSE },
+    { { 0xB8 }, 1, 0, FLAG_V, FALSE },
+    /* PLP and PHP */
+    { { 0x28 }, 1, 0, FLAGS_ALL, FALSE },
+    { { 0x08 }, 1, FLAGS_ALL, 0, FALSE },
+    /* Branches, jumps, calls, returns and BRK end the straight line code which can be tracked. */
+    { { 0x10, 0x30, 0x50, 0x70, 0x90, 0xB0, 0xD0, 0xF0, 0x80 }, 9, FLAGS_ALL, 0, TRUE },
+    { { 0x4C, 0x6C, 0x7C, 0x20, 0x60, 0x40, 0x00 }, 7, FLAGS_ALL, 0, TRUE }
+};
+
+/* Stores with the same addressing mode as the load they match once 0x20 is ORed into the opcode. */
+static const unsigned char g_storeOpcodes[] = 
+{
+    0x81, 0x84, 0x85, 0x86, 0x8C, 0x8D, 0x8E, 0x91, 0x92, 0x94, 0x95, 0x96, 0x99, 0x9D
+};
+
+static const unsigned char g_shortBranchOpcodes[] =
+{
+    0x10, 0x30, 0x50, 0x70, 0x80, 0x90, 0xB0, 0xD0, 0xF0
+};
+
+
+static int       isCandidateLine(LineInfo* pLineInfo);
+static LineInfo* findNextInstructionLine(LineInfo* pLineInfo);
+static int       isJsrFollowedByRts(LineInfo* pCurr, LineInfo* pNext);
+static size_t    rewriteJsrAndRts(LineInfo* pJsr, LineInfo* pRts);
+static int       isRedundantLoad(LineInfo* pStore, LineInfo* pLoad);
+static int       isClcFollowedByAddOne(LineInfo* pClc, LineInfo* pAdc);
+static size_t    rewriteLine(LineInfo* pLineInfo, PeepholeRewrite rewrite);
+size_t Peephole_FindRewrites(LineInfo* pFirstLine)
+{
+    LineInfo* pCurr;
+    size_t    rewriteCount = 0;
+    
+    for (pCurr = pFirstLine ; pCurr ; pCurr = pCurr->pNext)
+    {
+        LineInfo* pNext;
+        
+        if (!isCandidateLine(pCurr))
+            continue;
+        pNext = findNextInstructionLine(pCurr);
+        if (!pNext || pNext->peepholeRewrite != PEEPHOLE_NONE)
+            continue;
+            
+        if (isJsrFollowedByRts(pCurr, pNext))
+            rewriteCount += rewriteJsrAndRts(pCurr, pNext);
+        else if (isRedundantLoad(pCurr, pNext))
+            rewriteCount += rewriteLine(pNext, PEEPHOLE_DROP_LOAD);
+        else if (isClcFollowedByAddOne(pCurr, pNext))
+            rewriteCount += rewriteLine(pCurr, PEEPHOLE_DROP_CLC) + rewriteLine(pNext, PEEPHOLE_ADC_TO_INC);
+    }
+    
+    return rewriteCount;
+}
+
+static int isOptimizableInstruction(LineInfo* pLineInfo);
+static int isCandidateLine(LineInfo* pLineInfo)
+{
+    return isOptimizableInstruction(pLineInfo) && pLineInfo->peepholeRewrite == PEEPHOLE_NONE;
+}
+
+static int isOptimizableInstruction(LineInfo* pLineInfo)
+{
+    const unsigned int requiredFlags = LINEINFO_FLAG_OPTIMIZE | LINEINFO_FLAG_INSTRUCTION;
+    const unsigned int excludedFlags = LINEINFO_FLAG_TIMING_CRITICAL | 
+                                       LINEINFO_CONDITIONAL_SKIP_SOURCE | 
+                                       LINEINFO_CONDITIONAL_INHERITED_SKIP_SOURCE;
+    
+    /* Timing critical code is left alone since rewrites change the cycle counts. */
+    return (pLineInfo->flags & (requiredFlags | excludedFlags)) == requiredFlags &&
+           pLineInfo->machineCodeSize > 0 &&
+           (pLineInfo->instructionSet == INSTRUCTION_SET_6502 || pLineInfo->instructionSet == INSTRUCTION_SET_65C02);
+}
+
+static int isLineWithoutEffect(LineInfo* pLineInfo);
+static LineInfo* findNextInstructionLine(LineInfo* pLineInfo)
+{
+    LineInfo* pCurr;
+    
+    for (pCurr = pLineInfo->pNext ; pCurr && isLineWithoutEffect(pCurr) ; pCurr = pCurr->pNext)
+    {
+    }
+    if (!pCurr || !isOptimizableInstruction(pCurr))
+        return NULL;
+    return pCurr;
+}
+
+static int isDroppedLine(LineInfo* pLineInfo);
+static int isLineWithoutEffect(LineInfo* pLineInfo)
+{
+    ParsedLine parsedLine;
+    
+    /* Comments, lines removed by an earlier rewrite and lines skipped by conditional assembly can be stepped over
+       but any other directive or label ends the sequence of instructions being examined. */
+    if (pLineInfo->machineCodeSize > 0 || pLineInfo->pSymbol)
+        return FALSE;
+    if (pLineInfo->flags & (LINEINFO_CONDITIONAL_SKIP_SOURCE | LINEINFO_CONDITIONAL_INHERITED_SKIP_SOURCE))
+        return TRUE;
+    if (isDroppedLine(pLineInfo))
+        return TRUE;
+    ParseLine(&parsedLine, &pLineInfo->lineText);
+    return SizedString_strlen(&parsedLine.label) == 0 && SizedString_strlen(&parsedLine.op) == 0;
+}
+
+static int isDroppedLine(LineInfo* pLineInfo)
+{
+    return pLineInfo->peepholeRewrite == PEEPHOLE_DROP_RTS ||
+           pLineInfo->peepholeRewrite == PEEPHOLE_DROP_LOAD ||
+           pLineInfo->peepholeRewrite == PEEPHOLE_DROP_CLC;
+}
+
+static int isJsrFollowedByRts(LineInfo* pCurr, LineInfo* pNext)
+{
+    return pCurr->pMachineCode[0] == 0x20 && pNext->pMachineCode[0] == 0x60;
+}
+
+static size_t rewriteJsrAndRts(LineInfo* pJsr, LineInfo* pRts)
+{
+    rewriteLine(pJsr, PEEPHOLE_JSR_TO_JMP);
+    /* Other code branches to a labelled RTS so it has to stay but the JMP still saves the cycles of the return. */
+    if (pRts->pSymbol)
+        return 1;
+    return 1 + rewriteLine(pRts, PEEPHOLE_DROP_RTS);
+}
+
+static int isStoreInstruction(LineInfo* pLineInfo);
+static int isStoreToRam(LineInfo* pStore);
+static int haveSameOperands(LineInfo* pLineInfo1, LineInfo* pLineInfo2);
+static int areFlagsUnusedAfter(LineInfo* pLineInfo, unsigned char flags);
+static int isRedundantLoad(LineInfo* pStore, LineInfo* pLoad)
+{
+    /* The load can only go if nothing branches to it and the N and Z flags which it sets are never looked at. */
+    return isStoreInstruction(pStore) &&
+           pLoad->pMachineCode[0] == (pStore->pMachineCode[0] | 0x20) &&
+           pLoad->machineCodeSize == pStore->machineCodeSize &&
+           0 == memcmp(pLoad->pMachineCode + 1, pStore->pMachineCode + 1, pStore->machineCodeSize - 1) &&
+           pLoad->pSymbol == NULL &&
+           isStoreToRam(pStore) &&
+           haveSameOperands(pStore, pLoad) &&
+           areFlagsUnusedAfter(pLoad, FLAGS_NZ);
+}
+
+static int isStoreInstruction(LineInfo* pLineInfo)
+{
+    return NULL != memchr(g_storeOpcodes, pLineInfo->pMachineCode[0], sizeof(g_storeOpcodes));
+}
+
+static int isIndirectStore(LineInfo* pStore);
+static int isIndexedAbsoluteStore(LineInfo* pStore);
+static int isStoreToRam(LineInfo* pStore)
+{
+    unsigned int lastAddress;
+    
+    /* The target of an indirect store isn't known until run time so it could be a soft switch. */
+    if (isIndirectStore(pStore))
+        return FALSE;
+    /* Page zero stores, indexed or not, always stay in page zero. */
+    if (pStore->machineCodeSize == 2)
+        return TRUE;
+    lastAddress = pStore->pMachineCode[1] | (pStore->pMachineCode[2] << 8);
+    if (isIndexedAbsoluteStore(pStore))
+        lastAddress += 0xFF;
+    return lastAddress < FIRST_NON_RAM_ADDRESS;
+}
+
+static int isIndirectStore(LineInfo* pStore)
+{
+    /* STA (zp,X), STA (zp),Y and STA (zp) */
+    unsigned char opcode = pStore->pMachineCode[0];
+    return opcode == 0x81 || opcode == 0x91 || opcode == 0x92;
+}
+
+static int isIndexedAbsoluteStore(LineInfo* pStore)
+{
+    /* STA abs,Y and STA abs,X */
+    unsigned char opcode = pStore->pMachineCode[0];
+    return opcode == 0x99 || opcode == 0x9D;
+}
+
+static int haveSameOperands(LineInfo* pLineInfo1, LineInfo* pLineInfo2)
+{
+    ParsedLine parsedLine1;
+    ParsedLine parsedLine2;
+    
+    /* Matching text keeps the two addresses equal even after other rewrites have moved the code.  That isn't true
+       of operands which are relative to the current program counter. */
+    ParseLine(&parsedLine1, &pLineInfo1->lineText);
+    ParseLine(&parsedLine2, &pLineInfo2->lineText);
+    return 0 == SizedString_Compare(&parsedLine1.operands, &parsedLine2.operands) &&
+           NULL == SizedString_strchr(&parsedLine1.operands, '*');
+}
+
+static const FlagEffects* findFlagEffects(unsigned char opcode);
+static int areFlagsUnusedAfter(LineInfo* pLineInfo, unsigned char flags)
+{
+    LineInfo* pCurr = pLineInfo;
+    
+    while (flags)
+    {
+        const FlagEffects* pEffects;
+        
+        pCurr = findNextInstructionLine(pCurr);
+        if (!pCurr)
+            return FALSE;
+        pEffects = findFlagEffects(pCurr->pMachineCode[0]);
+        if (!pEffects)
+            continue;
+        if (pEffects->transfersControl || (pEffects->flagsRead & flags))
+            return FALSE;
+        flags &= ~pEffects->flagsWritten;
+    }
+    return TRUE;
+}
+
+static const FlagEffects* findFlagEffects(unsigned char opcode)
+{
+    size_t i;
+    
+    for (i = 0 ; i < ARRAYSIZE(g_flagEffects) ; i++)
+    {
+        if (memchr(g_flagEffects[i].opcodes, opcode, g_flagEffects[i].opcodeCount))
+            return &g_flagEffects[i];
+    }
+    return NULL;
+}
+
+static int isLiteralImmediateOperand(LineInfo* pLineInfo);
+static int isClcFollowedByAddOne(LineInfo* pClc, LineInfo* pAdc)
+{
+    /* INC A is only available on the 65C02 and doesn't update C or V so neither can be used afterwards.  This
+       assumes that decimal mode isn't in use within OPT regions. */
+    return pClc->pMachineCode[0] == 0x18 &&
+           pClc->instructionSet == INSTRUCTION_SET_65C02 &&
+           pAdc->instructionSet == INSTRUCTION_SET_65C02 &&
+           pAdc->machineCodeSize == 2 &&
+           pAdc->pMachineCode[0] == 0x69 &&
+           pAdc->pMachineCode[1] == 0x01 &&
+           pAdc->pSymbol == NULL &&
+           isLiteralImmediateOperand(pAdc) &&
+           areFlagsUnusedAfter(pAdc, FLAG_C | FLAG_V);
+}
+
+static int isLiteralImmediateOperand(LineInfo* pLineInfo)
+{
+    ParsedLine  parsedLine;
+    const char* pValidDigits = "0123456789";
+    size_t      i = 1;
+    
+    /* Only a literal is certain to keep the same value once other rewrites have moved the code around. */
+    ParseLine(&parsedLine, &pLineInfo->lineText);
+    if (parsedLine.operands.stringLength < 2 || parsedLine.operands.pString[0] != '#')
+        return FALSE;
+    if (parsedLine.operands.pString[i] == '$')
+    {
+        pValidDigits = "0123456789abcdefABCDEF";
+        i++;
+    }
+    else if (parsedLine.operands.pString[i] == '%')
+    {
+        pValidDigits = "01";
+        i++;
+    }
+    if (i >= parsedLine.operands.stringLength)
+        return FALSE;
+    for ( ; i < parsedLine.operands.stringLength ; i++)
+    {
+        if (!strchr(pValidDigits, parsedLine.operands.pString[i]))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static size_t rewriteLine(LineInfo* pLineInfo, PeepholeRewrite rewrite)
+{
+    pLineInfo->peepholeRewrite = rewrite;
+    return 1;
+}
+
+
+static int            isShortBranch(LineInfo* pLineInfo);
+static unsigned short getBranchTarget(LineInfo* pLineInfo);
+static LineInfo*      findOnlyInstructionAtAddress(LineInfo* pFirstLine, unsigned short address);
+static int            getJumpDestination(LineInfo* pBranch, LineInfo* pTarget, unsigned short* pDestination);
+static int            isBranchTargetInRange(LineInfo* pBranch, unsigned short targetAddress);
+void Peephole_ChainBranches(LineInfo* pFirstLine)
+{
+    LineInfo* pCurr;
+    
+    for (pCurr = pFirstLine ; pCurr ; pCurr = pCurr->pNext)
+    {
+        unsigned short originalTarget;
+        unsigned short target;
+        unsigned short chainedTarget;
+        int            i;
+        
+        if (!isCandidateLine(pCurr) || !isShortBranch(pCurr))
+            continue;
+        originalTarget = target = chainedTarget = getBranchTarget(pCurr);
+        for (i = 0 ; i < MAXIMUM_BRANCH_CHAIN ; i++)
+        {
+            LineInfo* pTarget = findOnlyInstructionAtAddress(pFirstLine, target);
+            
+            if (!pTarget || !isOptimizableInstruction(pTarget) || !getJumpDestination(pCurr, pTarget, &target))
+                break;
+            if (isBranchTargetInRange(pCurr, target))
+                chainedTarget = target;
+        }
+        if (chainedTarget == originalTarget)
+            continue;
+        pCurr->pMachineCode[1] = LO_BYTE(chainedTarget - (pCurr->address + 2));
+        rewriteLine(pCurr, PEEPHOLE_CHAINED_BRANCH);
+    }
+}
+
+static int isShortBranch(LineInfo* pLineInfo)
+{
+    return pLineInfo->machineCodeSize == 2 &&
+           NULL != memchr(g_shortBranchOpcodes, pLineInfo->pMachineCode[0], sizeof(g_shortBranchOpcodes));
+}
+
+static unsigned short getBranchTarget(LineInfo* pLineInfo)
+{
+    return pLineInfo->address + 2 + (signed char)pLineInfo->pMachineCode[1];
+}
+
+static LineInfo* findOnlyInstructionAtAddress(LineInfo* pFirstLine, unsigned short address)
+{
+    LineInfo* pCurr;
+    LineInfo* pFound = NULL;
+    
+    /* Give up if ORG has placed more than one instruction at this address since it isn't known which one runs. */
+    for (pCurr = pFirstLine ; pCurr ; pCurr = pCurr->pNext)
+    {
+        if (!(pCurr->flags & LINEINFO_FLAG_INSTRUCTION) || pCurr->machineCodeSize == 0 || pCurr->address != address)
+            continue;
+        if (pFound)
+            return NULL;
+        pFound = pCurr;
+    }
+    return pFound;
+}
+
+static int getJumpDestination(LineInfo* pBranch, LineInfo* pTarget, unsigned short* pDestination)
+{
+    unsigned char targetOpcode = pTarget->pMachineCode[0];
+    
+    if (targetOpcode == 0x4C && pTarget->machineCodeSize == 3)
+    {
+        *pDestination = pTarget->pMachineCode[1] | (pTarget->pMachineCode[2] << 8);
+        return TRUE;
+    }
+    if (isShortBranch(pTarget) && (targetOpcode == 0x80 || targetOpcode == pBranch->pMachineCode[0]))
+    {
+        *pDestination = getBranchTarget(pTarget);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static int isBranchTargetInRange(LineInfo* pBranch, unsigned short targetAddress)
+{
+    int offset = (int)targetAddress - (int)(pBranch->address + 2);
+    
+    return offset >= -128 && offset <= 127;
+}
@@ -0,0 +1,291 @@
+/*  Copyright (C) 2012  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include "Profiler.h"
+#include "ProfilerTest.h"
+#include "ListFile.h"
+#include "Symbol.h"
+#include "util.h"
+
+
+typedef struct ProfileEntry
+{
+    LineInfo*     pLineInfo;
+    size_t        ordinal;
+    unsigned long cycles;
+    unsigned long instructions;
+} ProfileEntry;
+
+struct Profiler
+{
+    ProfileEntry* pLines;
+    size_t        lineCount;
+    unsigned long totalCycles;
+    unsigned long totalInstructions;
+    unsigned long unattributedCycles;
+    /* Ordinal + 1 of the instruction line whose machine code covers each address or 0 if there is no such line. */
+    unsigned int  lineForAddress[64 * 1024];
+};
+
+
+static size_t countLines(LineInfo* pFirstLine);
+static ProfileEntry* allocateEntries(size_t entryCount);
+static void initLineEntriesAndMapTheirAddresses(Profiler* pThis, LineInfo* pFirstLine);
+__throws Profiler* Profiler_Create(LineInfo* pFirstLine)
+{
+    Profiler* pThis = NULL;
+    
+    __try
+    {
+        pThis = allocateAndZero(sizeof(*pThis));
+        pThis->lineCount = countLines(pFirstLine);
+        pThis->pLines = allocateEntries(pThis->lineCount);
+    }
+    __catch
+    {
+        Profiler_Free(pThis);
+        __rethrow;
+    }
+    initLineEntriesAndMapTheirAddresses(pThis, pFirstLine);
+    
+    return pThis;
+}
+
+static size_t countLines(LineInfo* pFirstLine)
+{
+    size_t count = 0;
+    
+    for ( ; pFirstLine ; pFirstLine = pFirstLine->pNext)
+        count++;
+    return count;
+}
+
+static ProfileEntry* allocateEntries(size_t entryCount)
+{
+    /* Always allocate at least one entry so that there is never a 0 byte allocation. */
+    return allocateAndZero(sizeof(ProfileEntry) * (entryCount + 1));
+}
+
+static void initLineEntriesAndMapTheirAddresses(Profiler* pThis, LineInfo* pFirstLine)
+{
+    LineInfo* pCurr = pFirstLine;
+    size_t    i;
+    
+    for (i = 0 ; i < pThis->lineCount ; i++, pCurr = pCurr->pNext)
+    {
+        size_t j;
+        
+        pThis->pLines[i].pLineInfo = pCurr;
+        pThis->pLines[i].ordinal = i;
+        if (!(pCurr->flags & LINEINFO_FLAG_INSTRUCTION))
+            continue;
+        /* Map every byte so that the JMP in the middle of a long branch is attributed to its line too. */
+        for (j = 0 ; j < pCurr->machineCodeSize ; j++)
+            pThis->lineForAddress[(unsigned short)(pCurr->address + j)] = i + 1;
+    }
+}
+
+
+void Profiler_Free(Profiler* pThis)
+{
+    if (!pThis)
+        return;
+    free(pThis->pLines);
+    free(pThis);
+}
+
+
+static void recordInstructionHook(void* pContext, unsigned short address, unsigned int cycles);
+void Profiler_AttachToSimulator(Profiler* pThis, Simulator* pSimulator)
+{
+    Simulator_SetInstructionHook(pSimulator, recordInstructionHook, pThis);
+}
+
+static void recordInstructionHook(void* pContext, unsigned short address, unsigned int cycles)
+{
+    Profiler_RecordInstruction((Profiler*)pContext, address, cycles);
+}
+
+
+void Profiler_RecordInstruction(Profiler* pThis, unsigned short address, unsigned int cycles)
+{
+    unsigned int lineOrdinalPlusOne = pThis->lineForAddress[address];
+    
+    pThis->totalCycles += cycles;
+    pThis->totalInstructions++;
+    if (lineOrdinalPlusOne == 0)
+    {
+        pThis->unattributedCycles += cycles;
+        return;
+    }
+    pThis->pLines[lineOrdinalPlusOne - 1].cycles += cycles;
+    pThis->pLines[lineOrdinalPlusOne - 1].instructions++;
+}
+
+
+unsigned long Profiler_GetTotalCycles(Profiler* pThis)
+{
+    return pThis->totalCycles;
+}
+
+
+unsigned long Profiler_GetUnattributedCycles(Profiler* pThis)
+{
+    return pThis->unattributedCycles;
+}
+
+
+static double calculatePercentage(Profiler* pThis, unsigned long cycles);
+__throws void Profiler_OutputAnnotatedListing(Profiler* pThis, FILE* pFile)
+{
+    ListFile* pListFile = ListFile_Create(pFile);
+    size_t    i;
+    
+    for (i = 0 ; i < pThis->lineCount ; i++)
+    {
+        ProfileEntry* pEntry = &pThis->pLines[i];
+        char          annotation[96] = "";
+        
+        if (pEntry->instructions > 0)
+            sprintf(annotation, "  [%lu cycles, %.2f%%, %lu instructions]", 
+                    pEntry->cycles, calculatePercentage(pThis, pEntry->cycles), pEntry->instructions);
+        ListFile_OutputAnnotatedLine(pListFile, pEntry->pLineInfo, annotation);
+    }
+    ListFile_Free(pListFile);
+}
+
+static double calculatePercentage(Profiler* pThis, unsigned long cycles)
+{
+    if (pThis->totalCycles == 0)
+        return 0.0;
+    return (100.0 * cycles) / pThis->totalCycles;
+}
+
+
+static size_t rollupLinesIntoGlobalLabels(Profiler* pThis, ProfileEntry* pLabels);
+static void outputTopLabels(Profiler* pThis, FILE* pFile, ProfileEntry* pLabels, size_t labelCount, size_t topCount);
+static void outputTopLines(Profiler* pThis, FILE* pFile, ProfileEntry* pLines, size_t topCount);
+__throws void Profiler_OutputReport(Profiler* pThis, FILE* pFile, size_t topCount)
+{
+    ProfileEntry* pEntries = NULL;
+    size_t        labelCount;
+    
+    fprintf(pFile, "Profiled %lu cycles over %lu instructions." LINE_ENDING, 
+            pThis->totalCycles, pThis->totalInstructions);
+    if (pThis->unattributedCycles > 0)
+        fprintf(pFile, "%lu cycles (%.2f%%) were spent in code which wasn't assembled from an instruction." LINE_ENDING, 
+                pThis->unattributedCycles, calculatePercentage(pThis, pThis->unattributedCycles));
+    
+    pEntries = allocateEntries(pThis->lineCount);
+    labelCount = rollupLinesIntoGlobalLabels(pThis, pEntries);
+    outputTopLabels(pThis, pFile, pEntries, labelCount, topCount);
+    memcpy(pEntries, pThis->pLines, sizeof(*pEntries) * pThis->lineCount);
+    outputTopLines(pThis, pFile, pEntries, topCount);
+    free(pEntries);
+}
+
+static int isGlobalLabelLine(LineInfo* pLineInfo);
+static size_t rollupLinesIntoGlobalLabels(Profiler* pThis, ProfileEntry* pLabels)
+{
+    /* The first entry, with a NULL pLineInfo, collects the lines which come before the first global label. */
+    size_t labelCount = 1;
+    size_t i;
+    
+    for (i = 0 ; i < pThis->lineCount ; i++)
+    {
+        ProfileEntry* pLine = &pThis->pLines[i];
+        
+        if (isGlobalLabelLine(pLine->pLineInfo))
+        {
+            pLabels[labelCount].pLineInfo = pLine->pLineInfo;
+            pLabels[labelCount].ordinal = labelCount;
+            labelCount++;
+        }
+        pLabels[labelCount - 1].cycles += pLine->cycles;
+        pLabels[labelCount - 1].instructions += pLine->instructions;
+    }
+    
+    return labelCount;
+}
+
+static int isGlobalLabelLine(LineInfo* pLineInfo)
+{
+    Symbol* pSymbol = pLineInfo->pSymbol;
+    
+    return pSymbol && 
+           !(pLineInfo->flags & LINEINFO_FLAG_WAS_EQU) &&
+           SizedString_strlen(&pSymbol->localKey) == 0 &&
+           pSymbol->globalKey.pString[0] != ']';
+}
+
+static size_t sortEntriesByCycles(ProfileEntry* pEntries, size_t entryCount);
+static void outputTopLabels(Profiler* pThis, FILE* pFile, ProfileEntry* pLabels, size_t labelCount, size_t topCount)
+{
+    size_t i;
+    
+    labelCount = sortEntriesByCycles(pLabels, labelCount);
+    fprintf(pFile, LINE_ENDING "Top labels by cycles:" LINE_ENDING
+                   "     Cycles  Percent  Instructions  Label" LINE_ENDING);
+    for (i = 0 ; i < labelCount && i < topCount ; i++)
+    {
+        SizedString label = pLabels[i].pLineInfo ? pLabels[i].pLineInfo->pSymbol->globalKey : 
+                                                   SizedString_InitFromString("(none)");
+        
+        fprintf(pFile, "%11lu  %6.2f%%  %12lu  %.*s" LINE_ENDING,
+                pLabels[i].cycles, calculatePercentage(pThis, pLabels[i].cycles), pLabels[i].instructions,
+                label.stringLength, label.pString);
+    }
+}
+
+static void outputTopLines(Profiler* pThis, FILE* pFile, ProfileEntry* pLines, size_t topCount)
+{
+    size_t lineCount = sortEntriesByCycles(pLines, pThis->lineCount);
+    size_t i;
+    
+    fprintf(pFile, LINE_ENDING "Top lines by cycles:" LINE_ENDING
+                   "     Cycles  Percent  Instructions  Address  Line" LINE_ENDING);
+    for (i = 0 ; i < lineCount && i < topCount ; i++)
+    {
+        LineInfo* pLineInfo = pLines[i].pLineInfo;
+        
+        fprintf(pFile, "%11lu  %6.2f%%  %12lu    $%04X  %5u %.*s" LINE_ENDING,
+                pLines[i].cycles, calculatePercentage(pThis, pLines[i].cycles), pLines[i].instructions,
+                pLineInfo->address, pLineInfo->lineNumber, 
+                pLineInfo->lineText.stringLength, pLineInfo->lineText.pString);
+    }
+}
+
+static int compareEntriesByCyclesDescending(const void* pv1, const void* pv2);
+static size_t sortEntriesByCycles(ProfileEntry* pEntries, size_t entryCount)
+{
+    size_t executedCount = 0;
+    size_t i;
+    
+    qsort(pEntries, entryCount, sizeof(*pEntries), compareEntriesByCyclesDescending);
+    for (i = 0 ; i < entryCount && pEntries[i].instructions > 0 ; i++)
+        executedCount++;
+    
+    return executedCount;
+}
+
+static int compareEntriesByCyclesDescending(const void* pv1, const void* pv2)
+{
+    const ProfileEntry* p1 = (const ProfileEntry*)pv1;
+    const ProfileEntry* p2 = (const ProfileEntry*)pv2;
+    
+    if (p1->cycles != p2->cycles)
+        return p1->cycles > p2->cycles ? -1 : 1;
+    if (p1->instructions != p2->instructions)
+        return p1->instructions > p2->instructions ? -1 : 1;
+    return p1->ordinal < p2->ordinal ? -1 : (p1->ordinal > p2->ordinal);
+}
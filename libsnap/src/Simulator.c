@@ -0,0 +1,772 @@
+/*  Copyright (C) 2012  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include "Simulator.h"
+#include "SimulatorTest.h"
+#include "BinaryBuffer.h"
+#include "OpcodeCycles.h"
+#include "util.h"
+
+
+typedef enum Operation
+{
+    OP_INVALID = 0,
+    OP_ADC, OP_AND, OP_ASL, OP_BCC, OP_BCS, OP_BEQ, OP_BIT, OP_BMI, OP_BNE, OP_BPL, OP_BRA, OP_BRK, OP_BVC, OP_BVS,
+    OP_CLC, OP_CLD, OP_CLI, OP_CLV, OP_CMP, OP_CPX, OP_CPY, OP_DEC, OP_DEX, OP_DEY, OP_EOR, OP_INC, OP_INX, OP_INY,
+    OP_JMP, OP_JSR, OP_LDA, OP_LDX, OP_LDY, OP_LSR, OP_NOP, OP_ORA, OP_PHA, OP_PHP, OP_PHX, OP_PHY, OP_PLA, OP_PLP,
+    OP_PLX, OP_PLY, OP_ROL, OP_ROR, OP_RTI, OP_RTS, OP_SBC, OP_SEC, OP_SED, OP_SEI, OP_STA, OP_STX, OP_STY, OP_STZ,
+    OP_TAX, OP_TAY, OP_TRB, OP_TSB, OP_TSX, OP_TXA, OP_TXS, OP_TYA
+} Operation;
+
+typedef enum OperandMode
+{
+    MODE_IMP = 0,   /* Implied */
+    MODE_ACC,       /* Accumulator */
+    MODE_IMM,       /* #imm */
+    MODE_ZP,        /* zp */
+    MODE_ZPX,       /* zp,X */
+    MODE_ZPY,       /* zp,Y */
+    MODE_ABS,       /* abs */
+    MODE_ABX,       /* abs,X */
+    MODE_ABY,       /* abs,Y */
+    MODE_IZX,       /* (zp,X) */
+    MODE_IZY,       /* (zp),Y */
+    MODE_IZP,       /* (zp) */
+    MODE_IND,       /* (abs) */
+    MODE_IAX,       /* (abs,X) */
+    MODE_REL        /* Relative branch */
+} OperandMode;
+
+typedef struct Decode
+{
+    unsigned char operation;
+    unsigned char mode;
+} Decode;
+
+typedef struct OpcodeEntry
+{
+    unsigned char opcode;
+    Decode        decode;
+} OpcodeEntry;
+
+struct Simulator
+{
+    unsigned char            memory[64 * 1024];
+    Decode                   decodeTable[256];
+    SimulatorRegisters       registers;
+    SimulatorInstructionHook instructionHook;
+    void*                    pInstructionHookContext;
+    unsigned long            cycleCount;
+    unsigned long            instructionCount;
+    InstructionSetSupported  instructionSet;
+    int                      pageCrossed;
+    int                      branchTaken;
+};
+
+
+static const OpcodeEntry g_6502Opcodes[] =
+{
+    {0x69, {OP_ADC, MODE_IMM}}, {0x65, {OP_ADC, MODE_ZP}}, {0x75, {OP_ADC, MODE_ZPX}}, {0x6D, {OP_ADC, MODE_ABS}},
+    {0x7D, {OP_ADC, MODE_ABX}}, {0x79, {OP_ADC, MODE_ABY}}, {0x61, {OP_ADC, MODE_IZX}}, {0x71, {OP_ADC, MODE_IZY}},
+    {0x29, {OP_AND, MODE_IMM}}, {0x25, {OP_AND, MODE_ZP}}, {0x35, {OP_AND, MODE_ZPX}}, {0x2D, {OP_AND, MODE_ABS}},
+    {0x3D, {OP_AND, MODE_ABX}}, {0x39, {OP_AND, MODE_ABY}}, {0x21, {OP_AND, MODE_IZX}}, {0x31, {OP_AND, MODE_IZY}},
+    {0x0A, {OP_ASL, MODE_ACC}}, {0x06, {OP_ASL, MODE_ZP}}, {0x16, {OP_ASL, MODE_ZPX}}, {0x0E, {OP_ASL, MODE_ABS}},
+    {0x1E, {OP_ASL, MODE_ABX}},
+    {0x90, {OP_BCC, MODE_REL}}, {0xB0, {OP_BCS, MODE_REL}}, {0xF0, {OP_BEQ, MODE_REL}}, {0x30, {OP_BMI, MODE_REL}},
+    {0xD0, {OP_BNE, MODE_REL}}, {0x10, {OP_BPL, MODE_REL}}, {0x50, {OP_BVC, MODE_REL}}, {0x70, {OP_BVS, MODE_REL}},
+    {0x24, {OP_BIT, MODE_ZP}}, {0x2C, {OP_BIT, MODE_ABS}},
+    {0x00, {OP_BRK, MODE_IMP}},
+    {0x18, {OP_CLC, MODE_IMP}}, {0xD8, {OP_CLD, MODE_IMP}}, {0x58, {OP_CLI, MODE_IMP}}, {0xB8, {OP_CLV, MODE_IMP}},
+    {0xC9, {OP_CMP, MODE_IMM}}, {0xC5, {OP_CMP, MODE_ZP}}, {0xD5, {OP_CMP, MODE_ZPX}}, {0xCD, {OP_CMP, MODE_ABS}},
+    {0xDD, {OP_CMP, MODE_ABX}}, {0xD9, {OP_CMP, MODE_ABY}}, {0xC1, {OP_CMP, MODE_IZX}}, {0xD1, {OP_CMP, MODE_IZY}},
+    {0xE0, {OP_CPX, MODE_IMM}}, {0xE4, {OP_CPX, MODE_ZP}}, {0xEC, {OP_CPX, MODE_ABS}},
+    {0xC0, {OP_CPY, MODE_IMM}}, {0xC4, {OP_CPY, MODE_ZP}}, {0xCC, {OP_CPY, MODE_ABS}},
+    {0xC6, {OP_DEC, MODE_ZP}}, {0xD6, {OP_DEC, MODE_ZPX}}, {0xCE, {OP_DEC, MODE_ABS}}, {0xDE, {OP_DEC, MODE_ABX}},
+    {0xCA, {OP_DEX, MODE_IMP}}, {0x88, {OP_DEY, MODE_IMP}},
+    {0x49, {OP_EOR, MODE_IMM}}, {0x45, {OP_EOR, MODE_ZP}}, {0x55, {OP_EOR, MODE_ZPX}}, {0x4D, {OP_EOR, MODE_ABS}},
+    {0x5D, {OP_EOR, MODE_ABX}}, {0x59, {OP_EOR, MODE_ABY}}, {0x41, {OP_EOR, MODE_IZX}}, {0x51, {OP_EOR, MODE_IZY}},
+    {0xE6, {OP_INC, MODE_ZP}}, {0xF6, {OP_INC, MODE_ZPX}}, {0xEE, {OP_INC, MODE_ABS}}, {0xFE, {OP_INC, MODE_ABX}},
+    {0xE8, {OP_INX, MODE_IMP}}, {0xC8, {OP_INY, MODE_IMP}},
+    {0x4C, {OP_JMP, MODE_ABS}}, {0x6C, {OP_JMP, MODE_IND}}, {0x20, {OP_JSR, MODE_ABS}},
+    {0xA9, {OP_LDA, MODE_IMM}}, {0xA5, {OP_LDA, MODE_ZP}}, {0xB5, {OP_LDA, MODE_ZPX}}, {0xAD, {OP_LDA, MODE_ABS}},
+    {0xBD, {OP_LDA, MODE_ABX}}, {0xB9, {OP_LDA, MODE_ABY}}, {0xA1, {OP_LDA, MODE_IZX}}, {0xB1, {OP_LDA, MODE_IZY}},
+    {0xA2, {OP_LDX, MODE_IMM}}, {0xA6, {OP_LDX, MODE_ZP}}, {0xB6, {OP_LDX, MODE_ZPY}}, {0xAE, {OP_LDX, MODE_ABS}},
+    {0xBE, {OP_LDX, MODE_ABY}},
+    {0xA0, {OP_LDY, MODE_IMM}}, {0xA4, {OP_LDY, MODE_ZP}}, {0xB4, {OP_LDY, MODE_ZPX}}, {0xAC, {OP_LDY, MODE_ABS}},
+    {0xBC, {OP_LDY, MODE_ABX}},
+    {0x4A, {OP_LSR, MODE_ACC}}, {0x46, {OP_LSR, MODE_ZP}}, {0x56, {OP_LSR, MODE_ZPX}}, {0x4E, {OP_LSR, MODE_ABS}},
+    {0x5E, {OP_LSR, MODE_ABX}},
+    {0xEA, {OP_NOP, MODE_IMP}},
+    {0x09, {OP_ORA, MODE_IMM}}, {0x05, {OP_ORA, MODE_ZP}}, {0x15, {OP_ORA, MODE_ZPX}}, {0x0D, {OP_ORA, MODE_ABS}},
+    {0x1D, {OP_ORA, MODE_ABX}}, {0x19, {OP_ORA, MODE_ABY}}, {0x01, {OP_ORA, MODE_IZX}}, {0x11, {OP_ORA, MODE_IZY}},
+    {0x48, {OP_PHA, MODE_IMP}}, {0x08, {OP_PHP, MODE_IMP}}, {0x68, {OP_PLA, MODE_IMP}}, {0x28, {OP_PLP, MODE_IMP}},
+    {0x2A, {OP_ROL, MODE_ACC}}, {0x26, {OP_ROL, MODE_ZP}}, {0x36, {OP_ROL, MODE_ZPX}}, {0x2E, {OP_ROL, MODE_ABS}},
+    {0x3E, {OP_ROL, MODE_ABX}},
+    {0x6A, {OP_ROR, MODE_ACC}}, {0x66, {OP_ROR, MODE_ZP}}, {0x76, {OP_ROR, MODE_ZPX}}, {0x6E, {OP_ROR, MODE_ABS}},
+    {0x7E, {OP_ROR, MODE_ABX}},
+    {0x40, {OP_RTI, MODE_IMP}}, {0x60, {OP_RTS, MODE_IMP}},
+    {0xE9, {OP_SBC, MODE_IMM}}, {0xE5, {OP_SBC, MODE_ZP}}, {0xF5, {OP_SBC, MODE_ZPX}}, {0xED, {OP_SBC, MODE_ABS}},
+    {0xFD, {OP_SBC, MODE_ABX}}, {0xF9, {OP_SBC, MODE_ABY}}, {0xE1, {OP_SBC, MODE_IZX}}, {0xF1, {OP_SBC, MODE_IZY}},
+    {0x38, {OP_SEC, MODE_IMP}}, {0xF8, {OP_SED, MODE_IMP}}, {0x78, {OP_SEI, MODE_IMP}},
+    {0x85, {OP_STA, MODE_ZP}}, {0x95, {OP_STA, MODE_ZPX}}, {0x8D, {OP_STA, MODE_ABS}}, {0x9D, {OP_STA, MODE_ABX}},
+    {0x99, {OP_STA, MODE_ABY}}, {0x81, {OP_STA, MODE_IZX}}, {0x91, {OP_STA, MODE_IZY}},
+    {0x86, {OP_STX, MODE_ZP}}, {0x96, {OP_STX, MODE_ZPY}}, {0x8E, {OP_STX, MODE_ABS}},
+    {0x84, {OP_STY, MODE_ZP}}, {0x94, {OP_STY, MODE_ZPX}}, {0x8C, {OP_STY, MODE_ABS}},
+    {0xAA, {OP_TAX, MODE_IMP}}, {0xA8, {OP_TAY, MODE_IMP}}, {0xBA, {OP_TSX, MODE_IMP}}, {0x8A, {OP_TXA, MODE_IMP}},
+    {0x9A, {OP_TXS, MODE_IMP}}, {0x98, {OP_TYA, MODE_IMP}}
+};
+
+/* Opcodes which the 65C02 adds to those of the 6502. */
+static const OpcodeEntry g_65c02Opcodes[] =
+{
+    {0x72, {OP_ADC, MODE_IZP}}, {0x32, {OP_AND, MODE_IZP}}, {0xD2, {OP_CMP, MODE_IZP}}, {0x52, {OP_EOR, MODE_IZP}},
+    {0xB2, {OP_LDA, MODE_IZP}}, {0x12, {OP_ORA, MODE_IZP}}, {0xF2, {OP_SBC, MODE_IZP}}, {0x92, {OP_STA, MODE_IZP}},
+    {0x89, {OP_BIT, MODE_IMM}}, {0x34, {OP_BIT, MODE_ZPX}}, {0x3C, {OP_BIT, MODE_ABX}},
+    {0x80, {OP_BRA, MODE_REL}},
+    {0x3A, {OP_DEC, MODE_ACC}}, {0x1A, {OP_INC, MODE_ACC}},
+    {0x7C, {OP_JMP, MODE_IAX}},
+    {0xDA, {OP_PHX, MODE_IMP}}, {0x5A, {OP_PHY, MODE_IMP}}, {0xFA, {OP_PLX, MODE_IMP}}, {0x7A, {OP_PLY, MODE_IMP}},
+    {0x64, {OP_STZ, MODE_ZP}}, {0x74, {OP_STZ, MODE_ZPX}}, {0x9C, {OP_STZ, MODE_ABS}}, {0x9E, {OP_STZ, MODE_ABX}},
+    {0x14, {OP_TRB, MODE_ZP}}, {0x1C, {OP_TRB, MODE_ABS}}, {0x04, {OP_TSB, MODE_ZP}}, {0x0C, {OP_TSB, MODE_ABS}}
+};
+
+/* Indexed by OperandMode. */
+static const unsigned char g_instructionSizes[] = { 1, 1, 2, 2, 2, 2, 3, 3, 3, 2, 2, 2, 3, 3, 2 };
+
+
+static void throwIfInstructionSetNotSupported(InstructionSetSupported instructionSet);
+static void addOpcodesToDecodeTable(Simulator* pThis, const OpcodeEntry* pEntries, size_t entryCount);
+__throws Simulator* Simulator_Create(InstructionSetSupported instructionSet)
+{
+    Simulator* pThis = NULL;
+    
+    throwIfInstructionSetNotSupported(instructionSet);
+    pThis = allocateAndZero(sizeof(*pThis));
+    pThis->instructionSet = instructionSet;
+    pThis->registers.s = 0xFF;
+    pThis->registers.p = SIMULATOR_FLAG_U | SIMULATOR_FLAG_I;
+    addOpcodesToDecodeTable(pThis, g_6502Opcodes, ARRAYSIZE(g_6502Opcodes));
+    if (instructionSet == INSTRUCTION_SET_65C02)
+        addOpcodesToDecodeTable(pThis, g_65c02Opcodes, ARRAYSIZE(g_65c02Opcodes));
+    
+    return pThis;
+}
+
+static void throwIfInstructionSetNotSupported(InstructionSetSupported instructionSet)
+{
+    if (instructionSet != INSTRUCTION_SET_6502 && instructionSet != INSTRUCTION_SET_65C02)
+        __throw(invalidArgumentException);
+}
+
+static void addOpcodesToDecodeTable(Simulator* pThis, const OpcodeEntry* pEntries, size_t entryCount)
+{
+    size_t i;
+    
+    for (i = 0 ; i < entryCount ; i++)
+        pThis->decodeTable[pEntries[i].opcode] = pEntries[i].decode;
+}
+
+
+void Simulator_Free(Simulator* pThis)
+{
+    free(pThis);
+}
+
+
+__throws void Simulator_LoadImage(Simulator* pThis, unsigned short address, const unsigned char* pImage, size_t imageSize)
+{
+    if (address + imageSize > sizeof(pThis->memory))
+        __throw(invalidArgumentException);
+    memcpy(&pThis->memory[address], pImage, imageSize);
+}
+
+
+static void readSavFileIntoMemory(Simulator* pThis, FILE* pFile);
+__throws void Simulator_LoadSavFile(Simulator* pThis, Vfs* pVfs, const char* pFilename)
+{
+    FILE* pFile = NULL;
+    
+    __try
+    {
+        pFile = Vfs_Open(pVfs, pFilename, "rb");
+        if (!pFile)
+            __throw(fileOpenException);
+        readSavFileIntoMemory(pThis, pFile);
+    }
+    __catch
+    {
+        if (pFile)
+            fclose(pFile);
+        __rethrow;
+    }
+    
+    fclose(pFile);
+}
+
+static void readSavFileIntoMemory(Simulator* pThis, FILE* pFile)
+{
+    static const char signature[4] = BINARY_BUFFER_SAV_SIGNATURE;
+    SavFileHeader     header;
+    
+    if (1 != fread(&header, sizeof(header), 1, pFile))
+        __throw(fileException);
+    if (0 != memcmp(header.signature, signature, sizeof(signature)))
+        __throw(invalidArgumentException);
+    if ((size_t)header.address + header.length > sizeof(pThis->memory))
+        __throw(invalidArgumentException);
+    if (header.length != fread(&pThis->memory[header.address], 1, header.length, pFile))
+        __throw(fileException);
+}
+
+
+static void push16(Simulator* pThis, unsigned short value);
+static void executeInstruction(Simulator* pThis, Decode decode);
+SimulatorStopReason Simulator_Run(Simulator* pThis, unsigned short entryPoint, unsigned long cycleBudget)
+{
+    pThis->cycleCount = 0;
+    pThis->instructionCount = 0;
+    pThis->registers.pc = entryPoint;
+    push16(pThis, SIMULATOR_SENTINEL_ADDRESS - 1);
+    
+    for (;;)
+    {
+        Decode decode = pThis->decodeTable[pThis->memory[pThis->registers.pc]];
+        
+        if (pThis->registers.pc == SIMULATOR_SENTINEL_ADDRESS)
+            return SIMULATOR_STOP_RETURN;
+        if (pThis->cycleCount >= cycleBudget)
+            return SIMULATOR_STOP_CYCLE_BUDGET;
+        if (decode.operation == OP_BRK)
+            return SIMULATOR_STOP_BRK;
+        if (decode.operation == OP_INVALID)
+            return SIMULATOR_STOP_INVALID_OPCODE;
+        executeInstruction(pThis, decode);
+    }
+}
+
+static void push(Simulator* pThis, unsigned char value)
+{
+    pThis->memory[0x100 | pThis->registers.s--] = value;
+}
+
+static unsigned char pull(Simulator* pThis)
+{
+    return pThis->memory[0x100 | ++pThis->registers.s];
+}
+
+static void push16(Simulator* pThis, unsigned short value)
+{
+    push(pThis, value >> 8);
+    push(pThis, value & 0xFF);
+}
+
+static unsigned short pull16(Simulator* pThis)
+{
+    unsigned short low = pull(pThis);
+    
+    return low | (pull(pThis) << 8);
+}
+
+static unsigned short calculateEffectiveAddress(Simulator* pThis, OperandMode mode, const unsigned char* pMachineCode);
+static void executeOperation(Simulator* pThis, Operation operation, OperandMode mode, unsigned short address);
+static unsigned int countCycles(Simulator* pThis, Operation operation, OpcodeCycles* pCycles);
+static void executeInstruction(Simulator* pThis, Decode decode)
+{
+    unsigned short instructionAddress = pThis->registers.pc;
+    size_t         instructionSize = g_instructionSizes[decode.mode];
+    unsigned char  machineCode[3];
+    OpcodeCycles   cycles;
+    unsigned short effectiveAddress;
+    unsigned int   cyclesTaken;
+    size_t         i;
+    
+    for (i = 0 ; i < instructionSize ; i++)
+        machineCode[i] = pThis->memory[(unsigned short)(instructionAddress + i)];
+    cycles = OpcodeCycles_Get(pThis->instructionSet, instructionAddress, machineCode, instructionSize);
+    
+    pThis->pageCrossed = FALSE;
+    pThis->branchTaken = FALSE;
+    pThis->registers.pc = instructionAddress + instructionSize;
+    effectiveAddress = calculateEffectiveAddress(pThis, decode.mode, machineCode);
+    executeOperation(pThis, decode.operation, decode.mode, effectiveAddress);
+    cyclesTaken = countCycles(pThis, decode.operation, &cycles);
+    pThis->cycleCount += cyclesTaken;
+    pThis->instructionCount++;
+    if (pThis->instructionHook)
+        pThis->instructionHook(pThis->pInstructionHookContext, instructionAddress, cyclesTaken);
+}
+
+static unsigned short readZeroPagePointer(Simulator* pThis, unsigned char zeroPageAddress);
+static unsigned short indexAndFlagPageCrossing(Simulator* pThis, unsigned short baseAddress, unsigned char index);
+static unsigned short readIndirectPointer(Simulator* pThis, unsigned short pointerAddress);
+static unsigned short calculateEffectiveAddress(Simulator* pThis, OperandMode mode, const unsigned char* pMachineCode)
+{
+    SimulatorRegisters* pRegs = &pThis->registers;
+    unsigned short      absoluteAddress = pMachineCode[1] | (pMachineCode[2] << 8);
+    
+    if (mode == MODE_IMM)
+        return pRegs->pc - 1;
+    if (mode == MODE_ZP)
+        return pMachineCode[1];
+    if (mode == MODE_ZPX)
+        return (pMachineCode[1] + pRegs->x) & 0xFF;
+    if (mode == MODE_ZPY)
+        return (pMachineCode[1] + pRegs->y) & 0xFF;
+    if (mode == MODE_ABS)
+        return absoluteAddress;
+    if (mode == MODE_ABX)
+        return indexAndFlagPageCrossing(pThis, absoluteAddress, pRegs->x);
+    if (mode == MODE_ABY)
+        return indexAndFlagPageCrossing(pThis, absoluteAddress, pRegs->y);
+    if (mode == MODE_IZX)
+        return readZeroPagePointer(pThis, pMachineCode[1] + pRegs->x);
+    if (mode == MODE_IZY)
+        return indexAndFlagPageCrossing(pThis, readZeroPagePointer(pThis, pMachineCode[1]), pRegs->y);
+    if (mode == MODE_IZP)
+        return readZeroPagePointer(pThis, pMachineCode[1]);
+    if (mode == MODE_IND)
+        return readIndirectPointer(pThis, absoluteAddress);
+    if (mode == MODE_IAX)
+        return pThis->memory[(unsigned short)(absoluteAddress + pRegs->x)] | 
+               (pThis->memory[(unsigned short)(absoluteAddress + pRegs->x + 1)] << 8);
+    if (mode == MODE_REL)
+        return pRegs->pc + (signed char)pMachineCode[1];
+    return 0;
+}
+
+static unsigned short readZeroPagePointer(Simulator* pThis, unsigned char zeroPageAddress)
+{
+    return pThis->memory[zeroPageAddress] | (pThis->memory[(zeroPageAddress + 1) & 0xFF] << 8);
+}
+
+static unsigned short indexAndFlagPageCrossing(Simulator* pThis, unsigned short baseAddress, unsigned char index)
+{
+    unsigned short indexedAddress = baseAddress + index;
+    
+    pThis->pageCrossed = (baseAddress & 0xFF00) != (indexedAddress & 0xFF00);
+    return indexedAddress;
+}
+
+static unsigned short readIndirectPointer(Simulator* pThis, unsigned short pointerAddress)
+{
+    unsigned short highByteAddress = pointerAddress + 1;
+    
+    /* The 6502 doesn't carry into the high byte of the pointer address when it straddles a page. */
+    if (pThis->instructionSet == INSTRUCTION_SET_6502)
+        highByteAddress = (pointerAddress & 0xFF00) | (highByteAddress & 0xFF);
+    return pThis->memory[pointerAddress] | (pThis->memory[highByteAddress] << 8);
+}
+
+static int isDecimalArithmeticOn65c02(Simulator* pThis, Operation operation);
+static unsigned int countCycles(Simulator* pThis, Operation operation, OpcodeCycles* pCycles)
+{
+    unsigned int cycles = pCycles->minCycles;
+    
+    if (pCycles->isBranch)
+        return pThis->branchTaken ? pCycles->maxCycles : pCycles->minCycles;
+    if (pThis->pageCrossed && pCycles->maxCycles > pCycles->minCycles)
+        cycles++;
+    if (isDecimalArithmeticOn65c02(pThis, operation))
+        cycles++;
+    return cycles;
+}
+
+static int isDecimalArithmeticOn65c02(Simulator* pThis, Operation operation)
+{
+    return pThis->instructionSet == INSTRUCTION_SET_65C02 && 
+           (pThis->registers.p & SIMULATOR_FLAG_D) &&
+           (operation == OP_ADC || operation == OP_SBC);
+}
+
+static unsigned char readOperand(Simulator* pThis, OperandMode mode, unsigned short address);
+static void writeResult(Simulator* pThis, OperandMode mode, unsigned short address, unsigned char value);
+static unsigned char setNZ(Simulator* pThis, unsigned char value);
+static void setFlag(Simulator* pThis, unsigned char flag, int isSet);
+static int isFlagSet(Simulator* pThis, unsigned char flag);
+static void branch(Simulator* pThis, int isTaken, unsigned short address);
+static void addWithCarry(Simulator* pThis, unsigned char value);
+static void subtractWithBorrow(Simulator* pThis, unsigned char value);
+static void compare(Simulator* pThis, unsigned char registerValue, unsigned char value);
+static void bitTest(Simulator* pThis, OperandMode mode, unsigned char value);
+static unsigned char shiftLeft(Simulator* pThis, unsigned char value, int carryIn);
+static unsigned char shiftRight(Simulator* pThis, unsigned char value, int carryIn);
+static void executeOperation(Simulator* pThis, Operation operation, OperandMode mode, unsigned short address)
+{
+    SimulatorRegisters* pRegs = &pThis->registers;
+    
+    switch (operation)
+    {
+    case OP_ADC:
+        addWithCarry(pThis, readOperand(pThis, mode, address));
+        break;
+    case OP_AND:
+        pRegs->a = setNZ(pThis, pRegs->a & readOperand(pThis, mode, address));
+        break;
+    case OP_ASL:
+        writeResult(pThis, mode, address, shiftLeft(pThis, readOperand(pThis, mode, address), 0));
+        break;
+    case OP_BCC:
+        branch(pThis, !isFlagSet(pThis, SIMULATOR_FLAG_C), address);
+        break;
+    case OP_BCS:
+        branch(pThis, isFlagSet(pThis, SIMULATOR_FLAG_C), address);
+        break;
+    case OP_BEQ:
+        branch(pThis, isFlagSet(pThis, SIMULATOR_FLAG_Z), address);
+        break;
+    case OP_BIT:
+        bitTest(pThis, mode, readOperand(pThis, mode, address));
+        break;
+    case OP_BMI:
+        branch(pThis, isFlagSet(pThis, SIMULATOR_FLAG_N), address);
+        break;
+    case OP_BNE:
+        branch(pThis, !isFlagSet(pThis, SIMULATOR_FLAG_Z), address);
+        break;
+    case OP_BPL:
+        branch(pThis, !isFlagSet(pThis, SIMULATOR_FLAG_N), address);
+        break;
+    case OP_BRA:
+        branch(pThis, TRUE, address);
+        break;
+    case OP_BVC:
+        branch(pThis, !isFlagSet(pThis, SIMULATOR_FLAG_V), address);
+        break;
+    case OP_BVS:
+        branch(pThis, isFlagSet(pThis, SIMULATOR_FLAG_V), address);
+        break;
+    case OP_CLC:
+        setFlag(pThis, SIMULATOR_FLAG_C, FALSE);
+        break;
+    case OP_CLD:
+        setFlag(pThis, SIMULATOR_FLAG_D, FALSE);
+        break;
+    case OP_CLI:
+        setFlag(pThis, SIMULATOR_FLAG_I, FALSE);
+        break;
+    case OP_CLV:
+        setFlag(pThis, SIMULATOR_FLAG_V, FALSE);
+        break;
+    case OP_CMP:
+        compare(pThis, pRegs->a, readOperand(pThis, mode, address));
+        break;
+    case OP_CPX:
+        compare(pThis, pRegs->x, readOperand(pThis, mode, address));
+        break;
+    case OP_CPY:
+        compare(pThis, pRegs->y, readOperand(pThis, mode, address));
+        break;
+    case OP_DEC:
+        writeResult(pThis, mode, address, setNZ(pThis, readOperand(pThis, mode, address) - 1));
+        break;
+    case OP_DEX:
+        pRegs->x = setNZ(pThis, pRegs->x - 1);
+        break;
+    case OP_DEY:
+        pRegs->y = setNZ(pThis, pRegs->y - 1);
+        break;
+    case OP_EOR:
+        pRegs->a = setNZ(pThis, pRegs->a ^ readOperand(pThis, mode, address));
+        break;
+    case OP_INC:
+        writeResult(pThis, mode, address, setNZ(pThis, readOperand(pThis, mode, address) + 1));
+        break;
+    case OP_INX:
+        pRegs->x = setNZ(pThis, pRegs->x + 1);
+        break;
+    case OP_INY:
+        pRegs->y = setNZ(pThis, pRegs->y + 1);
+        break;
+    case OP_JMP:
+        pRegs->pc = address;
+        break;
+    case OP_JSR:
+        push16(pThis, pRegs->pc - 1);
+        pRegs->pc = address;
+        break;
+    case OP_LDA:
+        pRegs->a = setNZ(pThis, readOperand(pThis, mode, address));
+        break;
+    case OP_LDX:
+        pRegs->x = setNZ(pThis, readOperand(pThis, mode, address));
+        break;
+    case OP_LDY:
+        pRegs->y = setNZ(pThis, readOperand(pThis, mode, address));
+        break;
+    case OP_LSR:
+        writeResult(pThis, mode, address, shiftRight(pThis, readOperand(pThis, mode, address), 0));
+        break;
+    case OP_NOP:
+        break;
+    case OP_ORA:
+        pRegs->a = setNZ(pThis, pRegs->a | readOperand(pThis, mode, address));
+        break;
+    case OP_PHA:
+        push(pThis, pRegs->a);
+        break;
+    case OP_PHP:
+        push(pThis, pRegs->p | SIMULATOR_FLAG_B | SIMULATOR_FLAG_U);
+        break;
+    case OP_PHX:
+        push(pThis, pRegs->x);
+        break;
+    case OP_PHY:
+        push(pThis, pRegs->y);
+        break;
+    case OP_PLA:
+        pRegs->a = setNZ(pThis, pull(pThis));
+        break;
+    case OP_PLP:
+        pRegs->p = (pull(pThis) & ~SIMULATOR_FLAG_B) | SIMULATOR_FLAG_U;
+        break;
+    case OP_PLX:
+        pRegs->x = setNZ(pThis, pull(pThis));
+        break;
+    case OP_PLY:
+        pRegs->y = setNZ(pThis, pull(pThis));
+        break;
+    case OP_ROL:
+        writeResult(pThis, mode, address, 
+                    shiftLeft(pThis, readOperand(pThis, mode, address), isFlagSet(pThis, SIMULATOR_FLAG_C)));
+        break;
+    case OP_ROR:
+        writeResult(pThis, mode, address, 
+                    shiftRight(pThis, readOperand(pThis, mode, address), isFlagSet(pThis, SIMULATOR_FLAG_C)));
+        break;
+    case OP_RTI:
+        pRegs->p = (pull(pThis) & ~SIMULATOR_FLAG_B) | SIMULATOR_FLAG_U;
+        pRegs->pc = pull16(pThis);
+        break;
+    case OP_RTS:
+        pRegs->pc = pull16(pThis) + 1;
+        break;
+    case OP_SBC:
+        subtractWithBorrow(pThis, readOperand(pThis, mode, address));
+        break;
+    case OP_SEC:
+        setFlag(pThis, SIMULATOR_FLAG_C, TRUE);
+        break;
+    case OP_SED:
+        setFlag(pThis, SIMULATOR_FLAG_D, TRUE);
+        break;
+    case OP_SEI:
+        setFlag(pThis, SIMULATOR_FLAG_I, TRUE);
+        break;
+    case OP_STA:
+        writeResult(pThis, mode, address, pRegs->a);
+        break;
+    case OP_STX:
+        writeResult(pThis, mode, address, pRegs->x);
+        break;
+    case OP_STY:
+        writeResult(pThis, mode, address, pRegs->y);
+        break;
+    case OP_STZ:
+        writeResult(pThis, mode, address, 0);
+        break;
+    case OP_TAX:
+        pRegs->x = setNZ(pThis, pRegs->a);
+        break;
+    case OP_TAY:
+        pRegs->y = setNZ(pThis, pRegs->a);
+        break;
+    case OP_TRB:
+        setFlag(pThis, SIMULATOR_FLAG_Z, (pRegs->a & readOperand(pThis, mode, address)) == 0);
+        writeResult(pThis, mode, address, readOperand(pThis, mode, address) & ~pRegs->a);
+        break;
+    case OP_TSB:
+        setFlag(pThis, SIMULATOR_FLAG_Z, (pRegs->a & readOperand(pThis, mode, address)) == 0);
+        writeResult(pThis, mode, address, readOperand(pThis, mode, address) | pRegs->a);
+        break;
+    case OP_TSX:
+        pRegs->x = setNZ(pThis, pRegs->s);
+        break;
+    case OP_TXA:
+        pRegs->a = setNZ(pThis, pRegs->x);
+        break;
+    case OP_TXS:
+        pRegs->s = pRegs->x;
+        break;
+    case OP_TYA:
+        pRegs->a = setNZ(pThis, pRegs->y);
+        break;
+    case OP_BRK:
+    case OP_INVALID:
+    default:
+        /* Simulator_Run() stops before executing these. */
+        break;
+    }
+}
+
+static unsigned char readOperand(Simulator* pThis, OperandMode mode, unsigned short address)
+{
+    if (mode == MODE_ACC)
+        return pThis->registers.a;
+    return pThis->memory[address];
+}
+
+static void writeResult(Simulator* pThis, OperandMode mode, unsigned short address, unsigned char value)
+{
+    if (mode == MODE_ACC)
+        pThis->registers.a = value;
+    else
+        pThis->memory[address] = value;
+}
+
+static unsigned char setNZ(Simulator* pThis, unsigned char value)
+{
+    setFlag(pThis, SIMULATOR_FLAG_Z, value == 0);
+    setFlag(pThis, SIMULATOR_FLAG_N, value & 0x80);
+    return value;
+}
+
+static void setFlag(Simulator* pThis, unsigned char flag, int isSet)
+{
+    if (isSet)
+        pThis->registers.p |= flag;
+    else
+        pThis->registers.p &= ~flag;
+}
+
+static int isFlagSet(Simulator* pThis, unsigned char flag)
+{
+    return (pThis->registers.p & flag) ? 1 : 0;
+}
+
+static void branch(Simulator* pThis, int isTaken, unsigned short address)
+{
+    if (!isTaken)
+        return;
+    pThis->registers.pc = address;
+    pThis->branchTaken = TRUE;
+}
+
+static void addWithCarry(Simulator* pThis, unsigned char value)
+{
+    SimulatorRegisters* pRegs = &pThis->registers;
+    unsigned int        carry = isFlagSet(pThis, SIMULATOR_FLAG_C);
+    unsigned int        binarySum = pRegs->a + value + carry;
+    unsigned int        lowDigit;
+    unsigned int        highDigit;
+    
+    if (!isFlagSet(pThis, SIMULATOR_FLAG_D))
+    {
+        setFlag(pThis, SIMULATOR_FLAG_V, ~(pRegs->a ^ value) & (pRegs->a ^ binarySum) & 0x80);
+        setFlag(pThis, SIMULATOR_FLAG_C, binarySum > 0xFF);
+        pRegs->a = setNZ(pThis, binarySum);
+        return;
+    }
+    
+    /* The NMOS 6502 sets Z from the binary sum and N/V from the sum before the high digit is adjusted. */
+    lowDigit = (pRegs->a & 0x0F) + (value & 0x0F) + carry;
+    if (lowDigit > 9)
+        lowDigit += 6;
+    highDigit = (pRegs->a >> 4) + (value >> 4) + (lowDigit > 0x0F);
+    setFlag(pThis, SIMULATOR_FLAG_Z, (binarySum & 0xFF) == 0);
+    setFlag(pThis, SIMULATOR_FLAG_N, (highDigit << 4) & 0x80);
+    setFlag(pThis, SIMULATOR_FLAG_V, ~(pRegs->a ^ value) & (pRegs->a ^ (highDigit << 4)) & 0x80);
+    if (highDigit > 9)
+        highDigit += 6;
+    setFlag(pThis, SIMULATOR_FLAG_C, highDigit > 0x0F);
+    pRegs->a = ((highDigit << 4) | (lowDigit & 0x0F)) & 0xFF;
+    if (pThis->instructionSet == INSTRUCTION_SET_65C02)
+        setNZ(pThis, pRegs->a);
+}
+
+static void subtractWithBorrow(Simulator* pThis, unsigned char value)
+{
+    SimulatorRegisters* pRegs = &pThis->registers;
+    int                 borrow = !isFlagSet(pThis, SIMULATOR_FLAG_C);
+    int                 binaryDifference = pRegs->a - value - borrow;
+    int                 lowDigit;
+    int                 highDigit;
+    
+    setFlag(pThis, SIMULATOR_FLAG_V, (pRegs->a ^ value) & (pRegs->a ^ binaryDifference) & 0x80);
+    setFlag(pThis, SIMULATOR_FLAG_C, binaryDifference >= 0);
+    if (!isFlagSet(pThis, SIMULATOR_FLAG_D))
+    {
+        pRegs->a = setNZ(pThis, binaryDifference & 0xFF);
+        return;
+    }
+    
+    /* The NMOS 6502 sets N and Z from the binary difference. */
+    setNZ(pThis, binaryDifference & 0xFF);
+    lowDigit = (pRegs->a & 0x0F) - (value & 0x0F) - borrow;
+    highDigit = (pRegs->a >> 4) - (value >> 4);
+    if (lowDigit < 0)
+    {
+        lowDigit -= 6;
+        highDigit--;
+    }
+    if (highDigit < 0)
+        highDigit -= 6;
+    pRegs->a = ((highDigit << 4) | (lowDigit & 0x0F)) & 0xFF;
+    if (pThis->instructionSet == INSTRUCTION_SET_65C02)
+        setNZ(pThis, pRegs->a);
+}
+
+static void compare(Simulator* pThis, unsigned char registerValue, unsigned char value)
+{
+    setFlag(pThis, SIMULATOR_FLAG_C, registerValue >= value);
+    setNZ(pThis, registerValue - value);
+}
+
+static void bitTest(Simulator* pThis, OperandMode mode, unsigned char value)
+{
+    setFlag(pThis, SIMULATOR_FLAG_Z, (pThis->registers.a & value) == 0);
+    /* BIT #imm on the 65C02 only updates Z. */
+    if (mode == MODE_IMM)
+        return;
+    setFlag(pThis, SIMULATOR_FLAG_N, value & SIMULATOR_FLAG_N);
+    setFlag(pThis, SIMULATOR_FLAG_V, value & SIMULATOR_FLAG_V);
+}
+
+static unsigned char shiftLeft(Simulator* pThis, unsigned char value, int carryIn)
+{
+    setFlag(pThis, SIMULATOR_FLAG_C, value & 0x80);
+    return setNZ(pThis, (value << 1) | carryIn);
+}
+
+static unsigned char shiftRight(Simulator* pThis, unsigned char value, int carryIn)
+{
+    setFlag(pThis, SIMULATOR_FLAG_C, value & 0x01);
+    return setNZ(pThis, (value >> 1) | (carryIn << 7));
+}
+
+
+void Simulator_SetInstructionHook(Simulator* pThis, SimulatorInstructionHook hook, void* pContext)
+{
+    pThis->instructionHook = hook;
+    pThis->pInstructionHookContext = pContext;
+}
+
+
+SimulatorRegisters* Simulator_GetRegisters(Simulator* pThis)
+{
+    return &pThis->registers;
+}
+
+unsigned char* Simulator_GetMemory(Simulator* pThis)
+{
+    return pThis->memory;
+}
+
+unsigned long Simulator_GetCycleCount(Simulator* pThis)
+{
+    return pThis->cycleCount;
+}
+
+unsigned long Simulator_GetInstructionCount(Simulator* pThis)
+{
+    return pThis->instructionCount;
+}
@@ -27,7 +27,8 @@ static void displayCopyrightNotice(void)
 static void displayUsage(void)
 {
     printf("Usage: snap [--list listFilename] [--putdirs includeDir1;includeDir2...]\n"
-           "            [--outdir outputDirectory]sourceFilename\n\n"
+           "            [--outdir outputDirectory] [--run label [--profile listFilename]]\n"
+           "            sourceFilename\n\n"
            "Where: --list listFilename allows the list file for the assembly\n"
            "         process to be output to the specified file.  By default it\n"
            "         will be sent to stdout.\n"
@@ -35,6 +36,12 @@ static void displayUsage(void)
            "         files will be searched when including files with PUT directive.\n"
            "       --outdir sets the directory where output files from directives\n"
            "         like USR and SAV should be stored.\n"
+           "       --run label loads the SAV output files into a simulated\n"
+           "         6502/65C02 and calls the routine at label until it returns\n"
+           "         or hits a BRK.  The cycles taken are then displayed.\n"
+           "       --profile listFilename writes a list file annotated with the\n"
+           "         cycles taken by each line during the --run and displays the\n"
+           "         labels and lines which took the most cycles.\n"
            "       sourceFilename is the required name of an input assembly\n"
            "         language file.\n");
 }
@@ -92,7 +99,9 @@ static int parseFlagArgument(SnapCommandLine* pThis, int argc, const char** ppAr
     {
         { "--list",    offsetof(SnapCommandLine, assemblerInitParams) + offsetof(AssemblerInitParams, pListFilename) },
         { "--putdirs", offsetof(SnapCommandLine, assemblerInitParams) + offsetof(AssemblerInitParams, pPutDirectories) },
-        { "--outdir",  offsetof(SnapCommandLine, assemblerInitParams) + offsetof(AssemblerInitParams, pOutputDirectory) }
+        { "--outdir",  offsetof(SnapCommandLine, assemblerInitParams) + offsetof(AssemblerInitParams, pOutputDirectory) },
+        { "--run",     offsetof(SnapCommandLine, pRunLabel) },
+        { "--profile", offsetof(SnapCommandLine, pProfileFilename) }
     };
     size_t i;
     
@@ -134,4 +143,6 @@ static void throwIfRequiredArgumentNotSpecified(SnapCommandLine* pThis)
 {
     if (!pThis->pSourceFilename)
         __throw(invalidArgumentException);
+    if (pThis->pProfileFilename && !pThis->pRunLabel)
+        __throw(invalidArgumentException);
 }
@@ -26,6 +26,7 @@ extern "C"
     #include "FileFailureInject.h"
     #include "printfSpy.h"
     #include "BinaryBuffer.h"
+    #include "MemoryVfs.h"
     #include "util.h"
 }
 
@@ -172,7 +173,8 @@ TEST_BASE(AssemblerBase)
         LONGS_EQUAL(expectedAddress, pLineInfo->address);
     }
     
-    void validateObjectFileContains(unsigned short expectedAddress, const char* pExpectedContent, long expectedContentSize)
+    void validateObjectFileContains(unsigned short expectedAddress, const char* pExpectedContent, long expectedContentSize,
+                                    const char* pExpectedSignature = BINARY_BUFFER_SAV_SIGNATURE)
     {
         SavFileHeader header;
         
@@ -181,7 +183,7 @@ TEST_BASE(AssemblerBase)
         LONGS_EQUAL(expectedContentSize + sizeof(header), getFileSize(m_pFile));
         
         LONGS_EQUAL(sizeof(header), fread(&header, 1, sizeof(header), m_pFile));
-        CHECK(0 == memcmp(header.signature, BINARY_BUFFER_SAV_SIGNATURE, sizeof(header.signature)));
+        CHECK(0 == memcmp(header.signature, pExpectedSignature, sizeof(header.signature)));
         LONGS_EQUAL(expectedAddress, header.address);
         LONGS_EQUAL(expectedContentSize, header.length);
         
@@ -201,7 +203,8 @@ TEST_BASE(AssemblerBase)
                                         unsigned short expectedTrack,
                                         unsigned short expectedOffset,
                                         const char*    pExpectedContent, 
-                                        long           expectedContentSize)
+                                        long           expectedContentSize,
+                                        const char*    pExpectedSignature = BINARY_BUFFER_RW18SAV_SIGNATURE)
     {
         RW18SavFileHeader header;
         
@@ -210,7 +213,7 @@ TEST_BASE(AssemblerBase)
         LONGS_EQUAL(expectedContentSize + sizeof(header), getFileSize(m_pFile));
         
         LONGS_EQUAL(sizeof(header), fread(&header, 1, sizeof(header), m_pFile));
-        CHECK(0 == memcmp(header.signature, BINARY_BUFFER_RW18SAV_SIGNATURE, sizeof(header.signature)));
+        CHECK(0 == memcmp(header.signature, pExpectedSignature, sizeof(header.signature)));
         LONGS_EQUAL(expectedSide, header.side);
         LONGS_EQUAL(expectedTrack, header.track);
         LONGS_EQUAL(expectedOffset, header.offset);
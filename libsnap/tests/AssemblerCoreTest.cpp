@@ -23,7 +23,7 @@ TEST_GROUP_BASE(AssemblerCore, AssemblerBase)
 
 TEST(AssemblerCore, FailAllInitAllocations)
 {
-    static const int allocationsToFail = 26;
+    static const int allocationsToFail = 27;
     m_initParams.pListFilename = g_listFilename;
     m_initParams.pPutDirectories = ".";
     for (int i = 1 ; i <= allocationsToFail ; i++)
@@ -59,9 +59,82 @@ TEST(AssemblerCore, InitFromNonExistantFile)
     validateFileOpenExceptionThrown();
 }
 
+TEST(AssemblerCore, RunWithAllFilesInMemoryVfs)
+{
+    static const char    source[] = " put Included" LINE_ENDING " sav Output.sav" LINE_ENDING;
+    static const char    included[] = " lda #$ff" LINE_ENDING;
+    static const char    expectedObject[] = "SAV\x1a\x00\x80\x02\x00\xa9\xff";
+    MemoryVfs*           pMemoryVfs = MemoryVfs_Create();
+    const unsigned char* pData;
+    size_t               dataSize = 0;
+    
+    MemoryVfs_AddFile(pMemoryVfs, "Source.S", source, sizeof(source) - 1);
+    MemoryVfs_AddFile(pMemoryVfs, "inc" SLASH_STR "Included.S", included, sizeof(included) - 1);
+    m_initParams.pVfs = MemoryVfs_GetVfs(pMemoryVfs);
+    m_initParams.pPutDirectories = "inc";
+    m_initParams.pListFilename = "Output.lst";
+    m_pAssembler = Assembler_CreateFromFile("Source.S", &m_initParams);
+    Assembler_Run(m_pAssembler);
+    Assembler_Free(m_pAssembler);
+    m_pAssembler = NULL;
+    
+    STRCMP_EQUAL("", printfSpy_GetLastErrorOutput());
+    pData = MemoryVfs_GetFileData(pMemoryVfs, "Output.sav", &dataSize);
+    CHECK(pData != NULL);
+    LONGS_EQUAL(sizeof(expectedObject) - 1, dataSize);
+    CHECK(0 == memcmp(expectedObject, pData, dataSize));
+    CHECK(NULL != MemoryVfs_GetFileData(pMemoryVfs, "Output.lst", &dataSize));
+    MemoryVfs_Free(pMemoryVfs);
+}
+
+TEST(AssemblerCore, KeepObjectsInMemoryAndEnumerateThem)
+{
+    static const unsigned char expectedObject[] = { 0xa9, 0xff };
+    BinaryBufferOutput         output;
+    
+    m_initParams.keepObjectsInMemory = TRUE;
+    m_pAssembler = Assembler_CreateFromString(" org $800" LINE_ENDING
+                                              " lda #$ff" LINE_ENDING
+                                              " usr $a9,1,$0,*-$800" LINE_ENDING, &m_initParams);
+    Assembler_Run(m_pAssembler);
+    LONGS_EQUAL(0, Assembler_GetErrorCount(m_pAssembler));
+    
+    Assembler_ObjectFileEnumStart(m_pAssembler);
+    CHECK_TRUE(Assembler_ObjectFileEnumNext(m_pAssembler, &output));
+    LONGS_EQUAL(sizeof(expectedObject), output.contentLength);
+    CHECK(0 == memcmp(expectedObject, output.pContent, sizeof(expectedObject)));
+    CHECK_TRUE(output.isRW18);
+    LONGS_EQUAL(0xa9, output.side);
+    LONGS_EQUAL(1, output.track);
+    LONGS_EQUAL(0, output.offset);
+    CHECK_FALSE(Assembler_ObjectFileEnumNext(m_pAssembler, &output));
+}
+
+TEST(AssemblerCore, GetLabelValue)
+{
+    InstructionSetSupported instructionSet = INSTRUCTION_SET_INVALID;
+    
+    m_pAssembler = Assembler_CreateFromString(dupe(" org $800" LINE_ENDING
+                                                   " xc" LINE_ENDING
+                                                   "entry lda #$ff" LINE_ENDING), NULL);
+    Assembler_Run(m_pAssembler);
+    LONGS_EQUAL(0x800, Assembler_GetLabelValue(m_pAssembler, "entry", &instructionSet));
+    LONGS_EQUAL(INSTRUCTION_SET_65C02, instructionSet);
+}
+
+TEST(AssemblerCore, FailToGetValueOfUndefinedLabel)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" lda missing" LINE_ENDING), NULL);
+    Assembler_Run(m_pAssembler);
+    __try_and_catch( Assembler_GetLabelValue(m_pAssembler, "entry", NULL) );
+    validateExceptionThrown(invalidArgumentException);
+    __try_and_catch( Assembler_GetLabelValue(m_pAssembler, "missing", NULL) );
+    validateExceptionThrown(invalidArgumentException);
+}
+
 TEST(AssemblerCore, FailAllAllocationsDuringFileInit)
 {
-    static const int allocationsToFail = 27;
+    static const int allocationsToFail = 28;
     createSourceFile(" ORG $800\r" LINE_ENDING);
     m_initParams.pListFilename = g_listFilename;
     m_initParams.pPutDirectories = ".";
@@ -517,6 +517,50 @@ TEST(AssemblerDirectives, SAV_DirectiveFailWriteFileQueue)
                                    "    :              1  sav AssemblerTest.sav" LINE_ENDING);
 }
 
+TEST(AssemblerDirectives, LZ_DirectiveShouldCompressSAVOutput)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" lz" LINE_ENDING
+                                                   " org $800" LINE_ENDING
+                                                   " hex 11,11,11,11,11,11,11,11" LINE_ENDING
+                                                   " sav AssemblerTest.sav" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastLineIs("    :              4  sav AssemblerTest.sav" LINE_ENDING, 6);
+    validateObjectFileContains(0x800, "\x01\x11\x83\x01\x00\x00", 6, BINARY_BUFFER_LZSAV_SIGNATURE);
+}
+
+TEST(AssemblerDirectives, LZ_DirectiveShouldCompressForwardReferencesResolvedAfterSAV)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" lz" LINE_ENDING
+                                                   " org $800" LINE_ENDING
+                                                   " db value" LINE_ENDING
+                                                   " sav AssemblerTest.sav" LINE_ENDING
+                                                   "value equ $42" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastLineIs("    :    =0042     5 value equ $42" LINE_ENDING, 5);
+    validateObjectFileContains(0x800, "\x01\x42\x00", 3, BINARY_BUFFER_LZSAV_SIGNATURE);
+}
+
+TEST(AssemblerDirectives, LZ_DirectiveOffShouldStopCompressingOutput)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" lz" LINE_ENDING
+                                                   " lz off" LINE_ENDING
+                                                   " org $800" LINE_ENDING
+                                                   " hex 00,ff" LINE_ENDING
+                                                   " sav AssemblerTest.sav" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastLineIs("    :              5  sav AssemblerTest.sav" LINE_ENDING, 5);
+    validateObjectFileContains(0x800, "\x00\xff", 2);
+}
+
+TEST(AssemblerDirectives, LZ_DirectiveShouldCompressUSROutput)
+{
+    createSourceFile(" lz" LINE_ENDING
+                     " org $800" LINE_ENDING
+                     " hex 00,ff" LINE_ENDING
+                     " usr $a9,1,$a80,*-$800" LINE_ENDING);
+    m_pAssembler = Assembler_CreateFromFile("AssemblerTest.S", NULL);
+    runAssemblerAndValidateLastLineIs("    :              4  usr $a9,1,$a80,*-$800" LINE_ENDING, 4);
+    validateRW18ObjectFileContains(g_usrFilename, 0xa9, 1, 0xa80, "\x02\x00\xff\x00", 4, 
+                                   BINARY_BUFFER_LZRW18SAV_SIGNATURE);
+}
+
 TEST(AssemblerDirectives, DB_DirectiveWithSingleExpression)
 {
     m_pAssembler = Assembler_CreateFromString(dupe("Value EQU $fe" LINE_ENDING
@@ -690,6 +734,430 @@ TEST(AssemblerDirectives, XC_DirectiveForwardReferenceFrom6502To65816)
     runAssemblerAndValidateLastLineIs("8002: 60           4 ForwardLabel lda #20" LINE_ENDING, 4);
 }
 
+TEST(AssemblerDirectives, CYC_DirectiveShouldAnnotateInstructionsWithCycleCounts)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" cyc" LINE_ENDING
+                                                   " lda #20" LINE_ENDING
+                                                   " sta $2000,x" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8000: A9 14        2  lda #20  (cycles 2, total 2)" LINE_ENDING,
+                                                   "8002: 9D 00 20     3  sta $2000,x  (cycles 5, total 7)" LINE_ENDING,
+                                                   3);
+}
+
+TEST(AssemblerDirectives, CYC_DirectiveShouldRestartTotalAtEachLabel)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" cyc" LINE_ENDING
+                                                   " lda $2000,y" LINE_ENDING
+                                                   "loop dex" LINE_ENDING
+                                                   " bne loop" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8003: CA           3 loop dex  (cycles 2, total 2)" LINE_ENDING,
+                                                   "8004: D0 FD        4  bne loop  (cycles 2/3, total 4-5)" LINE_ENDING,
+                                                   4);
+}
+
+TEST(AssemblerDirectives, CYC_DirectiveWithOffOperandShouldStopAnnotations)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" cyc" LINE_ENDING
+                                                   " cyc off" LINE_ENDING
+                                                   " lda #20" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastLineIs("8000: A9 14        3  lda #20" LINE_ENDING, 3);
+}
+
+TEST(AssemblerDirectives, CYC_DirectiveShouldUse65C02TimingsAfterXC)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" xc" LINE_ENDING
+                                                   " cyc" LINE_ENDING
+                                                   " jmp ($2000)" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastLineIs("8000: 6C 00 20     3  jmp ($2000)  (cycles 6, total 6)" LINE_ENDING, 3);
+}
+
+TEST(AssemblerDirectives, TIMED_DirectiveShouldWarnOnBackwardBranchAcrossPage)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" org $80fc" LINE_ENDING
+                                                   " timed" LINE_ENDING
+                                                   "loop dex" LINE_ENDING
+                                                   " nop" LINE_ENDING
+                                                   " nop" LINE_ENDING
+                                                   " nop" LINE_ENDING
+                                                   " bne loop" LINE_ENDING), NULL);
+    runAssemblerAndValidateWarning("filename:7: warning: Taken branch from $8100 to $80FC crosses a page in timing "
+                                   "critical code. Padding $80FC with 4 bytes would fix it." LINE_ENDING,
+                                   "8100: D0 FA        7  bne loop" LINE_ENDING, 8);
+}
+
+TEST(AssemblerDirectives, TIMED_DirectiveShouldWarnOnForwardBranchAcrossPage)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" org $80fd" LINE_ENDING
+                                                   " timed" LINE_ENDING
+                                                   " bne skip" LINE_ENDING
+                                                   " nop" LINE_ENDING
+                                                   "skip nop" LINE_ENDING), NULL);
+    runAssemblerAndValidateWarning("filename:3: warning: Taken branch from $80FD to $8100 crosses a page in timing "
+                                   "critical code. Padding $80FD with 1 bytes would fix it." LINE_ENDING,
+                                   "8100: EA           5 skip nop" LINE_ENDING, 6);
+}
+
+TEST(AssemblerDirectives, TIMED_DirectiveWithOffOperandShouldNotWarnOnBranchAcrossPage)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" org $80fd" LINE_ENDING
+                                                   " timed" LINE_ENDING
+                                                   " timed off" LINE_ENDING
+                                                   " bne skip" LINE_ENDING
+                                                   " nop" LINE_ENDING
+                                                   "skip nop" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastLineIs("8100: EA           6 skip nop" LINE_ENDING, 6);
+    LONGS_EQUAL(0, Assembler_GetWarningCount(m_pAssembler));
+}
+
+TEST(AssemblerDirectives, TIMED_DirectiveShouldNotWarnOnBranchWithinPage)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" timed" LINE_ENDING
+                                                   "loop dex" LINE_ENDING
+                                                   " bne loop" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastLineIs("8001: D0 FD        3  bne loop" LINE_ENDING, 3);
+    LONGS_EQUAL(0, Assembler_GetWarningCount(m_pAssembler));
+}
+
+TEST(AssemblerDirectives, TIMED_DirectiveShouldWarnOnIndexedTableAcrossPage)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" org $80f0" LINE_ENDING
+                                                   " timed" LINE_ENDING
+                                                   " lda table,x" LINE_ENDING
+                                                   " rts" LINE_ENDING
+                                                   " ds 4" LINE_ENDING
+                                                   "table hex 0001020304050607" LINE_ENDING
+                                                   " hex 08090a0b0c0d0e0f" LINE_ENDING), NULL);
+    runAssemblerAndValidateWarning("filename:3: warning: Indexed access to $80F8-$8107 crosses a page in timing "
+                                   "critical code. Padding $80F8 with 8 bytes would fix it." LINE_ENDING,
+                                   "8106: 0E 0F   " LINE_ENDING, 13);
+}
+
+TEST(AssemblerDirectives, TIMED_DirectiveShouldWarnOnIndexedTableTooLargeForPage)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" timed" LINE_ENDING
+                                                   " lda table,y" LINE_ENDING
+                                                   "table ds 257" LINE_ENDING), NULL);
+    Assembler_Run(m_pAssembler);
+    STRCMP_EQUAL("filename:2: warning: Indexed access to $8003-$8103 crosses a page in timing critical code. "
+                 "The 257 byte table can't fit in one page." LINE_ENDING, printfSpy_GetLastErrorOutput());
+    LONGS_EQUAL(1, Assembler_GetWarningCount(m_pAssembler));
+}
+
+TEST(AssemblerDirectives, TIMED_DirectiveShouldNotWarnOnIndexedTableWithinPage)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" timed" LINE_ENDING
+                                                   " lda table+1,x" LINE_ENDING
+                                                   " sta $c000,x" LINE_ENDING
+                                                   "table ds 16" LINE_ENDING
+                                                   "next ds 256" LINE_ENDING), NULL);
+    Assembler_Run(m_pAssembler);
+    LONGS_EQUAL(0, Assembler_GetWarningCount(m_pAssembler));
+    LONGS_EQUAL(0, Assembler_GetErrorCount(m_pAssembler));
+}
+
+TEST(AssemblerDirectives, LBR_DirectiveShouldExpandOutOfRangeBackwardBranch)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" lbr" LINE_ENDING
+                                                   "loop ds 200" LINE_ENDING
+                                                   " bne loop" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("80C8: F0 03 4C     3  bne loop  (long branch)" LINE_ENDING,
+                                                   "80CB: 00 80   " LINE_ENDING, 70);
+}
+
+TEST(AssemblerDirectives, LBR_DirectiveShouldKeepInRangeBranchShort)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" lbr" LINE_ENDING
+                                                   "loop dex" LINE_ENDING
+                                                   " bne loop" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastLineIs("8001: D0 FD        3  bne loop" LINE_ENDING, 3);
+}
+
+TEST(AssemblerDirectives, LBR_DirectiveShouldExpandOutOfRangeForwardBranch)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" lbr" LINE_ENDING
+                                                   " beq skip" LINE_ENDING
+                                                   " ds 200" LINE_ENDING
+                                                   "skip rts" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastLineIs("80CD: 60           4 skip rts" LINE_ENDING, 71);
+    validateLineInfo(m_pAssembler->linesHead.pNext->pNext, 0x8000, 5, "\xd0\x03\x4c\xcd\x80");
+}
+
+TEST(AssemblerDirectives, LBR_DirectiveShouldShrinkLongBranchBackOnceInRange)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" lbr" LINE_ENDING
+                                                   " beq target" LINE_ENDING
+                                                   " lda zp1" LINE_ENDING
+                                                   " lda zp2" LINE_ENDING
+                                                   " lda zp3" LINE_ENDING
+                                                   " lda zp4" LINE_ENDING
+                                                   " ds 116" LINE_ENDING
+                                                   "target rts" LINE_ENDING
+                                                   "zp1 equ $20" LINE_ENDING
+                                                   "zp2 equ $21" LINE_ENDING
+                                                   "zp3 equ $22" LINE_ENDING
+                                                   "zp4 equ $23" LINE_ENDING), NULL);
+    Assembler_Run(m_pAssembler);
+    LONGS_EQUAL(0, Assembler_GetErrorCount(m_pAssembler));
+    validateLineInfo(m_pAssembler->linesHead.pNext->pNext, 0x8000, 2, "\xf0\x7c");
+}
+
+TEST(AssemblerDirectives, LBR_DirectiveShouldTurnBranchAlwaysIntoJump)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" xc" LINE_ENDING
+                                                   " lbr" LINE_ENDING
+                                                   "loop ds 200" LINE_ENDING
+                                                   " bra loop" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastLineIs("80C8: 4C 00 80     4  bra loop  (long branch)" LINE_ENDING, 70);
+}
+
+TEST(AssemblerDirectives, LBR_DirectiveWithOffOperandShouldFailOutOfRangeBranch)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" lbr" LINE_ENDING
+                                                   " lbr off" LINE_ENDING
+                                                   "loop ds 200" LINE_ENDING
+                                                   " bne loop" LINE_ENDING), NULL);
+    runAssemblerAndValidateFailure("filename:4: error: Relative offset of 'loop' exceeds the allowed -128 to 127 range." LINE_ENDING,
+                                   "    :              4  bne loop" LINE_ENDING, 71);
+}
+
+TEST(AssemblerDirectives, LBR_DirectiveShouldReportForwardBranchWhenOtherErrorsPreventExpansion)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" lbr" LINE_ENDING
+                                                   " beq skip" LINE_ENDING
+                                                   " ds 200" LINE_ENDING
+                                                   " foo" LINE_ENDING
+                                                   "skip rts" LINE_ENDING), NULL);
+    Assembler_Run(m_pAssembler);
+    STRCMP_EQUAL("filename:2: error: Relative offset of 'skip' exceeds the allowed -128 to 127 range." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+    LONGS_EQUAL(2, Assembler_GetErrorCount(m_pAssembler));
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldTurnJsrFollowedByRtsIntoJmp)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" opt" LINE_ENDING
+                                                   " jsr $1234" LINE_ENDING
+                                                   " rts" LINE_ENDING
+                                                   " nop" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("    :              3  rts  (optimized: RTS removed)" LINE_ENDING,
+                                                   "8003: EA           4  nop" LINE_ENDING, 4);
+    validateLineInfo(m_pAssembler->linesHead.pNext->pNext, 0x8000, 3, "\x4c\x34\x12");
+    LONGS_EQUAL(PEEPHOLE_JSR_TO_JMP, m_pAssembler->linesHead.pNext->pNext->peepholeRewrite);
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldKeepLabelledRtsAfterTurningJsrIntoJmp)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" opt" LINE_ENDING
+                                                   " jsr $1234" LINE_ENDING
+                                                   "exit rts" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8000: 4C 34 12     2  jsr $1234  (optimized: JSR/RTS to JMP)" LINE_ENDING,
+                                                   "8003: 60           3 exit rts" LINE_ENDING, 3);
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldStepOverCommentsAndForwardReferences)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" opt" LINE_ENDING
+                                                   " jsr sub" LINE_ENDING
+                                                   "* Return to caller." LINE_ENDING
+                                                   " rts" LINE_ENDING
+                                                   "sub lda #1" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("    :              4  rts  (optimized: RTS removed)" LINE_ENDING,
+                                                   "8003: A9 01        5 sub lda #1" LINE_ENDING, 5);
+    validateLineInfo(m_pAssembler->linesHead.pNext->pNext, 0x8000, 3, "\x4c\x03\x80");
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveWithOffOperandShouldLeaveCodeAsWritten)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" opt" LINE_ENDING
+                                                   " opt off" LINE_ENDING
+                                                   " jsr $1234" LINE_ENDING
+                                                   " rts" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8000: 20 34 12     3  jsr $1234" LINE_ENDING,
+                                                   "8003: 60           4  rts" LINE_ENDING, 4);
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldLeaveTimingCriticalCodeAsWritten)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" opt" LINE_ENDING
+                                                   " timed" LINE_ENDING
+                                                   " jsr $1234" LINE_ENDING
+                                                   " rts" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8000: 20 34 12     3  jsr $1234" LINE_ENDING,
+                                                   "8003: 60           4  rts" LINE_ENDING, 4);
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldRemoveLoadOfJustStoredValue)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" opt" LINE_ENDING
+                                                   " sta $1234,x" LINE_ENDING
+                                                   " lda $1234,x" LINE_ENDING
+                                                   " ldy #0" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("    :              3  lda $1234,x  (optimized: redundant load removed)" LINE_ENDING,
+                                                   "8003: A0 00        4  ldy #0" LINE_ENDING, 4);
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldKeepLoadOfSoftSwitch)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" opt" LINE_ENDING
+                                                   " sta $c030" LINE_ENDING
+                                                   " lda $c030" LINE_ENDING
+                                                   " ldy #0" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8003: AD 30 C0     3  lda $c030" LINE_ENDING,
+                                                   "8006: A0 00        4  ldy #0" LINE_ENDING, 4);
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldKeepLoadWhichIndexesIntoSoftSwitches)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" opt" LINE_ENDING
+                                                   " sta $bf80,x" LINE_ENDING
+                                                   " lda $bf80,x" LINE_ENDING
+                                                   " ldy #0" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8003: BD 80 BF     3  lda $bf80,x" LINE_ENDING,
+                                                   "8006: A0 00        4  ldy #0" LINE_ENDING, 4);
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldKeepLoadThroughPointer)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" opt" LINE_ENDING
+                                                   " sta ($20),y" LINE_ENDING
+                                                   " lda ($20),y" LINE_ENDING
+                                                   " ldy #0" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8002: B1 20        3  lda ($20),y" LINE_ENDING,
+                                                   "8004: A0 00        4  ldy #0" LINE_ENDING, 4);
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldKeepLoadWhenItsFlagsAreUsed)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" opt" LINE_ENDING
+                                                   " stx $20" LINE_ENDING
+                                                   " ldx $20" LINE_ENDING
+                                                   " beq *" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8002: A6 20        3  ldx $20" LINE_ENDING,
+                                                   "8004: F0 FE        4  beq *" LINE_ENDING, 4);
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldKeepLabelledLoad)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" opt" LINE_ENDING
+                                                   " sty $20" LINE_ENDING
+                                                   "again ldy $20" LINE_ENDING
+                                                   " ldx #0" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8002: A4 20        3 again ldy $20" LINE_ENDING,
+                                                   "8004: A2 00        4  ldx #0" LINE_ENDING, 4);
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldKeepLoadOfDifferentRegister)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" opt" LINE_ENDING
+                                                   " sta $20" LINE_ENDING
+                                                   " ldx $20" LINE_ENDING
+                                                   " ldx #0" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8002: A6 20        3  ldx $20" LINE_ENDING,
+                                                   "8004: A2 00        4  ldx #0" LINE_ENDING, 4);
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldTurnClcAndAdcOfOneIntoIncOn65C02)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" xc" LINE_ENDING
+                                                   " opt" LINE_ENDING
+                                                   " clc" LINE_ENDING
+                                                   " adc #1" LINE_ENDING
+                                                   " clc" LINE_ENDING
+                                                   " adc $20" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8001: 18           5  clc" LINE_ENDING,
+                                                   "8002: 65 20        6  adc $20" LINE_ENDING, 6);
+    LineInfo* pClcLine = m_pAssembler->linesHead.pNext->pNext->pNext;
+    LONGS_EQUAL(0, pClcLine->machineCodeSize);
+    LONGS_EQUAL(PEEPHOLE_DROP_CLC, pClcLine->peepholeRewrite);
+    validateLineInfo(pClcLine->pNext, 0x8000, 1, "\x1a");
+    LONGS_EQUAL(PEEPHOLE_ADC_TO_INC, pClcLine->pNext->peepholeRewrite);
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldKeepClcAndAdcOfOneWhenCarryIsUsed)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" xc" LINE_ENDING
+                                                   " opt" LINE_ENDING
+                                                   " clc" LINE_ENDING
+                                                   " adc #1" LINE_ENDING
+                                                   " bcs *" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8001: 69 01        4  adc #1" LINE_ENDING,
+                                                   "8003: B0 FE        5  bcs *" LINE_ENDING, 5);
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldKeepClcAndAdcOfOneOn6502)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" opt" LINE_ENDING
+                                                   " clc" LINE_ENDING
+                                                   " adc #1" LINE_ENDING
+                                                   " clv" LINE_ENDING
+                                                   " sec" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8003: B8           4  clv" LINE_ENDING,
+                                                   "8004: 38           5  sec" LINE_ENDING, 5);
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldKeepClcAndAdcOfSymbolWithValueOfOne)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" xc" LINE_ENDING
+                                                   " opt" LINE_ENDING
+                                                   "one equ 1" LINE_ENDING
+                                                   " clc" LINE_ENDING
+                                                   " adc #one" LINE_ENDING
+                                                   " clv" LINE_ENDING
+                                                   " sec" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8003: B8           6  clv" LINE_ENDING,
+                                                   "8004: 38           7  sec" LINE_ENDING, 7);
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldChainBranchToJump)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" opt" LINE_ENDING
+                                                   " beq hop" LINE_ENDING
+                                                   " nop" LINE_ENDING
+                                                   "hop jmp target" LINE_ENDING
+                                                   " nop" LINE_ENDING
+                                                   "target rts" LINE_ENDING), NULL);
+    Assembler_Run(m_pAssembler);
+    LONGS_EQUAL(0, Assembler_GetErrorCount(m_pAssembler));
+    validateLineInfo(m_pAssembler->linesHead.pNext->pNext, 0x8000, 2, "\xf0\x05");
+    LONGS_EQUAL(PEEPHOLE_CHAINED_BRANCH, m_pAssembler->linesHead.pNext->pNext->peepholeRewrite);
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldChainBranchThroughSameBranchAndBranchAlways)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" xc" LINE_ENDING
+                                                   " opt" LINE_ENDING
+                                                   " bne first" LINE_ENDING
+                                                   " nop" LINE_ENDING
+                                                   "first bne second" LINE_ENDING
+                                                   " nop" LINE_ENDING
+                                                   "second bra third" LINE_ENDING
+                                                   " nop" LINE_ENDING
+                                                   "third rts" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastLineIs("8009: 60           9 third rts" LINE_ENDING, 9);
+    validateLineInfo(m_pAssembler->linesHead.pNext->pNext->pNext, 0x8000, 2, "\xd0\x07");
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldNotChainBranchThroughOppositeBranch)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" opt" LINE_ENDING
+                                                   " bne first" LINE_ENDING
+                                                   " nop" LINE_ENDING
+                                                   "first beq second" LINE_ENDING
+                                                   "second rts" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8003: F0 00        4 first beq second" LINE_ENDING,
+                                                   "8005: 60           5 second rts" LINE_ENDING, 5);
+    validateLineInfo(m_pAssembler->linesHead.pNext->pNext, 0x8000, 2, "\xd0\x01");
+}
+
+TEST(AssemblerDirectives, OPT_DirectiveShouldNotChainBranchToOutOfRangeJump)
+{
+    m_pAssembler = Assembler_CreateFromString(dupe(" opt" LINE_ENDING
+                                                   " bcc hop" LINE_ENDING
+                                                   "hop jmp $9000" LINE_ENDING), NULL);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8000: 90 00        2  bcc hop" LINE_ENDING,
+                                                   "8002: 4C 00 90     3 hop jmp $9000" LINE_ENDING, 3);
+}
+
 /* UNDONE: This should be supported in the future. */
 TEST(AssemblerDirectives, MX_DirectiveIgnored)
 {
@@ -777,6 +1245,54 @@ TEST(AssemblerDirectives, PUT_DirectiveWithPutDirsSetToTwoComponentsFirstInvalid
                                                    "8000: 85 FF            1  sta $ff" LINE_ENDING);
 }
 
+TEST(AssemblerDirectives, PUT_DirectiveWithPutDirsShouldBePrefetchedFromDirectoryWhereFileWasFound)
+{
+    createThisSourceFile(g_putFilename, " sta $ff" LINE_ENDING);
+    m_initParams.pPutDirectories = "foo;.";
+    m_pAssembler = Assembler_CreateFromString(dupe(" put AssemblerTestPut" LINE_ENDING), &m_initParams);
+    CHECK(m_pAssembler->pPutFiles != NULL);
+    STRCMP_EQUAL("AssemblerTestPut", m_pAssembler->pPutFiles->pName);
+    LONGS_EQUAL(1, m_pAssembler->pPutFiles->directoryIndex);
+    CHECK(m_pAssembler->pPutFiles->pPrefetchedFile != NULL);
+    POINTERS_EQUAL(NULL, m_pAssembler->pPutFiles->pNext);
+}
+
+TEST(AssemblerDirectives, PUT_DirectiveShouldReadPrefetchedFileWithoutOpeningItAgain)
+{
+    createThisSourceFile(g_putFilename, " sta $ff" LINE_ENDING);
+    m_initParams.pPutDirectories = "foo;.";
+    m_pAssembler = Assembler_CreateFromString(dupe(" put AssemblerTestPut" LINE_ENDING), &m_initParams);
+    fopenFail(NULL);
+        runAssemblerAndValidateLastTwoLinesOfOutputAre("    :              1  put AssemblerTestPut" LINE_ENDING,
+                                                       "8000: 85 FF            1  sta $ff" LINE_ENDING);
+    fopenRestore();
+    POINTERS_EQUAL(NULL, m_pAssembler->pPutFiles->pPrefetchedFile);
+}
+
+TEST(AssemblerDirectives, PUT_DirectiveForFileCreatedAfterPrefetchShouldStillBeFound)
+{
+    m_initParams.pPutDirectories = "foo;.";
+    m_pAssembler = Assembler_CreateFromString(dupe(" put AssemblerTestPut" LINE_ENDING), &m_initParams);
+    POINTERS_EQUAL(NULL, m_pAssembler->pPutFiles);
+    createThisSourceFile(g_putFilename, " sta $ff" LINE_ENDING);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("    :              1  put AssemblerTestPut" LINE_ENDING,
+                                                   "8000: 85 FF            1  sta $ff" LINE_ENDING);
+    CHECK(m_pAssembler->pPutFiles != NULL);
+    LONGS_EQUAL(1, m_pAssembler->pPutFiles->directoryIndex);
+}
+
+TEST(AssemblerDirectives, PUT_DirectiveTwiceWithPutDirsShouldUseCachedDirectory)
+{
+    createThisSourceFile(g_putFilename, " sta $ff" LINE_ENDING);
+    m_initParams.pPutDirectories = "foo;.";
+    m_pAssembler = Assembler_CreateFromString(dupe(" put AssemblerTestPut" LINE_ENDING
+                                                   " put AssemblerTestPut" LINE_ENDING), &m_initParams);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("    :              2  put AssemblerTestPut" LINE_ENDING,
+                                                   "8002: 85 FF            1  sta $ff" LINE_ENDING, 4);
+    CHECK(m_pAssembler->pPutFiles != NULL);
+    POINTERS_EQUAL(NULL, m_pAssembler->pPutFiles->pNext);
+}
+
 TEST(AssemblerDirectives, PUT_DirectiveInvalidNesting)
 {
     createThisSourceFile(g_putFilename, " put AssemblerTestPut2" LINE_ENDING);
@@ -794,20 +1310,20 @@ TEST(AssemblerDirectives, PUT_DirectiveWithErrorInPutFile)
                                    "    :                  1  foo" LINE_ENDING, 3);
 }
 
-TEST(AssemblerDirectives, PUT_DirectiveInvalidForwardReferenceInPutFile)
+TEST(AssemblerDirectives, PUT_DirectiveZeroPageForwardReferenceInPutFile)
 {
     createThisSourceFile(g_putFilename, " sta Label" LINE_ENDING);
     m_pAssembler = Assembler_CreateFromString(dupe(" put AssemblerTestPut" LINE_ENDING
                                                    "Label EQU $00" LINE_ENDING), NULL);
-    runAssemblerAndValidateFailure("AssemblerTestPut.S:1: error: Couldn't properly infer size of a forward reference in 'Label' operand." LINE_ENDING, 
-                                   "    :    =0000     2 Label EQU $00" LINE_ENDING, 4);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8000: 85 00            1  sta Label" LINE_ENDING,
+                                                   "    :    =0000     2 Label EQU $00" LINE_ENDING, 3);
 }
 
 TEST(AssemblerDirectives, PUT_DirectiveFailFileOpen)
 {
     createThisSourceFile(g_putFilename, " sta $ff" LINE_ENDING);
-    m_pAssembler = Assembler_CreateFromString(dupe(" put AssemblerTestPut" LINE_ENDING), NULL);
     fopenFail(NULL);
+    m_pAssembler = Assembler_CreateFromString(dupe(" put AssemblerTestPut" LINE_ENDING), NULL);
         runAssemblerAndValidateFailure("filename:1: error: Failed to PUT 'AssemblerTestPut.S' source file." LINE_ENDING, 
                                        "    :              1  put AssemblerTestPut" LINE_ENDING);
 }
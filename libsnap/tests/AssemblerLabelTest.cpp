@@ -214,14 +214,82 @@ TEST(AssemblerLabel, Variable9DefaultTo0Value)
     runAssemblerAndValidateLastLineIs("8000: 85 00        1  sta ]9" LINE_ENDING, 1);
 }
 
-TEST(AssemblerLabel, FailZeroPageForwardReference)
+TEST(AssemblerLabel, RelaxZeroPageForwardReference)
 {
     m_pAssembler = Assembler_CreateFromString(" org $0000" LINE_ENDING
                                               " sta globalLabel" LINE_ENDING
                                               "globalLabel sta $22" LINE_ENDING, NULL);
     
-    runAssemblerAndValidateFailure("filename:2: error: Couldn't properly infer size of a forward reference in 'globalLabel' operand." LINE_ENDING,
-                                   "0003: 85 22        3 globalLabel sta $22" LINE_ENDING, 4);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("0000: 85 02        2  sta globalLabel" LINE_ENDING,
+                                                   "0002: 85 22        3 globalLabel sta $22" LINE_ENDING, 3);
+}
+
+TEST(AssemblerLabel, RelaxZeroPageForwardReferenceToEquate)
+{
+    m_pAssembler = Assembler_CreateFromString(" lda zpVar,x" LINE_ENDING
+                                              " rts" LINE_ENDING
+                                              "zpVar equ $20" LINE_ENDING, NULL);
+    
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8002: 60           2  rts" LINE_ENDING,
+                                                   "    :    =0020     3 zpVar equ $20" LINE_ENDING, 3);
+    LONGS_EQUAL(2, m_pAssembler->linesHead.pNext->machineCodeSize);
+    CHECK(0 == memcmp(m_pAssembler->linesHead.pNext->pMachineCode, "\xb5\x20", 2));
+}
+
+TEST(AssemblerLabel, IndirectIndexedForwardReferenceToZeroPage)
+{
+    m_pAssembler = Assembler_CreateFromString(" lda (ptr),y" LINE_ENDING
+                                              " rts" LINE_ENDING
+                                              "ptr equ $20" LINE_ENDING, NULL);
+    
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8002: 60           2  rts" LINE_ENDING,
+                                                   "    :    =0020     3 ptr equ $20" LINE_ENDING, 3);
+    CHECK(0 == memcmp(m_pAssembler->linesHead.pNext->pMachineCode, "\xb1\x20", 2));
+}
+
+TEST(AssemblerLabel, FailIndirectIndexedForwardReferenceOutsideOfZeroPage)
+{
+    m_pAssembler = Assembler_CreateFromString(" lda (ptr),y" LINE_ENDING
+                                              "ptr equ $300" LINE_ENDING, NULL);
+    
+    runAssemblerAndValidateFailure("filename:1: error: 'ptr' isn't in page zero as required for indirect indexed addressing." LINE_ENDING,
+                                   "    :    =0300     2 ptr equ $300" LINE_ENDING, 3);
+}
+
+TEST(AssemblerLabel, RelaxCascadingZeroPageForwardReferences)
+{
+    m_pAssembler = Assembler_CreateFromString(" org $00f9" LINE_ENDING
+                                              " lda first" LINE_ENDING
+                                              " lda second" LINE_ENDING
+                                              "first nop" LINE_ENDING
+                                              "second nop" LINE_ENDING, NULL);
+    
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("00FD: EA           4 first nop" LINE_ENDING,
+                                                   "00FE: EA           5 second nop" LINE_ENDING, 5);
+}
+
+TEST(AssemblerLabel, RelaxZeroPageForwardReferenceShouldNotRepeatWarnings)
+{
+    m_pAssembler = Assembler_CreateFromString(" sta zpVar" LINE_ENDING
+                                              " dum 0" LINE_ENDING
+                                              " dend $100" LINE_ENDING
+                                              "zpVar equ $20" LINE_ENDING, NULL);
+    
+    runAssemblerAndValidateWarning("filename:3: warning: dend directive ignoring operand as comment." LINE_ENDING,
+                                   "    :    =0020     4 zpVar equ $20" LINE_ENDING, 5);
+    CHECK(0 == memcmp(m_pAssembler->linesHead.pNext->pMachineCode, "\x85\x20", 2));
+}
+
+TEST(AssemblerLabel, FailZeroPageForwardReferenceWhenOtherErrorsPreventRelaxation)
+{
+    m_pAssembler = Assembler_CreateFromString(" sta zpVar" LINE_ENDING
+                                              " foo" LINE_ENDING
+                                              "zpVar equ $20" LINE_ENDING, NULL);
+    
+    Assembler_Run(m_pAssembler);
+    STRCMP_EQUAL("filename:1: error: Couldn't properly infer size of a forward reference in 'zpVar' operand." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+    LONGS_EQUAL(2, Assembler_GetErrorCount(m_pAssembler));
 }
 
 TEST(AssemblerLabel, ReferenceNonExistantLabel)
@@ -33,6 +33,7 @@ extern "C"
 static const char*         g_filename = "BinaryBufferTest.test";
 static const char*         g_filename2 = "BinaryBufferTest2.test";
 static const unsigned char g_testData[2] = { 0x00, 0xff };
+static const unsigned char g_compressedTestData[4] = { 0x02, 0x00, 0xff, 0x00 };
 
 TEST_GROUP(BinaryBuffer)
 {
@@ -88,7 +89,8 @@ TEST_GROUP(BinaryBuffer)
         memcpy(m_pAlloc, pData, dataSize);
     }
     
-    void validateObjectFileContains(const char* pFilename, unsigned short expectedAddress, const unsigned char* pExpectedContent, long expectedContentSize)
+    void validateObjectFileContains(const char* pFilename, unsigned short expectedAddress, const unsigned char* pExpectedContent, long expectedContentSize,
+                                    const char* pExpectedSignature = BINARY_BUFFER_SAV_SIGNATURE)
     {
         SavFileHeader header;
         
@@ -97,7 +99,7 @@ TEST_GROUP(BinaryBuffer)
         LONGS_EQUAL(expectedContentSize + sizeof(header), getFileSize(m_pFile));
         
         LONGS_EQUAL(sizeof(header), fread(&header, 1, sizeof(header), m_pFile));
-        CHECK(0 == memcmp(header.signature, BINARY_BUFFER_SAV_SIGNATURE, sizeof(header.signature)));
+        CHECK(0 == memcmp(header.signature, pExpectedSignature, sizeof(header.signature)));
         LONGS_EQUAL(expectedAddress, header.address);
         LONGS_EQUAL(expectedContentSize, header.length);
         
@@ -116,7 +118,8 @@ TEST_GROUP(BinaryBuffer)
                                         unsigned short       expectedTrack,
                                         unsigned short       expectedOffset,
                                         const unsigned char* pExpectedContent, 
-                                        long                 expectedContentSize)
+                                        long                 expectedContentSize,
+                                        const char*          pExpectedSignature = BINARY_BUFFER_RW18SAV_SIGNATURE)
     {
         RW18SavFileHeader header;
         
@@ -125,7 +128,7 @@ TEST_GROUP(BinaryBuffer)
         LONGS_EQUAL(expectedContentSize + sizeof(header), getFileSize(m_pFile));
         
         LONGS_EQUAL(sizeof(header), fread(&header, 1, sizeof(header), m_pFile));
-        CHECK(0 == memcmp(header.signature, BINARY_BUFFER_RW18SAV_SIGNATURE, sizeof(header.signature)));
+        CHECK(0 == memcmp(header.signature, pExpectedSignature, sizeof(header.signature)));
         LONGS_EQUAL(expectedSide, header.side);
         LONGS_EQUAL(expectedTrack, header.track);
         LONGS_EQUAL(expectedOffset, header.offset);
@@ -237,7 +240,7 @@ TEST(BinaryBuffer, QueueWriteToFile)
 {
     placeDataInBuffer(g_testData, sizeof(g_testData));
     BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
-    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
     validateObjectFileContains(g_filename, 0x0000, g_testData, sizeof(g_testData));
 }
 
@@ -245,7 +248,7 @@ TEST(BinaryBuffer, QueueWriteToFileWithDirectoryNoSlash)
 {
     placeDataInBuffer(g_testData, sizeof(g_testData));
     BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, ".", toSizedString(g_filename), NULL);
-    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
     validateObjectFileContains(g_filename, 0x0000, g_testData, sizeof(g_testData));
 }
 
@@ -253,7 +256,7 @@ TEST(BinaryBuffer, QueueWriteToFileWithDirectorySlash)
 {
     placeDataInBuffer(g_testData, sizeof(g_testData));
     BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, "." SLASH_STR, toSizedString(g_filename), NULL);
-    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
     validateObjectFileContains(g_filename, 0x0000, g_testData, sizeof(g_testData));
 }
 
@@ -261,7 +264,7 @@ TEST(BinaryBuffer, QueueWriteToFileWithDirectoryAndSuffix)
 {
     placeDataInBuffer(g_testData, sizeof(g_testData));
     BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, ".", toSizedString("BinaryBufferTest"), ".test");
-    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
     validateObjectFileContains(g_filename, 0x0000, g_testData, sizeof(g_testData));
 }
 
@@ -269,7 +272,7 @@ TEST(BinaryBuffer, QueueWriteToInvalidDirectory)
 {
     placeDataInBuffer(g_testData, sizeof(g_testData));
     BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, "invalidDirectory" SLASH_STR, toSizedString(g_filename), NULL);
-    __try_and_catch( BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer) );
+    __try_and_catch( BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL) );
     validateExceptionThrown(fileException);
 }
 
@@ -279,7 +282,7 @@ TEST(BinaryBuffer, FailFOpenDuringWriteToFile)
     
     fopenFail(NULL);
         BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
-        __try_and_catch( BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer) );
+        __try_and_catch( BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL) );
     validateExceptionThrown(fileException);
 }
 
@@ -289,7 +292,7 @@ TEST(BinaryBuffer, FailFWriteDuringWriteToFile)
     
     fwriteFail(0);
         BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
-        __try_and_catch( BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer) );
+        __try_and_catch( BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL) );
     validateExceptionThrown(fileException);
 }
 
@@ -317,7 +320,7 @@ TEST(BinaryBuffer, QueueRW18WriteToFile)
     placeDataInBuffer(g_testData, sizeof(g_testData));
     BinaryBuffer_QueueRW18WriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL,
                                       RW18_SIDE_0, RW18_TRACK_1, RW18_OFFSET_0);
-    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
     validateRW18ObjectFileContains(g_filename, RW18_SIDE_0, RW18_TRACK_1, RW18_OFFSET_0, 
                                    g_testData, sizeof(g_testData));
 }
@@ -354,7 +357,149 @@ TEST(BinaryBuffer, QueueUPTwoWritesFromBuffer)
     BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename2), NULL);
 
 
-    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
     validateObjectFileContains(g_filename, 0x800, testData1, sizeof(testData1));
     validateObjectFileContains(g_filename2, 0x900, testData2, sizeof(testData2));
 }
+
+TEST(BinaryBuffer, EnumerateEmptyWriteQueue)
+{
+    BinaryBufferOutput output;
+    
+    m_pBinaryBuffer = BinaryBuffer_Create(4);
+    BinaryBuffer_WriteFileQueueEnumStart(m_pBinaryBuffer);
+    CHECK_FALSE(BinaryBuffer_WriteFileQueueEnumNext(m_pBinaryBuffer, &output));
+}
+
+TEST(BinaryBuffer, EnumerateSAVAndRW18WritesWithoutTouchingDisk)
+{
+    static const unsigned char testData1[2] = { 1, 2 };
+    static const unsigned char testData2[2] = { 3, 4 };
+    BinaryBufferOutput         output;
+    
+    m_pBinaryBuffer = BinaryBuffer_Create(4);
+    BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x800);
+    placeDataInBuffer(testData1, sizeof(testData1));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x900);
+    placeDataInBuffer(testData2, sizeof(testData2));
+    BinaryBuffer_QueueRW18WriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename2), NULL,
+                                      RW18_SIDE_0, RW18_TRACK_1, RW18_OFFSET_0);
+    
+    BinaryBuffer_WriteFileQueueEnumStart(m_pBinaryBuffer);
+    CHECK_TRUE(BinaryBuffer_WriteFileQueueEnumNext(m_pBinaryBuffer, &output));
+    STRCMP_EQUAL(g_filename, output.pFilename);
+    LONGS_EQUAL(sizeof(testData1), output.contentLength);
+    CHECK(0 == memcmp(testData1, output.pContent, sizeof(testData1)));
+    LONGS_EQUAL(0x800, output.baseAddress);
+    CHECK_FALSE(output.isRW18);
+    
+    CHECK_TRUE(BinaryBuffer_WriteFileQueueEnumNext(m_pBinaryBuffer, &output));
+    STRCMP_EQUAL(g_filename2, output.pFilename);
+    LONGS_EQUAL(sizeof(testData2), output.contentLength);
+    CHECK(0 == memcmp(testData2, output.pContent, sizeof(testData2)));
+    CHECK_TRUE(output.isRW18);
+    LONGS_EQUAL(RW18_SIDE_0, output.side);
+    LONGS_EQUAL(RW18_TRACK_1, output.track);
+    LONGS_EQUAL(RW18_OFFSET_0, output.offset);
+    
+    CHECK_FALSE(BinaryBuffer_WriteFileQueueEnumNext(m_pBinaryBuffer, &output));
+    POINTERS_EQUAL(NULL, fopen(g_filename, "rb"));
+}
+
+TEST(BinaryBuffer, QueueCompressedWriteToFile)
+{
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_SetCompression(m_pBinaryBuffer, TRUE);
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    validateObjectFileContains(g_filename, 0x0000, g_compressedTestData, sizeof(g_compressedTestData),
+                               BINARY_BUFFER_LZSAV_SIGNATURE);
+}
+
+TEST(BinaryBuffer, QueueCompressedWriteOfRepeatedBytesToFile)
+{
+    static const unsigned char testData[16] = { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                                0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11 };
+    static const unsigned char compressedData[] = { 0x01, 0x11, 0x8B, 0x01, 0x00, 0x00 };
+    
+    placeDataInBuffer(testData, sizeof(testData));
+    BinaryBuffer_SetCompression(m_pBinaryBuffer, TRUE);
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    validateObjectFileContains(g_filename, 0x0000, compressedData, sizeof(compressedData),
+                               BINARY_BUFFER_LZSAV_SIGNATURE);
+}
+
+TEST(BinaryBuffer, CompressContentPatchedAfterWriteWasQueued)
+{
+    static const unsigned char patchedData[2] = { 0x12, 0x34 };
+    static const unsigned char compressedData[4] = { 0x02, 0x12, 0x34, 0x00 };
+    
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_SetCompression(m_pBinaryBuffer, TRUE);
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    memcpy(m_pAlloc, patchedData, sizeof(patchedData));
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    validateObjectFileContains(g_filename, 0x0000, compressedData, sizeof(compressedData),
+                               BINARY_BUFFER_LZSAV_SIGNATURE);
+}
+
+TEST(BinaryBuffer, QueueCompressedRW18WriteToFile)
+{
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_SetCompression(m_pBinaryBuffer, TRUE);
+    BinaryBuffer_QueueRW18WriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL,
+                                      RW18_SIDE_0, RW18_TRACK_1, RW18_OFFSET_0);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    validateRW18ObjectFileContains(g_filename, RW18_SIDE_0, RW18_TRACK_1, RW18_OFFSET_0, 
+                                   g_compressedTestData, sizeof(g_compressedTestData),
+                                   BINARY_BUFFER_LZRW18SAV_SIGNATURE);
+}
+
+TEST(BinaryBuffer, TurnCompressionBackOffForLaterWrites)
+{
+    static const unsigned char testData2[2] = { 3, 4 };
+    
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_SetCompression(m_pBinaryBuffer, TRUE);
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x900);
+    placeDataInBuffer(testData2, sizeof(testData2));
+    BinaryBuffer_SetCompression(m_pBinaryBuffer, FALSE);
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename2), NULL);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    validateObjectFileContains(g_filename, 0x0000, g_compressedTestData, sizeof(g_compressedTestData),
+                               BINARY_BUFFER_LZSAV_SIGNATURE);
+    validateObjectFileContains(g_filename2, 0x900, testData2, sizeof(testData2));
+}
+
+TEST(BinaryBuffer, FailCompressionBufferAllocationDuringWriteQueue)
+{
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_SetCompression(m_pBinaryBuffer, TRUE);
+    MallocFailureInject_FailAllocation(2);
+        __try_and_catch( BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL) );
+    validateExceptionThrown(outOfMemoryException);
+}
+
+TEST(BinaryBuffer, EnumerateCompressedWrite)
+{
+    BinaryBufferOutput output;
+    
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_SetCompression(m_pBinaryBuffer, TRUE);
+    BinaryBuffer_QueueRW18WriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL,
+                                      RW18_SIDE_0, RW18_TRACK_1, RW18_OFFSET_0);
+    
+    BinaryBuffer_WriteFileQueueEnumStart(m_pBinaryBuffer);
+    CHECK_TRUE(BinaryBuffer_WriteFileQueueEnumNext(m_pBinaryBuffer, &output));
+    LONGS_EQUAL(sizeof(g_testData), output.contentLength);
+    CHECK(0 == memcmp(g_testData, output.pContent, sizeof(g_testData)));
+    CHECK_TRUE(output.isCompressed);
+    LONGS_EQUAL(sizeof(g_compressedTestData), output.compressedLength);
+    CHECK(0 == memcmp(g_compressedTestData, output.pCompressedContent, sizeof(g_compressedTestData)));
+    CHECK_TRUE(output.isRW18);
+    LONGS_EQUAL(RW18_TRACK_1, output.track);
+    CHECK_FALSE(BinaryBuffer_WriteFileQueueEnumNext(m_pBinaryBuffer, &output));
+}
@@ -165,3 +165,127 @@ TEST(ListFile, OutputLineWithIndentation)
 
     STRCMP_EQUAL("0800: CA               3  DEX" LINE_ENDING, printfSpy_GetLastOutput());
 }
+
+TEST(ListFile, OutputInstructionWithoutCyclesFlagShouldNotAnnotate)
+{
+    m_lineInfo.lineText = SizedString_InitFromString(" DEX");
+    m_lineInfo.lineNumber = 3;
+    m_lineInfo.address = 0x0800;
+    m_lineInfo.flags = LINEINFO_FLAG_INSTRUCTION;
+    m_lineInfo.machineCodeSize = 1;
+    m_lineInfo.pMachineCode[0] = 0xCA;
+    ListFile_OutputLine(m_pListFile, &m_lineInfo);
+
+    STRCMP_EQUAL("0800: CA           3  DEX" LINE_ENDING, printfSpy_GetLastOutput());
+}
+
+TEST(ListFile, OutputDataWithCyclesFlagShouldNotAnnotate)
+{
+    m_lineInfo.lineText = SizedString_InitFromString(" HEX CA");
+    m_lineInfo.lineNumber = 3;
+    m_lineInfo.address = 0x0800;
+    m_lineInfo.flags = LINEINFO_FLAG_CYCLES;
+    m_lineInfo.machineCodeSize = 1;
+    m_lineInfo.pMachineCode[0] = 0xCA;
+    ListFile_OutputLine(m_pListFile, &m_lineInfo);
+
+    STRCMP_EQUAL("0800: CA           3  HEX CA" LINE_ENDING, printfSpy_GetLastOutput());
+}
+
+TEST(ListFile, OutputInstructionsWithCyclesAndPagePenaltyShouldAccumulateTotal)
+{
+    m_lineInfo.lineText = SizedString_InitFromString(" LDA $2001,X");
+    m_lineInfo.lineNumber = 1;
+    m_lineInfo.address = 0x0800;
+    m_lineInfo.flags = LINEINFO_FLAG_INSTRUCTION | LINEINFO_FLAG_CYCLES;
+    m_lineInfo.machineCodeSize = 3;
+    m_lineInfo.pMachineCode[0] = 0xBD;
+    m_lineInfo.pMachineCode[1] = 0x01;
+    m_lineInfo.pMachineCode[2] = 0x20;
+    ListFile_OutputLine(m_pListFile, &m_lineInfo);
+    STRCMP_EQUAL("0800: BD 01 20     1  LDA $2001,X  (cycles 4+1, total 4-5)" LINE_ENDING, printfSpy_GetLastOutput());
+
+    m_lineInfo.lineText = SizedString_InitFromString(" DEX");
+    m_lineInfo.lineNumber = 2;
+    m_lineInfo.address = 0x0803;
+    m_lineInfo.machineCodeSize = 1;
+    m_lineInfo.pMachineCode[0] = 0xCA;
+    ListFile_OutputLine(m_pListFile, &m_lineInfo);
+    STRCMP_EQUAL("0803: CA           2  DEX  (cycles 2, total 6-7)" LINE_ENDING, printfSpy_GetLastOutput());
+}
+
+TEST(ListFile, OutputLabelledInstructionShouldRestartCycleTotal)
+{
+    Symbol symbol;
+    
+    memset(&symbol, 0, sizeof(symbol));
+    m_lineInfo.lineText = SizedString_InitFromString(" DEX");
+    m_lineInfo.lineNumber = 1;
+    m_lineInfo.address = 0x0800;
+    m_lineInfo.flags = LINEINFO_FLAG_INSTRUCTION | LINEINFO_FLAG_CYCLES;
+    m_lineInfo.machineCodeSize = 1;
+    m_lineInfo.pMachineCode[0] = 0xCA;
+    ListFile_OutputLine(m_pListFile, &m_lineInfo);
+
+    m_lineInfo.lineText = SizedString_InitFromString("LOOP BNE LOOP");
+    m_lineInfo.lineNumber = 2;
+    m_lineInfo.address = 0x0801;
+    m_lineInfo.pSymbol = &symbol;
+    m_lineInfo.machineCodeSize = 2;
+    m_lineInfo.pMachineCode[0] = 0xD0;
+    m_lineInfo.pMachineCode[1] = 0xFE;
+    ListFile_OutputLine(m_pListFile, &m_lineInfo);
+    STRCMP_EQUAL("0801: D0 FE        2 LOOP BNE LOOP  (cycles 2/3, total 2-3)" LINE_ENDING, printfSpy_GetLastOutput());
+}
+
+TEST(ListFile, OutputLongBranchShouldBeFlagged)
+{
+    m_lineInfo.lineText = SizedString_InitFromString(" BNE FAR");
+    m_lineInfo.lineNumber = 1;
+    m_lineInfo.address = 0x0800;
+    m_lineInfo.flags = LINEINFO_FLAG_INSTRUCTION | LINEINFO_FLAG_LONG_BRANCH;
+    m_lineInfo.machineCodeSize = 5;
+    memcpy(m_lineInfo.pMachineCode, "\xF0\x03\x4C\x00\x20", 5);
+    ListFile_OutputLine(m_pListFile, &m_lineInfo);
+
+    STRCMP_EQUAL("0800: F0 03 4C     1  BNE FAR  (long branch)" LINE_ENDING, printfSpy_GetPreviousOutput());
+    STRCMP_EQUAL("0803: 00 20   " LINE_ENDING, printfSpy_GetLastOutput());
+}
+
+TEST(ListFile, OutputPeepholeRewriteShouldBeFlagged)
+{
+    m_lineInfo.lineText = SizedString_InitFromString(" JSR SUB");
+    m_lineInfo.lineNumber = 1;
+    m_lineInfo.address = 0x0800;
+    m_lineInfo.flags = LINEINFO_FLAG_INSTRUCTION | LINEINFO_FLAG_OPTIMIZE;
+    m_lineInfo.peepholeRewrite = PEEPHOLE_JSR_TO_JMP;
+    m_lineInfo.machineCodeSize = 3;
+    memcpy(m_lineInfo.pMachineCode, "\x4C\x00\x20", 3);
+    ListFile_OutputLine(m_pListFile, &m_lineInfo);
+    STRCMP_EQUAL("0800: 4C 00 20     1  JSR SUB  (optimized: JSR/RTS to JMP)" LINE_ENDING, printfSpy_GetLastOutput());
+}
+
+TEST(ListFile, OutputRemovedInstructionShouldBeFlagged)
+{
+    m_lineInfo.lineText = SizedString_InitFromString(" RTS");
+    m_lineInfo.lineNumber = 2;
+    m_lineInfo.address = 0x0803;
+    m_lineInfo.flags = LINEINFO_FLAG_OPTIMIZE;
+    m_lineInfo.peepholeRewrite = PEEPHOLE_DROP_RTS;
+    ListFile_OutputLine(m_pListFile, &m_lineInfo);
+    STRCMP_EQUAL("    :              2  RTS  (optimized: RTS removed)" LINE_ENDING, printfSpy_GetLastOutput());
+}
+
+TEST(ListFile, OutputLongBranchWithCyclesShouldCountTakenPathThroughJump)
+{
+    m_lineInfo.lineText = SizedString_InitFromString(" BNE FAR");
+    m_lineInfo.lineNumber = 1;
+    m_lineInfo.address = 0x0800;
+    m_lineInfo.flags = LINEINFO_FLAG_INSTRUCTION | LINEINFO_FLAG_LONG_BRANCH | LINEINFO_FLAG_CYCLES;
+    m_lineInfo.machineCodeSize = 5;
+    memcpy(m_lineInfo.pMachineCode, "\xF0\x03\x4C\x00\x20", 5);
+    ListFile_OutputLine(m_pListFile, &m_lineInfo);
+
+    STRCMP_EQUAL("0800: F0 03 4C     1  BNE FAR  (long branch)  (cycles 3/5, total 3-5)" LINE_ENDING, 
+                 printfSpy_GetPreviousOutput());
+}
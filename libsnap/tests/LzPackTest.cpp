@@ -0,0 +1,192 @@
+/*  Copyright (C) 2012  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "LzPack.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+
+TEST_GROUP(LzPack)
+{
+    unsigned char m_compressed[1024];
+    unsigned char m_decompressed[1024];
+    size_t        m_compressedLength;
+    
+    void setup()
+    {
+        clearExceptionCode();
+        memset(m_compressed, 0xCC, sizeof(m_compressed));
+        m_compressedLength = 0;
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+    }
+    
+    void compress(const unsigned char* pSrc, size_t srcLength)
+    {
+        m_compressedLength = LzPack_Compress(m_compressed, pSrc, srcLength);
+        CHECK(m_compressedLength <= LzPack_MaximumCompressedSize(srcLength));
+    }
+    
+    void validateCompressed(const unsigned char* pExpected, size_t expectedLength)
+    {
+        LONGS_EQUAL(expectedLength, m_compressedLength);
+        CHECK(0 == memcmp(pExpected, m_compressed, expectedLength));
+    }
+    
+    void validateRoundTrip(const unsigned char* pSrc, size_t srcLength)
+    {
+        compress(pSrc, srcLength);
+        LONGS_EQUAL(srcLength, LzPack_Decompress(m_decompressed, sizeof(m_decompressed), m_compressed, m_compressedLength));
+        CHECK(0 == memcmp(pSrc, m_decompressed, srcLength));
+    }
+    
+    void validateDecompressFails(const unsigned char* pSrc, size_t srcLength, size_t destSize, int expectedException)
+    {
+        __try_and_catch( LzPack_Decompress(m_decompressed, destSize, pSrc, srcLength) );
+        LONGS_EQUAL(expectedException, getExceptionCode());
+        clearExceptionCode();
+    }
+};
+
+
+TEST(LzPack, MaximumCompressedSize)
+{
+    LONGS_EQUAL(1, LzPack_MaximumCompressedSize(0));
+    LONGS_EQUAL(3, LzPack_MaximumCompressedSize(1));
+    LONGS_EQUAL(128 + 1, LzPack_MaximumCompressedSize(127));
+    LONGS_EQUAL(128 + 2 + 1, LzPack_MaximumCompressedSize(128));
+}
+
+TEST(LzPack, CompressEmptyInputToJustEndToken)
+{
+    static const unsigned char expected[] = { 0x00 };
+    
+    compress(NULL, 0);
+    validateCompressed(expected, sizeof(expected));
+}
+
+TEST(LzPack, CompressShortInputToLiteralRun)
+{
+    static const unsigned char src[] = { 0x01, 0x02, 0x03 };
+    static const unsigned char expected[] = { 0x03, 0x01, 0x02, 0x03, 0x00 };
+    
+    compress(src, sizeof(src));
+    validateCompressed(expected, sizeof(expected));
+}
+
+TEST(LzPack, CompressRepeatedByteToOverlappingMatch)
+{
+    static const unsigned char src[] = { 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA };
+    static const unsigned char expected[] = { 0x01, 0xAA, 0x83, 0x01, 0x00, 0x00 };
+    
+    compress(src, sizeof(src));
+    validateCompressed(expected, sizeof(expected));
+}
+
+TEST(LzPack, CompressRepeatedSequenceWithTrailingLiterals)
+{
+    static const unsigned char src[] = { 1, 2, 3, 4, 5, 1, 2, 3, 4, 5, 6 };
+    static const unsigned char expected[] = { 0x05, 1, 2, 3, 4, 5, 0x81, 0x05, 0x00, 0x01, 6, 0x00 };
+    
+    compress(src, sizeof(src));
+    validateCompressed(expected, sizeof(expected));
+}
+
+TEST(LzPack, ThreeByteRepeatIsLeftAsLiterals)
+{
+    static const unsigned char src[] = { 1, 2, 3, 9, 1, 2, 3, 8 };
+    static const unsigned char expected[] = { 0x08, 1, 2, 3, 9, 1, 2, 3, 8, 0x00 };
+    
+    compress(src, sizeof(src));
+    validateCompressed(expected, sizeof(expected));
+}
+
+TEST(LzPack, SplitLongLiteralRuns)
+{
+    unsigned char src[200];
+    
+    for (size_t i = 0 ; i < sizeof(src) ; i++)
+        src[i] = i;
+    compress(src, sizeof(src));
+    LONGS_EQUAL(LzPack_MaximumCompressedSize(sizeof(src)), m_compressedLength);
+    LONGS_EQUAL(LZPACK_MAXIMUM_LITERALS, m_compressed[0]);
+    LONGS_EQUAL(sizeof(src) - LZPACK_MAXIMUM_LITERALS, m_compressed[1 + LZPACK_MAXIMUM_LITERALS]);
+    validateRoundTrip(src, sizeof(src));
+}
+
+TEST(LzPack, SplitLongMatches)
+{
+    unsigned char src[300];
+    
+    memset(src, 0x55, sizeof(src));
+    compress(src, sizeof(src));
+    LONGS_EQUAL(0xFF, m_compressed[2]);
+    validateRoundTrip(src, sizeof(src));
+}
+
+TEST(LzPack, RoundTripMixOfRandomAndRepeatedData)
+{
+    unsigned char src[1000];
+    unsigned int  seed = 1;
+    
+    for (size_t i = 0 ; i < sizeof(src) ; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        src[i] = (i % 100 < 50) ? (seed >> 16) : (i % 9);
+    }
+    validateRoundTrip(src, sizeof(src));
+    CHECK(m_compressedLength < sizeof(src));
+}
+
+TEST(LzPack, DecompressFailsOnMissingEndToken)
+{
+    static const unsigned char src[] = { 0x02, 0x01, 0x02 };
+    
+    validateDecompressFails(src, sizeof(src), sizeof(m_decompressed), bufferOverrunException);
+}
+
+TEST(LzPack, DecompressFailsOnTruncatedLiteralRun)
+{
+    static const unsigned char src[] = { 0x03, 0x01, 0x02 };
+    
+    validateDecompressFails(src, sizeof(src), sizeof(m_decompressed), bufferOverrunException);
+}
+
+TEST(LzPack, DecompressFailsOnTruncatedMatchDistance)
+{
+    static const unsigned char src[] = { 0x01, 0x01, 0x80, 0x01 };
+    
+    validateDecompressFails(src, sizeof(src), sizeof(m_decompressed), bufferOverrunException);
+}
+
+TEST(LzPack, DecompressFailsWhenOutputDoesNotFit)
+{
+    static const unsigned char src[] = { 0x01, 0xAA, 0x83, 0x01, 0x00, 0x00 };
+    
+    validateDecompressFails(src, sizeof(src), 7, bufferOverrunException);
+}
+
+TEST(LzPack, DecompressFailsOnMatchBeforeStartOfOutput)
+{
+    static const unsigned char src[] = { 0x01, 0xAA, 0x80, 0x02, 0x00, 0x00 };
+    
+    validateDecompressFails(src, sizeof(src), sizeof(m_decompressed), invalidArgumentException);
+}
@@ -0,0 +1,144 @@
+/*  Copyright (C) 2012  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "OpcodeCycles.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+
+TEST_GROUP(OpcodeCycles)
+{
+    OpcodeCycles m_cycles;
+    
+    void setup()
+    {
+    }
+
+    void teardown()
+    {
+    }
+    
+    void get(InstructionSetSupported instructionSet, unsigned short address,
+             unsigned char byte0, unsigned char byte1 = 0x00, unsigned char byte2 = 0x00, size_t size = 1)
+    {
+        unsigned char machineCode[3] = { byte0, byte1, byte2 };
+        
+        m_cycles = OpcodeCycles_Get(instructionSet, address, machineCode, size);
+    }
+    
+    void validate(unsigned int expectedMin, unsigned int expectedMax, int expectedIsBranch = 0)
+    {
+        LONGS_EQUAL(expectedMin, m_cycles.minCycles);
+        LONGS_EQUAL(expectedMax, m_cycles.maxCycles);
+        LONGS_EQUAL(expectedIsBranch, m_cycles.isBranch);
+    }
+};
+
+
+TEST(OpcodeCycles, ImpliedInstruction)
+{
+    get(INSTRUCTION_SET_6502, 0x0800, 0xCA);
+    validate(2, 2);
+}
+
+TEST(OpcodeCycles, ReadModifyWriteAbsoluteIndexed)
+{
+    get(INSTRUCTION_SET_6502, 0x0800, 0xFE, 0x01, 0x20, 3);
+    validate(7, 7);
+}
+
+TEST(OpcodeCycles, AbsoluteIndexedReadCanCrossPage)
+{
+    get(INSTRUCTION_SET_6502, 0x0800, 0xB9, 0x01, 0x20, 3);
+    validate(4, 5);
+}
+
+TEST(OpcodeCycles, AbsoluteIndexedReadFromStartOfPageCantCrossPage)
+{
+    get(INSTRUCTION_SET_6502, 0x0800, 0xBD, 0x00, 0x20, 3);
+    validate(4, 4);
+}
+
+TEST(OpcodeCycles, IndirectIndexedReadCanCrossPage)
+{
+    get(INSTRUCTION_SET_6502, 0x0800, 0xB1, 0x3C, 0x00, 2);
+    validate(5, 6);
+}
+
+TEST(OpcodeCycles, IndexedStoreHasNoPagePenalty)
+{
+    get(INSTRUCTION_SET_6502, 0x0800, 0x91, 0x3C, 0x00, 2);
+    validate(6, 6);
+}
+
+TEST(OpcodeCycles, BranchTakenWithinPage)
+{
+    get(INSTRUCTION_SET_6502, 0x0800, 0xD0, 0x10, 0x00, 2);
+    validate(2, 3, 1);
+}
+
+TEST(OpcodeCycles, BranchTakenBackwardsAcrossPage)
+{
+    get(INSTRUCTION_SET_6502, 0x0800, 0xD0, 0xFC, 0x00, 2);
+    validate(2, 4, 1);
+}
+
+TEST(OpcodeCycles, BranchTakenForwardsAcrossPage)
+{
+    get(INSTRUCTION_SET_6502, 0x08F0, 0x10, 0x7F, 0x00, 2);
+    validate(2, 4, 1);
+}
+
+TEST(OpcodeCycles, IndirectJumpOn6502And65C02)
+{
+    get(INSTRUCTION_SET_6502, 0x0800, 0x6C, 0x00, 0x20, 3);
+    validate(5, 5);
+    get(INSTRUCTION_SET_65C02, 0x0800, 0x6C, 0x00, 0x20, 3);
+    validate(6, 6);
+}
+
+TEST(OpcodeCycles, ZeroPageIndirectOnlyOn65C02)
+{
+    get(INSTRUCTION_SET_6502, 0x0800, 0xB2, 0x3C, 0x00, 2);
+    validate(0, 0);
+    get(INSTRUCTION_SET_65C02, 0x0800, 0xB2, 0x3C, 0x00, 2);
+    validate(5, 5);
+}
+
+TEST(OpcodeCycles, BranchAlwaysOn65C02IsAlwaysTaken)
+{
+    get(INSTRUCTION_SET_65C02, 0x0800, 0x80, 0x10, 0x00, 2);
+    validate(3, 3);
+    get(INSTRUCTION_SET_65C02, 0x0800, 0x80, 0xF0, 0x00, 2);
+    validate(4, 4);
+}
+
+TEST(OpcodeCycles, ShiftAbsoluteIndexedOn65C02CanCrossPage)
+{
+    get(INSTRUCTION_SET_65C02, 0x0800, 0x1E, 0x01, 0x20, 3);
+    validate(6, 7);
+}
+
+TEST(OpcodeCycles, UnknownOpcodeAndUnsupportedInstructionSet)
+{
+    get(INSTRUCTION_SET_6502, 0x0800, 0x02);
+    validate(0, 0);
+    get(INSTRUCTION_SET_65816, 0x0800, 0xCA);
+    validate(0, 0);
+    get(INSTRUCTION_SET_6502, 0x0800, 0xCA, 0x00, 0x00, 0);
+    validate(0, 0);
+}
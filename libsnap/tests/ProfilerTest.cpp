@@ -0,0 +1,221 @@
+/*  Copyright (C) 2012  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "Profiler.h"
+    #include "Assembler.h"
+    #include "MallocFailureInject.h"
+    #include "printfSpy.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+
+static const char g_outputFilename[] = "ProfilerTest.out";
+
+
+TEST_GROUP(Profiler)
+{
+    Profiler*  m_pProfiler;
+    Simulator* m_pSimulator;
+    Assembler* m_pAssembler;
+    char       m_source[512];
+    char       m_output[2048];
+    
+    void setup()
+    {
+        m_pProfiler = NULL;
+        m_pSimulator = NULL;
+        m_pAssembler = NULL;
+        printfSpy_Hook(256);
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        MallocFailureInject_Restore();
+        printfSpy_Unhook();
+        Profiler_Free(m_pProfiler);
+        Simulator_Free(m_pSimulator);
+        Assembler_Free(m_pAssembler);
+        remove(g_outputFilename);
+    }
+    
+    void assemble(const char* pSource)
+    {
+        AssemblerInitParams initParams;
+        
+        memset(&initParams, 0, sizeof(initParams));
+        initParams.keepObjectsInMemory = TRUE;
+        strcpy(m_source, pSource);
+        m_pAssembler = Assembler_CreateFromString(m_source, &initParams);
+        Assembler_Run(m_pAssembler);
+        LONGS_EQUAL(0, Assembler_GetErrorCount(m_pAssembler));
+    }
+    
+    void assembleAndRunProfiled(const char* pSource, const char* pEntryLabel)
+    {
+        BinaryBufferOutput output;
+        
+        assemble(pSource);
+        m_pSimulator = Simulator_Create(INSTRUCTION_SET_6502);
+        Assembler_ObjectFileEnumStart(m_pAssembler);
+        while (Assembler_ObjectFileEnumNext(m_pAssembler, &output))
+            Simulator_LoadImage(m_pSimulator, output.baseAddress, output.pContent, output.contentLength);
+        m_pProfiler = Profiler_Create(Assembler_GetFirstLine(m_pAssembler));
+        Profiler_AttachToSimulator(m_pProfiler, m_pSimulator);
+        LONGS_EQUAL(SIMULATOR_STOP_RETURN, 
+                    Simulator_Run(m_pSimulator, Assembler_GetLabelValue(m_pAssembler, pEntryLabel, NULL), 1000000));
+    }
+    
+    FILE* openOutputFile(void)
+    {
+        FILE* pFile;
+        
+        /* The real fprintf() is needed to write the output to a file for comparison. */
+        printfSpy_Unhook();
+        pFile = fopen(g_outputFilename, "w+");
+        CHECK(pFile != NULL);
+        return pFile;
+    }
+    
+    const char* readOutputFile(FILE* pFile)
+    {
+        size_t bytesRead;
+        
+        rewind(pFile);
+        bytesRead = fread(m_output, 1, sizeof(m_output) - 1, pFile);
+        m_output[bytesRead] = '\0';
+        fclose(pFile);
+        return m_output;
+    }
+    
+    const char* outputReport(size_t topCount)
+    {
+        FILE* pFile = openOutputFile();
+        
+        Profiler_OutputReport(m_pProfiler, pFile, topCount);
+        return readOutputFile(pFile);
+    }
+    
+    const char* outputAnnotatedListing(void)
+    {
+        FILE* pFile = openOutputFile();
+        
+        Profiler_OutputAnnotatedListing(m_pProfiler, pFile);
+        return readOutputFile(pFile);
+    }
+};
+
+static const char g_testSource[] = " org $800" LINE_ENDING
+                                   "main ldx #3" LINE_ENDING
+                                   ":loop dex" LINE_ENDING
+                                   " bne :loop" LINE_ENDING
+                                   " jsr sub" LINE_ENDING
+                                   " rts" LINE_ENDING
+                                   "sub lda #1" LINE_ENDING
+                                   " rts" LINE_ENDING
+                                   " sav Output.sav" LINE_ENDING;
+
+
+TEST(Profiler, FailAllocations)
+{
+    assemble(g_testSource);
+    for (int i = 1 ; i <= 2 ; i++)
+    {
+        MallocFailureInject_FailAllocation(i);
+        __try_and_catch( m_pProfiler = Profiler_Create(Assembler_GetFirstLine(m_pAssembler)) );
+        POINTERS_EQUAL(NULL, m_pProfiler);
+        LONGS_EQUAL(outOfMemoryException, getExceptionCode());
+        clearExceptionCode();
+    }
+    MallocFailureInject_FailAllocation(3);
+    m_pProfiler = Profiler_Create(Assembler_GetFirstLine(m_pAssembler));
+    CHECK(m_pProfiler != NULL);
+}
+
+TEST(Profiler, EmptyProfile)
+{
+    m_pProfiler = Profiler_Create(NULL);
+    LONGS_EQUAL(0, Profiler_GetTotalCycles(m_pProfiler));
+    STRCMP_EQUAL("Profiled 0 cycles over 0 instructions." LINE_ENDING
+                 LINE_ENDING
+                 "Top labels by cycles:" LINE_ENDING
+                 "     Cycles  Percent  Instructions  Label" LINE_ENDING
+                 LINE_ENDING
+                 "Top lines by cycles:" LINE_ENDING
+                 "     Cycles  Percent  Instructions  Address  Line" LINE_ENDING, outputReport(10));
+}
+
+TEST(Profiler, CyclesAttributedToLinesAndLabels)
+{
+    assembleAndRunProfiled(g_testSource, "main");
+    LONGS_EQUAL(2 + 3 * 2 + 2 * 3 + 2 + 6 + 6 + 2 + 6, Profiler_GetTotalCycles(m_pProfiler));
+    LONGS_EQUAL(0, Profiler_GetUnattributedCycles(m_pProfiler));
+    STRCMP_EQUAL("Profiled 36 cycles over 11 instructions." LINE_ENDING
+                 LINE_ENDING
+                 "Top labels by cycles:" LINE_ENDING
+                 "     Cycles  Percent  Instructions  Label" LINE_ENDING
+                 "         28   77.78%             9  main" LINE_ENDING
+                 "          8   22.22%             2  sub" LINE_ENDING
+                 LINE_ENDING
+                 "Top lines by cycles:" LINE_ENDING
+                 "     Cycles  Percent  Instructions  Address  Line" LINE_ENDING
+                 "          8   22.22%             3    $0803      4  bne :loop" LINE_ENDING
+                 "          6   16.67%             3    $0802      3 :loop dex" LINE_ENDING
+                 "          6   16.67%             1    $0805      5  jsr sub" LINE_ENDING, outputReport(3));
+}
+
+TEST(Profiler, AnnotatedListing)
+{
+    assembleAndRunProfiled(g_testSource, "main");
+    STRCMP_EQUAL("    :              1  org $800" LINE_ENDING
+                 "0800: A2 03        2 main ldx #3  [2 cycles, 5.56%, 1 instructions]" LINE_ENDING
+                 "0802: CA           3 :loop dex  [6 cycles, 16.67%, 3 instructions]" LINE_ENDING
+                 "0803: D0 FD        4  bne :loop  [8 cycles, 22.22%, 3 instructions]" LINE_ENDING
+                 "0805: 20 09 08     5  jsr sub  [6 cycles, 16.67%, 1 instructions]" LINE_ENDING
+                 "0808: 60           6  rts  [6 cycles, 16.67%, 1 instructions]" LINE_ENDING
+                 "0809: A9 01        7 sub lda #1  [2 cycles, 5.56%, 1 instructions]" LINE_ENDING
+                 "080B: 60           8  rts  [6 cycles, 16.67%, 1 instructions]" LINE_ENDING
+                 "    :              9  sav Output.sav" LINE_ENDING, outputAnnotatedListing());
+}
+
+TEST(Profiler, LongBranchJumpAttributedToItsLine)
+{
+    assembleAndRunProfiled(" org $800" LINE_ENDING
+                           " lbr" LINE_ENDING
+                           "main ldx #0" LINE_ENDING
+                           " beq far" LINE_ENDING
+                           " ds 200" LINE_ENDING
+                           "far rts" LINE_ENDING
+                           " sav Output.sav" LINE_ENDING, "main");
+    LONGS_EQUAL(0, Profiler_GetUnattributedCycles(m_pProfiler));
+    STRCMP_EQUAL("          5   38.46%             2    $0802      4  beq far" LINE_ENDING, 
+                 strstr(outputReport(2), "          5"));
+}
+
+TEST(Profiler, CodeOutsideOfInstructionLinesIsUnattributed)
+{
+    assembleAndRunProfiled(" org $800" LINE_ENDING
+                           "main jmp code" LINE_ENDING
+                           "code hex 60" LINE_ENDING
+                           " sav Output.sav" LINE_ENDING, "main");
+    LONGS_EQUAL(9, Profiler_GetTotalCycles(m_pProfiler));
+    LONGS_EQUAL(6, Profiler_GetUnattributedCycles(m_pProfiler));
+    CHECK(strstr(outputReport(10), "6 cycles (66.67%) were spent in code which wasn't assembled from an instruction."));
+}
@@ -0,0 +1,469 @@
+/*  Copyright (C) 2012  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "Simulator.h"
+    #include "Assembler.h"
+    #include "MemoryVfs.h"
+    #include "MallocFailureInject.h"
+    #include "printfSpy.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+
+TEST_GROUP(Simulator)
+{
+    Simulator*          m_pSimulator;
+    MemoryVfs*          m_pMemoryVfs;
+    Assembler*          m_pAssembler;
+    SimulatorStopReason m_stopReason;
+    
+    void setup()
+    {
+        m_pSimulator = NULL;
+        m_pMemoryVfs = NULL;
+        m_pAssembler = NULL;
+        printfSpy_Hook(128);
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        MallocFailureInject_Restore();
+        printfSpy_Unhook();
+        Assembler_Free(m_pAssembler);
+        MemoryVfs_Free(m_pMemoryVfs);
+        Simulator_Free(m_pSimulator);
+    }
+    
+    void create(InstructionSetSupported instructionSet = INSTRUCTION_SET_6502)
+    {
+        m_pSimulator = Simulator_Create(instructionSet);
+    }
+    
+    void load(unsigned short address, const char* pImage, size_t imageSize)
+    {
+        Simulator_LoadImage(m_pSimulator, address, (const unsigned char*)pImage, imageSize);
+    }
+    
+    void run(unsigned short entryPoint, unsigned long cycleBudget = 1000000)
+    {
+        m_stopReason = Simulator_Run(m_pSimulator, entryPoint, cycleBudget);
+    }
+    
+    void validateStop(SimulatorStopReason expectedReason, unsigned short expectedPC, 
+                      unsigned long expectedCycles, unsigned long expectedInstructions)
+    {
+        LONGS_EQUAL(expectedReason, m_stopReason);
+        LONGS_EQUAL(expectedPC, Simulator_GetRegisters(m_pSimulator)->pc);
+        LONGS_EQUAL(expectedCycles, Simulator_GetCycleCount(m_pSimulator));
+        LONGS_EQUAL(expectedInstructions, Simulator_GetInstructionCount(m_pSimulator));
+    }
+    
+    void validateReturn(unsigned long expectedCycles, unsigned long expectedInstructions)
+    {
+        validateStop(SIMULATOR_STOP_RETURN, SIMULATOR_SENTINEL_ADDRESS, expectedCycles, expectedInstructions);
+        LONGS_EQUAL(0xFF, Simulator_GetRegisters(m_pSimulator)->s);
+    }
+    
+    unsigned char registerA(void)
+    {
+        return Simulator_GetRegisters(m_pSimulator)->a;
+    }
+    
+    unsigned char flags(void)
+    {
+        return Simulator_GetRegisters(m_pSimulator)->p;
+    }
+    
+    void addSavFile(const char* pFilename, const char* pData, size_t dataSize)
+    {
+        if (!m_pMemoryVfs)
+            m_pMemoryVfs = MemoryVfs_Create();
+        MemoryVfs_AddFile(m_pMemoryVfs, pFilename, pData, dataSize);
+    }
+    
+    void loadSavFile(const char* pFilename)
+    {
+        Simulator_LoadSavFile(m_pSimulator, MemoryVfs_GetVfs(m_pMemoryVfs), pFilename);
+    }
+    
+    void validateExceptionThrown(int expectedException)
+    {
+        LONGS_EQUAL(expectedException, getExceptionCode());
+        clearExceptionCode();
+    }
+};
+
+
+TEST(Simulator, FailAllocation)
+{
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( create() );
+    POINTERS_EQUAL(NULL, m_pSimulator);
+    validateExceptionThrown(outOfMemoryException);
+}
+
+TEST(Simulator, Fail65816InstructionSet)
+{
+    __try_and_catch( create(INSTRUCTION_SET_65816) );
+    POINTERS_EQUAL(NULL, m_pSimulator);
+    validateExceptionThrown(invalidArgumentException);
+}
+
+TEST(Simulator, InitialRegisters)
+{
+    SimulatorRegisters* pRegs;
+    
+    create();
+    pRegs = Simulator_GetRegisters(m_pSimulator);
+    LONGS_EQUAL(0x00, pRegs->a);
+    LONGS_EQUAL(0x00, pRegs->x);
+    LONGS_EQUAL(0x00, pRegs->y);
+    LONGS_EQUAL(0xFF, pRegs->s);
+    LONGS_EQUAL(SIMULATOR_FLAG_U | SIMULATOR_FLAG_I, pRegs->p);
+}
+
+TEST(Simulator, LoadImage)
+{
+    create();
+    load(0xFFFE, "\x12\x34", 2);
+    LONGS_EQUAL(0x12, Simulator_GetMemory(m_pSimulator)[0xFFFE]);
+    LONGS_EQUAL(0x34, Simulator_GetMemory(m_pSimulator)[0xFFFF]);
+}
+
+TEST(Simulator, FailToLoadImagePastEndOfMemory)
+{
+    create();
+    __try_and_catch( load(0xFFFF, "\x12\x34", 2) );
+    validateExceptionThrown(invalidArgumentException);
+    LONGS_EQUAL(0x00, Simulator_GetMemory(m_pSimulator)[0xFFFF]);
+}
+
+TEST(Simulator, LoadSavFile)
+{
+    static const char savFile[] = "SAV\x1a\x00\x08\x03\x00\xa9\x12\x60";
+    
+    create();
+    addSavFile("Test.sav", savFile, sizeof(savFile) - 1);
+    loadSavFile("Test.sav");
+    run(0x0800);
+    validateReturn(2 + 6, 2);
+    LONGS_EQUAL(0x12, registerA());
+}
+
+TEST(Simulator, FailToLoadMissingSavFile)
+{
+    create();
+    addSavFile("Test.sav", "", 0);
+    __try_and_catch( loadSavFile("Missing.sav") );
+    validateExceptionThrown(fileOpenException);
+}
+
+TEST(Simulator, FailToLoadSavFileWithInvalidSignature)
+{
+    static const char savFile[] = "USR\x1a\x00\x08\x01\x00\x60";
+    
+    create();
+    addSavFile("Test.sav", savFile, sizeof(savFile) - 1);
+    __try_and_catch( loadSavFile("Test.sav") );
+    validateExceptionThrown(invalidArgumentException);
+}
+
+TEST(Simulator, FailToLoadTruncatedSavFile)
+{
+    static const char savFile[] = "SAV\x1a\x00\x08\x03\x00\xa9\x12";
+    
+    create();
+    addSavFile("Test.sav", savFile, sizeof(savFile) - 1);
+    __try_and_catch( loadSavFile("Test.sav") );
+    validateExceptionThrown(fileException);
+}
+
+TEST(Simulator, FailToLoadSavFileWhichDoesNotFitInMemory)
+{
+    static const char savFile[] = "SAV\x1a\xff\xff\x02\x00\x00\x00";
+    
+    create();
+    addSavFile("Test.sav", savFile, sizeof(savFile) - 1);
+    __try_and_catch( loadSavFile("Test.sav") );
+    validateExceptionThrown(invalidArgumentException);
+}
+
+TEST(Simulator, StopOnBRK)
+{
+    create();
+    load(0x0800, "\xa9\x01\x00", 3);
+    run(0x0800);
+    validateStop(SIMULATOR_STOP_BRK, 0x0802, 2, 1);
+}
+
+TEST(Simulator, StopWhenCycleBudgetIsReached)
+{
+    create();
+    load(0x0800, "\x4c\x00\x08", 3);
+    run(0x0800, 10);
+    validateStop(SIMULATOR_STOP_CYCLE_BUDGET, 0x0800, 12, 4);
+}
+
+TEST(Simulator, StopOnOpcodeWhich6502DoesNotSupport)
+{
+    create();
+    load(0x0800, "\x80\x00\x60", 3);
+    run(0x0800);
+    validateStop(SIMULATOR_STOP_INVALID_OPCODE, 0x0800, 0, 0);
+}
+
+TEST(Simulator, BRAOn65C02)
+{
+    create(INSTRUCTION_SET_65C02);
+    load(0x0800, "\x80\x00\x60", 3);
+    run(0x0800);
+    validateReturn(3 + 6, 2);
+}
+
+TEST(Simulator, CountdownLoopCyclesIncludeTakenBranches)
+{
+    create();
+    load(0x0800, "\xa2\x05\xca\xd0\xfd\x60", 6);
+    run(0x0800);
+    validateReturn(2 + 5 * 2 + 4 * 3 + 2 + 6, 1 + 5 + 5 + 1);
+    LONGS_EQUAL(0x00, Simulator_GetRegisters(m_pSimulator)->x);
+}
+
+TEST(Simulator, TakenBranchWhichCrossesPage)
+{
+    create();
+    load(0x08FA, "\xa9\x00\xf0\x02\x00\x00\x60", 7);
+    run(0x08FA);
+    validateReturn(2 + 4 + 6, 3);
+}
+
+TEST(Simulator, IndexedReadWhichCrossesPage)
+{
+    create();
+    load(0x0800, "\xa2\x01\xbd\xff\x08\x60", 6);
+    load(0x0900, "\x42", 1);
+    run(0x0800);
+    validateReturn(2 + 5 + 6, 3);
+    LONGS_EQUAL(0x42, registerA());
+}
+
+TEST(Simulator, IndexedReadWhichDoesNotCrossPage)
+{
+    create();
+    load(0x0800, "\xa2\x01\xbd\xfe\x08\x60", 6);
+    run(0x0800);
+    validateReturn(2 + 4 + 6, 3);
+}
+
+TEST(Simulator, IndexedWriteWhichCrossesPageHasNoPenalty)
+{
+    create();
+    load(0x0800, "\xa9\x42\xa2\x01\x9d\xff\x08\x60", 8);
+    run(0x0800);
+    validateReturn(2 + 2 + 5 + 6, 4);
+    LONGS_EQUAL(0x42, Simulator_GetMemory(m_pSimulator)[0x0900]);
+}
+
+TEST(Simulator, IndirectIndexedReadWhichCrossesPage)
+{
+    create();
+    load(0x0010, "\xff\x08", 2);
+    load(0x0800, "\xa0\x01\xb1\x10\x60", 5);
+    load(0x0900, "\x24", 1);
+    run(0x0800);
+    validateReturn(2 + 6 + 6, 3);
+    LONGS_EQUAL(0x24, registerA());
+}
+
+TEST(Simulator, NestedSubroutineCalls)
+{
+    create();
+    load(0x0800, "\x20\x04\x08\x60\xa9\x07\x60", 7);
+    run(0x0800);
+    validateReturn(6 + 2 + 6 + 6, 4);
+    LONGS_EQUAL(0x07, registerA());
+}
+
+TEST(Simulator, PushAndPullAccumulator)
+{
+    create();
+    load(0x0800, "\xa9\x33\x48\xa9\x00\x68\x60", 7);
+    run(0x0800);
+    validateReturn(2 + 3 + 2 + 4 + 6, 5);
+    LONGS_EQUAL(0x33, registerA());
+}
+
+TEST(Simulator, BinaryAddWithOverflow)
+{
+    create();
+    load(0x0800, "\x18\xa9\x7f\x69\x01\x60", 6);
+    run(0x0800);
+    validateReturn(2 + 2 + 2 + 6, 4);
+    LONGS_EQUAL(0x80, registerA());
+    LONGS_EQUAL(SIMULATOR_FLAG_N | SIMULATOR_FLAG_V, flags() & (SIMULATOR_FLAG_N | SIMULATOR_FLAG_V | SIMULATOR_FLAG_C));
+}
+
+TEST(Simulator, BinarySubtractWithBorrow)
+{
+    create();
+    load(0x0800, "\x38\xa9\x00\xe9\x01\x60", 6);
+    run(0x0800);
+    validateReturn(2 + 2 + 2 + 6, 4);
+    LONGS_EQUAL(0xFF, registerA());
+    LONGS_EQUAL(SIMULATOR_FLAG_N, flags() & (SIMULATOR_FLAG_N | SIMULATOR_FLAG_C));
+}
+
+TEST(Simulator, DecimalAddOn6502)
+{
+    create();
+    load(0x0800, "\xf8\x18\xa9\x09\x69\x01\x60", 7);
+    run(0x0800);
+    validateReturn(2 + 2 + 2 + 2 + 6, 5);
+    LONGS_EQUAL(0x10, registerA());
+}
+
+TEST(Simulator, DecimalAddOn65C02TakesExtraCycle)
+{
+    create(INSTRUCTION_SET_65C02);
+    load(0x0800, "\xf8\x18\xa9\x99\x69\x01\x60", 7);
+    run(0x0800);
+    validateReturn(2 + 2 + 2 + 3 + 6, 5);
+    LONGS_EQUAL(0x00, registerA());
+    LONGS_EQUAL(SIMULATOR_FLAG_Z | SIMULATOR_FLAG_C, flags() & (SIMULATOR_FLAG_Z | SIMULATOR_FLAG_C));
+}
+
+TEST(Simulator, DecimalSubtract)
+{
+    create();
+    load(0x0800, "\xf8\x38\xa9\x10\xe9\x01\x60", 7);
+    run(0x0800);
+    validateReturn(2 + 2 + 2 + 2 + 6, 5);
+    LONGS_EQUAL(0x09, registerA());
+    LONGS_EQUAL(SIMULATOR_FLAG_C, flags() & SIMULATOR_FLAG_C);
+}
+
+TEST(Simulator, IndirectJumpPageWrapBugOn6502)
+{
+    create();
+    load(0x0300, "\x6c\xff\x10", 3);
+    load(0x10FF, "\x00\x05", 2);
+    load(0x1000, "\x06", 1);
+    load(0x0500, "\xa9\x05\x60", 3);
+    load(0x0600, "\xa9\x06\x60", 3);
+    run(0x0300);
+    validateReturn(5 + 2 + 6, 3);
+    LONGS_EQUAL(0x06, registerA());
+}
+
+TEST(Simulator, IndirectJumpPageWrapFixedOn65C02)
+{
+    create(INSTRUCTION_SET_65C02);
+    load(0x0300, "\x6c\xff\x10", 3);
+    load(0x10FF, "\x00\x05", 2);
+    load(0x1000, "\x06", 1);
+    load(0x0500, "\xa9\x05\x60", 3);
+    load(0x0600, "\xa9\x06\x60", 3);
+    run(0x0300);
+    validateReturn(6 + 2 + 6, 3);
+    LONGS_EQUAL(0x05, registerA());
+}
+
+TEST(Simulator, RotateThroughCarry)
+{
+    create();
+    load(0x0800, "\x38\xa9\x80\x2a\x6a\x60", 6);
+    run(0x0800);
+    validateReturn(2 + 2 + 2 + 2 + 6, 5);
+    LONGS_EQUAL(0x80, registerA());
+    LONGS_EQUAL(SIMULATOR_FLAG_C, flags() & SIMULATOR_FLAG_C);
+}
+
+TEST(Simulator, TestAndSetBitsAndStoreZeroOn65C02)
+{
+    create(INSTRUCTION_SET_65C02);
+    load(0x0010, "\x0f\xff", 2);
+    load(0x0800, "\xa9\x30\x04\x10\x64\x11\x60", 7);
+    run(0x0800);
+    validateReturn(2 + 5 + 3 + 6, 4);
+    LONGS_EQUAL(0x3F, Simulator_GetMemory(m_pSimulator)[0x0010]);
+    LONGS_EQUAL(0x00, Simulator_GetMemory(m_pSimulator)[0x0011]);
+    LONGS_EQUAL(SIMULATOR_FLAG_Z, flags() & SIMULATOR_FLAG_Z);
+}
+
+static unsigned int g_hookCalls;
+static unsigned int g_hookCycles;
+static unsigned short g_hookLastAddress;
+
+static void instructionHook(void* pContext, unsigned short address, unsigned int cycles)
+{
+    LONGS_EQUAL(0x1234, (size_t)pContext);
+    g_hookCalls++;
+    g_hookCycles += cycles;
+    g_hookLastAddress = address;
+}
+
+TEST(Simulator, InstructionHookCalledForEachInstruction)
+{
+    g_hookCalls = 0;
+    g_hookCycles = 0;
+    g_hookLastAddress = 0;
+    create();
+    Simulator_SetInstructionHook(m_pSimulator, instructionHook, (void*)0x1234);
+    load(0x0800, "\xa2\x05\xca\xd0\xfd\x60", 6);
+    run(0x0800);
+    validateReturn(32, 12);
+    LONGS_EQUAL(12, g_hookCalls);
+    LONGS_EQUAL(32, g_hookCycles);
+    LONGS_EQUAL(0x0805, g_hookLastAddress);
+}
+
+TEST(Simulator, RunAssembledSavOutputFromLabel)
+{
+    char                    source[] = " org $800" LINE_ENDING
+                                       "main lda #$12" LINE_ENDING
+                                       " jsr sub" LINE_ENDING
+                                       " rts" LINE_ENDING
+                                       "sub ldx #$34" LINE_ENDING
+                                       " rts" LINE_ENDING
+                                       " sav Output.sav" LINE_ENDING;
+    AssemblerInitParams     initParams;
+    BinaryBufferOutput      output;
+    InstructionSetSupported instructionSet = INSTRUCTION_SET_INVALID;
+    unsigned short          entryPoint;
+    
+    memset(&initParams, 0, sizeof(initParams));
+    initParams.keepObjectsInMemory = TRUE;
+    m_pAssembler = Assembler_CreateFromString(source, &initParams);
+    Assembler_Run(m_pAssembler);
+    LONGS_EQUAL(0, Assembler_GetErrorCount(m_pAssembler));
+    entryPoint = Assembler_GetLabelValue(m_pAssembler, "main", &instructionSet);
+    LONGS_EQUAL(0x0800, entryPoint);
+    LONGS_EQUAL(INSTRUCTION_SET_6502, instructionSet);
+    
+    create(instructionSet);
+    Assembler_ObjectFileEnumStart(m_pAssembler);
+    CHECK_TRUE(Assembler_ObjectFileEnumNext(m_pAssembler, &output));
+    Simulator_LoadImage(m_pSimulator, output.baseAddress, output.pContent, output.contentLength);
+    run(entryPoint);
+    validateReturn(2 + 6 + 2 + 6 + 6, 5);
+    LONGS_EQUAL(0x12, registerA());
+    LONGS_EQUAL(0x34, Simulator_GetRegisters(m_pSimulator)->x);
+}
@@ -143,6 +143,49 @@ TEST(SnapCommandLine, OneSourceFilenameAndOutputDirectory)
     validateParamsAndNoErrorMessage("SOURCE1.S", NULL, NULL, "foobar");
 }
 
+TEST(SnapCommandLine, OneSourceFilenameAndRunLabel)
+{
+    addArg("--run");
+    addArg("main");
+    addArg("SOURCE1.S");
+    
+    SnapCommandLine_Init(&m_commandLine, m_argc, m_argv);
+    validateParamsAndNoErrorMessage("SOURCE1.S", NULL);
+    STRCMP_EQUAL("main", m_commandLine.pRunLabel);
+}
+
+TEST(SnapCommandLine, RunLabelAndProfileFilename)
+{
+    addArg("--run");
+    addArg("main");
+    addArg("--profile");
+    addArg("SOURCE1.PRF");
+    addArg("SOURCE1.S");
+    
+    SnapCommandLine_Init(&m_commandLine, m_argc, m_argv);
+    validateParamsAndNoErrorMessage("SOURCE1.S", NULL);
+    STRCMP_EQUAL("main", m_commandLine.pRunLabel);
+    STRCMP_EQUAL("SOURCE1.PRF", m_commandLine.pProfileFilename);
+}
+
+TEST(SnapCommandLine, FailOnProfileFilenameWithoutRunLabel)
+{
+    addArg("--profile");
+    addArg("SOURCE1.PRF");
+    addArg("SOURCE1.S");
+    
+    __try_and_catch( SnapCommandLine_Init(&m_commandLine, m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrownAndUsageStringDisplayed();
+}
+
+TEST(SnapCommandLine, NoRunLabelByDefault)
+{
+    addArg("SOURCE1.S");
+    
+    SnapCommandLine_Init(&m_commandLine, m_argc, m_argv);
+    POINTERS_EQUAL(NULL, m_commandLine.pRunLabel);
+}
+
 TEST(SnapCommandLine, AllValidCommandLineParameters)
 {
     addArg("--list");
@@ -13,9 +13,18 @@
 #include <stdio.h>
 #include "SnapCommandLine.h"
 #include "Assembler.h"
+#include "Simulator.h"
+#include "Profiler.h"
+#include "FileOpen.h"
 #include "util.h"
 
+/* Roughly 100 seconds of a 1MHz Apple II. */
+#define RUN_CYCLE_BUDGET    100000000UL
+/* Number of labels and lines listed in the profile report. */
+#define PROFILE_TOP_COUNT   10
+
 static int displayAndReturnErrorCountIfAnyWereEncountered(Assembler* pAssembler);
+static int runLabelInSimulator(Assembler* pAssembler, const SnapCommandLine* pCommandLine);
 int main(int argc, const char** argv)
 {
     int                 returnValue = 0;
@@ -28,6 +37,8 @@ int main(int argc, const char** argv)
         pAssembler = Assembler_CreateFromFile(commandLine.pSourceFilename, &commandLine.assemblerInitParams);
         Assembler_Run(pAssembler);
         returnValue = displayAndReturnErrorCountIfAnyWereEncountered(pAssembler);
+        if (returnValue == 0 && commandLine.pRunLabel)
+            returnValue = runLabelInSimulator(pAssembler, &commandLine);
     }
     __catch
     {
@@ -37,6 +48,7 @@ int main(int argc, const char** argv)
     }
     
     Assembler_Free(pAssembler);
+    FileOpen_FreeDirectoryCache();
     
     return returnValue;
 }
@@ -52,3 +64,143 @@ static int displayAndReturnErrorCountIfAnyWereEncountered(Assembler* pAssembler)
                warningCount, warningCount != 1 ? "warnings" : "warning");
     return (int)errorCount;
 }
+
+static Simulator* createSimulatorForLabel(Assembler* pAssembler, const char* pLabel, unsigned short* pEntryPoint);
+static Profiler* createProfilerIfRequested(Assembler* pAssembler, Simulator* pSimulator, const char* pProfileFilename);
+static void displaySimulationResults(Simulator* pSimulator, const char* pLabel, SimulatorStopReason stopReason);
+static void outputProfile(Profiler* pProfiler, const char* pProfileFilename);
+static int runLabelInSimulator(Assembler* pAssembler, const SnapCommandLine* pCommandLine)
+{
+    const char*         pLabel = pCommandLine->pRunLabel;
+    Simulator*          pSimulator = NULL;
+    Profiler*           pProfiler = NULL;
+    unsigned short      entryPoint = 0;
+    SimulatorStopReason stopReason;
+    
+    pSimulator = createSimulatorForLabel(pAssembler, pLabel, &entryPoint);
+    if (!pSimulator)
+        return 1;
+    pProfiler = createProfilerIfRequested(pAssembler, pSimulator, pCommandLine->pProfileFilename);
+    stopReason = Simulator_Run(pSimulator, entryPoint, RUN_CYCLE_BUDGET);
+    displaySimulationResults(pSimulator, pLabel, stopReason);
+    outputProfile(pProfiler, pCommandLine->pProfileFilename);
+    Profiler_Free(pProfiler);
+    Simulator_Free(pSimulator);
+    
+    return (stopReason == SIMULATOR_STOP_RETURN || stopReason == SIMULATOR_STOP_BRK) ? 0 : 1;
+}
+
+static int loadObjectFilesIntoSimulator(Assembler* pAssembler, Simulator* pSimulator);
+static Simulator* createSimulatorForLabel(Assembler* pAssembler, const char* pLabel, unsigned short* pEntryPoint)
+{
+    Simulator*              pSimulator = NULL;
+    InstructionSetSupported instructionSet = INSTRUCTION_SET_6502;
+    int                     filesLoaded = 0;
+    
+    __try
+        *pEntryPoint = Assembler_GetLabelValue(pAssembler, pLabel, &instructionSet);
+    __catch
+    {
+        fprintf(stderr, "Failed to find %s label to run." LINE_ENDING, pLabel);
+        __nothrow_and_return(NULL);
+    }
+    __try
+        pSimulator = Simulator_Create(instructionSet);
+    __catch
+    {
+        fprintf(stderr, "Failed to create simulator for %s.  Only 6502 and 65C02 code can be run." LINE_ENDING, pLabel);
+        __nothrow_and_return(NULL);
+    }
+    __try
+        filesLoaded = loadObjectFilesIntoSimulator(pAssembler, pSimulator);
+    __catch
+        clearExceptionCode();
+    if (filesLoaded == 0)
+    {
+        fprintf(stderr, "Failed to load SAV output into the simulator to run %s." LINE_ENDING, pLabel);
+        Simulator_Free(pSimulator);
+        return NULL;
+    }
+    
+    return pSimulator;
+}
+
+static int loadObjectFilesIntoSimulator(Assembler* pAssembler, Simulator* pSimulator)
+{
+    BinaryBufferOutput output;
+    int                filesLoaded = 0;
+    
+    Assembler_ObjectFileEnumStart(pAssembler);
+    while (Assembler_ObjectFileEnumNext(pAssembler, &output))
+    {
+        /* RW18 images are placed by track/sector and not by address so they can't be loaded. */
+        if (output.isRW18)
+            continue;
+        Simulator_LoadImage(pSimulator, output.baseAddress, output.pContent, output.contentLength);
+        filesLoaded++;
+    }
+    
+    return filesLoaded;
+}
+
+static Profiler* createProfilerIfRequested(Assembler* pAssembler, Simulator* pSimulator, const char* pProfileFilename)
+{
+    Profiler* pProfiler = NULL;
+    
+    if (!pProfileFilename)
+        return NULL;
+    __try
+        pProfiler = Profiler_Create(Assembler_GetFirstLine(pAssembler));
+    __catch
+    {
+        fprintf(stderr, "Failed to create profiler.  Running without it." LINE_ENDING);
+        __nothrow_and_return(NULL);
+    }
+    Profiler_AttachToSimulator(pProfiler, pSimulator);
+    
+    return pProfiler;
+}
+
+static void displaySimulationResults(Simulator* pSimulator, const char* pLabel, SimulatorStopReason stopReason)
+{
+    SimulatorRegisters* pRegs = Simulator_GetRegisters(pSimulator);
+    
+    printf("%s took %lu cycles to execute %lu instructions and ", 
+           pLabel, Simulator_GetCycleCount(pSimulator), Simulator_GetInstructionCount(pSimulator));
+    if (stopReason == SIMULATOR_STOP_RETURN)
+        printf("returned." LINE_ENDING);
+    else if (stopReason == SIMULATOR_STOP_BRK)
+        printf("stopped on BRK at $%04X." LINE_ENDING, pRegs->pc);
+    else if (stopReason == SIMULATOR_STOP_CYCLE_BUDGET)
+        printf("was stopped at $%04X after exceeding the cycle budget." LINE_ENDING, pRegs->pc);
+    else
+        printf("stopped on invalid opcode $%02X at $%04X." LINE_ENDING, 
+               Simulator_GetMemory(pSimulator)[pRegs->pc], pRegs->pc);
+    printf("A=$%02X X=$%02X Y=$%02X S=$%02X P=$%02X" LINE_ENDING, pRegs->a, pRegs->x, pRegs->y, pRegs->s, pRegs->p);
+}
+
+static void outputProfile(Profiler* pProfiler, const char* pProfileFilename)
+{
+    FILE* pFile = NULL;
+    
+    if (!pProfiler)
+        return;
+    __try
+    {
+        pFile = fopen(pProfileFilename, "w");
+        if (!pFile)
+            __throw(fileOpenException);
+        Profiler_OutputAnnotatedListing(pProfiler, pFile);
+        fclose(pFile);
+        pFile = NULL;
+        printf(LINE_ENDING);
+        Profiler_OutputReport(pProfiler, stdout, PROFILE_TOP_COUNT);
+    }
+    __catch
+    {
+        if (pFile)
+            fclose(pFile);
+        fprintf(stderr, "Failed to output profile to %s." LINE_ENDING, pProfileFilename);
+        clearExceptionCode();
+    }
+}